@@ -0,0 +1,147 @@
+#include <windows.h>
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Launch latency of the MSE shim: runs it N times against this program as the browser and reports p50/p99.
+//
+//   MSEBench.exe <path to MSE.exe> [runs]
+//
+// Each run times the span from CreateProcess of the shim to the stub browser's start, as seen from here, which
+// is what the shim adds between a click and the browser. The shim runs in timing mode, so its own phase times
+// are summarised as well. Started by the shim with --mse-bench-stub=<event>, this program is the stub: it sets
+// the event and exits.
+
+const wchar_t kStubFlag[] = L"--mse-bench-stub=";
+const DWORD kRunTimeoutMs = 10000;
+const int kWarmupRuns = 5;
+
+static int runStub(const wchar_t* eventName) {
+    HANDLE started = OpenEventW(EVENT_MODIFY_STATE, FALSE, eventName);
+    if (!started) {
+        return 1;
+    }
+    SetEvent(started);
+    CloseHandle(started);
+    return 0;
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(p / 100 * sorted.size() + 0.999999);
+    return sorted[rank ? std::min(rank, sorted.size()) - 1 : 0];
+}
+
+static void report(const wchar_t* name, std::vector<double> values) {
+    if (values.empty()) {
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    wprintf(L"%-12ls %10.1f %10.1f %10.1f\n", name, percentile(values, 50), percentile(values, 99), values.back());
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    size_t stubFlagLength = wcslen(kStubFlag);
+    for (int i = 1; i < argc; ++i) {
+        if (wcsncmp(argv[i], kStubFlag, stubFlagLength) == 0) {
+            return runStub(argv[i] + stubFlagLength);
+        }
+    }
+    if (argc < 2) {
+        fwprintf(stderr, L"usage: MSEBench <path to MSE.exe> [runs]\n");
+        return 2;
+    }
+    const std::wstring shim = argv[1];
+    const int runs = argc > 2 ? _wtoi(argv[2]) : 200;
+    if (runs < 1) {
+        fwprintf(stderr, L"runs must be at least 1\n");
+        return 2;
+    }
+
+    // This program is the browser, the shim launches directly and times itself into a fresh log
+    WCHAR self[MAX_PATH + 1];
+    DWORD n = GetModuleFileNameW(nullptr, self, ARRAYSIZE(self));
+    if (!n || n >= ARRAYSIZE(self)) {
+        fwprintf(stderr, L"cannot find this program's path\n");
+        return 1;
+    }
+    WCHAR temp[MAX_PATH + 1];
+    n = GetTempPathW(ARRAYSIZE(temp), temp);
+    if (!n || n >= ARRAYSIZE(temp)) {
+        fwprintf(stderr, L"cannot find the temporary directory\n");
+        return 1;
+    }
+    const std::wstring timingLog = std::wstring(temp) + L"MSEBench-" + std::to_wstring(GetCurrentProcessId()) + L".log";
+    SetEnvironmentVariableW(L"MSE_BROWSER", self);
+    SetEnvironmentVariableW(L"MSE_COALESCE_MS", nullptr);
+    SetEnvironmentVariableW(L"MSE_LOG", nullptr);
+    SetEnvironmentVariableW(L"MSE_TIMING", nullptr);
+
+    const std::wstring eventName = L"Local\\MSEBench-" + std::to_wstring(GetCurrentProcessId());
+    HANDLE started = CreateEventW(nullptr, FALSE, FALSE, eventName.c_str());
+    if (!started) {
+        fwprintf(stderr, L"CreateEvent failed, error %lu\n", GetLastError());
+        return 1;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    std::vector<double> latencies;
+    for (int run = 0; run < kWarmupRuns + runs; ++run) {
+        if (run == kWarmupRuns) {
+            SetEnvironmentVariableW(L"MSE_TIMING", timingLog.c_str()); // Warm-up runs stay out of the phase times
+        }
+        std::wstring command = L"\"" + shim + L"\" " + kStubFlag + eventName + L" https://example.com/?run=" + std::to_wstring(run);
+        STARTUPINFO si = { sizeof(STARTUPINFO) };
+        PROCESS_INFORMATION pi = {};
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        if (!CreateProcess(shim.c_str(), &command[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &si, &pi)) {
+            fwprintf(stderr, L"cannot start %ls, error %lu\n", shim.c_str(), GetLastError());
+            return 1;
+        }
+        DWORD wait = WaitForSingleObject(started, kRunTimeoutMs);
+        QueryPerformanceCounter(&end);
+        WaitForSingleObject(pi.hProcess, kRunTimeoutMs);
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+        if (wait != WAIT_OBJECT_0) {
+            fwprintf(stderr, L"run %d: the stub browser did not start within %lu ms\n", run, kRunTimeoutMs);
+            return 1;
+        }
+        if (run >= kWarmupRuns) {
+            latencies.push_back(static_cast<double>(end.QuadPart - begin.QuadPart) * 1e6 / frequency.QuadPart);
+        }
+    }
+    CloseHandle(started);
+
+    // Lines of "<time stamp> name_us=value ... mode=direct"
+    std::map<std::wstring, std::vector<double>> phases;
+    std::wifstream log(timingLog);
+    std::wstring line;
+    while (std::getline(log, line)) {
+        std::wistringstream fields(line);
+        std::wstring field;
+        while (fields >> field) {
+            size_t split = field.find(L"_us=");
+            if (split != std::wstring::npos) {
+                phases[field.substr(0, split)].push_back(_wtof(field.c_str() + split + 4));
+            }
+        }
+    }
+    log.close();
+    DeleteFileW(timingLog.c_str());
+
+    wprintf(L"%d runs of %ls, microseconds\n\n", runs, shim.c_str());
+    wprintf(L"%-12ls %10ls %10ls %10ls\n", L"", L"p50", L"p99", L"max");
+    report(L"launch", latencies);
+    for (const auto& phase : phases) {
+        report(phase.first.c_str(), phase.second);
+    }
+    return 0;
+}
@@ -1,6 +1,24 @@
 #include <windows.h>
+#include <cwchar>
 #include <string>
-#include <sstream>
+#include <vector>
+
+// Stands in for msedge.exe and hands its arguments to Chrome. Nothing on the way blocks: the only UI is the
+// error box when Chrome cannot be started.
+//
+// To see what is launched, pass --verbose (the shim keeps it to itself) to append each command line to
+// %TEMP%\MSE.log, or set MSE_LOG to a file path to log every launch there, for callers that cannot add flags.
+//
+// Setting MSE_COALESCE_MS to a number of milliseconds turns on single-instance mode, for bursts of links that
+// would otherwise each start a Chrome process only for it to hand off to the running one. The first shim of a
+// session launches its own arguments at once and then stays as a broker on a named pipe; the shims that follow
+// pass their arguments to it and exit. Once no link has come for that long, the broker launches what it
+// collected as one command line, and it exits after a quiet window with nothing collected. Launches with
+// flags are never merged, since a flag applies to the whole command line; they go out on their own, in order.
+//
+// Setting MSE_TIMING to a file path turns on timing mode: each shim appends a line there with the time it spent
+// in each phase, in microseconds. MSE_BROWSER, when set, is launched in place of Chrome; MSEBench points it at a
+// stub to measure the shim alone.
 
 // Function to display a message box
 void showMessageBox(const std::wstring& message, const std::wstring& title, UINT type) {
@@ -11,60 +29,495 @@ std::wstring stringToWString(const std::string& str) {
     return std::wstring(str.begin(), str.end());
 }
 
+// The browser MSE_BROWSER names, or else Chrome's path from its App Paths registration, per user first and then
+// per machine, the way the shell finds it.
+// A shim process lives for one launch, so this runs once per launch and there is nothing to keep between them.
+static std::wstring resolveBrowserPath() {
+    WCHAR browser[MAX_PATH + 1];
+    DWORD n = GetEnvironmentVariableW(L"MSE_BROWSER", browser, ARRAYSIZE(browser));
+    if (n && n < ARRAYSIZE(browser)) {
+        return browser;
+    }
+    const wchar_t* key = L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\App Paths\\chrome.exe";
+    const HKEY roots[] = { HKEY_CURRENT_USER, HKEY_LOCAL_MACHINE };
+    for (HKEY root : roots) {
+        DWORD flags = RRF_RT_REG_SZ | RRF_SUBKEY_WOW6464KEY; // The 64-bit view, where Chrome registers, from either build
+        DWORD bytes = 0;
+        if (RegGetValueW(root, key, nullptr, flags, nullptr, nullptr, &bytes) != ERROR_SUCCESS || bytes < 2 * sizeof(WCHAR)) {
+            continue;
+        }
+        std::wstring path(bytes / sizeof(WCHAR), L'\0');
+        if (RegGetValueW(root, key, nullptr, flags, nullptr, &path[0], &bytes) != ERROR_SUCCESS) {
+            continue;
+        }
+        path.resize(wcslen(path.c_str()));
+        if (path.size() >= 2 && path.front() == L'"' && path.back() == L'"') {
+            path = path.substr(1, path.size() - 2);
+        }
+        if (!path.empty()) {
+            return path;
+        }
+    }
+    return L"C:\\Program Files\\Google\\Chrome\\Application\\chrome.exe";
+}
+
+static bool isBlank(wchar_t c) {
+    return c == L' ' || c == L'\t';
+}
+
+// Where the arguments start in a raw command line: past the program name, which the caller may or may not have quoted
+static const wchar_t* skipProgramName(const wchar_t* p) {
+    if (*p == L'"') {
+        for (++p; *p && *p != L'"'; ++p) {}
+        return *p ? p + 1 : p;
+    }
+    while (*p && !isBlank(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// End of the argument that starts at p, split the way CommandLineToArgvW splits: a blank ends it unless quoted,
+// and a quote only counts after an even number of backslashes
+static const wchar_t* argumentEnd(const wchar_t* p) {
+    bool quoted = false;
+    size_t backslashes = 0;
+    for (; *p; ++p) {
+        if (*p == L'\\') {
+            ++backslashes;
+            continue;
+        }
+        if (*p == L'"' && backslashes % 2 == 0) {
+            quoted = !quoted;
+        } else if (isBlank(*p) && !quoted) {
+            break;
+        }
+        backslashes = 0;
+    }
+    return p;
+}
+
+// The log file for this launch, or empty for none
+static std::wstring logPath(bool verbose) {
+    WCHAR path[MAX_PATH + 1];
+    DWORD n = GetEnvironmentVariableW(L"MSE_LOG", path, ARRAYSIZE(path));
+    if (n && n < ARRAYSIZE(path)) {
+        return path;
+    }
+    if (!verbose) {
+        return std::wstring();
+    }
+    n = GetTempPathW(ARRAYSIZE(path), path);
+    return n && n < ARRAYSIZE(path) ? std::wstring(path) + L"MSE.log" : std::wstring();
+}
+
+// Appends a time-stamped line to the log, in UTF-8
+static void appendLog(const std::wstring& path, const std::wstring& line) {
+    HANDLE file = CreateFileW(path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    SYSTEMTIME now;
+    GetLocalTime(&now);
+    WCHAR stamp[32];
+    swprintf_s(stamp, L"%04u-%02u-%02u %02u:%02u:%02u.%03u ", now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+    std::wstring text = stamp + line + L"\r\n";
+    int bytes = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), nullptr, 0, nullptr, nullptr);
+    if (bytes > 0) {
+        std::string utf8(bytes, '\0');
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &utf8[0], bytes, nullptr, nullptr);
+        DWORD written;
+        WriteFile(file, utf8.data(), static_cast<DWORD>(utf8.size()), &written, nullptr);
+    }
+    CloseHandle(file);
+}
+
+// The arguments to forward from a raw command line tail, exactly as they came, quoting and all, so a URL with
+// spaces or quotes reaches Chrome intact however long it is. Each one is preceded by a space. Drops --verbose,
+// setting verbose instead.
+static std::wstring forwardedArguments(const wchar_t* p, bool& verbose) {
+    std::wstring arguments;
+    for (;;) {
+        while (isBlank(*p)) {
+            ++p;
+        }
+        if (!*p) {
+            return arguments;
+        }
+        const wchar_t* end = argumentEnd(p);
+        if (end - p == 9 && wcsncmp(p, L"--verbose", 9) == 0) {
+            verbose = true;
+        } else {
+            arguments += L' ';
+            arguments.append(p, end);
+        }
+        p = end;
+    }
+}
+
+// Starts Chrome with arguments, in directory, or the shim's own directory when it is empty
+static void launchBrowser(const std::wstring& chromePath, const std::wstring& arguments, const std::wstring& directory, const std::wstring& log) {
+    std::wstring wsFullCommand = L"\"" + chromePath + L"\"" + arguments;
+    if (!log.empty()) {
+        appendLog(log, wsFullCommand);
+    }
+
+    // Prepare the STARTUPINFO and PROCESS_INFORMATION structures
+    STARTUPINFO si = { sizeof(STARTUPINFO) };
+    si.dwFlags = STARTF_USESHOWWINDOW;
+    si.wShowWindow = SW_HIDE; // Hide the console window
+    PROCESS_INFORMATION pi = {};
+
+    // Create the process. The command line buffer must be writable; the string's own storage is.
+    if (!CreateProcess(
+        chromePath.c_str(),               // Application name, so the command line is never searched for it
+        &wsFullCommand[0],                // Command line - must be modifiable buffer
+        nullptr,                          // Process security attributes
+        nullptr,                          // Thread security attributes
+        FALSE,                            // Inherit handles
+        CREATE_NO_WINDOW | DETACHED_PROCESS, // Flags to hide the window and detach the process
+        nullptr,                          // Environment
+        directory.empty() ? nullptr : directory.c_str(), // Current directory
+        &si,                              // Startup info
+        &pi                               // Process info
+    )) {
+        DWORD error = GetLastError();
+        if (!log.empty()) {
+            appendLog(log, L"CreateProcess failed, error " + std::to_wstring(error));
+        }
+        showMessageBox(L"Error: Failed to launch Chrome (" + chromePath + L"). Error code: " + std::to_wstring(error), L"Error", MB_OK | MB_ICONERROR);
+    }
+    else {
+        // Close handles to avoid resource leaks
+        CloseHandle(pi.hProcess);
+        CloseHandle(pi.hThread);
+    }
+}
+
+// Single-instance mode
+
+const DWORD kBrokerWaitMs = 500;         // How long a shim waits on a busy broker, and a broker on a slow shim
+const DWORD kMaxCoalesceMs = 10000;
+const size_t kMaxCommandChars = 32000;   // CreateProcess takes at most 32767, with the terminator
+const size_t kMaxMessageBytes = 2 * 32768 * sizeof(wchar_t);
+
+// The window MSE_COALESCE_MS asks for, or 0 when single-instance mode is off
+static DWORD coalesceWindowMs() {
+    WCHAR value[16];
+    DWORD n = GetEnvironmentVariableW(L"MSE_COALESCE_MS", value, ARRAYSIZE(value));
+    if (!n || n >= ARRAYSIZE(value)) {
+        return 0;
+    }
+    unsigned long ms = wcstoul(value, nullptr, 10);
+    return ms > kMaxCoalesceMs ? kMaxCoalesceMs : static_cast<DWORD>(ms);
+}
+
+// One broker per session: sessions on a terminal server belong to different users, and pipe names are machine-wide
+static std::wstring brokerPipeName() {
+    DWORD session = 0;
+    ProcessIdToSessionId(GetCurrentProcessId(), &session);
+    return L"\\\\.\\pipe\\MSE-broker-" + std::to_wstring(session);
+}
+
+// Hands a launch to the session's broker, which acknowledges it with a byte once it has it. False when there is
+// no broker or it did not take the launch, and the caller is to launch it itself.
+static bool forwardToBroker(const std::wstring& pipe, const std::wstring& message) {
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        HANDLE h = CreateFileW(pipe.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (h == INVALID_HANDLE_VALUE) {
+            if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeW(pipe.c_str(), kBrokerWaitMs)) {
+                return false;
+            }
+            continue;
+        }
+        // Only to a broker of this session: another user could create the pipe name first to read our links
+        ULONG server = 0;
+        DWORD session = 0, serverSession = 0;
+        if (!GetNamedPipeServerProcessId(h, &server) || !ProcessIdToSessionId(server, &serverSession)
+            || !ProcessIdToSessionId(GetCurrentProcessId(), &session) || serverSession != session) {
+            CloseHandle(h);
+            return false;
+        }
+        DWORD mode = PIPE_READMODE_MESSAGE;
+        DWORD bytes = static_cast<DWORD>(message.size() * sizeof(wchar_t));
+        DWORD written = 0, read = 0;
+        char ack = 0;
+        bool taken = SetNamedPipeHandleState(h, &mode, nullptr, nullptr)
+            && WriteFile(h, message.data(), bytes, &written, nullptr) && written == bytes
+            && ReadFile(h, &ack, 1, &read, nullptr) && read == 1;
+        CloseHandle(h);
+        return taken;
+    }
+    return false;
+}
+
+// Waits up to ms for an overlapped operation on pipe, cancelling it if it takes longer. True if it completed.
+static bool awaitIo(HANDLE pipe, OVERLAPPED& ov, DWORD ms, DWORD& bytes) {
+    if (WaitForSingleObject(ov.hEvent, ms) != WAIT_OBJECT_0) {
+        CancelIo(pipe);
+    }
+    return GetOverlappedResult(pipe, &ov, &bytes, TRUE) != FALSE;
+}
+
+// Waits up to ms for the next shim to connect
+static bool acceptShim(HANDLE pipe, HANDLE event, DWORD ms) {
+    OVERLAPPED ov = {};
+    ov.hEvent = event;
+    if (ConnectNamedPipe(pipe, &ov)) {
+        return true;
+    }
+    DWORD error = GetLastError();
+    DWORD bytes;
+    return error == ERROR_PIPE_CONNECTED || (error == ERROR_IO_PENDING && awaitIo(pipe, ov, ms, bytes));
+}
+
+// Reads one message from the connected shim and acknowledges it
+static bool receiveLaunch(HANDLE pipe, HANDLE event, std::wstring& message) {
+    std::vector<char> bytes;
+    char chunk[4096];
+    for (;;) {
+        OVERLAPPED ov = {};
+        ov.hEvent = event;
+        if (!ReadFile(pipe, chunk, sizeof(chunk), nullptr, &ov) && GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_MORE_DATA) {
+            return false;
+        }
+        DWORD n = 0;
+        bool done = awaitIo(pipe, ov, kBrokerWaitMs, n);
+        if (!done && GetLastError() != ERROR_MORE_DATA) {
+            return false;
+        }
+        bytes.insert(bytes.end(), chunk, chunk + n);
+        if (done) {
+            break;
+        }
+        if (bytes.size() > kMaxMessageBytes) {
+            return false;
+        }
+    }
+    message.assign(reinterpret_cast<const wchar_t*>(bytes.data()), bytes.size() / sizeof(wchar_t));
+
+    OVERLAPPED ov = {};
+    ov.hEvent = event;
+    const char ack = 1;
+    DWORD written = 0;
+    if (!WriteFile(pipe, &ack, 1, nullptr, &ov) && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    return awaitIo(pipe, ov, kBrokerWaitMs, written) && written == 1;
+}
+
+// The arguments of a launch as plain URL arguments that can share a command line with other launches', or false
+// when it has none or has flags, which apply to a whole command line and so keep it to itself
+static bool urlArguments(const std::wstring& arguments, std::wstring& urls) {
+    std::wstring merged;
+    const wchar_t* p = arguments.c_str();
+    for (;;) {
+        while (isBlank(*p)) {
+            ++p;
+        }
+        if (!*p) {
+            break;
+        }
+        const wchar_t* end = argumentEnd(p);
+        if (end - p == 17 && wcsncmp(p, L"--single-argument", 17) == 0) {
+            // Everything after it is one argument, as is; it is quoted here, unless quoting it would change it
+            for (p = end; isBlank(*p); ++p) {}
+            std::wstring rest(p);
+            if (rest.empty() || rest.find(L'"') != std::wstring::npos || rest.back() == L'\\') {
+                return false;
+            }
+            merged += L" \"" + rest + L"\"";
+            break;
+        }
+        if (*p == L'-') {
+            return false;
+        }
+        merged += L' ';
+        merged.append(p, end);
+        p = end;
+    }
+    urls = merged;
+    return !urls.empty(); // Nothing to open means a new window, which is not the same as one more tab
+}
+
+// The launches a broker has collected, merged into as few command lines as they allow. Those from one directory
+// in a row share a command line, so Chrome resolves relative arguments where their shims would have.
+class LaunchBatch {
+public:
+    LaunchBatch(const std::wstring& chromePath, const std::wstring& log) : chromePath_(chromePath), log_(log) {}
+
+    // message is a shim's directory, a NUL and its forwarded arguments
+    void add(const std::wstring& message) {
+        size_t split = message.find(L'\0');
+        std::wstring directory = message.substr(0, split);
+        std::wstring arguments = split == std::wstring::npos ? std::wstring() : message.substr(split + 1);
+        std::wstring urls;
+        if (!urlArguments(arguments, urls)) {
+            flush();
+            launchBrowser(chromePath_, arguments, directory, log_);
+            return;
+        }
+        if (launches_ && (directory != directory_ || chromePath_.size() + 2 + urls_.size() + urls.size() > kMaxCommandChars)) {
+            flush();
+        }
+        directory_ = directory;
+        urls_ += urls;
+        ++launches_;
+    }
+
+    void flush() {
+        if (!launches_) {
+            return;
+        }
+        if (!log_.empty()) {
+            appendLog(log_, L"Coalesced " + std::to_wstring(launches_) + L" launches");
+        }
+        launchBrowser(chromePath_, urls_, directory_, log_);
+        urls_.clear();
+        launches_ = 0;
+    }
+
+    bool empty() const { return launches_ == 0; }
+
+private:
+    const std::wstring& chromePath_;
+    const std::wstring& log_;
+    std::wstring directory_;
+    std::wstring urls_;
+    size_t launches_ = 0;
+};
+
+// Runs the broker on pipe, which this process created. Returns once a whole window has passed with nothing to launch.
+static void runBroker(HANDLE pipe, const std::wstring& chromePath, DWORD windowMs, const std::wstring& log) {
+    HANDLE event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (event) {
+        LaunchBatch batch(chromePath, log);
+        for (;;) {
+            if (!acceptShim(pipe, event, windowMs)) {
+                if (batch.empty()) {
+                    break;
+                }
+                batch.flush();
+                continue;
+            }
+            std::wstring message;
+            if (receiveLaunch(pipe, event, message)) {
+                batch.add(message);
+            }
+            DisconnectNamedPipe(pipe);
+        }
+        CloseHandle(event);
+    }
+    // A shim that connects as this closes gets no acknowledgement and launches by itself
+    CloseHandle(pipe);
+}
+
+// Timing mode
+
+const DWORD kTimingLogBytes = 1 << 20;   // The timing log rolls over to <file>.1 past this
+
+// Phase times of one launch, taken with QueryPerformanceCounter, for the log MSE_TIMING names. Each mark() ends
+// a phase begun by the last one, or by the timer's construction at the top of WinMain.
+class LaunchTimer {
+public:
+    LaunchTimer() {
+        WCHAR path[MAX_PATH + 1];
+        DWORD n = GetEnvironmentVariableW(L"MSE_TIMING", path, ARRAYSIZE(path));
+        if (!n || n >= ARRAYSIZE(path)) {
+            return;
+        }
+        path_ = path;
+        QueryPerformanceFrequency(&frequency_);
+        QueryPerformanceCounter(&start_);
+        last_ = start_;
+
+        // From process creation to here: loader, CRT start-up and static initialisation
+        FILETIME created, exited, kernel, user, now;
+        if (GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+            GetSystemTimePreciseAsFileTime(&now);
+            ULONGLONG from = (static_cast<ULONGLONG>(created.dwHighDateTime) << 32) | created.dwLowDateTime;
+            ULONGLONG to = (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+            line_ = L" startup_us=" + std::to_wstring(to > from ? (to - from) / 10 : 0);
+        }
+    }
+
+    void mark(const wchar_t* phase) {
+        if (path_.empty()) {
+            return;
+        }
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        line_ += L" " + std::wstring(phase) + L"_us=" + std::to_wstring(microseconds(now.QuadPart - last_.QuadPart));
+        last_ = now;
+    }
+
+    // Appends the line for this launch, which ended as mode
+    void finish(const wchar_t* mode) {
+        if (path_.empty()) {
+            return;
+        }
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        line_ += L" total_us=" + std::to_wstring(microseconds(now.QuadPart - start_.QuadPart)) + L" mode=" + mode;
+        WIN32_FILE_ATTRIBUTE_DATA info;
+        if (GetFileAttributesExW(path_.c_str(), GetFileExInfoStandard, &info) && (info.nFileSizeHigh || info.nFileSizeLow > kTimingLogBytes)) {
+            MoveFileExW(path_.c_str(), (path_ + L".1").c_str(), MOVEFILE_REPLACE_EXISTING);
+        }
+        appendLog(path_, line_.substr(1));
+        path_.clear();
+    }
+
+private:
+    long long microseconds(long long ticks) const {
+        return ticks / frequency_.QuadPart * 1000000 + ticks % frequency_.QuadPart * 1000000 / frequency_.QuadPart;
+    }
+
+    std::wstring path_;
+    std::wstring line_;
+    LARGE_INTEGER frequency_ = {};
+    LARGE_INTEGER start_ = {};
+    LARGE_INTEGER last_ = {};
+};
+
 int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     try {
+        LaunchTimer timer;
+        bool verbose = false;
+        const std::wstring arguments = forwardedArguments(skipProgramName(GetCommandLineW()), verbose);
+        const std::wstring log = logPath(verbose);
+        timer.mark(L"arguments");
+
+        HANDLE broker = INVALID_HANDLE_VALUE;
+        const DWORD windowMs = coalesceWindowMs();
+        if (windowMs) {
+            const std::wstring pipe = brokerPipeName();
+            WCHAR directory[MAX_PATH + 1];
+            DWORD n = GetCurrentDirectoryW(ARRAYSIZE(directory), directory);
+            std::wstring message = std::wstring(directory, n < ARRAYSIZE(directory) ? n : 0) + L'\0' + arguments;
+            bool forwarded = forwardToBroker(pipe, message);
+            timer.mark(L"forward");
+            if (forwarded) {
+                if (!log.empty()) {
+                    appendLog(log, L"Forwarded to the broker:" + arguments);
+                }
+                timer.finish(L"forwarded");
+                return 0;
+            }
+            // Nobody took it: become the broker, unless another shim has just done so
+            broker = CreateNamedPipeW(pipe.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                1, 4096, static_cast<DWORD>(kMaxMessageBytes), 0, nullptr);
+        }
+
         // Path to Chrome executable
-        const std::wstring chromePath = L"C:\\Program Files\\Google\\Chrome\\Application\\chrome.exe";
-
-        // Retrieve command line arguments
-        int argc;
-        LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
-
-        // Build the command line arguments
-        std::wstringstream commandArgs;
-        for (int i = 1; i < argc; ++i) {
-            commandArgs << L" " << argv[i];
-        }
-        std::wstring strCommandArgs = commandArgs.str();
-
-        // Prepare the STARTUPINFO and PROCESS_INFORMATION structures
-        STARTUPINFO si = { sizeof(STARTUPINFO) };
-        si.dwFlags = STARTF_USESHOWWINDOW;
-        si.wShowWindow = SW_HIDE; // Hide the console window
-        PROCESS_INFORMATION pi = {};
-
-        // Combine the executable path and arguments
-        std::wstring wsFullCommand = L"\"" + chromePath + L"\"" + strCommandArgs;
-
-        // Create a mutable copy of the command string for CreateProcess
-        WCHAR cmdLine[MAX_PATH * 2]; // Adjust size as needed
-        wcscpy_s(cmdLine, wsFullCommand.c_str());
-
-        // Show command for debugging
-        showMessageBox(wsFullCommand, L"Command", MB_OK | MB_ICONINFORMATION);
-
-        // Create the process
-        if (!CreateProcess(
-            nullptr,                          // Application name (nullptr since it's included in the command line)
-            cmdLine,                          // Command line - must be modifiable buffer
-            nullptr,                          // Process security attributes
-            nullptr,                          // Thread security attributes
-            FALSE,                            // Inherit handles
-            CREATE_NO_WINDOW | DETACHED_PROCESS, // Flags to hide the window and detach the process
-            nullptr,                          // Environment
-            nullptr,                          // Current directory
-            &si,                              // Startup info
-            &pi                               // Process info
-        )) {
-            showMessageBox(L"Error: Failed to launch Chrome. Error code: " + std::to_wstring(GetLastError()), L"Error", MB_OK | MB_ICONERROR);
-        }
-        else {
-            // Close handles to avoid resource leaks
-            CloseHandle(pi.hProcess);
-            CloseHandle(pi.hThread);
-        }
-
-        LocalFree(argv); // Free memory allocated for CommandLineToArgvW
+        const std::wstring chromePath = resolveBrowserPath();
+        timer.mark(L"resolve");
+        launchBrowser(chromePath, arguments, std::wstring(), log);
+        timer.mark(L"create");
+        timer.finish(broker != INVALID_HANDLE_VALUE ? L"broker" : L"direct");
+        if (broker != INVALID_HANDLE_VALUE) {
+            runBroker(broker, chromePath, windowMs, log);
+        }
     }
     catch (const std::exception& e) {
         showMessageBox(stringToWString("Exception: " + std::string(e.what())), L"Exception", MB_OK | MB_ICONERROR);
@@ -74,4 +527,4 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,333 @@
+/* Benchmarks for the bolt-on regex functions and the Levenshtein extension, run through SQL the way queries use them.
+*
+* Each benchmark scans a synthetic table bench( a TEXT, b TEXT ) once per iteration: a is made of words, numbers
+* and MRN/phone-like tokens, b is a copy of a with 0 to 4 random edits. Lengths follow --length_dist between
+* --min_len and --max_len. Reported per benchmark: rows/s (items_per_second) and ns/row.
+*
+* Build (Google Benchmark, https://github.com/google/benchmark):
+*   cmake -S . -B build && cmake --build build builds bolton_bench linked with libboltons.a, which has every
+*   connection register the regex and Levenshtein functions itself, with -DBOLTON_BENCH_STATIC; see CMakeLists.txt.
+*   By hand, with the Levenshtein extension loaded from levenshtein.so:
+*   g++ -std=c++17 -O2 -o bolton_bench sqliteBoltOnBenchmark.cpp sqliteBoltOnFunctions.cpp sqliteBoltOnRegexEngine.cpp -lbenchmark -lsqlite3 -lpthread
+*   gcc -O2 -shared -fPIC -pthread -o levenshtein.so sqlite_levenshtein.c
+*
+* Run:
+*   ./bolton_bench --rows=1000,100000 --min_len=8 --max_len=256 --length_dist=skewed
+*   ./bolton_bench --benchmark_filter=levenshtein --extension=./levenshtein
+*   ./bolton_bench --rows=10000 --save=bench.db --benchmark_filter=levenshtein && python3 sqlite_levenstein.py --bench bench.db
+*   The last line times the pure-Python UDF over the same rows, for comparison with the levenshtein rows here.
+*
+* Options, besides Google Benchmark's own --benchmark_* flags:
+*   --rows=N[,N...]          table sizes (default 1000,100000)
+*   --min_len=N --max_len=N  length range of a (default 8, 64)
+*   --length_dist=D          uniform (default), or skewed: mostly short strings with a long tail
+*   --seed=N                 generator seed (default 1), so runs compare the same rows
+*   --extension=PATH         loadable extension to load into every connection (default ./levenshtein, none with
+*                            BOLTON_BENCH_STATIC). Functions it defines replace those already registered, so
+*                            --extension=./boltons times the whole bundle as a loadable extension, and
+*                            --extension=./bolton the regex functions alone. The Levenshtein benchmarks are skipped
+*                            when no Levenshtein functions are registered. A PATH that does not load is an error.
+*                            --levenshtein=PATH, the older name, is the same.
+*   --save=FILE              also write the largest table to FILE
+*
+* Documented functions:
+   static std::string make_text( std::mt19937_64& rng, size_t len );
+   static std::string mutate( std::mt19937_64& rng, std::string s, int edits );
+   static int register_functions( sqlite3* db );
+   static sqlite3* bench_db( size_t rows );
+   static void run_query( benchmark::State& state, size_t rows, const std::string& sql, bool needsLevenshtein );
+   int main( int argc, char** argv );
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+#include "sqliteBoltOnFunctions.h"
+#ifdef BOLTON_BENCH_STATIC
+#include "sqliteBoltOnBundle.h"
+#endif
+
+static struct {
+  std::vector< size_t > rows           = { 1000, 100000 };
+  size_t                minLen         = 8;
+  size_t                maxLen         = 64;
+  bool                  skewed         = false;
+  unsigned long long    seed           = 1;
+#ifdef BOLTON_BENCH_STATIC
+  std::string           extension;
+#else
+  std::string           extension      = "./levenshtein";
+#endif
+  bool                  extensionGiven = false; // On the command line, so a failure to load it is fatal
+  std::string           save;
+} options;
+
+static const char* const kWords[] = { "apple",  "banana", "cherry", "pepper", "patient", "admit",   "discharge", "lab",
+                                      "result", "normal", "smith",  "jones",  "kitten",  "sitting", "foo",       "bar" };
+
+// Text of exactly len bytes: words, numbers and the occasional MRN:123456 or 816-555-0100
+static std::string make_text( std::mt19937_64& rng, size_t len ) {
+  std::string s;
+  while ( s.size() < len ) {
+    if ( !s.empty() ) {
+      s.push_back( ' ' );
+    }
+    switch ( rng() % 8 ) {
+      case 0:
+        s += "MRN:" + std::to_string( 100000 + rng() % 900000 );
+        break;
+      case 1:
+        s += "816-" + std::to_string( 100 + rng() % 900 ) + "-" + std::to_string( 1000 + rng() % 9000 );
+        break;
+      case 2:
+        s += std::to_string( rng() % 10000 );
+        break;
+      default:
+        s += kWords[ rng() % ( sizeof( kWords ) / sizeof( kWords[ 0 ] ) ) ];
+        break;
+    }
+  }
+  s.resize( len );
+  return s;
+}
+
+// s with edits random substitutions, insertions or deletions of lowercase letters
+static std::string mutate( std::mt19937_64& rng, std::string s, int edits ) {
+  for ( int i = 0; i < edits; ++i ) {
+    size_t at = s.empty() ? 0 : rng() % s.size();
+    char   c  = static_cast< char >( 'a' + rng() % 26 );
+    switch ( rng() % 3 ) {
+      case 0:
+        if ( !s.empty() ) {
+          s[ at ] = c;
+          break;
+        }
+        // fall through
+      case 1:
+        s.insert( s.begin() + static_cast< std::ptrdiff_t >( at ), c );
+        break;
+      default:
+        if ( !s.empty() ) {
+          s.erase( at, 1 );
+        }
+        break;
+    }
+  }
+  return s;
+}
+
+static size_t draw_length( std::mt19937_64& rng ) {
+  size_t span = options.maxLen - options.minLen + 1;
+  if ( !options.skewed ) {
+    return options.minLen + rng() % span;
+  }
+  std::exponential_distribution< double > tail( 6.0 ); // Nine rows in ten within the first ~40% of the range
+  return options.minLen + std::min( span - 1, static_cast< size_t >( tail( rng ) * static_cast< double >( span ) ) );
+}
+
+// The functions under test, on a new connection. Linked with libboltons.a, sqlite3_boltons_autoload() in main()
+// has registered them all as it opened.
+static int register_functions( sqlite3* db ) {
+#ifdef BOLTON_BENCH_STATIC
+  return SQLITE_OK;
+#else
+  return registerSqlLiteBoltOnFunctions( db );
+#endif
+}
+
+// One in-memory database per table size, built on first use and kept for every benchmark of that size
+static sqlite3* bench_db( size_t rows ) {
+  static std::map< size_t, sqlite3* > dbs;
+  auto                                found = dbs.find( rows );
+  if ( found != dbs.end() ) {
+    return found->second;
+  }
+  sqlite3* db = nullptr;
+  if ( sqlite3_open( ":memory:", &db ) != SQLITE_OK || register_functions( db ) != SQLITE_OK ) {
+    std::cerr << "Failed to open database: " << sqlite3_errmsg( db ) << "\n";
+    std::exit( 1 );
+  }
+  char* error = nullptr;
+  sqlite3_enable_load_extension( db, 1 );
+  if ( !options.extension.empty() && sqlite3_load_extension( db, options.extension.c_str(), nullptr, &error ) != SQLITE_OK ) {
+    if ( options.extensionGiven ) {
+      std::cerr << "Cannot load " << options.extension << ": " << ( error ? error : sqlite3_errmsg( db ) ) << "\n";
+      std::exit( 1 );
+    }
+    if ( dbs.empty() ) {
+      std::cerr << "Levenshtein benchmarks skipped: " << ( error ? error : "cannot load " + options.extension ) << "\n";
+    }
+    sqlite3_free( error );
+  }
+
+  sqlite3_exec( db, "CREATE TABLE bench( a TEXT, b TEXT ); BEGIN", nullptr, nullptr, nullptr );
+  sqlite3_stmt*   insert = nullptr;
+  std::mt19937_64 rng( options.seed );
+  sqlite3_prepare_v2( db, "INSERT INTO bench VALUES( ?1, ?2 )", -1, &insert, nullptr );
+  for ( size_t i = 0; i < rows; ++i ) {
+    std::string a = make_text( rng, draw_length( rng ) );
+    std::string b = mutate( rng, a, static_cast< int >( rng() % 5 ) );
+    sqlite3_bind_text( insert, 1, a.data(), static_cast< int >( a.size() ), SQLITE_TRANSIENT );
+    sqlite3_bind_text( insert, 2, b.data(), static_cast< int >( b.size() ), SQLITE_TRANSIENT );
+    sqlite3_step( insert );
+    sqlite3_reset( insert );
+  }
+  sqlite3_finalize( insert );
+  sqlite3_exec( db, "COMMIT", nullptr, nullptr, nullptr );
+  dbs[ rows ] = db;
+  return db;
+}
+
+// Steps sql to completion once per iteration. sql scans bench once and returns one row, so steps are not counted.
+static void run_query( benchmark::State& state, size_t rows, const std::string& sql, bool needsLevenshtein ) {
+  sqlite3*      db   = bench_db( rows );
+  sqlite3_stmt* stmt = nullptr;
+  if ( sqlite3_prepare_v2( db, sql.c_str(), -1, &stmt, nullptr ) != SQLITE_OK ) {
+    std::string error = ( needsLevenshtein ? "levenshtein extension not loaded: " : "" ) + std::string( sqlite3_errmsg( db ) );
+    state.SkipWithError( error.c_str() );
+    return;
+  }
+  sqlite3_int64 result = 0;
+  auto          start  = std::chrono::steady_clock::now();
+  for ( auto _ : state ) {
+    while ( sqlite3_step( stmt ) == SQLITE_ROW ) {
+      result = sqlite3_column_int64( stmt, 0 );
+    }
+    if ( sqlite3_reset( stmt ) != SQLITE_OK ) {
+      state.SkipWithError( sqlite3_errmsg( db ) );
+      break;
+    }
+  }
+  double elapsed = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - start ).count();
+  sqlite3_finalize( stmt );
+  benchmark::DoNotOptimize( result );
+  double scanned = static_cast< double >( state.iterations() ) * static_cast< double >( rows );
+  state.SetItemsProcessed( static_cast< int64_t >( scanned ) );
+  state.counters[ "ns/row" ] = scanned > 0 ? elapsed / scanned : 0.0;
+  state.counters[ "matched" ] = static_cast< double >( result );
+}
+
+// From a plain literal, which the prefilter alone answers for most rows, to alternation and bounded repeats
+static const struct {
+  const char* name;
+  const char* pattern;
+  const char* flags;
+} kPatterns[] = {
+  { "literal", "discharge", "" },
+  { "literal_icase", "DISCHARGE", "i" },
+  { "mrn", "MRN:\\d{6}", "" },
+  { "phone", "\\b\\d{3}-\\d{3}-\\d{4}\\b", "" },
+  { "alternation", "(apple|cherry|pepper) (lab|result)", "" },
+  { "groups", "(\\w+) (\\d+)", "" },
+};
+
+static const int kThresholds[] = { 1, 2, 4, 8 };
+
+static std::vector< size_t > parse_sizes( const char* list ) {
+  std::vector< size_t > sizes;
+  for ( const char* p = list; *p; ) {
+    char*  end;
+    size_t n = std::strtoull( p, &end, 10 );
+    if ( end == p || n == 0 ) {
+      return {};
+    }
+    sizes.push_back( n );
+    p = *end == ',' ? end + 1 : end;
+  }
+  return sizes;
+}
+
+static void register_benchmarks() {
+  for ( size_t rows : options.rows ) {
+    std::string suffix = "/rows:" + std::to_string( rows );
+    for ( const auto& p : kPatterns ) {
+      std::string quoted = p.pattern; // None of the patterns contains a quote
+      benchmark::RegisterBenchmark( ( std::string( "regexp/" ) + p.name + suffix ).c_str(), [ = ]( benchmark::State& state ) {
+        run_query( state, rows, "SELECT count(*) FROM bench WHERE regexp( '" + quoted + "', a, '" + p.flags + "' )", false );
+      } );
+      benchmark::RegisterBenchmark( ( std::string( "regex_replace/" ) + p.name + suffix ).c_str(), [ = ]( benchmark::State& state ) {
+        run_query( state, rows, "SELECT sum( length( regex_replace( a, '" + quoted + "', '<$&>', '" + p.flags + "' ) ) ) FROM bench", false );
+      } );
+    }
+    benchmark::RegisterBenchmark( ( "levenshtein/unbounded" + suffix ).c_str(), [ = ]( benchmark::State& state ) {
+      run_query( state, rows, "SELECT count(*) FROM bench WHERE levenshtein( a, b ) <= 2", true );
+    } );
+    for ( int k : kThresholds ) {
+      std::string bound = std::to_string( k );
+      benchmark::RegisterBenchmark( ( "levenshtein/max:" + bound + suffix ).c_str(), [ = ]( benchmark::State& state ) {
+        run_query( state, rows, "SELECT count(*) FROM bench WHERE levenshtein( a, b, " + bound + " ) <= " + bound, true );
+      } );
+    }
+    benchmark::RegisterBenchmark( ( "levenshtein_utf8/max:2" + suffix ).c_str(), [ = ]( benchmark::State& state ) {
+      run_query( state, rows, "SELECT count(*) FROM bench WHERE levenshtein_utf8( a, b, 2 ) <= 2", true );
+    } );
+  }
+}
+
+// Writes the largest table to path, for sqlite_levenstein.py --bench
+static bool save_table( const std::string& path ) {
+  size_t      rows   = *std::max_element( options.rows.begin(), options.rows.end() );
+  sqlite3*    db     = bench_db( rows );
+  std::string attach = "ATTACH '" + path + "' AS saved; DROP TABLE IF EXISTS saved.bench; CREATE TABLE saved.bench AS SELECT * FROM bench; DETACH saved";
+  if ( sqlite3_exec( db, attach.c_str(), nullptr, nullptr, nullptr ) != SQLITE_OK ) {
+    std::cerr << "Failed to save " << path << ": " << sqlite3_errmsg( db ) << "\n";
+    return false;
+  }
+  std::cerr << "Saved " << rows << " rows to " << path << "\n";
+  return true;
+}
+
+int main( int argc, char** argv ) {
+  benchmark::Initialize( &argc, argv ); // Removes the --benchmark_* flags, leaving ours
+#ifdef BOLTON_BENCH_STATIC
+  if ( sqlite3_boltons_autoload() != SQLITE_OK ) {
+    std::cerr << "Failed to register the bolt-on functions\n";
+    return 1;
+  }
+#endif
+  for ( int i = 1; i < argc; ++i ) {
+    std::string arg = argv[ i ];
+    size_t      eq  = arg.find( '=' );
+    std::string key = arg.substr( 0, eq );
+    const char* val = eq == std::string::npos ? "" : argv[ i ] + eq + 1;
+    if ( key == "--rows" ) {
+      options.rows = parse_sizes( val );
+    } else if ( key == "--min_len" ) {
+      options.minLen = std::strtoull( val, nullptr, 10 );
+    } else if ( key == "--max_len" ) {
+      options.maxLen = std::strtoull( val, nullptr, 10 );
+    } else if ( key == "--length_dist" && ( std::strcmp( val, "uniform" ) == 0 || std::strcmp( val, "skewed" ) == 0 ) ) {
+      options.skewed = std::strcmp( val, "skewed" ) == 0;
+    } else if ( key == "--seed" ) {
+      options.seed = std::strtoull( val, nullptr, 10 );
+    } else if ( key == "--extension" || key == "--levenshtein" ) {
+      options.extension      = val;
+      options.extensionGiven = true;
+    } else if ( key == "--save" ) {
+      options.save = val;
+    } else {
+      std::cerr << "Unknown option " << arg << " (see the comment at the top of sqliteBoltOnBenchmark.cpp)\n";
+      return 1;
+    }
+  }
+  if ( options.rows.empty() || options.minLen == 0 || options.maxLen < options.minLen ) {
+    std::cerr << "Need --rows=N[,N...] and 0 < --min_len <= --max_len\n";
+    return 1;
+  }
+  if ( !options.save.empty() && !save_table( options.save ) ) {
+    return 1;
+  }
+  register_benchmarks();
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,49 @@
+/* The bolt-on regex functions (sqliteBoltOnFunctions.cpp) and the Levenshtein extension (sqlite_levenshtein.c) as
+* one library. CMakeLists.txt builds it two ways:
+*   boltons.so     a loadable extension: .load ./boltons registers both
+*   libboltons.a   for programs that link SQLite themselves: call sqlite3_boltons_autoload() once at start-up and
+*                  every connection opened after it has both, or sqlite3_boltons_init( db, 0, 0 ) for one connection
+*
+* Both sources are compiled with BOLTON_BUNDLED and LEVENSHTEIN_BUNDLED, which leave sqlite3_api and the one
+* sqlite3_extension_init() to this file. The static library is compiled with SQLITE_CORE as well, so all three
+* call SQLite directly rather than through sqlite3_api.
+*/
+
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+
+#include "sqliteBoltOnBundle.h"
+
+int sqlite3_levenshtein_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi );
+int sqlite3_bolton_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi );
+
+#ifdef _WIN32
+__declspec( dllexport )
+#endif
+int sqlite3_boltons_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi ) {
+  int rc;
+
+  SQLITE_EXTENSION_INIT2( pApi );
+  rc = sqlite3_levenshtein_init( db, pzErrMsg, pApi );
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_bolton_init( db, pzErrMsg, pApi );
+  }
+  return rc;
+}
+
+#ifdef SQLITE_CORE
+
+int sqlite3_boltons_autoload( void ) {
+  return sqlite3_auto_extension( ( void ( * )( void ) )sqlite3_boltons_init );
+}
+
+#else
+
+#ifdef _WIN32
+__declspec( dllexport )
+#endif
+int sqlite3_extension_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi ) {
+  return sqlite3_boltons_init( db, pzErrMsg, pApi );
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#ifndef SQLLITEBOLTONBUNDLE_H
+#define SQLLITEBOLTONBUNDLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Registers the bolt-on regex functions and the Levenshtein extension on db. Returns SQLITE_OK or the first error.
+int sqlite3_boltons_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi );
+
+// Static library only: registers both on every connection opened from now on, through sqlite3_auto_extension().
+int sqlite3_boltons_autoload( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SQLLITEBOLTONBUNDLE_H
@@ -6,76 +6,108 @@
 * 
 * Untested. 
 *  
+* Linked into a program, call registerSqlLiteBoltOnFunctions( db ) on each connection. As a loadable extension:
+*   g++ -std=c++17 -O2 -shared -fPIC -pthread -DBOLTON_LOADABLE_EXTENSION -o bolton.so sqliteBoltOnFunctions.cpp sqliteBoltOnRegexEngine.cpp
+*   sqlite> .load ./bolton
+*   sqlite> SELECT 'MRN:123' REGEXP 'MRN:\d+', regex_replace( 'Apple pie', 'p+', 'P', 'i' );
+*   Python: conn.enable_load_extension( True ); conn.load_extension( './bolton' )
+* CMakeLists.txt builds the same, and the bundle of these functions with the Levenshtein extension described in
+* sqliteBoltOnBundle.c. -DBOLTON_BUNDLED leaves sqlite3_api and sqlite3_extension_init() to that bundle.
+* 
+* Every function keeps per-connection counters, read with SELECT * FROM boltOn_stats(). Build with -DBOLTON_NO_STATS
+* to compile them out.
+* 
+* SELECT boltOn_config( 'regex_budget_us', 50000 ) caps the time any one regex call on the connection may spend
+* matching, so a pathological user-supplied pattern fails with an error instead of pinning a pooled connection.
+* 
+* sqliteBoltOnBenchmark.cpp times these functions over synthetic tables; see the build line at its top.
 * 
 * Documented functions:
-   std::regex::flag_type parse_flags( const char* flags, std::string& pattern, bool& invalid_flag );
+   RegexFlags parse_flags( const char* flags, bool& extended, bool& invalid_flag );
+   std::string strip_extended( std::string_view pattern );
+   static std::unique_ptr< RegexEngine > compile_pattern( std::string_view pattern, const char* flags, const char** error, size_t* reach = nullptr );
+   static CompiledPatternPtr cached_pattern( BoltOnConnection* conn, std::string_view pattern, const char* flags, const char** error );
+   static CompiledPatternPtr lookup_pattern( sqlite3_context* context, int patternArg, std::string_view pattern, const char* flags, const char** error );
+   template < void ( *Fn )( sqlite3_context*, int, sqlite3_value** ) > static void memoized( sqlite3_context* context, int argc, sqlite3_value** argv );
    static void regexp_func( sqlite3_context* context, int argc, sqlite3_value** argv );
+   static void regexp_blob_func( sqlite3_context* context, int argc, sqlite3_value** argv );
    static void regex_replace_func( sqlite3_context* context, int argc, sqlite3_value** argv );
-   void registerSqlLiteBoltOnFunctions(sqlite3 * db);
+   static const CompiledPatternSet* lookup_pattern_set( sqlite3_context* context, int patternsArg, sqlite3_value* patterns, const char* flags, const char** error );
+   static void regexp_any_func( sqlite3_context* context, int argc, sqlite3_value** argv );
+   static void regexp_which_func( sqlite3_context* context, int argc, sqlite3_value** argv );
+   static void regex_extract_func( sqlite3_context* context, int argc, sqlite3_value** argv );
+   regex_matches( value, pattern [, flags] ) table-valued function
+   regexp_scan( table, column, pattern [, flags] ) table-valued function
+   regexp_blob( table, column, rowid, pattern [, flags] )
+   boltOn_stats() table-valued function, boltOn_stats_reset()
+   static void bolton_config_func( sqlite3_context* context, int argc, sqlite3_value** argv );
+   int registerSqlLiteBoltOnFunctions( sqlite3* db );
    int sqlLiteBoltOnRegexReplaceTest();
 
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <iostream>
-#include <regex>
-#include <sqlite3.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifdef BOLTON_LOADABLE_EXTENSION
+#include <sqlite3ext.h>
+#ifdef BOLTON_BUNDLED
+extern "C" {
+SQLITE_EXTENSION_INIT3
+}
+#else
+SQLITE_EXTENSION_INIT1
+#endif
+#else
+#include <sqlite3.h>
+#endif
 #include "sqliteBoltOnFunctions.h"
+#include "sqliteBoltOnRegexEngine.h"
+
+#if !defined( BOLTON_NO_STATS ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <x86intrin.h>
+#elif !defined( BOLTON_NO_STATS ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#include <intrin.h>
+#endif
 
-std::regex::flag_type parse_flags( const char* flags, std::string& pattern, bool& invalid_flag ) {
-  std::regex::flag_type mode = std::regex::ECMAScript;
-  invalid_flag               = false;
+// Flags are read once per compile, on a cache miss; a cached pattern keeps the engine built from them.
+// 'x' is returned in extended, for the caller to strip the pattern with strip_extended() before compiling.
+RegexFlags parse_flags( const char* flags, bool& extended, bool& invalid_flag ) {
+  RegexFlags mode;
+  extended     = false;
+  invalid_flag = false;
   if ( !flags ) {
     return mode;
   }
-  std::string f( flags );
-  for ( char c : f ) {
-    switch ( c ) {
+  for ( const char* f = flags; *f; ++f ) {
+    switch ( *f ) {
       case 'i':
-        mode |= std::regex::icase;
+        mode.icase = true;
         break;
       case 'm':
+        mode.multiline = true;
         break;
       case 'g':
         break;
       case 's':
-        std::cerr << "Warning: 's' flag (dot matches newline) is not supported by std::regex.\n";
+        mode.dotall = true;
         break;
-      case 'x': {
-        std::string cleaned;
-        bool        inClass = false, escaping = false;
-        for ( size_t i = 0; i < pattern.length(); ++i ) {
-          char c = pattern[ i ];
-          if ( escaping ) {
-            cleaned  += c;
-            escaping  = false;
-            continue;
-          }
-          if ( c == '\\' ) {
-            cleaned  += c;
-            escaping  = true;
-            continue;
-          }
-          if ( c == '[' ) {
-            inClass = true;
-          }
-          if ( c == ']' ) {
-            inClass = false;
-          }
-          if ( !inClass && ( c == ' ' || c == '\t' || c == '\n' ) ) {
-            continue;
-          }
-          if ( !inClass && c == '#' && ( i == 0 || pattern[ i - 1 ] == '\n' ) ) {
-            while ( i < pattern.length() && pattern[ i ] != '\n' ) {
-              i++;
-            }
-            continue;
-          }
-          cleaned += c;
-        }
-        pattern = cleaned;
+      case 'x':
+        extended = true;
         break;
-      }
       default:
         invalid_flag = true;
         break;
@@ -84,81 +116,1939 @@ std::regex::flag_type parse_flags( const char* flags, std::string& pattern, bool
   return mode;
 }
 
+// The 'x' flag: drops whitespace outside classes, and comments from a '#' at the start of a line to its end
+std::string strip_extended( std::string_view pattern ) {
+  std::string cleaned;
+  bool        inClass = false, escaping = false;
+  cleaned.reserve( pattern.size() );
+  for ( size_t i = 0; i < pattern.length(); ++i ) {
+    char c = pattern[ i ];
+    if ( escaping ) {
+      cleaned  += c;
+      escaping  = false;
+      continue;
+    }
+    if ( c == '\\' ) {
+      cleaned  += c;
+      escaping  = true;
+      continue;
+    }
+    if ( c == '[' ) {
+      inClass = true;
+    }
+    if ( c == ']' ) {
+      inClass = false;
+    }
+    if ( !inClass && ( c == ' ' || c == '\t' || c == '\n' ) ) {
+      continue;
+    }
+    if ( !inClass && c == '#' && ( i == 0 || pattern[ i - 1 ] == '\n' ) ) {
+      while ( i < pattern.length() && pattern[ i ] != '\n' ) {
+        i++;
+      }
+      continue;
+    }
+    cleaned += c;
+  }
+  return cleaned;
+}
+
+// A pattern compiled once, shared between the per-statement auxdata slot and the connection LRU.
+struct CompiledPattern {
+  std::string                    flags; // Flag string as passed in, so a changed flags argument is not served a stale regex
+  std::unique_ptr< RegexEngine > re;
+  size_t                         reach; // regex_match_reach() of the pattern, for streaming it over a blob
+};
+typedef std::shared_ptr< const CompiledPattern > CompiledPatternPtr;
+
+// Connection-level LRU of compiled patterns, for queries where the pattern varies per row but repeats.
+class PatternCache {
+public:
+  explicit PatternCache( size_t capacity ) : capacity_( capacity ) {}
+
+  CompiledPatternPtr find( const std::string& key ) {
+    auto it = index_.find( key );
+    if ( it == index_.end() ) {
+      return nullptr;
+    }
+    lru_.splice( lru_.begin(), lru_, it->second ); // Move to front; list iterators stay valid
+    return it->second->second;
+  }
+
+  void insert( const std::string& key, CompiledPatternPtr compiled ) {
+    auto it = index_.find( key );
+    if ( it != index_.end() ) {
+      it->second->second = std::move( compiled );
+      lru_.splice( lru_.begin(), lru_, it->second );
+      return;
+    }
+    lru_.emplace_front( key, std::move( compiled ) );
+    index_[ key ] = lru_.begin();
+    if ( lru_.size() > capacity_ ) {
+      index_.erase( lru_.back().first );
+      lru_.pop_back();
+    }
+  }
+
+private:
+  typedef std::list< std::pair< std::string, CompiledPatternPtr > > LruList;
+  size_t                                               capacity_;
+  LruList                                              lru_;
+  std::unordered_map< std::string, LruList::iterator > index_;
+};
+
+/* Per-function counters, read with SELECT * FROM boltOn_stats() and cleared with boltOn_stats_reset(). Sampled and
+* compiled out (-DBOLTON_NO_STATS) like levenshtein_stats() in sqlite_levenshtein.c, plus pattern cache hits.
+*/
+#ifndef BOLTON_NO_STATS
+
+enum BoltOnStat { kStatRegexp, kStatRegexReplace, kStatRegexpAny, kStatRegexpWhich, kStatRegexExtract, kStatRegexMatches, kStatRegexpScan, kStatRegexpBlob, kStatCount };
+
+static const char* const kStatNames[ kStatCount ] = { "regexp", "regex_replace", "regexp_any", "regexp_which", "regex_extract", "regex_matches", "regexp_scan", "regexp_blob" };
+
+static const bool kStatMemoized[ kStatCount ] = { true, true, false, false, true, false, false, false };
+
+static const uint64_t kStatSample = 64; // A power of two
+
+struct BoltOnStats {
+  uint64_t calls       = 0;
+  uint64_t bytes       = 0; // Of the value searched, not the pattern
+  uint64_t cacheHits   = 0; // Pattern found in auxdata or the connection LRU
+  uint64_t cacheMisses = 0; // Pattern compiled
+  uint64_t memoHits    = 0; // Result served from the statement's memo
+  uint64_t memoMisses  = 0; // Memoized call computed
+  uint64_t ticks       = 0; // Cycle counter ticks spent in the sampled calls
+  uint64_t samples     = 0;
+};
+
+// The cheapest clock there is: the time stamp counter on x86, the virtual counter on AArch64
+static uint64_t stat_ticks() {
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+  return __rdtsc();
+#elif defined( __aarch64__ ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+  uint64_t v;
+  __asm__ __volatile__( "mrs %0, cntvct_el0" : "=r"( v ) );
+  return v;
+#else
+  return static_cast< uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now().time_since_epoch() ).count() );
+#endif
+}
+
+// Adds the ticks of its lifetime to stats, if given
+class StatTimer {
+public:
+  explicit StatTimer( BoltOnStats* stats ) : stats_( stats ), start_( stats ? stat_ticks() : 0 ) {}
+  ~StatTimer() {
+    if ( stats_ ) {
+      stats_->ticks += stat_ticks() - start_;
+    }
+  }
+
+private:
+  BoltOnStats* stats_;
+  uint64_t     start_;
+};
+
+// Set while a counted function runs, so cache lookups know whom to charge
+#define BOLTON_COUNT( conn, field )       \
+  do {                                    \
+    if ( ( conn ) && ( conn )->current ) { \
+      ++( conn )->current->field;         \
+    }                                     \
+  } while ( 0 )
+
+// For functions that read their value themselves, so only they know how many bytes they searched
+#define BOLTON_COUNT_BYTES( conn, n )                        \
+  do {                                                       \
+    if ( ( conn ) && ( conn )->current ) {                    \
+      ( conn )->current->bytes += static_cast< uint64_t >( n ); \
+    }                                                        \
+  } while ( 0 )
+
+#else
+
+#define BOLTON_COUNT( conn, field ) ( ( void )( conn ) )
+#define BOLTON_COUNT_BYTES( conn, n ) ( ( void )( conn ), ( void )( n ) )
+
+#endif
+
+struct MemoResult;
+
+// Per-connection state, handed to every registered function through the pApp pointer.
+struct BoltOnConnection {
+  PatternCache patterns{ 64 };
+  uint64_t     regexBudgetUs = 0; // boltOn_config( 'regex_budget_us' ): limit on each call's matching, 0 for none
+  uint64_t     scanThreads   = 0; // boltOn_config( 'scan_threads' ): workers for each regexp_scan(), 0 for one per core
+  uint64_t     memoSlots     = 0; // boltOn_config( 'memo_slots' ): results kept per statement, 0 for no memo
+  int          mainEncoding  = 0; // Text encoding of the main database once regexp_blob() has needed it, 0 before
+  MemoResult*  memoResult    = nullptr; // Set while a memoized call runs, for memo_keep()
+#ifndef BOLTON_NO_STATS
+  BoltOnStats                           stats[ kStatCount ];
+  BoltOnStats*                          current = nullptr;      // The counted function now running, if any
+  uint64_t                              tick0   = stat_ticks(); // Taken with time0, to turn ticks into nanoseconds
+  std::chrono::steady_clock::time_point time0   = std::chrono::steady_clock::now();
+#endif
+};
+typedef std::shared_ptr< BoltOnConnection > BoltOnConnectionPtr;
+
+static void destroy_connection_ref( void* p ) { delete static_cast< BoltOnConnectionPtr* >( p ); }
+static void destroy_pattern_ref( void* p ) { delete static_cast< CompiledPatternPtr* >( p ); }
+
+// Polled by the regex budget, so sqlite3_interrupt() and a progress handler that stops the statement also stop a
+// long match in progress. SQLite before 3.41 has no way to ask; matches then run to the end of their budget.
+#if SQLITE_VERSION_NUMBER >= 3041000
+static bool statement_interrupted( void* db ) { return sqlite3_is_interrupted( static_cast< sqlite3* >( db ) ) != 0; }
+static const RegexBudget::Poll kInterruptPoll = &statement_interrupted;
+#else
+static const RegexBudget::Poll kInterruptPoll = nullptr;
+#endif
+
+static uint64_t regex_budget_us( sqlite3_context* context ) {
+  auto* conn = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  return conn ? ( *conn )->regexBudgetUs : 0;
+}
+
+// Reports a match stopped by its budget, as SQLITE_INTERRUPT when the statement itself was interrupted
+static void result_budget_error( sqlite3_context* context, const RegexBudgetExceeded& e ) {
+  sqlite3_result_error( context, e.what(), -1 );
+  if ( e.interrupted() ) {
+    sqlite3_result_error_code( context, SQLITE_INTERRUPT );
+  }
+}
+
+// Compiles pattern with its flags, without caching, and sets reach if given. On failure returns nullptr and sets error.
+static std::unique_ptr< RegexEngine > compile_pattern( std::string_view pattern, const char* flags, const char** error, size_t* reach = nullptr ) {
+  bool       extended     = false;
+  bool       invalid_flag = false;
+  RegexFlags mode         = parse_flags( flags, extended, invalid_flag );
+  if ( invalid_flag ) {
+    *error = "Invalid regex flag used";
+    return nullptr;
+  }
+  std::string                    source = extended ? strip_extended( pattern ) : std::string( pattern );
+  std::string                    compileError;
+  std::unique_ptr< RegexEngine > re = compile_regex( source, mode, compileError );
+  if ( !re ) {
+    *error = "Invalid regex";
+  } else if ( reach ) {
+    *reach = regex_match_reach( source, mode );
+  }
+  return re;
+}
+
+// Returns the compiled pattern from the connection LRU, compiling it on a miss. conn may be null, for no caching.
+// On failure returns nullptr and sets error.
+static CompiledPatternPtr cached_pattern( BoltOnConnection* conn, std::string_view pattern, const char* flags, const char** error ) {
+  const char* flagStr = flags ? flags : "";
+  std::string key     = flagStr;
+  key.push_back( '\0' ); // Flags never contain NUL, so this separator keeps keys unambiguous
+  key.append( pattern.data(), pattern.size() );
+
+  CompiledPatternPtr compiled = conn ? conn->patterns.find( key ) : nullptr;
+  if ( compiled ) {
+    BOLTON_COUNT( conn, cacheHits );
+  } else {
+    BOLTON_COUNT( conn, cacheMisses );
+    size_t                         reach = SIZE_MAX;
+    std::unique_ptr< RegexEngine > re    = compile_pattern( pattern, flags, error, &reach );
+    if ( !re ) {
+      return nullptr;
+    }
+    compiled = std::make_shared< const CompiledPattern >( CompiledPattern{ flagStr, std::move( re ), reach } );
+    if ( conn ) {
+      conn->patterns.insert( key, compiled );
+    }
+  }
+  return compiled;
+}
+
+// Returns the compiled pattern for this row: the statement's auxdata slot first (constant pattern),
+// then the connection LRU, compiling only on a miss in both. On failure returns nullptr and sets error.
+static CompiledPatternPtr lookup_pattern( sqlite3_context* context, int patternArg, std::string_view pattern, const char* flags, const char** error ) {
+  const char* flagStr = flags ? flags : "";
+  auto*       aux     = static_cast< CompiledPatternPtr* >( sqlite3_get_auxdata( context, patternArg ) );
+  auto*       connRef = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  auto*       conn    = connRef ? connRef->get() : nullptr;
+  if ( aux && ( *aux )->flags == flagStr ) {
+    BOLTON_COUNT( conn, cacheHits );
+    return *aux;
+  }
+
+  CompiledPatternPtr compiled = cached_pattern( conn, pattern, flags, error );
+  if ( !compiled ) {
+    return nullptr;
+  }
+  // SQLite keeps this only while the pattern argument is constant, and may free it straight away otherwise.
+  sqlite3_set_auxdata( context, patternArg, new CompiledPatternPtr( compiled ), &destroy_pattern_ref );
+  return compiled;
+}
+
+/* A per-statement memo of results, for statements that call one function with the same arguments over and over, as
+* a join on normalized codes does. Off by default: boltOn_config( 'memo_slots', n ) keeps up to n results per
+* statement for regexp(), regex_replace() and regex_extract(), and boltOn_stats() counts memo_hits and memo_misses.
+*
+* It is built like the levenshtein memo in sqlite_levenshtein.c, which explains the design, with an auxdata slot of its
+* own. Only here results are text, so results over kMemoMaxBytes are skipped as well as keys: long values seldom repeat
+* and cost as much to copy as to match.
+*/
+static const int    kMemoAuxSlot  = -0x626f6c74; // Negative: not tied to an argument, so kept across rows
+static const size_t kMemoMaxBytes = 1024;
+
+class ResultMemo {
+public:
+  enum Kind { kInteger, kText, kNull, kFirstArg }; // kFirstArg: argv[ 0 ] itself, unchanged
+
+  struct Entry {
+    uint64_t      hash = 0; // 0 for an empty slot
+    std::string   key;
+    Kind          kind    = kNull;
+    sqlite3_int64 integer = 0;
+    std::string   text;
+  };
+
+  explicit ResultMemo( size_t slots ) : slots_( slots ) {} // A power of two
+
+  const Entry* find( uint64_t hash, const std::string& key ) const {
+    for ( size_t i = hash & ( slots_.size() - 1 );; i = ( i + 1 ) & ( slots_.size() - 1 ) ) {
+      const Entry& e = slots_[ i ];
+      if ( !e.hash ) {
+        return nullptr;
+      }
+      if ( e.hash == hash && e.key == key ) {
+        return &e;
+      }
+    }
+  }
+
+  // The slot for a key find() did not have
+  Entry& insert( uint64_t hash, std::string& key ) {
+    if ( used_ >= slots_.size() / 4 * 3 ) {
+      for ( Entry& e : slots_ ) {
+        e.hash = 0;
+      }
+      used_ = 0;
+    }
+    size_t i = hash & ( slots_.size() - 1 );
+    while ( slots_[ i ].hash ) {
+      i = ( i + 1 ) & ( slots_.size() - 1 );
+    }
+    ++used_;
+    Entry& e = slots_[ i ];
+    e.hash   = hash;
+    e.key.swap( key );
+    return e;
+  }
+
+private:
+  std::vector< Entry > slots_;
+  size_t               used_ = 0;
+};
+
+// The result of the memoized call now running, set by memo_keep() next to the sqlite3_result_*() call it mirrors
+struct MemoResult {
+  bool             kept    = false;
+  ResultMemo::Kind kind    = ResultMemo::kNull;
+  sqlite3_int64    integer = 0;
+  std::string      text;
+};
+
+static void destroy_memo( void* p ) { delete static_cast< ResultMemo* >( p ); }
+
+static ResultMemo* statement_memo( sqlite3_context* context, uint64_t slots ) {
+  auto* memo = static_cast< ResultMemo* >( sqlite3_get_auxdata( context, kMemoAuxSlot ) );
+  if ( !memo ) {
+    size_t size = 8;
+    while ( size < slots + slots / 3 + 1 ) { // n results fit under the three quarters load
+      size *= 2;
+    }
+    try {
+      memo = new ResultMemo( size );
+    } catch ( std::bad_alloc& ) { return nullptr; }
+    sqlite3_set_auxdata( context, kMemoAuxSlot, memo, &destroy_memo );
+    memo = static_cast< ResultMemo* >( sqlite3_get_auxdata( context, kMemoAuxSlot ) ); // Freed already if SQLite could not keep it
+  }
+  return memo;
+}
+
+// Appends an argument to a memo key as the functions read it: numbers by value, so 1 and '1' stay apart, the rest as text.
+// False when the key would be too long to keep.
+static bool memo_key_append( std::string& key, sqlite3_value* value ) {
+  int type = sqlite3_value_type( value );
+  key.push_back( static_cast< char >( type ) );
+  if ( type == SQLITE_INTEGER ) {
+    sqlite3_int64 i = sqlite3_value_int64( value );
+    key.append( reinterpret_cast< const char* >( &i ), sizeof( i ) );
+  } else if ( type == SQLITE_FLOAT ) {
+    double d = sqlite3_value_double( value );
+    key.append( reinterpret_cast< const char* >( &d ), sizeof( d ) );
+  } else if ( type != SQLITE_NULL ) {
+    const char* text = reinterpret_cast< const char* >( sqlite3_value_text( value ) );
+    uint32_t    n    = static_cast< uint32_t >( sqlite3_value_bytes( value ) );
+    if ( !text || key.size() + sizeof( n ) + n > kMemoMaxBytes ) {
+      return false;
+    }
+    key.append( reinterpret_cast< const char* >( &n ), sizeof( n ) );
+    key.append( text, n );
+  }
+  return true;
+}
+
+static void memo_keep( sqlite3_context* context, ResultMemo::Kind kind, sqlite3_int64 integer = 0, const char* text = nullptr, size_t len = 0 ) {
+  auto*       connRef = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  MemoResult* result  = connRef ? ( *connRef )->memoResult : nullptr;
+  if ( !result || len > kMemoMaxBytes ) {
+    return;
+  }
+  result->kept    = true;
+  result->kind    = kind;
+  result->integer = integer;
+  result->text.assign( text ? text : "", len );
+}
+
+// Serves Fn from the statement's memo when memo_slots is set and these arguments have been seen
+template < void ( *Fn )( sqlite3_context*, int, sqlite3_value** ) >
+static void memoized( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  auto*       connRef = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  auto*       conn    = connRef ? connRef->get() : nullptr;
+  ResultMemo* memo    = conn && conn->memoSlots ? statement_memo( context, conn->memoSlots ) : nullptr;
+  if ( !memo ) {
+    Fn( context, argc, argv );
+    return;
+  }
+  std::string key;
+  uint64_t    hash = 0;
+  try {
+    void ( *fn )( sqlite3_context*, int, sqlite3_value** ) = Fn; // Tells the functions apart within one memo
+    key.append( reinterpret_cast< const char* >( &fn ), sizeof( fn ) );
+    bool fits = true;
+    for ( int i = 0; i < argc && fits; ++i ) {
+      fits = memo_key_append( key, argv[ i ] );
+    }
+    if ( !fits ) {
+      Fn( context, argc, argv );
+      return;
+    }
+    hash = static_cast< uint64_t >( std::hash< std::string >()( key ) ) | 1;
+  } catch ( std::bad_alloc& ) {
+    Fn( context, argc, argv );
+    return;
+  }
+
+  if ( const ResultMemo::Entry* hit = memo->find( hash, key ) ) {
+    BOLTON_COUNT( conn, memoHits );
+    switch ( hit->kind ) {
+      case ResultMemo::kInteger: sqlite3_result_int64( context, hit->integer ); break;
+      case ResultMemo::kText: sqlite3_result_text64( context, hit->text.data(), hit->text.size(), SQLITE_TRANSIENT, SQLITE_UTF8 ); break;
+      case ResultMemo::kNull: sqlite3_result_null( context ); break;
+      case ResultMemo::kFirstArg: sqlite3_result_value( context, argv[ 0 ] ); break;
+    }
+    return;
+  }
+  BOLTON_COUNT( conn, memoMisses );
+  MemoResult result;
+  conn->memoResult = &result;
+  Fn( context, argc, argv );
+  conn->memoResult = nullptr;
+  if ( result.kept ) { // Errors are never kept, so a budget overrun on one row is not replayed on the next
+    try {
+      ResultMemo::Entry& e = memo->insert( hash, key );
+      e.kind               = result.kind;
+      e.integer            = result.integer;
+      e.text.swap( result.text );
+    } catch ( std::bad_alloc& ) {}
+  }
+}
+
 static void regexp_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
   if ( argc < 2 || argc > 3 ) {
     sqlite3_result_error( context, "REGEXP requires 2 or 3 arguments", -1 );
     return;
   }
-  const char* pattern = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
-  const char* value   = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
-  const char* flags   = ( argc == 3 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) ) : nullptr;
+  const char* pattern  = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* value    = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  int         valueLen = sqlite3_value_bytes( argv[ 1 ] );
+  const char* flags    = ( argc == 3 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) ) : nullptr;
   if ( !pattern || !value ) {
     sqlite3_result_int( context, 0 );
     return;
   }
-  std::string           patternStr   = pattern;
-  bool                  invalid_flag = false;
-  std::regex::flag_type mode         = parse_flags( flags, patternStr, invalid_flag );
-  if ( invalid_flag ) {
-    sqlite3_result_error( context, "Invalid regex flag used", -1 );
+  const char*        error    = nullptr;
+  CompiledPatternPtr compiled = lookup_pattern( context, 0, std::string_view( pattern, sqlite3_value_bytes( argv[ 0 ] ) ), flags, &error );
+  if ( !compiled ) {
+    sqlite3_result_error( context, error, -1 );
     return;
   }
   try {
-    std::regex re( patternStr, mode );
-    sqlite3_result_int( context, std::regex_search( value, re ) ? 1 : 0 );
-  } catch ( std::regex_error& ) { sqlite3_result_error( context, "Invalid regex", -1 ); }
+    RegexBudget budget( regex_budget_us( context ), kInterruptPoll, sqlite3_context_db_handle( context ) );
+    int matched = compiled->re->search( value, valueLen ) ? 1 : 0;
+    memo_keep( context, ResultMemo::kInteger, matched );
+    sqlite3_result_int( context, matched );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+/* regexp_blob( table, column, rowid, pattern [, flags] ): regexp() over main.table.column at rowid, read in
+* kBlobChunk pieces through a blob handle rather than loaded whole, so a multi-megabyte value costs one chunk of
+* memory and the read stops at the first match.
+*
+*   SELECT id FROM studies WHERE regexp_blob( 'studies', 'report', rowid, 'MRN:\d{6}' );
+*
+* A pattern whose matches have no bound (.*, lookaround, backreferences; see regex_match_reach()) cannot be windowed
+* by std::regex, PCRE2 or RE2, and is matched against the whole value instead; Hyperscan streams anything it compiles.
+* Values a blob handle cannot open, such as numbers, and every value of a UTF-16 database, are read through SQL.
+* A NULL value or a missing row is 0, as with regexp(). It reads whatever table it is told to, so it runs only from
+* top-level SQL.
+*/
+static const int kBlobChunk = 64 * 1024;
+
+struct BlobHandle {
+  sqlite3_blob* p = nullptr;
+  ~BlobHandle() { sqlite3_blob_close( p ); }
+};
+
+// Whether main stores text as UTF-8, so the bytes under a blob handle are what regexp() would have matched.
+// Only asked once a blob has opened: with a table in it, the encoding of the database is fixed.
+static bool main_is_utf8( sqlite3* db, BoltOnConnection* conn ) {
+  if ( conn && conn->mainEncoding ) {
+    return conn->mainEncoding == SQLITE_UTF8;
+  }
+  int           encoding = 0;
+  sqlite3_stmt* stmt     = nullptr;
+  if ( sqlite3_prepare_v2( db, "PRAGMA main.encoding", -1, &stmt, nullptr ) == SQLITE_OK && sqlite3_step( stmt ) == SQLITE_ROW ) {
+    const char* name = reinterpret_cast< const char* >( sqlite3_column_text( stmt, 0 ) );
+    encoding         = name && sqlite3_stricmp( name, "UTF-8" ) == 0 ? SQLITE_UTF8 : SQLITE_UTF16;
+  }
+  sqlite3_finalize( stmt );
+  if ( conn ) {
+    conn->mainEncoding = encoding;
+  }
+  return encoding == SQLITE_UTF8;
+}
+
+static void read_blob( sqlite3_blob* blob, char* buf, int n, int offset ) {
+  int rc = sqlite3_blob_read( blob, buf, n, offset );
+  if ( rc != SQLITE_OK ) {
+    throw std::runtime_error( std::string( "regexp_blob: " ) + sqlite3_errstr( rc ) );
+  }
+}
+
+static bool blob_search( sqlite3_blob* blob, const CompiledPattern& compiled, BoltOnConnection* conn ) {
+  int                            size   = sqlite3_blob_bytes( blob );
+  std::unique_ptr< RegexStream > stream = size > kBlobChunk ? open_regex_stream( *compiled.re, compiled.reach ) : nullptr;
+  if ( !stream ) { // Small enough to read in one go, or unbounded
+    std::unique_ptr< char[] > value( new char[ size ? size : 1 ] );
+    read_blob( blob, value.get(), size, 0 );
+    BOLTON_COUNT_BYTES( conn, size );
+    return compiled.re->search( value.get(), size );
+  }
+  std::unique_ptr< char[] > chunk( new char[ kBlobChunk ] );
+  for ( int offset = 0; offset < size; offset += kBlobChunk ) {
+    int n = std::min( kBlobChunk, size - offset );
+    read_blob( blob, chunk.get(), n, offset );
+    BOLTON_COUNT_BYTES( conn, n );
+    if ( stream->feed( chunk.get(), n ) ) {
+      return true;
+    }
+  }
+  return stream->finish();
 }
 
+// The value read through SQL, for what a blob handle will not do. Returns -1, with the error reported, when the
+// table or column does not exist.
+static int column_search( sqlite3_context* context, sqlite3* db, const char* table, const char* column, sqlite3_int64 rowid, const CompiledPattern& compiled,
+                          BoltOnConnection* conn ) {
+  char* sql = sqlite3_mprintf( "SELECT main.\"%w\".\"%w\" FROM main.\"%w\" WHERE rowid = ?1", table, column, table );
+  if ( !sql ) {
+    sqlite3_result_error_nomem( context );
+    return -1;
+  }
+  sqlite3_stmt* stmt = nullptr;
+  int           rc   = sqlite3_prepare_v2( db, sql, -1, &stmt, nullptr );
+  sqlite3_free( sql );
+  if ( rc != SQLITE_OK ) {
+    sqlite3_result_error( context, sqlite3_errmsg( db ), -1 );
+    sqlite3_result_error_code( context, rc );
+    return -1;
+  }
+  sqlite3_bind_int64( stmt, 1, rowid );
+  int matched = 0;
+  rc          = sqlite3_step( stmt );
+  if ( rc == SQLITE_ROW ) {
+    const char* value = reinterpret_cast< const char* >( sqlite3_column_text( stmt, 0 ) );
+    int         n     = sqlite3_column_bytes( stmt, 0 );
+    BOLTON_COUNT_BYTES( conn, n );
+    try {
+      matched = value && compiled.re->search( value, n ) ? 1 : 0;
+    } catch ( ... ) {
+      sqlite3_finalize( stmt );
+      throw;
+    }
+  } else if ( rc != SQLITE_DONE ) {
+    sqlite3_result_error( context, sqlite3_errmsg( db ), -1 );
+    sqlite3_result_error_code( context, rc );
+    matched = -1;
+  }
+  sqlite3_finalize( stmt );
+  return matched;
+}
+
+static void regexp_blob_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  if ( argc < 4 || argc > 5 ) {
+    sqlite3_result_error( context, "REGEXP_BLOB requires 4 or 5 arguments", -1 );
+    return;
+  }
+  const char* table   = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* column  = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  const char* pattern = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 3 ] ) );
+  const char* flags   = ( argc == 5 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 4 ] ) ) : nullptr;
+  if ( !table || !column || !pattern || sqlite3_value_type( argv[ 2 ] ) == SQLITE_NULL ) {
+    sqlite3_result_int( context, 0 );
+    return;
+  }
+  sqlite3_int64      rowid    = sqlite3_value_int64( argv[ 2 ] );
+  const char*        error    = nullptr;
+  CompiledPatternPtr compiled = lookup_pattern( context, 3, std::string_view( pattern, sqlite3_value_bytes( argv[ 3 ] ) ), flags, &error );
+  if ( !compiled ) {
+    sqlite3_result_error( context, error, -1 );
+    return;
+  }
+  auto*    connRef = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  auto*    conn    = connRef ? connRef->get() : nullptr;
+  sqlite3* db      = sqlite3_context_db_handle( context );
+  try {
+    RegexBudget budget( regex_budget_us( context ), kInterruptPoll, db );
+    BlobHandle  blob;
+    if ( sqlite3_blob_open( db, "main", table, column, rowid, 0, &blob.p ) == SQLITE_OK && main_is_utf8( db, conn ) ) {
+      sqlite3_result_int( context, blob_search( blob.p, *compiled, conn ) ? 1 : 0 );
+      return;
+    }
+    int matched = column_search( context, db, table, column, rowid, *compiled, conn );
+    if ( matched >= 0 ) {
+      sqlite3_result_int( context, matched );
+    }
+  } catch ( std::bad_alloc& ) {
+    sqlite3_result_error_nomem( context );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+// Builds a result in sqlite3_malloc memory, so SQLite can take it over with sqlite3_free as the destructor.
+class SqliteTextSink : public TextSink {
+public:
+  ~SqliteTextSink() override { sqlite3_free( data_ ); }
+
+  char* release() {
+    char* p = data_;
+    data_   = nullptr;
+    size_   = capacity_ = 0;
+    return p;
+  }
+
+protected:
+  void grow( size_t need ) override {
+    size_t capacity = capacity_ ? capacity_ : 64;
+    while ( capacity < need ) {
+      capacity *= 2;
+    }
+    void* p = sqlite3_realloc64( data_, capacity );
+    if ( !p ) {
+      throw std::bad_alloc();
+    }
+    data_     = static_cast< char* >( p );
+    capacity_ = capacity;
+  }
+};
+
+// A row the pattern does not touch is returned as the original value; a rewritten one is built once, in memory
+// SQLite then owns, so neither case copies the text again on the way out.
 static void regex_replace_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
   if ( argc < 3 || argc > 4 ) {
     sqlite3_result_error( context, "REGEX_REPLACE requires 3 or 4 arguments", -1 );
     return;
   }
-  const char* src         = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
-  const char* pattern     = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
-  const char* replacement = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) );
-  const char* flags       = ( argc == 4 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 3 ] ) ) : nullptr;
-  if ( !src || !pattern || !replacement ) {
+  const char* srcText         = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* patternText     = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  const char* replacementText = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) );
+  const char* flags           = ( argc == 4 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 3 ] ) ) : nullptr;
+  if ( !srcText || !patternText || !replacementText ) {
     sqlite3_result_null( context );
     return;
   }
-  std::string           patternStr   = pattern;
-  bool                  invalid_flag = false;
-  std::regex::flag_type mode         = parse_flags( flags, patternStr, invalid_flag );
-  if ( invalid_flag ) { sqlite3_result_error( context, "Invalid regex flag used", -1 ); return; }
+  std::string_view   src( srcText, sqlite3_value_bytes( argv[ 0 ] ) );
+  std::string_view   replacement( replacementText, sqlite3_value_bytes( argv[ 2 ] ) );
+  const char*        error    = nullptr;
+  CompiledPatternPtr compiled = lookup_pattern( context, 1, std::string_view( patternText, sqlite3_value_bytes( argv[ 1 ] ) ), flags, &error );
+  if ( !compiled ) { sqlite3_result_error( context, error, -1 ); return; }
+
+  try {
+    RegexBudget budget( regex_budget_us( context ), kInterruptPoll, sqlite3_context_db_handle( context ) );
+    SqliteTextSink result;
+    if ( !regex_replace_all( *compiled->re, src.data(), src.size(), replacement.data(), replacement.size(), result ) ) {
+      if ( sqlite3_value_type( argv[ 0 ] ) == SQLITE_TEXT ) {
+        memo_keep( context, ResultMemo::kFirstArg );
+        sqlite3_result_value( context, argv[ 0 ] );
+      } else { // Numbers and blobs still come back as the text they were matched as
+        memo_keep( context, ResultMemo::kText, 0, src.data(), src.size() );
+        sqlite3_result_text64( context, src.data(), src.size(), SQLITE_TRANSIENT, SQLITE_UTF8 );
+      }
+      return;
+    }
+    size_t size = result.size();
+    memo_keep( context, ResultMemo::kText, 0, result.data(), size );
+    if ( !size ) {
+      sqlite3_result_text( context, "", 0, SQLITE_STATIC );
+      return;
+    }
+    sqlite3_result_text64( context, result.release(), size, sqlite3_free, SQLITE_UTF8 );
+  } catch ( std::bad_alloc& ) {
+    sqlite3_result_error_nomem( context );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+// Patterns for regexp_any() and regexp_which(), compiled into one set per statement.
+struct CompiledPatternSet {
+  std::string                       flags;
+  std::vector< std::string >        ids; // JSON text of each pattern's id: its array index or object key
+  std::unique_ptr< RegexSetEngine > set;
+};
+
+static void destroy_pattern_set( void* p ) { delete static_cast< CompiledPatternSet* >( p ); }
+
+// The patterns argument is a JSON array of pattern strings or an object of id: pattern, read with
+// json_each() so a table can be passed as ( SELECT json_group_object( id, pattern ) FROM patterns ).
+// Cached in auxdata, so a constant argument is parsed and compiled once per statement.
+static const CompiledPatternSet* lookup_pattern_set( sqlite3_context* context, int patternsArg, sqlite3_value* patterns, const char* flags, const char** error ) {
+  const char* flagStr = flags ? flags : "";
+  auto*       aux     = static_cast< CompiledPatternSet* >( sqlite3_get_auxdata( context, patternsArg ) );
+  auto*       connRef = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) );
+  auto*       conn    = connRef ? connRef->get() : nullptr;
+  if ( aux && aux->flags == flagStr ) {
+    BOLTON_COUNT( conn, cacheHits );
+    return aux;
+  }
+  BOLTON_COUNT( conn, cacheMisses );
+
+  std::unique_ptr< CompiledPatternSet > compiled( new CompiledPatternSet() );
+  std::vector< std::string >            sources;
+  bool                                  extended     = false;
+  bool                                  invalid_flag = false;
+  RegexFlags                            mode         = parse_flags( flags, extended, invalid_flag ); // Shared by every pattern in the list
+  if ( invalid_flag ) {
+    *error = "Invalid regex flag used";
+    return nullptr;
+  }
+  compiled->flags = flagStr;
+
+  *error = "Invalid regex pattern list: expected a JSON array or object of pattern strings";
+  sqlite3_stmt* stmt = nullptr;
+  if ( sqlite3_prepare_v2( sqlite3_context_db_handle( context ), "SELECT json_quote( key ), value, type FROM json_each( ?1 )", -1, &stmt, nullptr ) != SQLITE_OK ) {
+    return nullptr;
+  }
+  sqlite3_bind_value( stmt, 1, patterns );
+  int rc;
+  while ( ( rc = sqlite3_step( stmt ) ) == SQLITE_ROW ) {
+    const char* type = reinterpret_cast< const char* >( sqlite3_column_text( stmt, 2 ) );
+    if ( !type || std::string( type ) != "text" ) {
+      break;
+    }
+    std::string_view text( reinterpret_cast< const char* >( sqlite3_column_text( stmt, 1 ) ), sqlite3_column_bytes( stmt, 1 ) );
+    std::string      source = extended ? strip_extended( text ) : std::string( text );
+    compiled->ids.emplace_back( reinterpret_cast< const char* >( sqlite3_column_text( stmt, 0 ) ), sqlite3_column_bytes( stmt, 0 ) );
+    sources.push_back( std::move( source ) );
+  }
+  sqlite3_finalize( stmt );
+  if ( rc != SQLITE_DONE ) {
+    return nullptr;
+  }
+
+  std::string compileError;
+  compiled->set = compile_regex_set( sources, mode, compileError );
+  if ( !compiled->set ) {
+    *error = "Invalid regex";
+    return nullptr;
+  }
+  // SQLite keeps this at least until the call returns, unless it is freed at once for lack of memory
+  *error                     = nullptr;
+  CompiledPatternSet* result = compiled.release();
+  sqlite3_set_auxdata( context, patternsArg, result, &destroy_pattern_set );
+  return static_cast< CompiledPatternSet* >( sqlite3_get_auxdata( context, patternsArg ) ) == result ? result : nullptr;
+}
+
+static void regexp_any_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  if ( argc < 2 || argc > 3 ) {
+    sqlite3_result_error( context, "REGEXP_ANY requires 2 or 3 arguments", -1 );
+    return;
+  }
+  const char* value = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* flags = ( argc == 3 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) ) : nullptr;
+  if ( !value || sqlite3_value_type( argv[ 1 ] ) == SQLITE_NULL ) {
+    sqlite3_result_int( context, 0 );
+    return;
+  }
+  const char*               error    = nullptr;
+  const CompiledPatternSet* compiled = lookup_pattern_set( context, 1, argv[ 1 ], flags, &error );
+  if ( !compiled ) {
+    error ? sqlite3_result_error( context, error, -1 ) : sqlite3_result_error_nomem( context );
+    return;
+  }
+  try {
+    RegexBudget budget( regex_budget_us( context ), kInterruptPoll, sqlite3_context_db_handle( context ) );
+    sqlite3_result_int( context, compiled->set->any( value, sqlite3_value_bytes( argv[ 0 ] ) ) ? 1 : 0 );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+// Returns the ids of the matching patterns as a JSON array, [] when none match
+static void regexp_which_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  if ( argc < 2 || argc > 3 ) {
+    sqlite3_result_error( context, "REGEXP_WHICH requires 2 or 3 arguments", -1 );
+    return;
+  }
+  const char* value = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* flags = ( argc == 3 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) ) : nullptr;
+  if ( !value || sqlite3_value_type( argv[ 1 ] ) == SQLITE_NULL ) {
+    sqlite3_result_null( context );
+    return;
+  }
+  const char*               error    = nullptr;
+  const CompiledPatternSet* compiled = lookup_pattern_set( context, 1, argv[ 1 ], flags, &error );
+  if ( !compiled ) {
+    error ? sqlite3_result_error( context, error, -1 ) : sqlite3_result_error_nomem( context );
+    return;
+  }
+  try {
+    RegexBudget        budget( regex_budget_us( context ), kInterruptPoll, sqlite3_context_db_handle( context ) );
+    std::vector< int > hits;
+    compiled->set->which( value, sqlite3_value_bytes( argv[ 0 ] ), hits );
+    std::string result = "[";
+    for ( size_t i = 0; i < hits.size(); ++i ) {
+      if ( i ) {
+        result += ',';
+      }
+      result += compiled->ids[ hits[ i ] ];
+    }
+    result += ']';
+    sqlite3_result_text( context, result.c_str(), static_cast< int >( result.size() ), SQLITE_TRANSIENT );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+// regex_extract( value, pattern [, group [, flags]] ): the text of one capture group (default 0, the whole match)
+// in the first match, or NULL when nothing matches or the group took no part in the match.
+static void regex_extract_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  if ( argc < 2 || argc > 4 ) {
+    sqlite3_result_error( context, "REGEX_EXTRACT requires 2 to 4 arguments", -1 );
+    return;
+  }
+  const char* value   = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* pattern = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  const char* flags   = ( argc == 4 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 3 ] ) ) : nullptr;
+  if ( !value || !pattern || ( argc >= 3 && sqlite3_value_type( argv[ 2 ] ) == SQLITE_NULL ) ) {
+    sqlite3_result_null( context );
+    return;
+  }
+  const char*        error    = nullptr;
+  CompiledPatternPtr compiled = lookup_pattern( context, 1, std::string_view( pattern, sqlite3_value_bytes( argv[ 1 ] ) ), flags, &error );
+  if ( !compiled ) {
+    sqlite3_result_error( context, error, -1 );
+    return;
+  }
+  sqlite3_int64 group = ( argc >= 3 ) ? sqlite3_value_int64( argv[ 2 ] ) : 0;
+  if ( group < 0 || static_cast< sqlite3_uint64 >( group ) > compiled->re->groupCount() ) {
+    sqlite3_result_error( context, "Invalid regex group", -1 );
+    return;
+  }
+  try {
+    RegexBudget budget( regex_budget_us( context ), kInterruptPoll, sqlite3_context_db_handle( context ) );
+    std::vector< RegexSpan > groups;
+    if ( !compiled->re->find( value, sqlite3_value_bytes( argv[ 0 ] ), 0, groups ) || groups[ group ].start < 0 ) {
+      memo_keep( context, ResultMemo::kNull );
+      sqlite3_result_null( context );
+      return;
+    }
+    memo_keep( context, ResultMemo::kText, 0, value + groups[ group ].start, static_cast< size_t >( groups[ group ].end - groups[ group ].start ) );
+    sqlite3_result_text64( context, value + groups[ group ].start, static_cast< sqlite3_uint64 >( groups[ group ].end - groups[ group ].start ), SQLITE_TRANSIENT,
+                           SQLITE_UTF8 );
+  } catch ( RegexBudgetExceeded& e ) {
+    result_budget_error( context, e );
+  } catch ( std::exception& e ) { sqlite3_result_error( context, e.what(), -1 ); }
+}
+
+/* regex_matches( value, pattern [, flags] ): one row per non-overlapping match, like Python's re.finditer.
+*
+*   SELECT match, group1, start, end FROM notes, regex_matches( notes.body, 'MRN:(\d+)' );
+*
+* group1..group9 hold the first nine capture groups (NULL when absent; use regex_extract() for more), start and
+* end the match's 0-based code point offsets, end exclusive, as Python reports them. rowid counts matches from 1.
+*/
+enum {
+  kMatchesMatch   = 0,
+  kMatchesGroup1  = 1,
+  kMatchesGroups  = 9,
+  kMatchesStart   = 10,
+  kMatchesEnd     = 11,
+  kMatchesValue   = 12, // Hidden arguments from here on
+  kMatchesPattern = 13,
+  kMatchesFlags   = 14,
+};
+
+struct RegexMatchesVtab {
+  sqlite3_vtab        base;
+  sqlite3*            db;
+  BoltOnConnectionPtr conn;
+};
+
+struct RegexMatchesCursor {
+  sqlite3_vtab_cursor      base;
+  sqlite3_value*           args[ 3 ] = {}; // value, pattern, flags as passed, for the hidden columns
+  std::string              value;
+  CompiledPatternPtr       compiled;
+  std::vector< RegexSpan > groups;
+  size_t                   next      = 0; // Byte offset the next search starts from
+  size_t                   countedAt = 0; // Byte offset up to which code points have been counted
+  sqlite3_int64            counted   = 0; // Code points in value[0, countedAt)
+  sqlite3_int64            start     = 0; // Code point offsets of the current match
+  sqlite3_int64            end       = 0;
+  sqlite3_int64            rowid     = 0;
+  bool                     eof       = true;
+#ifndef BOLTON_NO_STATS
+  BoltOnStats* timed = nullptr; // Set for the sampled scans, which add the time of every search
+#endif
+
+  ~RegexMatchesCursor() { reset(); }
+
+  void reset() {
+    for ( sqlite3_value*& arg : args ) {
+      sqlite3_value_free( arg );
+      arg = nullptr;
+    }
+    compiled.reset();
+    eof = true;
+  }
+
+  // Code points before byte offset at, which never moves backwards between calls within one value
+  sqlite3_int64 chars_to( size_t at ) {
+    for ( ; countedAt < at; ++countedAt ) {
+      counted += ( static_cast< unsigned char >( value[ countedAt ] ) & 0xC0 ) != 0x80;
+    }
+    return counted;
+  }
+
+  // Moves to the next match, or sets eof
+  void advance() {
+#ifndef BOLTON_NO_STATS
+    StatTimer timer( timed );
+#endif
+    size_t len = value.size();
+    if ( next > len || !compiled->re->find( value.data(), len, next, groups ) ) {
+      eof = true;
+      return;
+    }
+    size_t s = static_cast< size_t >( groups[ 0 ].start );
+    size_t e = static_cast< size_t >( groups[ 0 ].end );
+    start    = chars_to( s );
+    end      = chars_to( e );
+    next     = e;
+    if ( e == s ) { // Empty match: resume after the next whole character so the scan always advances
+      ++next;
+      while ( next < len && ( static_cast< unsigned char >( value[ next ] ) & 0xC0 ) == 0x80 ) {
+        ++next;
+      }
+    }
+    ++rowid;
+  }
+};
+
+static int regex_matches_connect( sqlite3* db, void* pAux, int, const char* const*, sqlite3_vtab** ppVtab, char** ) {
+  int rc = sqlite3_declare_vtab( db,
+                                 "CREATE TABLE x( match TEXT, group1 TEXT, group2 TEXT, group3 TEXT, group4 TEXT, group5 TEXT, group6 TEXT, group7 TEXT, "
+                                 "group8 TEXT, group9 TEXT, start INTEGER, \"end\" INTEGER, value HIDDEN, pattern HIDDEN, flags HIDDEN )" );
+  if ( rc != SQLITE_OK ) {
+    return rc;
+  }
+  RegexMatchesVtab* vtab = new ( std::nothrow ) RegexMatchesVtab();
+  if ( !vtab ) {
+    return SQLITE_NOMEM;
+  }
+  vtab->db   = db;
+  vtab->conn = *static_cast< BoltOnConnectionPtr* >( pAux );
+  sqlite3_vtab_config( db, SQLITE_VTAB_INNOCUOUS );
+  *ppVtab = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int regex_matches_disconnect( sqlite3_vtab* pVtab ) {
+  delete reinterpret_cast< RegexMatchesVtab* >( pVtab );
+  return SQLITE_OK;
+}
+
+// value and pattern are required, flags optional; idxNum is 1 when flags is given
+static int regex_matches_best( sqlite3_vtab* pVtab, sqlite3_index_info* info ) {
+  int found = 0;
+  for ( int i = 0; i < info->nConstraint; ++i ) {
+    const auto& c   = info->aConstraint[ i ];
+    int         arg = c.iColumn - kMatchesValue;
+    if ( arg >= 0 && c.op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+      if ( !c.usable ) {
+        return SQLITE_CONSTRAINT;
+      }
+      info->aConstraintUsage[ i ].argvIndex = arg + 1;
+      info->aConstraintUsage[ i ].omit      = 1;
+      found |= 1 << arg;
+    }
+  }
+  if ( ( found & 3 ) != 3 ) {
+    pVtab->zErrMsg = sqlite3_mprintf( "regex_matches() requires a value and a pattern: ( value, pattern [, flags] )" );
+    return SQLITE_ERROR;
+  }
+  info->idxNum        = found == 7;
+  info->estimatedCost = 100;
+  info->estimatedRows = 10;
+  return SQLITE_OK;
+}
+
+static int regex_matches_open( sqlite3_vtab*, sqlite3_vtab_cursor** ppCursor ) {
+  RegexMatchesCursor* cur = new ( std::nothrow ) RegexMatchesCursor();
+  if ( !cur ) {
+    return SQLITE_NOMEM;
+  }
+  *ppCursor = &cur->base;
+  return SQLITE_OK;
+}
+
+static int regex_matches_close( sqlite3_vtab_cursor* pCursor ) {
+  delete reinterpret_cast< RegexMatchesCursor* >( pCursor );
+  return SQLITE_OK;
+}
+
+static int regex_matches_filter( sqlite3_vtab_cursor* pCursor, int idxNum, const char*, int argc, sqlite3_value** argv ) {
+  RegexMatchesCursor* cur  = reinterpret_cast< RegexMatchesCursor* >( pCursor );
+  RegexMatchesVtab*   vtab = reinterpret_cast< RegexMatchesVtab* >( pCursor->pVtab );
+  cur->reset();
+  for ( int i = 0; i < argc; ++i ) {
+    cur->args[ i ] = sqlite3_value_dup( argv[ i ] );
+    if ( !cur->args[ i ] ) {
+      return SQLITE_NOMEM;
+    }
+  }
+  const char* value   = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* pattern = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  const char* flags   = idxNum ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) ) : nullptr;
+  if ( !value || !pattern ) {
+    return SQLITE_OK;
+  }
+  BoltOnConnection* conn = vtab->conn.get();
+#ifndef BOLTON_NO_STATS
+  BoltOnStats& st = conn->stats[ kStatRegexMatches ];
+  st.bytes += static_cast< uint64_t >( sqlite3_value_bytes( argv[ 0 ] ) );
+  cur->timed = ( st.calls++ & ( kStatSample - 1 ) ) == 0 ? &st : nullptr;
+  st.samples += cur->timed != nullptr;
+  conn->current = &st;
+#endif
+  try {
+    const char* error = nullptr;
+    cur->compiled     = cached_pattern( conn, std::string_view( pattern, sqlite3_value_bytes( argv[ 1 ] ) ), flags, &error );
+#ifndef BOLTON_NO_STATS
+    conn->current = nullptr;
+#endif
+    if ( !cur->compiled ) {
+      pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", error );
+      return SQLITE_ERROR;
+    }
+    cur->value.assign( value, sqlite3_value_bytes( argv[ 0 ] ) );
+    cur->next = cur->countedAt = 0;
+    cur->counted = cur->rowid = 0;
+    cur->eof                  = false;
+    RegexBudget budget( conn->regexBudgetUs, kInterruptPoll, vtab->db );
+    cur->advance();
+  } catch ( std::bad_alloc& ) {
+    return SQLITE_NOMEM;
+  } catch ( RegexBudgetExceeded& e ) {
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", e.what() );
+    return e.interrupted() ? SQLITE_INTERRUPT : SQLITE_ERROR;
+  } catch ( std::exception& e ) {
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", e.what() );
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+// Each row has the whole budget: it bounds one search, and SQLite's own progress handler runs between rows
+static int regex_matches_next( sqlite3_vtab_cursor* pCursor ) {
+  RegexMatchesVtab* vtab = reinterpret_cast< RegexMatchesVtab* >( pCursor->pVtab );
+  try {
+    RegexBudget budget( vtab->conn->regexBudgetUs, kInterruptPoll, vtab->db );
+    reinterpret_cast< RegexMatchesCursor* >( pCursor )->advance();
+  } catch ( RegexBudgetExceeded& e ) {
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", e.what() );
+    return e.interrupted() ? SQLITE_INTERRUPT : SQLITE_ERROR;
+  } catch ( std::exception& e ) {
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", e.what() );
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+static int regex_matches_eof( sqlite3_vtab_cursor* pCursor ) { return reinterpret_cast< RegexMatchesCursor* >( pCursor )->eof; }
+
+static int regex_matches_column( sqlite3_vtab_cursor* pCursor, sqlite3_context* context, int i ) {
+  RegexMatchesCursor* cur = reinterpret_cast< RegexMatchesCursor* >( pCursor );
+  if ( i <= kMatchesGroups ) {
+    size_t group = static_cast< size_t >( i - kMatchesMatch );
+    if ( group < cur->groups.size() && cur->groups[ group ].start >= 0 ) {
+      sqlite3_result_text64( context, cur->value.data() + cur->groups[ group ].start,
+                             static_cast< sqlite3_uint64 >( cur->groups[ group ].end - cur->groups[ group ].start ), SQLITE_TRANSIENT, SQLITE_UTF8 );
+    }
+  } else if ( i == kMatchesStart ) {
+    sqlite3_result_int64( context, cur->start );
+  } else if ( i == kMatchesEnd ) {
+    sqlite3_result_int64( context, cur->end );
+  } else if ( cur->args[ i - kMatchesValue ] ) {
+    sqlite3_result_value( context, cur->args[ i - kMatchesValue ] );
+  }
+  return SQLITE_OK;
+}
+
+static int regex_matches_rowid( sqlite3_vtab_cursor* pCursor, sqlite3_int64* pRowid ) {
+  *pRowid = reinterpret_cast< RegexMatchesCursor* >( pCursor )->rowid;
+  return SQLITE_OK;
+}
+
+static sqlite3_module regex_matches_module = {
+  0,       // iVersion
+  nullptr, // xCreate: eponymous only, used as a table-valued function
+  &regex_matches_connect,
+  &regex_matches_best,
+  &regex_matches_disconnect,
+  nullptr, // xDestroy
+  &regex_matches_open,
+  &regex_matches_close,
+  &regex_matches_filter,
+  &regex_matches_next,
+  &regex_matches_eof,
+  &regex_matches_column,
+  &regex_matches_rowid,
+};
+
+/* regexp_scan( table, column, pattern [, flags] ): the rowids of the rows of table whose column matches, scanned in
+* parallel. A plain WHERE regexp(...) runs on one core, because the VM calls the function for one row at a time.
+*
+*   SELECT n.* FROM notes n JOIN regexp_scan( 'notes', 'body', 'MRN:\d+' ) s ON n.rowid = s.id;
+*   SELECT id FROM regexp_scan( 'notes', 'body', 'sepsis', 'i' ) ORDER BY id;
+*
+* The rowid range of main.table is cut into shards that boltOn_config( 'scan_threads' ) worker threads take in
+* turn. Each worker has its own read-only connection to the database file and its own compiled pattern, and walks
+* its shard selecting only the column, which it searches where it lies in the page: the rest of the row is never
+* decoded, and a value is copied only when it spills onto overflow pages. Rows are returned shard by shard as they
+* finish, in rowid order when the query orders by id or rowid and in completion order otherwise. Only TEXT and BLOB
+* values are searched, as stored, so the database must be UTF-8.
+*
+* The workers read what is committed, each in its own read transaction: use WAL mode, so they never wait on a
+* writer, and do not expect to see changes the calling connection has not committed. A database with no file,
+* such as :memory:, is scanned on the calling connection instead, all of it before the first row is returned.
+*/
+enum {
+  kScanId      = 0,
+  kScanTable   = 1, // Hidden arguments from here on
+  kScanColumn  = 2,
+  kScanPattern = 3,
+  kScanFlags   = 4,
+};
+
+static const size_t kScanShardsPerWorker = 8;    // Enough that a slow shard does not leave the other workers idle
+static const int    kScanBusyMs          = 5000; // Workers wait this long on a lock, as a rollback journal writer's
+
+struct RegexScanShard {
+  sqlite3_int64                first;
+  sqlite3_int64                last;
+  std::vector< sqlite3_int64 > rowids; // Matches, ascending, once done
+  bool                         done = false;
+};
+
+// One scan, shared by its workers and the cursor that reads their results
+struct RegexScan {
+  std::string                   file; // Empty to scan on the calling connection
+  std::string                   table;
+  std::string                   column;
+  std::string                   pattern;
+  std::string                   flags;
+  bool                          hasFlags = false;
+  uint64_t                      budgetUs = 0;
+  sqlite3*                      caller   = nullptr; // Polled for sqlite3_interrupt() only
+  std::vector< RegexScanShard > shards;
+  std::atomic< size_t >         nextShard{ 0 };
+  std::atomic< bool >           stop{ false };
+  std::atomic< uint64_t >       bytes{ 0 };
+  std::mutex                    mutex; // Guards the rest
+  std::condition_variable       ready;
+  std::vector< size_t >         finished; // Shards in the order they were done
+  int                           rc = SQLITE_OK;
+  std::string                   error;
+  std::vector< std::thread >    workers;
+
+  ~RegexScan() {
+    stop = true;
+    for ( std::thread& t : workers ) {
+      t.join();
+    }
+  }
+
+  // Keeps the first failure; the other workers stop at their next row
+  void fail( int code, const std::string& what ) {
+    std::lock_guard< std::mutex > lock( mutex );
+    if ( rc == SQLITE_OK ) {
+      rc    = code;
+      error = what;
+    }
+    stop = true;
+    ready.notify_all();
+  }
+};
+
+static bool scan_stopped( void* p ) {
+  RegexScan* scan = static_cast< RegexScan* >( p );
+  return scan->stop.load( std::memory_order_relaxed ) || ( kInterruptPoll && kInterruptPoll( scan->caller ) );
+}
+
+// typeof() does not read the value, even one on overflow pages. The column is qualified so that a name which is
+// not a column is an error, never a string literal.
+static char* scan_rows_sql( const RegexScan& scan ) {
+  const char* t = scan.table.c_str();
+  const char* c = scan.column.c_str();
+  return sqlite3_mprintf( "SELECT rowid, main.\"%w\".\"%w\" FROM main.\"%w\" WHERE rowid >= ?1 AND rowid <= ?2 AND typeof( main.\"%w\".\"%w\" ) IN ( 'text', 'blob' )", t,
+                          c, t, t, c );
+}
+
+// Takes shards until none are left, on db, or on a connection of its own when db is null
+static void regexp_scan_work( RegexScan* scan, sqlite3* db ) {
+  sqlite3*      own  = nullptr;
+  sqlite3_stmt* stmt = nullptr;
+  try {
+    if ( !db ) {
+      if ( sqlite3_open_v2( scan->file.c_str(), &own, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr ) != SQLITE_OK ) {
+        throw std::runtime_error( std::string( "regexp_scan: cannot open the database: " ) + ( own ? sqlite3_errmsg( own ) : "out of memory" ) );
+      }
+      sqlite3_busy_timeout( own, kScanBusyMs );
+      db = own;
+    }
+    const char*                    error = nullptr;
+    std::unique_ptr< RegexEngine > re    = compile_pattern( scan->pattern, scan->hasFlags ? scan->flags.c_str() : nullptr, &error );
+    char*                          sql   = scan_rows_sql( *scan );
+    int                            rc    = sql ? sqlite3_prepare_v2( db, sql, -1, &stmt, nullptr ) : SQLITE_NOMEM;
+    sqlite3_free( sql );
+    if ( rc != SQLITE_OK || !re ) {
+      throw std::runtime_error( std::string( "regexp_scan: " ) + ( re ? sqlite3_errmsg( db ) : error ) );
+    }
+    std::vector< sqlite3_int64 > rowids;
+    uint64_t                     bytes = 0;
+    for ( size_t i; !scan_stopped( scan ) && ( i = scan->nextShard++ ) < scan->shards.size(); ) {
+      RegexScanShard& shard = scan->shards[ i ];
+      rowids.clear();
+      sqlite3_bind_int64( stmt, 1, shard.first );
+      sqlite3_bind_int64( stmt, 2, shard.last );
+      while ( ( rc = sqlite3_step( stmt ) ) == SQLITE_ROW && !scan_stopped( scan ) ) {
+        sqlite3_int64 rowid = sqlite3_column_int64( stmt, 0 );
+        const char*   value = static_cast< const char* >( sqlite3_column_blob( stmt, 1 ) ); // Bytes as stored: no conversion, no terminator
+        int           n     = sqlite3_column_bytes( stmt, 1 );
+        bytes += static_cast< uint64_t >( n );
+        RegexBudget budget( scan->budgetUs, kInterruptPoll ? &scan_stopped : nullptr, scan ); // Polled as the other functions poll
+        if ( re->search( value ? value : "", static_cast< size_t >( n ) ) ) {
+          rowids.push_back( rowid );
+        }
+      }
+      if ( rc == SQLITE_ROW ) {
+        break; // Stopped part way, so the shard is not done
+      }
+      if ( rc != SQLITE_DONE ) {
+        throw std::runtime_error( std::string( "regexp_scan: " ) + sqlite3_errmsg( db ) );
+      }
+      sqlite3_reset( stmt );
+      std::lock_guard< std::mutex > lock( scan->mutex );
+      shard.rowids.swap( rowids );
+      shard.done = true;
+      scan->finished.push_back( i );
+      scan->ready.notify_all();
+    }
+    scan->bytes += bytes;
+  } catch ( std::bad_alloc& ) {
+    scan->fail( SQLITE_NOMEM, "out of memory" );
+  } catch ( RegexBudgetExceeded& e ) {
+    if ( !scan->stop ) {
+      scan->fail( e.interrupted() ? SQLITE_INTERRUPT : SQLITE_ERROR, e.what() );
+    }
+  } catch ( std::exception& e ) { scan->fail( SQLITE_ERROR, e.what() ); }
+  sqlite3_finalize( stmt );
+  sqlite3_close( own );
+}
+
+struct RegexScanVtab {
+  sqlite3_vtab        base;
+  sqlite3*            db;
+  BoltOnConnectionPtr conn;
+};
+
+struct RegexScanCursor {
+  sqlite3_vtab_cursor          base;
+  sqlite3_value*               args[ 4 ] = {}; // table, column, pattern, flags as passed, for the hidden columns
+  std::unique_ptr< RegexScan > scan;
+  std::vector< sqlite3_int64 > rowids; // Of the shard being returned
+  size_t                       pos     = 0;
+  size_t                       taken   = 0; // Shards returned so far
+  sqlite3_int64                rowid   = 0;
+  bool                         ordered = false;
+  bool                         eof     = true;
+#ifndef BOLTON_NO_STATS
+  BoltOnStats* stats = nullptr; // Of the scan running, which is timed from filter to its last row
+#endif
+
+  ~RegexScanCursor() { reset(); }
+
+  void reset() {
+    for ( sqlite3_value*& arg : args ) {
+      sqlite3_value_free( arg );
+      arg = nullptr;
+    }
+    if ( scan ) {
+      scan->stop = true;
+      for ( std::thread& t : scan->workers ) {
+        t.join();
+      }
+      scan->workers.clear();
+#ifndef BOLTON_NO_STATS
+      stats->bytes += scan->bytes;
+#endif
+      scan.reset();
+    }
+    rowids.clear();
+    eof = true;
+  }
+
+  // Moves to the next matching rowid, waiting for its shard if need be, or sets eof
+  int advance( sqlite3* db, char** zErrMsg ) {
+#ifndef BOLTON_NO_STATS
+    StatTimer timer( stats );
+#endif
+    while ( pos == rowids.size() ) {
+      if ( taken == scan->shards.size() ) {
+        eof = true;
+        return SQLITE_OK;
+      }
+      std::unique_lock< std::mutex > lock( scan->mutex );
+      while ( scan->rc == SQLITE_OK && !( ordered ? scan->shards[ taken ].done : scan->finished.size() > taken ) ) {
+        if ( kInterruptPoll && kInterruptPoll( db ) ) {
+          return SQLITE_INTERRUPT; // The workers see it too
+        }
+        scan->ready.wait_for( lock, std::chrono::milliseconds( 10 ) );
+      }
+      if ( scan->rc != SQLITE_OK ) {
+        *zErrMsg = sqlite3_mprintf( "%s", scan->error.c_str() );
+        return scan->rc;
+      }
+      rowids.swap( scan->shards[ ordered ? taken : scan->finished[ taken ] ].rowids );
+      ++taken;
+      pos = 0;
+    }
+    rowid = rowids[ pos++ ];
+    return SQLITE_OK;
+  }
+};
+
+static int regexp_scan_connect( sqlite3* db, void* pAux, int, const char* const*, sqlite3_vtab** ppVtab, char** ) {
+  int rc = sqlite3_declare_vtab( db, "CREATE TABLE x( id INTEGER, \"table\" HIDDEN, \"column\" HIDDEN, pattern HIDDEN, flags HIDDEN )" );
+  if ( rc != SQLITE_OK ) {
+    return rc;
+  }
+  RegexScanVtab* vtab = new ( std::nothrow ) RegexScanVtab();
+  if ( !vtab ) {
+    return SQLITE_NOMEM;
+  }
+  vtab->db   = db;
+  vtab->conn = *static_cast< BoltOnConnectionPtr* >( pAux );
+  sqlite3_vtab_config( db, SQLITE_VTAB_DIRECTONLY ); // Opens connections and threads: never from a schema the user did not write
+  *ppVtab = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int regexp_scan_disconnect( sqlite3_vtab* pVtab ) {
+  delete reinterpret_cast< RegexScanVtab* >( pVtab );
+  return SQLITE_OK;
+}
+
+// table, column and pattern are required, flags optional. idxNum bit 0 is set when flags is given, bit 1 when the
+// rows are to come back in rowid order, which the scan then provides instead of a sort.
+static int regexp_scan_best( sqlite3_vtab* pVtab, sqlite3_index_info* info ) {
+  int found = 0;
+  for ( int i = 0; i < info->nConstraint; ++i ) {
+    const auto& c   = info->aConstraint[ i ];
+    int         arg = c.iColumn - kScanTable;
+    if ( arg >= 0 && c.op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+      if ( !c.usable ) {
+        return SQLITE_CONSTRAINT;
+      }
+      info->aConstraintUsage[ i ].argvIndex = arg + 1;
+      info->aConstraintUsage[ i ].omit      = 1;
+      found |= 1 << arg;
+    }
+  }
+  if ( ( found & 7 ) != 7 ) {
+    pVtab->zErrMsg = sqlite3_mprintf( "regexp_scan() requires a table, a column and a pattern: ( table, column, pattern [, flags] )" );
+    return SQLITE_ERROR;
+  }
+  info->idxNum = found == 15;
+  if ( info->nOrderBy == 1 && ( info->aOrderBy[ 0 ].iColumn == kScanId || info->aOrderBy[ 0 ].iColumn == -1 ) && !info->aOrderBy[ 0 ].desc ) {
+    info->idxNum |= 2;
+    info->orderByConsumed = 1;
+  }
+  info->estimatedCost = 1e6;
+  info->estimatedRows = 1000;
+  return SQLITE_OK;
+}
+
+static int regexp_scan_open( sqlite3_vtab*, sqlite3_vtab_cursor** ppCursor ) {
+  RegexScanCursor* cur = new ( std::nothrow ) RegexScanCursor();
+  if ( !cur ) {
+    return SQLITE_NOMEM;
+  }
+  *ppCursor = &cur->base;
+  return SQLITE_OK;
+}
+
+static int regexp_scan_close( sqlite3_vtab_cursor* pCursor ) {
+  delete reinterpret_cast< RegexScanCursor* >( pCursor );
+  return SQLITE_OK;
+}
+
+static int regexp_scan_filter( sqlite3_vtab_cursor* pCursor, int idxNum, const char*, int argc, sqlite3_value** argv ) {
+  RegexScanCursor* cur  = reinterpret_cast< RegexScanCursor* >( pCursor );
+  RegexScanVtab*   vtab = reinterpret_cast< RegexScanVtab* >( pCursor->pVtab );
+  cur->reset();
+  for ( int i = 0; i < argc; ++i ) {
+    cur->args[ i ] = sqlite3_value_dup( argv[ i ] );
+    if ( !cur->args[ i ] ) {
+      return SQLITE_NOMEM;
+    }
+  }
+  const char* table   = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  const char* column  = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 1 ] ) );
+  const char* pattern = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 2 ] ) );
+  const char* flags   = ( idxNum & 1 ) ? reinterpret_cast< const char* >( sqlite3_value_text( argv[ 3 ] ) ) : nullptr;
+  if ( !table || !column || !pattern ) {
+    return SQLITE_OK;
+  }
+  BoltOnConnection* conn = vtab->conn.get();
+#ifndef BOLTON_NO_STATS
+  BoltOnStats& st = conn->stats[ kStatRegexpScan ];
+  ++st.calls;
+  ++st.samples;
+  cur->stats    = &st;
+  conn->current = &st;
+#endif
+  sqlite3_stmt* stmt = nullptr;
+  try {
+    const char* error = nullptr;
+    bool        valid = cached_pattern( conn, std::string_view( pattern, sqlite3_value_bytes( argv[ 2 ] ) ), flags, &error ) != nullptr; // Fails here rather than in every worker
+#ifndef BOLTON_NO_STATS
+    conn->current = nullptr;
+#endif
+    if ( !valid ) {
+      pCursor->pVtab->zErrMsg = sqlite3_mprintf( "%s", error );
+      return SQLITE_ERROR;
+    }
+    std::unique_ptr< RegexScan > scan( new RegexScan() );
+    scan->table.assign( table, sqlite3_value_bytes( argv[ 0 ] ) );
+    scan->column.assign( column, sqlite3_value_bytes( argv[ 1 ] ) );
+    scan->pattern.assign( pattern, sqlite3_value_bytes( argv[ 2 ] ) );
+    scan->hasFlags = flags != nullptr;
+    scan->flags    = flags ? flags : "";
+    scan->budgetUs = conn->regexBudgetUs;
+    scan->caller   = vtab->db;
+
+    // Also checks, before any worker starts, that the table is a rowid table with that column
+    char* sql = scan_rows_sql( *scan );
+    int   rc  = sql ? sqlite3_prepare_v2( vtab->db, sql, -1, &stmt, nullptr ) : SQLITE_NOMEM;
+    sqlite3_free( sql );
+    sqlite3_finalize( stmt );
+    stmt = nullptr;
+    if ( rc == SQLITE_OK ) {
+      sql = sqlite3_mprintf( "SELECT min( rowid ), max( rowid ), ( SELECT encoding = 'UTF-8' FROM pragma_encoding ) FROM main.\"%w\"", scan->table.c_str() );
+      rc  = sql ? sqlite3_prepare_v2( vtab->db, sql, -1, &stmt, nullptr ) : SQLITE_NOMEM;
+      sqlite3_free( sql );
+    }
+    if ( rc == SQLITE_OK && sqlite3_step( stmt ) != SQLITE_ROW ) {
+      rc = sqlite3_errcode( vtab->db );
+    }
+    if ( rc != SQLITE_OK ) {
+      pCursor->pVtab->zErrMsg = sqlite3_mprintf( "regexp_scan: %s", sqlite3_errmsg( vtab->db ) );
+      sqlite3_finalize( stmt );
+      return rc;
+    }
+    if ( !sqlite3_column_int( stmt, 2 ) ) {
+      pCursor->pVtab->zErrMsg = sqlite3_mprintf( "regexp_scan() reads values as stored and needs a UTF-8 database" );
+      sqlite3_finalize( stmt );
+      return SQLITE_ERROR;
+    }
+    bool          empty = sqlite3_column_type( stmt, 0 ) == SQLITE_NULL;
+    sqlite3_int64 lo    = sqlite3_column_int64( stmt, 0 );
+    sqlite3_int64 hi    = sqlite3_column_int64( stmt, 1 );
+    sqlite3_finalize( stmt );
+    stmt = nullptr;
+
+    const char* file    = sqlite3_db_filename( vtab->db, "main" );
+    size_t      threads = conn->scanThreads ? static_cast< size_t >( conn->scanThreads ) : std::max( std::thread::hardware_concurrency(), 1u );
+    if ( !file || !*file || !sqlite3_threadsafe() ) {
+      threads = 0; // Nothing another connection could open, or a library built without threads
+    } else {
+      scan->file = file;
+    }
+    if ( !empty ) {
+      uint64_t span = static_cast< uint64_t >( hi ) - static_cast< uint64_t >( lo ) + 1; // 0 for the whole int64 range
+      uint64_t n    = std::max< uint64_t >( threads, 1 ) * kScanShardsPerWorker;
+      if ( span && span < n ) {
+        n = span;
+      }
+      uint64_t step = span ? span / n : UINT64_MAX / n;
+      uint64_t rem  = span ? span % n : UINT64_MAX % n + 1;
+      uint64_t at   = static_cast< uint64_t >( lo );
+      for ( uint64_t i = 0; i < n; ++i ) {
+        uint64_t size = step + ( i < rem );
+        scan->shards.push_back( { static_cast< sqlite3_int64 >( at ), static_cast< sqlite3_int64 >( at + size - 1 ), {} } );
+        at += size;
+      }
+    }
+
+    cur->scan    = std::move( scan );
+    cur->ordered = ( idxNum & 2 ) != 0;
+    cur->pos = cur->taken = 0;
+    cur->eof              = false;
+    if ( threads == 0 ) {
+      regexp_scan_work( cur->scan.get(), vtab->db );
+    } else {
+      threads = std::min( threads, cur->scan->shards.size() );
+      for ( size_t i = 0; i < threads; ++i ) {
+        cur->scan->workers.emplace_back( &regexp_scan_work, cur->scan.get(), nullptr );
+      }
+    }
+    return cur->advance( vtab->db, &pCursor->pVtab->zErrMsg );
+  } catch ( std::bad_alloc& ) {
+    sqlite3_finalize( stmt );
+    return SQLITE_NOMEM;
+  } catch ( std::exception& e ) { // Thread creation failed; workers already started are joined on reset
+    pCursor->pVtab->zErrMsg = sqlite3_mprintf( "regexp_scan: %s", e.what() );
+    return SQLITE_ERROR;
+  }
+}
+
+static int regexp_scan_next( sqlite3_vtab_cursor* pCursor ) {
+  return reinterpret_cast< RegexScanCursor* >( pCursor )->advance( reinterpret_cast< RegexScanVtab* >( pCursor->pVtab )->db, &pCursor->pVtab->zErrMsg );
+}
+
+static int regexp_scan_eof( sqlite3_vtab_cursor* pCursor ) { return reinterpret_cast< RegexScanCursor* >( pCursor )->eof; }
+
+static int regexp_scan_column( sqlite3_vtab_cursor* pCursor, sqlite3_context* context, int i ) {
+  RegexScanCursor* cur = reinterpret_cast< RegexScanCursor* >( pCursor );
+  if ( i == kScanId ) {
+    sqlite3_result_int64( context, cur->rowid );
+  } else if ( cur->args[ i - kScanTable ] ) {
+    sqlite3_result_value( context, cur->args[ i - kScanTable ] );
+  }
+  return SQLITE_OK;
+}
+
+static int regexp_scan_rowid( sqlite3_vtab_cursor* pCursor, sqlite3_int64* pRowid ) {
+  *pRowid = reinterpret_cast< RegexScanCursor* >( pCursor )->rowid;
+  return SQLITE_OK;
+}
+
+static sqlite3_module regexp_scan_module = {
+  0,       // iVersion
+  nullptr, // xCreate: eponymous only, used as a table-valued function
+  &regexp_scan_connect,
+  &regexp_scan_best,
+  &regexp_scan_disconnect,
+  nullptr, // xDestroy
+  &regexp_scan_open,
+  &regexp_scan_close,
+  &regexp_scan_filter,
+  &regexp_scan_next,
+  &regexp_scan_eof,
+  &regexp_scan_column,
+  &regexp_scan_rowid,
+};
+
+#ifndef BOLTON_NO_STATS
+
+// Counts one call of Fn, whose searched value is argv[ ValueArg ] (-1 for none), and times it if it is the sampled one
+template < BoltOnStat Id, int ValueArg, void ( *Fn )( sqlite3_context*, int, sqlite3_value** ) >
+static void counted( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  BoltOnConnection* conn = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) )->get();
+  BoltOnStats&      st   = conn->stats[ Id ];
+  if ( ValueArg >= 0 ) { // Otherwise Fn counts the bytes it reads
+    st.bytes += static_cast< uint64_t >( sqlite3_value_bytes( argv[ ValueArg ] ) );
+  }
+  conn->current = &st;
+  if ( ( st.calls++ & ( kStatSample - 1 ) ) == 0 ) {
+    StatTimer timer( &st );
+    ++st.samples;
+    Fn( context, argc, argv );
+  } else {
+    Fn( context, argc, argv );
+  }
+  conn->current = nullptr;
+}
+
+#define BOLTON_ENTRY( id, valueArg, fn ) &counted< id, valueArg, &fn >
+
+/* boltOn_stats(): one row per counted function on this connection, followed by the rows of levenshtein_stats()
+* when the Levenshtein extension is loaded too, so one query covers both.
+*
+*   SELECT * FROM boltOn_stats();
+*   SELECT boltOn_stats_reset();
+*
+* Columns: function, calls, bytes, cache_hits, cache_misses, early_exits, nanoseconds, memo_hits, memo_misses.
+* early_exits is NULL for the regex functions, which take no bound, and the memo columns for functions without a
+* memo (see memo_slots). nanoseconds is estimated from the sampled calls.
+*/
+static const int kStatsValues = 8; // The columns after function
+
+struct BoltOnStatsRow {
+  std::string   function;
+  sqlite3_int64 values[ kStatsValues ];
+  bool          present[ kStatsValues ];
+};
+
+struct BoltOnStatsVtab {
+  sqlite3_vtab        base;
+  sqlite3*            db;
+  BoltOnConnectionPtr conn;
+};
+
+struct BoltOnStatsCursor {
+  sqlite3_vtab_cursor           base;
+  std::vector< BoltOnStatsRow > rows;
+  size_t                        row = 0;
+};
+
+static int bolton_stats_connect( sqlite3* db, void* pAux, int, const char* const*, sqlite3_vtab** ppVtab, char** ) {
+  int rc = sqlite3_declare_vtab( db, "CREATE TABLE x( function TEXT, calls INTEGER, bytes INTEGER, cache_hits INTEGER, cache_misses INTEGER, early_exits INTEGER, nanoseconds INTEGER, memo_hits INTEGER, memo_misses INTEGER )" );
+  if ( rc != SQLITE_OK ) {
+    return rc;
+  }
+  BoltOnStatsVtab* vtab = new ( std::nothrow ) BoltOnStatsVtab();
+  if ( !vtab ) {
+    return SQLITE_NOMEM;
+  }
+  vtab->db   = db;
+  vtab->conn = *static_cast< BoltOnConnectionPtr* >( pAux );
+  *ppVtab    = &vtab->base;
+  return SQLITE_OK;
+}
+
+static int bolton_stats_disconnect( sqlite3_vtab* pVtab ) {
+  delete reinterpret_cast< BoltOnStatsVtab* >( pVtab );
+  return SQLITE_OK;
+}
+
+static int bolton_stats_best( sqlite3_vtab*, sqlite3_index_info* info ) {
+  info->estimatedCost = 20;
+  info->estimatedRows = 20;
+  return SQLITE_OK;
+}
+
+static int bolton_stats_open( sqlite3_vtab*, sqlite3_vtab_cursor** ppCursor ) {
+  BoltOnStatsCursor* cur = new ( std::nothrow ) BoltOnStatsCursor();
+  if ( !cur ) {
+    return SQLITE_NOMEM;
+  }
+  *ppCursor = &cur->base;
+  return SQLITE_OK;
+}
+
+static int bolton_stats_close( sqlite3_vtab_cursor* pCursor ) {
+  delete reinterpret_cast< BoltOnStatsCursor* >( pCursor );
+  return SQLITE_OK;
+}
+
+// Takes a snapshot, so the counters of the functions this query itself runs do not shift under it
+static int bolton_stats_filter( sqlite3_vtab_cursor* pCursor, int, const char*, int, sqlite3_value** ) {
+  BoltOnStatsCursor* cur  = reinterpret_cast< BoltOnStatsCursor* >( pCursor );
+  BoltOnStatsVtab*   vtab = reinterpret_cast< BoltOnStatsVtab* >( pCursor->pVtab );
+  BoltOnConnection*  conn = vtab->conn.get();
+  try {
+    cur->rows.clear();
+    cur->row          = 0;
+    uint64_t ticks    = stat_ticks() - conn->tick0;
+    double   elapsed  = std::chrono::duration< double, std::nano >( std::chrono::steady_clock::now() - conn->time0 ).count();
+    double   nsByTick = ticks ? elapsed / static_cast< double >( ticks ) : 0.0;
+    for ( int i = 0; i < kStatCount; ++i ) {
+      const BoltOnStats& st = conn->stats[ i ];
+      double             ns = st.samples ? static_cast< double >( st.ticks ) * nsByTick * static_cast< double >( st.calls ) / static_cast< double >( st.samples ) : 0.0;
+      cur->rows.push_back( { kStatNames[ i ],
+                             { static_cast< sqlite3_int64 >( st.calls ), static_cast< sqlite3_int64 >( st.bytes ), static_cast< sqlite3_int64 >( st.cacheHits ),
+                               static_cast< sqlite3_int64 >( st.cacheMisses ), 0, static_cast< sqlite3_int64 >( ns ), static_cast< sqlite3_int64 >( st.memoHits ),
+                               static_cast< sqlite3_int64 >( st.memoMisses ) },
+                             { true, true, true, true, false, true, kStatMemoized[ i ], kStatMemoized[ i ] } } );
+    }
+    sqlite3_stmt* stmt = nullptr;
+    if ( sqlite3_prepare_v2( vtab->db, "SELECT * FROM levenshtein_stats()", -1, &stmt, nullptr ) == SQLITE_OK ) { // Absent unless that extension is loaded
+      while ( sqlite3_step( stmt ) == SQLITE_ROW ) {
+        BoltOnStatsRow row;
+        row.function.assign( reinterpret_cast< const char* >( sqlite3_column_text( stmt, 0 ) ), sqlite3_column_bytes( stmt, 0 ) );
+        for ( int c = 0; c < kStatsValues; ++c ) { // Columns an older build lacks read as NULL
+          row.present[ c ] = sqlite3_column_type( stmt, c + 1 ) != SQLITE_NULL;
+          row.values[ c ]  = sqlite3_column_int64( stmt, c + 1 );
+        }
+        cur->rows.push_back( std::move( row ) );
+      }
+    }
+    sqlite3_finalize( stmt );
+  } catch ( std::bad_alloc& ) { return SQLITE_NOMEM; }
+  return SQLITE_OK;
+}
+
+static int bolton_stats_next( sqlite3_vtab_cursor* pCursor ) {
+  ++reinterpret_cast< BoltOnStatsCursor* >( pCursor )->row;
+  return SQLITE_OK;
+}
+
+static int bolton_stats_eof( sqlite3_vtab_cursor* pCursor ) {
+  BoltOnStatsCursor* cur = reinterpret_cast< BoltOnStatsCursor* >( pCursor );
+  return cur->row >= cur->rows.size();
+}
+
+static int bolton_stats_column( sqlite3_vtab_cursor* pCursor, sqlite3_context* context, int i ) {
+  BoltOnStatsCursor*    cur = reinterpret_cast< BoltOnStatsCursor* >( pCursor );
+  const BoltOnStatsRow& row = cur->rows[ cur->row ];
+  if ( i == 0 ) {
+    sqlite3_result_text( context, row.function.c_str(), static_cast< int >( row.function.size() ), SQLITE_TRANSIENT );
+  } else if ( row.present[ i - 1 ] ) {
+    sqlite3_result_int64( context, row.values[ i - 1 ] );
+  }
+  return SQLITE_OK;
+}
+
+static int bolton_stats_rowid( sqlite3_vtab_cursor* pCursor, sqlite3_int64* pRowid ) {
+  *pRowid = static_cast< sqlite3_int64 >( reinterpret_cast< BoltOnStatsCursor* >( pCursor )->row ) + 1;
+  return SQLITE_OK;
+}
+
+static sqlite3_module bolton_stats_module = {
+  0,       // iVersion
+  nullptr, // xCreate: eponymous only, used as a table-valued function
+  &bolton_stats_connect,
+  &bolton_stats_best,
+  &bolton_stats_disconnect,
+  nullptr, // xDestroy
+  &bolton_stats_open,
+  &bolton_stats_close,
+  &bolton_stats_filter,
+  &bolton_stats_next,
+  &bolton_stats_eof,
+  &bolton_stats_column,
+  &bolton_stats_rowid,
+};
+
+// Zeroes this connection's counters, and the Levenshtein extension's when it is loaded. The clock reference is kept.
+static void bolton_stats_reset_func( sqlite3_context* context, int, sqlite3_value** ) {
+  BoltOnConnection* conn = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) )->get();
+  for ( BoltOnStats& st : conn->stats ) {
+    st = BoltOnStats();
+  }
+  sqlite3_stmt* stmt = nullptr;
+  if ( sqlite3_prepare_v2( sqlite3_context_db_handle( context ), "SELECT levenshtein_stats_reset()", -1, &stmt, nullptr ) == SQLITE_OK ) {
+    sqlite3_step( stmt );
+  }
+  sqlite3_finalize( stmt );
+  sqlite3_result_null( context );
+}
+
+#else
+
+#define BOLTON_ENTRY( id, valueArg, fn ) &fn
+
+#endif
+
+/* boltOn_config( name [, value] ): reads a per-connection setting, or sets it and returns the new value.
+*
+*   SELECT boltOn_config( 'regex_budget_us', 50000 );
+*
+*   regex_budget_us   time limit, in microseconds, on the matching done by each regex call (each row of
+*                     regex_matches() and regexp_scan()); over it the call fails with "Regex match exceeded
+*                     regex_budget_us". 0, the default, is no limit. See RegexBudget for how closely each engine
+*                     keeps to it.
+*   scan_threads      worker threads, each with its own connection, for each regexp_scan(). 0, the default, is one
+*                     per core.
+*   memo_slots        results of regexp(), regex_replace() and regex_extract() remembered per statement, so repeated
+*                     arguments are not matched again (see ResultMemo). 0, the default, is no memo.
+*/
+static const struct {
+  const char* name;
+  uint64_t BoltOnConnection::*field;
+  uint64_t                    max;
+} kBoltOnSettings[] = {
+  { "regex_budget_us", &BoltOnConnection::regexBudgetUs, 3600000000ull }, // An hour, well inside steady_clock's range
+  { "scan_threads", &BoltOnConnection::scanThreads, 256 },
+  { "memo_slots", &BoltOnConnection::memoSlots, 65536 }, // About 6 MB of slots per statement at most
+};
+
+static void bolton_config_func( sqlite3_context* context, int argc, sqlite3_value** argv ) {
+  BoltOnConnection* conn = static_cast< BoltOnConnectionPtr* >( sqlite3_user_data( context ) )->get();
+  const char*       name = reinterpret_cast< const char* >( sqlite3_value_text( argv[ 0 ] ) );
+  for ( const auto& setting : kBoltOnSettings ) {
+    if ( !name || sqlite3_stricmp( name, setting.name ) != 0 ) {
+      continue;
+    }
+    if ( argc == 2 ) {
+      sqlite3_int64 value = sqlite3_value_int64( argv[ 1 ] );
+      if ( sqlite3_value_numeric_type( argv[ 1 ] ) != SQLITE_INTEGER || value < 0 || static_cast< uint64_t >( value ) > setting.max ) {
+        char* msg = sqlite3_mprintf( "boltOn_config: %s must be an integer from 0 to %llu", setting.name, static_cast< unsigned long long >( setting.max ) );
+        sqlite3_result_error( context, msg ? msg : "boltOn_config: value out of range", -1 );
+        sqlite3_free( msg );
+        return;
+      }
+      conn->*setting.field = static_cast< uint64_t >( value );
+    }
+    sqlite3_result_int64( context, static_cast< sqlite3_int64 >( conn->*setting.field ) );
+    return;
+  }
+  char* msg = sqlite3_mprintf( "boltOn_config: unknown setting '%s'", name ? name : "" );
+  sqlite3_result_error( context, msg ? msg : "boltOn_config: unknown setting", -1 );
+  sqlite3_free( msg );
+}
 
+// Every arity each function accepts. SQLITE_INNOCUOUS lets them run in views, triggers and CHECK constraints
+// with trusted_schema off; none of them has side effects.
+static const struct {
+  const char* name;
+  int         nargs;
+  void ( *fn )( sqlite3_context*, int, sqlite3_value** );
+} kBoltOnFunctions[] = {
+  { "regexp", 2, BOLTON_ENTRY( kStatRegexp, 1, memoized< regexp_func > ) },
+  { "regexp", 3, BOLTON_ENTRY( kStatRegexp, 1, memoized< regexp_func > ) },
+  { "regex_replace", 3, BOLTON_ENTRY( kStatRegexReplace, 0, memoized< regex_replace_func > ) },
+  { "regex_replace", 4, BOLTON_ENTRY( kStatRegexReplace, 0, memoized< regex_replace_func > ) },
+  { "regexp_any", 2, BOLTON_ENTRY( kStatRegexpAny, 0, regexp_any_func ) },
+  { "regexp_any", 3, BOLTON_ENTRY( kStatRegexpAny, 0, regexp_any_func ) },
+  { "regexp_which", 2, BOLTON_ENTRY( kStatRegexpWhich, 0, regexp_which_func ) },
+  { "regexp_which", 3, BOLTON_ENTRY( kStatRegexpWhich, 0, regexp_which_func ) },
+  { "regex_extract", 2, BOLTON_ENTRY( kStatRegexExtract, 0, memoized< regex_extract_func > ) },
+  { "regex_extract", 3, BOLTON_ENTRY( kStatRegexExtract, 0, memoized< regex_extract_func > ) },
+  { "regex_extract", 4, BOLTON_ENTRY( kStatRegexExtract, 0, memoized< regex_extract_func > ) },
+};
+
+int registerSqlLiteBoltOnFunctions( sqlite3* db ) { // This function registers the custom SQL functions with SQLite
+  BoltOnConnectionPtr conn;
   try {
-    std::regex  re( patternStr, mode );
-    std::string result = std::regex_replace( src, re, replacement );
-    sqlite3_result_text( context, result.c_str(), -1, SQLITE_TRANSIENT );
-  } catch ( std::regex_error& ) { sqlite3_result_error( context, "Invalid regex", -1 ); }
+    conn = std::make_shared< BoltOnConnection >();
+  } catch ( std::bad_alloc& ) { return SQLITE_NOMEM; }
+  // Each registration holds its own reference, so the shared connection state outlives whichever function is dropped first.
+  // sqlite3_create_function_v2() runs the destructor itself when registration fails.
+  for ( const auto& f : kBoltOnFunctions ) {
+    int rc = sqlite3_create_function_v2( db, f.name, f.nargs, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, new BoltOnConnectionPtr( conn ), f.fn, nullptr, nullptr,
+                                         &destroy_connection_ref );
+    if ( rc != SQLITE_OK ) {
+      return rc;
+    }
+  }
+  // Changes connection state, so only from top-level SQL: never from a view, trigger or schema the user did not write
+  for ( int nargs = 1; nargs <= 2; ++nargs ) {
+    int rc = sqlite3_create_function_v2( db, "boltOn_config", nargs, SQLITE_UTF8 | SQLITE_DIRECTONLY, new BoltOnConnectionPtr( conn ), &bolton_config_func, nullptr,
+                                         nullptr, &destroy_connection_ref );
+    if ( rc != SQLITE_OK ) {
+      return rc;
+    }
+  }
+  // Reads the table it is named, and what is in it changes, so neither deterministic nor allowed in a schema
+  for ( int nargs = 4; nargs <= 5; ++nargs ) {
+    int rc = sqlite3_create_function_v2( db, "regexp_blob", nargs, SQLITE_UTF8 | SQLITE_DIRECTONLY, new BoltOnConnectionPtr( conn ),
+                                         BOLTON_ENTRY( kStatRegexpBlob, -1, regexp_blob_func ), nullptr, nullptr, &destroy_connection_ref );
+    if ( rc != SQLITE_OK ) {
+      return rc;
+    }
+  }
+  int rc = SQLITE_OK;
+#ifndef BOLTON_NO_STATS
+  // Clears every counter on the connection, so like boltOn_config() only from top-level SQL
+  rc = sqlite3_create_function_v2( db, "boltOn_stats_reset", 0, SQLITE_UTF8 | SQLITE_DIRECTONLY, new BoltOnConnectionPtr( conn ), &bolton_stats_reset_func, nullptr, nullptr,
+                                   &destroy_connection_ref );
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module_v2( db, "boltOn_stats", &bolton_stats_module, new BoltOnConnectionPtr( conn ), &destroy_connection_ref );
+  }
+  if ( rc != SQLITE_OK ) {
+    return rc;
+  }
+#endif
+  rc = sqlite3_create_module_v2( db, "regex_matches", &regex_matches_module, new BoltOnConnectionPtr( conn ), &destroy_connection_ref );
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_create_module_v2( db, "regexp_scan", &regexp_scan_module, new BoltOnConnectionPtr( conn ), &destroy_connection_ref );
+  }
+  return rc;
 }
 
-void registerSqlLiteBoltOnFunctions(sqlite3 * db) { // This function registers the custom SQL functions with SQLite
-  sqlite3_create_function( db, "regexp", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, &regexp_func, nullptr, nullptr );
-  sqlite3_create_function( db, "regex_replace", 4, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, &regex_replace_func, nullptr, nullptr );
+#ifdef BOLTON_LOADABLE_EXTENSION
+
+// Entry points for .load ./bolton and Python's conn.load_extension( './bolton' ).
+extern "C" {
+
+#ifdef _WIN32
+__declspec( dllexport )
+#endif
+int sqlite3_bolton_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi ) {
+  SQLITE_EXTENSION_INIT2( pApi );
+  return registerSqlLiteBoltOnFunctions( db );
 }
 
+#ifndef BOLTON_BUNDLED
+#ifdef _WIN32
+__declspec( dllexport )
+#endif
+int sqlite3_extension_init( sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi ) {
+  return sqlite3_bolton_init( db, pzErrMsg, pApi );
+}
+#endif
+
+}
+
+#endif
+
+// regex_replace() over a small table against known results. Returns the number of rows that came out wrong, so the
+// test driver (sqliteBoltOnTest.cpp) can fail on it; each wrong row is written to std::cerr.
 int sqlLiteBoltOnRegexReplaceTest() {
   sqlite3* db;
   if ( sqlite3_open( ":memory:", &db ) != SQLITE_OK ) { std::cerr << "Failed to open database\n"; return 1; }
   registerSqlLiteBoltOnFunctions( db );
   const char* setup = R"(
-        CREATE TABLE test (val TEXT);
-        INSERT INTO test (val) VALUES ('Apple pie'), ('banana'), ('Cherry Pepper');
+        CREATE TABLE test (val TEXT, expected TEXT);
+        INSERT INTO test (val, expected) VALUES ('Apple pie', 'APle Pie'), ('banana', 'banana'), ('Cherry Pepper', 'Cherry PePer');
     )";
   sqlite3_exec( db, setup, nullptr, nullptr, nullptr );
 
-  const char*   query = "SELECT val, regex_replace(val, 'p+', 'P', 'i') FROM test;";
-  sqlite3_stmt* stmt  = nullptr;
+  const char*   query  = "SELECT val, regex_replace(val, 'p+', 'P', 'i'), expected FROM test;";
+  sqlite3_stmt* stmt   = nullptr;
+  int           wrong  = 0;
+  int           rows   = 0;
   if ( sqlite3_prepare_v2( db, query, -1, &stmt, nullptr ) == SQLITE_OK ) {
-    std::cout << "Original | Replaced\n---------------------\n";
     while ( sqlite3_step( stmt ) == SQLITE_ROW ) {
-      std::cout << sqlite3_column_text( stmt, 0 ) << " | " << sqlite3_column_text( stmt, 1 ) << "\n";
+      ++rows;
+      const char* replaced = reinterpret_cast< const char* >( sqlite3_column_text( stmt, 1 ) );
+      const char* expected = reinterpret_cast< const char* >( sqlite3_column_text( stmt, 2 ) );
+      if ( !replaced || std::string( replaced ) != expected ) {
+        std::cerr << "regex_replace( '" << sqlite3_column_text( stmt, 0 ) << "', 'p+', 'P', 'i' ) gave " << ( replaced ? replaced : "NULL" )
+                  << ", expected " << expected << "\n";
+        ++wrong;
+      }
     }
     sqlite3_finalize( stmt );
+  } else {
+    std::cerr << "regex_replace test: " << sqlite3_errmsg( db ) << "\n";
+    wrong = 1;
   }
 
   sqlite3_close( db );
-  return 0;
+  return rows == 3 ? wrong : wrong + 1;
 }
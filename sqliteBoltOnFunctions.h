@@ -3,6 +3,10 @@
 #ifndef SQLLITEBOLTONFUNCTIONS_H
 #define SQLLITEBOLTONFUNCTIONS_H
 
-void registerSqlLiteBoltOnFunctions( sqlite3* db );
+// Registers the bolt-on functions on db. Returns SQLITE_OK or the first registration error.
+int registerSqlLiteBoltOnFunctions( sqlite3* db );
+
+// Runs regex_replace() over a small table and checks the results. Returns 0 when they are all as expected.
+int sqlLiteBoltOnRegexReplaceTest();
 
 #endif // SQLLITEBOLTONFUNCTIONS_H
@@ -0,0 +1,1328 @@
+/* Regex engine backends for sqliteBoltOnFunctions.cpp. See sqliteBoltOnRegexEngine.h for how one is selected.
+*
+* Documented functions:
+   std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error );
+   std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error );
+   bool regex_replace_all( const RegexEngine& re, const char* data, size_t len, const char* fmt, size_t fmtLen, TextSink& out );
+   size_t regex_match_reach( const std::string& pattern, const RegexFlags& flags );
+   std::unique_ptr< RegexStream > open_regex_stream( const RegexEngine& re, size_t reach );
+   RegexBudget::RegexBudget( uint64_t budgetUs, Poll interrupted, void* arg );
+   const char* regex_engine_name();
+
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <regex>
+#include <stdexcept>
+#include "sqliteBoltOnRegexEngine.h"
+
+#if defined( BOLTON_REGEX_PCRE2 )
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+#elif defined( BOLTON_REGEX_RE2 )
+#include <re2/re2.h>
+#include <re2/set.h>
+#elif defined( BOLTON_REGEX_HYPERSCAN )
+#include <hs/hs.h>
+#endif
+
+thread_local RegexBudget* RegexBudget::current_ = nullptr;
+
+RegexBudget::RegexBudget( uint64_t budgetUs, Poll interrupted, void* arg )
+  : outer_( current_ ), budgetUs_( budgetUs ), interrupted_( interrupted ), arg_( arg ), armed_( budgetUs || interrupted ) {
+  if ( armed_ ) {
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds( budgetUs );
+    current_  = this;
+  }
+}
+
+RegexBudget::~RegexBudget() {
+  if ( armed_ ) {
+    current_ = outer_;
+  }
+}
+
+void RegexBudget::check_now() const {
+  if ( interrupted_ && interrupted_( arg_ ) ) {
+    throw RegexBudgetExceeded( "Regex match interrupted", true );
+  }
+  if ( budgetUs_ && std::chrono::steady_clock::now() > deadline_ ) {
+    throw RegexBudgetExceeded( "Regex match exceeded regex_budget_us (" + std::to_string( budgetUs_ ) + " us)", false );
+  }
+}
+
+uint64_t RegexBudget::remaining_us() {
+  if ( !current_ || !current_->budgetUs_ ) {
+    return UINT64_MAX;
+  }
+  auto left = std::chrono::duration_cast< std::chrono::microseconds >( current_->deadline_ - std::chrono::steady_clock::now() ).count();
+  return left > 0 ? static_cast< uint64_t >( left ) : 0;
+}
+
+static bool is_ascii_alnum( unsigned char c ) { return ( c >= '0' && c <= '9' ) || ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ); }
+static unsigned char ascii_fold( unsigned char c ) { return ( c >= 'A' && c <= 'Z' ) ? static_cast< unsigned char >( c + 32 ) : c; }
+
+#if defined( BOLTON_REGEX_STD ) || defined( BOLTON_REGEX_HYPERSCAN )
+
+// Steps std::regex has taken on this thread, across calls, so many short matches are checked as often as one long one
+static thread_local uint32_t stdRegexSteps = 0;
+
+// Walks the text like a const char*, checking the budget in scope every 4096 moves of the matcher. std::regex has
+// no step limit or callback of its own; its backtracking executor moves its iterators for every step it takes.
+class BudgetIterator {
+public:
+  typedef std::bidirectional_iterator_tag iterator_category;
+  typedef char                            value_type;
+  typedef std::ptrdiff_t                  difference_type;
+  typedef const char*                     pointer;
+  typedef const char&                     reference;
+
+  BudgetIterator() = default;
+  explicit BudgetIterator( const char* p ) : p_( p ) {}
+
+  reference operator*() const { return *p_; }
+  BudgetIterator& operator++() {
+    ++p_;
+    step();
+    return *this;
+  }
+  BudgetIterator& operator--() {
+    --p_;
+    step();
+    return *this;
+  }
+  BudgetIterator operator++( int ) {
+    BudgetIterator before( *this );
+    ++*this;
+    return before;
+  }
+  BudgetIterator operator--( int ) {
+    BudgetIterator before( *this );
+    --*this;
+    return before;
+  }
+  bool operator==( const BudgetIterator& other ) const { return p_ == other.p_; }
+  bool operator!=( const BudgetIterator& other ) const { return p_ != other.p_; }
+
+  const char* base() const { return p_; }
+
+private:
+  static void step() {
+    if ( ( ++stdRegexSteps & 4095 ) == 0 ) {
+      RegexBudget::check();
+    }
+  }
+
+  const char* p_ = nullptr;
+};
+
+static const char* base( const char* p ) { return p; }
+static const char* base( const BudgetIterator& it ) { return it.base(); }
+
+// Case folding for 'i' as a compare on ASCII letters. std::regex_traits< char >::translate_nocase looks up the
+// locale's ctype facet for every character the matcher compares, which is most of the cost of a caseless scan.
+// Only used for ASCII patterns: those are the ones whose letters the C and UTF-8 locales fold the same way.
+struct AsciiFoldTraits : std::regex_traits< char > {
+  char translate_nocase( char c ) const { return static_cast< char >( ascii_fold( static_cast< unsigned char >( c ) ) ); }
+
+  // Backreferences compare the transforms of both sides when the traits are not std::regex_traits, so \1 is caseless
+  template < class It >
+  std::string transform( It first, It last ) const {
+    std::string s;
+    for ( ; first != last; ++first ) {
+      s.push_back( translate_nocase( *first ) );
+    }
+    return s;
+  }
+};
+
+// std::regex: the default engine, and the capture-group engine behind Hyperscan. Instantiated once
+// per traits type, so the caseless matcher inlines its folding instead of going through the locale.
+template < class Traits >
+class StdRegexEngine : public RegexEngine {
+public:
+  // Throws std::regex_error on a bad pattern. std::regex has no multiline here, as before.
+  StdRegexEngine( const std::string& pattern, const RegexFlags& flags )
+    : re_( flags.dotall ? dotall_pattern( pattern ) : pattern, flags.icase ? std::regex::ECMAScript | std::regex::icase : std::regex::ECMAScript ) {}
+
+  // Plain pointers unless a budget is in scope, which costs a step counter
+  bool search( const char* data, size_t len ) const override {
+    try {
+      if ( RegexBudget::active() ) {
+        RegexBudget::check();
+        return std::regex_search( BudgetIterator( data ), BudgetIterator( data + len ), re_ );
+      }
+      return std::regex_search( data, data + len, re_ );
+    } catch ( std::regex_error& ) { throw std::runtime_error( "Regex match exceeded std::regex limits" ); }
+  }
+
+  bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const override {
+    if ( RegexBudget::active() ) {
+      RegexBudget::check();
+      return find_in( BudgetIterator( data ), BudgetIterator( data + offset ), BudgetIterator( data + len ), offset, groups );
+    }
+    return find_in( data, data + offset, data + len, offset, groups );
+  }
+
+  size_t groupCount() const override { return re_.mark_count(); }
+
+private:
+  // ECMAScript has no dotall option: '.' outside a class becomes [\s\S], which matches every byte
+  static std::string dotall_pattern( const std::string& p ) {
+    std::string out;
+    bool        inClass = false;
+    for ( size_t i = 0; i < p.size(); ++i ) {
+      char c = p[ i ];
+      if ( c == '\\' && i + 1 < p.size() ) {
+        out  += c;
+        out  += p[ ++i ];
+        continue;
+      }
+      if ( c == '[' ) {
+        inClass = true;
+      } else if ( c == ']' ) {
+        inClass = false;
+      } else if ( c == '.' && !inClass ) {
+        out += "[\\s\\S]";
+        continue;
+      }
+      out += c;
+    }
+    return out;
+  }
+
+  template < class It >
+  bool find_in( It data, It first, It last, size_t offset, std::vector< RegexSpan >& groups ) const {
+    std::match_results< It >              m;
+    std::regex_constants::match_flag_type mf = offset ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+    try {
+      if ( !std::regex_search( first, last, m, re_, mf ) ) {
+        return false;
+      }
+    } catch ( std::regex_error& ) { throw std::runtime_error( "Regex match exceeded std::regex limits" ); }
+    groups.resize( m.size() );
+    for ( size_t i = 0; i < m.size(); ++i ) {
+      if ( m[ i ].matched ) {
+        groups[ i ] = { base( m[ i ].first ) - base( data ), base( m[ i ].second ) - base( data ) };
+      } else {
+        groups[ i ] = { -1, -1 };
+      }
+    }
+    return true;
+  }
+
+  std::basic_regex< char, Traits > re_;
+};
+
+static bool is_ascii( const std::string& p ) {
+  for ( unsigned char c : p ) {
+    if ( c >= 0x80 ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Throws std::regex_error on a bad pattern
+static std::unique_ptr< RegexEngine > std_regex_engine( const std::string& pattern, const RegexFlags& flags ) {
+  if ( flags.icase && is_ascii( pattern ) ) {
+    return std::unique_ptr< RegexEngine >( new StdRegexEngine< AsciiFoldTraits >( pattern, flags ) );
+  }
+  return std::unique_ptr< RegexEngine >( new StdRegexEngine< std::regex_traits< char > >( pattern, flags ) );
+}
+
+#endif
+
+// Skips a bracket expression starting at p[i] == '['. Returns the index after it, or npos if it cannot be
+// delimited the same way by every engine (a leading ']' is a member in PCRE2 and RE2 but ends ECMAScript classes).
+static size_t skip_class( const std::string& p, size_t i ) {
+  size_t n = p.size();
+  size_t j = i + 1;
+  if ( j < n && p[ j ] == '^' ) {
+    ++j;
+  }
+  if ( j < n && p[ j ] == ']' ) {
+    return std::string::npos;
+  }
+  while ( j < n && p[ j ] != ']' ) {
+    if ( p[ j ] == '\\' ) {
+      j += 2;
+    } else if ( p[ j ] == '[' && j + 1 < n && ( p[ j + 1 ] == ':' || p[ j + 1 ] == '=' || p[ j + 1 ] == '.' ) ) {
+      size_t close = p.find( std::string( 1, p[ j + 1 ] ) + "]", j + 2 ); // [:alpha:], [=a=], [.a.]
+      if ( close == std::string::npos ) {
+        return std::string::npos;
+      }
+      j = close + 2;
+    } else {
+      ++j;
+    }
+  }
+  return j < n ? j + 1 : std::string::npos;
+}
+
+// Skips a group starting at p[i] == '('. Returns the index after its ')', or npos.
+static size_t skip_group( const std::string& p, size_t i ) {
+  size_t n = p.size();
+  if ( p.compare( i, 3, "(?#" ) == 0 ) { // PCRE2 comment: no nesting, brackets are not special
+    size_t close = p.find( ')', i );
+    return close == std::string::npos ? close : close + 1;
+  }
+  int depth = 0;
+  while ( i < n ) {
+    char c = p[ i ];
+    if ( c == '\\' ) {
+      i += 2;
+      continue;
+    }
+    if ( c == '[' ) {
+      i = skip_class( p, i );
+      if ( i == std::string::npos ) {
+        return i;
+      }
+      continue;
+    }
+    if ( c == '(' ) {
+      ++depth;
+    } else if ( c == ')' && --depth == 0 ) {
+      return i + 1;
+    }
+    ++i;
+  }
+  return std::string::npos;
+}
+
+// Skips the arguments of an alphanumeric escape whose letter is at p[i], so \x41 or \p{L} is not read as literal text.
+static size_t skip_escape( const std::string& p, size_t i ) {
+  size_t n      = p.size();
+  char   letter = p[ i++ ];
+  auto   braced = [ & ]( char open, char close ) -> bool {
+    if ( i < n && p[ i ] == open ) {
+      size_t end = p.find( close, i );
+      i          = end == std::string::npos ? n : end + 1;
+      return true;
+    }
+    return false;
+  };
+  switch ( letter ) {
+    case 'x':
+    case 'u':
+    case 'o':
+      if ( !braced( '{', '}' ) ) {
+        for ( size_t k = 0; k < ( letter == 'u' ? 4u : 2u ) && i < n && isxdigit( static_cast< unsigned char >( p[ i ] ) ); ++k ) {
+          ++i;
+        }
+      }
+      break;
+    case 'c':
+      i = i < n ? i + 1 : i;
+      break;
+    case 'p':
+    case 'P':
+      if ( !braced( '{', '}' ) ) {
+        i = i < n ? i + 1 : i;
+      }
+      break;
+    case 'k':
+    case 'g':
+      if ( !braced( '{', '}' ) && !braced( '<', '>' ) && !braced( '\'', '\'' ) ) {
+        while ( i < n && ( p[ i ] == '-' || p[ i ] == '+' || ( p[ i ] >= '0' && p[ i ] <= '9' ) ) ) {
+          ++i;
+        }
+      }
+      break;
+    case 'N':
+      braced( '{', '}' );
+      break;
+    default:
+      while ( letter >= '0' && letter <= '9' && i < n && p[ i ] >= '0' && p[ i ] <= '9' ) { // Backreference or octal
+        ++i;
+      }
+      break;
+  }
+  return i;
+}
+
+// Conservative: groups, classes, escapes and anchors end a literal run, an optional quantifier drops the character
+// before it, and top-level alternation, inline flags, \Q...\E or a '{' that is not plainly {n}, {n,} or {n,m} give
+// up. With icase only ASCII bytes whose case folding is plain ASCII are kept ('k' and 's' also match U+212A and
+// U+017F in UTF-8 engines).
+std::string regex_required_literal( const std::string& p, bool icase ) {
+  std::string best, run;
+  auto        flush = [ & ]() {
+    if ( run.size() > best.size() ) {
+      best = run;
+    }
+    run.clear();
+  };
+  auto drop_last = [ & ]() { // Remove the whole trailing code point, which is what a UTF-8 engine quantifies
+    while ( !run.empty() && ( static_cast< unsigned char >( run.back() ) & 0xC0 ) == 0x80 ) {
+      run.pop_back();
+    }
+    if ( !run.empty() ) {
+      run.pop_back();
+    }
+  };
+  auto literal = [ & ]( unsigned char c ) {
+    if ( icase && ( c >= 0x80 || ascii_fold( c ) == 'k' || ascii_fold( c ) == 's' ) ) {
+      flush();
+    } else {
+      run += static_cast< char >( icase ? ascii_fold( c ) : c );
+    }
+  };
+  if ( p.find( "\\Q" ) != std::string::npos ) {
+    return "";
+  }
+  size_t n = p.size();
+  size_t i = 0;
+  while ( i < n ) {
+    unsigned char c = static_cast< unsigned char >( p[ i ] );
+    switch ( c ) {
+      case '|':
+      case ')':
+        return "";
+      case '(':
+        if ( i + 2 < n && p[ i + 1 ] == '?' && ( p[ i + 2 ] == '-' || ( is_ascii_alnum( static_cast< unsigned char >( p[ i + 2 ] ) ) && p[ i + 2 ] != 'P' ) ) ) {
+          return ""; // (?i) and friends change how the rest of the pattern matches
+        }
+        flush();
+        i = skip_group( p, i );
+        if ( i == std::string::npos ) {
+          return "";
+        }
+        break;
+      case '[':
+        flush();
+        i = skip_class( p, i );
+        if ( i == std::string::npos ) {
+          return "";
+        }
+        break;
+      case '\\':
+        if ( i + 1 >= n ) {
+          return "";
+        }
+        if ( is_ascii_alnum( static_cast< unsigned char >( p[ i + 1 ] ) ) ) {
+          flush();
+          i = skip_escape( p, i + 1 );
+        } else {
+          literal( static_cast< unsigned char >( p[ i + 1 ] ) );
+          i += 2;
+        }
+        break;
+      case '*':
+      case '?':
+      case '+':
+      case '{': {
+        size_t next = i + 1;
+        bool   keep = c == '+';
+        if ( c == '{' ) {
+          size_t j = next;
+          while ( j < n && p[ j ] >= '0' && p[ j ] <= '9' ) {
+            ++j;
+          }
+          size_t digits = j - next;
+          bool   atLeastOne = digits && p.compare( next, digits, std::string( digits, '0' ) ) != 0;
+          if ( j < n && p[ j ] == ',' ) {
+            ++j;
+            while ( j < n && p[ j ] >= '0' && p[ j ] <= '9' ) {
+              ++j;
+            }
+          }
+          if ( !digits || j >= n || p[ j ] != '}' ) {
+            return ""; // A literal '{' in most engines, but {,n} is a repeat in PCRE2 10.43 and later
+          }
+          keep = atLeastOne;
+          next = j + 1;
+        }
+        if ( !keep ) {
+          drop_last();
+        }
+        flush();
+        if ( next < n && ( p[ next ] == '?' || p[ next ] == '+' ) ) { // Lazy or possessive suffix
+          ++next;
+        }
+        if ( next < n && strchr( "*+?{", p[ next ] ) ) {
+          return ""; // A quantified quantifier, as std::regex reads :+{0,1}, can make the kept literal optional
+        }
+        i = next;
+        break;
+      }
+      case '.':
+      case '^':
+      case '$':
+        flush();
+        ++i;
+        break;
+      default:
+        literal( c );
+        ++i;
+        break;
+    }
+  }
+  flush();
+  return best;
+}
+
+// A regex behind a literal it requires: a row that lacks the literal cannot match, so it never reaches the engine.
+// Case-sensitive literals are found with memchr on their rarest-looking byte (vectorised in every mainstream libc),
+// caseless ones with Boyer-Moore-Horspool over ASCII-folded bytes.
+class PrefilteredEngine : public RegexEngine {
+public:
+  PrefilteredEngine( std::unique_ptr< RegexEngine > re, std::string literal, bool icase ) : re_( std::move( re ) ), literal_( std::move( literal ) ), icase_( icase ) {
+    size_t n = literal_.size();
+    anchor_  = 0;
+    for ( size_t i = 0; i < n; ++i ) {
+      if ( rarity( static_cast< unsigned char >( literal_[ i ] ) ) > rarity( static_cast< unsigned char >( literal_[ anchor_ ] ) ) ) {
+        anchor_ = i;
+      }
+    }
+    for ( size_t c = 0; c < 256; ++c ) {
+      shift_[ c ] = n;
+    }
+    for ( size_t i = 0; i + 1 < n; ++i ) {
+      shift_[ static_cast< unsigned char >( literal_[ i ] ) ] = n - 1 - i;
+    }
+  }
+
+  bool search( const char* data, size_t len ) const override { return contains( data, len ) && re_->search( data, len ); }
+
+  // The whole match lies at or after offset, so the literal must too
+  bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const override {
+    return offset <= len && contains( data + offset, len - offset ) && re_->find( data, len, offset, groups );
+  }
+
+  size_t groupCount() const override { return re_->groupCount(); }
+
+private:
+  // Rough rarity in text: punctuation and digits rarer than capitals, capitals rarer than common lowercase
+  static int rarity( unsigned char c ) {
+    if ( c == ' ' || strchr( "etaoinsrhl", c ) ) {
+      return 0;
+    }
+    if ( c >= 'a' && c <= 'z' ) {
+      return 1;
+    }
+    if ( c >= 'A' && c <= 'Z' ) {
+      return 2;
+    }
+    return 3;
+  }
+
+  bool contains( const char* data, size_t len ) const {
+    size_t n = literal_.size();
+    if ( n > len ) {
+      return false;
+    }
+    const char* lit = literal_.data();
+    if ( !icase_ ) {
+      const char* p    = data + anchor_;
+      const char* last = data + ( len - n ) + anchor_; // Anchor position of the last possible start
+      while ( p <= last ) {
+        p = static_cast< const char* >( memchr( p, lit[ anchor_ ], static_cast< size_t >( last - p ) + 1 ) );
+        if ( !p ) {
+          return false;
+        }
+        if ( memcmp( p - anchor_, lit, n ) == 0 ) {
+          return true;
+        }
+        ++p;
+      }
+      return false;
+    }
+    const unsigned char* s = reinterpret_cast< const unsigned char* >( data );
+    for ( size_t i = 0; i + n <= len; i += shift_[ ascii_fold( s[ i + n - 1 ] ) ] ) {
+      size_t k = n;
+      while ( k > 0 && ascii_fold( s[ i + k - 1 ] ) == static_cast< unsigned char >( lit[ k - 1 ] ) ) {
+        --k;
+      }
+      if ( k == 0 ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::unique_ptr< RegexEngine > re_;
+  std::string                    literal_; // ASCII-folded when icase_
+  bool                           icase_;
+  size_t                         anchor_;
+  size_t                         shift_[ 256 ];
+};
+
+static std::unique_ptr< RegexEngine > with_prefilter( std::unique_ptr< RegexEngine > re, const std::string& pattern, const RegexFlags& flags ) {
+  std::string literal = regex_required_literal( pattern, flags.icase );
+  if ( literal.empty() ) {
+    return re;
+  }
+  return std::unique_ptr< RegexEngine >( new PrefilteredEngine( std::move( re ), std::move( literal ), flags.icase ) );
+}
+
+static const size_t kUnboundedReach = SIZE_MAX;
+static const size_t kMaxCharBytes   = 4;         // One UTF-8 character
+static const size_t kMaxWindowReach = 256 << 10; // Past this a window rescans too much of each piece to be worth it
+
+static size_t reach_add( size_t a, size_t b ) { return a > kUnboundedReach - b ? kUnboundedReach : a + b; }
+static size_t reach_mul( size_t a, size_t b ) { return a && b > kUnboundedReach / a ? kUnboundedReach : a * b; }
+
+// Bytes spanned by the alternatives from p[i] to the ')' that closes the group at depth, or to the end at depth 0.
+// Leaves i on that ')'. Errs high: a class or escape counts as a whole character, and so does a caseless letter
+// with a multi-byte match (see regex_required_literal()).
+static size_t branch_reach( const std::string& p, size_t& i, bool icase, int depth ) {
+  size_t n    = p.size();
+  size_t best = 0;
+  size_t run  = 0;
+  while ( i < n && p[ i ] != ')' ) {
+    unsigned char c = static_cast< unsigned char >( p[ i ] );
+    size_t        atom;
+    if ( c == '|' ) {
+      best = std::max( best, run );
+      run  = 0;
+      ++i;
+      continue;
+    }
+    if ( c == '(' ) {
+      size_t j = i + 1;
+      if ( j < n && p[ j ] == '*' ) {
+        return kUnboundedReach; // PCRE2 verbs
+      }
+      if ( j < n && p[ j ] == '?' ) {
+        ++j;
+        if ( j < n && p[ j ] == '#' ) {
+          size_t close = p.find( ')', j );
+          if ( close == std::string::npos ) {
+            return kUnboundedReach;
+          }
+          i = close + 1;
+          continue;
+        }
+        if ( j < n && ( p[ j ] == ':' || p[ j ] == '>' || p[ j ] == '|' ) ) {
+          ++j;
+        } else if ( p.compare( j, 2, "P<" ) == 0 || p.compare( j, 1, "'" ) == 0 || ( p.compare( j, 1, "<" ) == 0 && j + 1 < n && p[ j + 1 ] != '=' && p[ j + 1 ] != '!' ) ) {
+          j = p.find( p[ j ] == '\'' ? '\'' : '>', j + 1 ); // Named group
+          if ( j == std::string::npos ) {
+            return kUnboundedReach;
+          }
+          ++j;
+        } else {
+          size_t k = j; // Options such as (?i) or (?i:...); anything else is lookaround, a backreference, recursion or a condition
+          while ( k < n && ( isalpha( static_cast< unsigned char >( p[ k ] ) ) || p[ k ] == '-' || p[ k ] == '^' ) ) {
+            if ( p[ k ] == 'x' ) {
+              return kUnboundedReach; // Whitespace and comments would be read as literals, and a '[' in one as a class
+            }
+            ++k;
+          }
+          if ( k == j || k >= n || ( p[ k ] != ')' && p[ k ] != ':' ) ) {
+            return kUnboundedReach;
+          }
+          if ( p[ k ] == ')' ) {
+            i = k + 1;
+            continue;
+          }
+          j = k + 1;
+        }
+      }
+      atom = branch_reach( p, j, icase, depth + 1 );
+      if ( atom == kUnboundedReach || j >= n ) {
+        return kUnboundedReach;
+      }
+      i = j + 1;
+    } else if ( c == '[' ) {
+      i = skip_class( p, i );
+      if ( i == std::string::npos ) {
+        return kUnboundedReach;
+      }
+      atom = kMaxCharBytes;
+    } else if ( c == '\\' ) {
+      if ( i + 1 >= n ) {
+        return kUnboundedReach;
+      }
+      char e = p[ i + 1 ];
+      if ( e == '\0' || strchr( "123456789kgKGX", e ) ) {
+        return kUnboundedReach; // Backreferences, \K, \G and graphemes
+      }
+      if ( e == 'Q' ) {
+        size_t close = p.find( "\\E", i + 2 );
+        size_t end   = close == std::string::npos ? n : close;
+        atom         = reach_mul( end - ( i + 2 ), icase ? kMaxCharBytes : 1 );
+        i            = close == std::string::npos ? n : close + 2;
+      } else if ( strchr( "bBAzZE", e ) ) {
+        atom  = 0;
+        i    += 2;
+      } else if ( e == 'R' ) {
+        atom  = 2 * kMaxCharBytes; // \r\n
+        i    += 2;
+      } else if ( is_ascii_alnum( static_cast< unsigned char >( e ) ) ) {
+        atom = kMaxCharBytes;
+        i    = skip_escape( p, i + 1 );
+      } else {
+        atom  = 1;
+        i    += 2;
+      }
+    } else if ( c == '.' ) {
+      atom = kMaxCharBytes;
+      ++i;
+    } else if ( c == '^' || c == '$' ) {
+      atom = 0;
+      ++i;
+    } else if ( strchr( "*+?{", c ) ) {
+      return kUnboundedReach; // Nothing to repeat, or a literal '{' in PCRE2
+    } else {
+      atom = icase && ( c >= 0x80 || ascii_fold( c ) == 'k' || ascii_fold( c ) == 's' ) ? kMaxCharBytes : 1;
+      ++i;
+    }
+
+    if ( i < n && ( p[ i ] == '*' || p[ i ] == '+' ) ) {
+      if ( atom ) {
+        return kUnboundedReach;
+      }
+      ++i;
+    } else if ( i < n && p[ i ] == '?' ) {
+      ++i;
+    } else if ( i < n && p[ i ] == '{' ) {
+      size_t j  = i + 1;
+      size_t lo = 0, hi = 0;
+      bool   haveLo = false, haveHi = false, comma = false;
+      for ( ; j < n && isdigit( static_cast< unsigned char >( p[ j ] ) ); ++j, haveLo = true ) {
+        lo = reach_add( reach_mul( lo, 10 ), static_cast< size_t >( p[ j ] - '0' ) );
+      }
+      if ( j < n && p[ j ] == ',' ) {
+        comma = true;
+        for ( ++j; j < n && isdigit( static_cast< unsigned char >( p[ j ] ) ); ++j, haveHi = true ) {
+          hi = reach_add( reach_mul( hi, 10 ), static_cast< size_t >( p[ j ] - '0' ) );
+        }
+      }
+      if ( j >= n || p[ j ] != '}' || ( !haveLo && !haveHi ) ) {
+        return kUnboundedReach; // A literal '{' in PCRE2, an error elsewhere
+      }
+      if ( comma && !haveHi && atom ) {
+        return kUnboundedReach;
+      }
+      atom = reach_mul( atom, comma ? hi : lo );
+      i    = j + 1;
+    } else {
+      run = reach_add( run, atom );
+      continue;
+    }
+    if ( i < n && ( p[ i ] == '?' || p[ i ] == '+' ) ) { // Lazy or possessive
+      ++i;
+    }
+    if ( i < n && strchr( "*+?{", p[ i ] ) ) {
+      return kUnboundedReach;
+    }
+    run = reach_add( run, atom );
+  }
+  if ( i < n && depth == 0 ) {
+    return kUnboundedReach; // A ')' with no '('
+  }
+  return std::max( best, run );
+}
+
+size_t regex_match_reach( const std::string& pattern, const RegexFlags& flags ) {
+  bool icase = flags.icase;
+  for ( size_t at = pattern.find( "(?" ); !icase && at != std::string::npos; at = pattern.find( "(?", at + 2 ) ) {
+    for ( size_t k = at + 2; k < pattern.size() && ( isalpha( static_cast< unsigned char >( pattern[ k ] ) ) || pattern[ k ] == '-' ); ++k ) {
+      icase = icase || pattern[ k ] == 'i'; // (?i) anywhere: count every letter as caseless
+    }
+  }
+  size_t i     = 0;
+  size_t width = branch_reach( pattern, i, icase, 0 );
+  return width == kUnboundedReach ? width : reach_add( width, 1 );
+}
+
+// Bytes at the end of s[0, len) that begin a UTF-8 character without finishing it
+static size_t utf8_partial_tail( const std::string& s, size_t len ) {
+  for ( size_t k = 1; k <= 4 && k <= len; ++k ) {
+    unsigned char c = static_cast< unsigned char >( s[ len - k ] );
+    if ( ( c & 0xC0 ) != 0x80 ) {
+      size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+      return need > k ? k : 0;
+    }
+  }
+  return 0;
+}
+
+// A stream for engines without one of their own. Each piece is searched together with the last reach + 2 bytes
+// before it and a character of context for \b and lookbehind-like assertions. A match ending less than two bytes
+// from the end of the window is not trusted, as what follows could undo it ($ also matches before a final
+// newline); any match it could hide starts late enough to be searched again in the next window, which overlaps.
+// So when reach bounds every match, the answer is the one a search of the whole value would give.
+class WindowedStream : public RegexStream {
+public:
+  WindowedStream( const RegexEngine& re, size_t reach ) : re_( re ), keep_( reach + 2 ) {}
+
+  bool feed( const char* data, size_t len ) override {
+    if ( !matched_ && len ) {
+      window_.append( data, len );
+      scan( false );
+    }
+    return matched_;
+  }
+
+  bool finish() override {
+    if ( !matched_ ) {
+      scan( true );
+    }
+    return matched_;
+  }
+
+private:
+  static bool continuation( char c ) { return ( static_cast< unsigned char >( c ) & 0xC0 ) == 0x80; }
+
+  void scan( bool last ) {
+    size_t len = window_.size() - ( last ? 0 : utf8_partial_tail( window_, window_.size() ) ); // A UTF-8 engine never sees a split character
+    if ( from_ <= len && re_.find( window_.data(), len, from_, groups_ ) ) {
+      matched_ = last || static_cast< size_t >( groups_[ 0 ].end ) + 2 <= len;
+    }
+    if ( matched_ || last || len < keep_ + from_ ) {
+      return;
+    }
+    size_t start = len - keep_; // First byte searched again, moved back onto a character
+    while ( start > 0 && continuation( window_[ start ] ) ) {
+      --start;
+    }
+    size_t context = start ? start - 1 : 0;
+    while ( context > 0 && continuation( window_[ context ] ) ) {
+      --context;
+    }
+    window_.erase( 0, context );
+    from_ = start - context;
+  }
+
+  const RegexEngine&       re_;
+  size_t                   keep_;
+  size_t                   from_    = 0; // Where the search in window_ starts; bytes before it are context
+  bool                     matched_ = false;
+  std::string              window_;
+  std::vector< RegexSpan > groups_;
+};
+
+std::unique_ptr< RegexStream > open_regex_stream( const RegexEngine& re, size_t reach ) {
+  std::unique_ptr< RegexStream > native = re.stream();
+  if ( native || reach > kMaxWindowReach ) {
+    return native;
+  }
+  return std::unique_ptr< RegexStream >( new WindowedStream( re, reach ) );
+}
+
+#if defined( BOLTON_REGEX_STD ) || defined( BOLTON_REGEX_PCRE2 )
+
+// Patterns tried one by one, for engines without a multi-pattern mode.
+class RegexListSet : public RegexSetEngine {
+public:
+  explicit RegexListSet( std::vector< std::unique_ptr< RegexEngine > > engines ) : engines_( std::move( engines ) ) {}
+
+  bool any( const char* data, size_t len ) const override {
+    for ( const auto& re : engines_ ) {
+      if ( re->search( data, len ) ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void which( const char* data, size_t len, std::vector< int >& hits ) const override {
+    hits.clear();
+    for ( size_t i = 0; i < engines_.size(); ++i ) {
+      if ( engines_[ i ]->search( data, len ) ) {
+        hits.push_back( static_cast< int >( i ) );
+      }
+    }
+  }
+
+private:
+  std::vector< std::unique_ptr< RegexEngine > > engines_;
+};
+
+static std::unique_ptr< RegexSetEngine > compile_regex_list( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error ) {
+  std::vector< std::unique_ptr< RegexEngine > > engines;
+  for ( const std::string& pattern : patterns ) {
+    std::unique_ptr< RegexEngine > re = compile_regex( pattern, flags, error );
+    if ( !re ) {
+      return nullptr;
+    }
+    engines.push_back( std::move( re ) );
+  }
+  return std::unique_ptr< RegexSetEngine >( new RegexListSet( std::move( engines ) ) );
+}
+
+#endif
+
+#if defined( BOLTON_REGEX_PCRE2 )
+
+class Pcre2Engine : public RegexEngine {
+public:
+  Pcre2Engine( pcre2_code* code )
+    : code_( code ), match_( pcre2_match_data_create_from_pattern( code, nullptr ) ), limits_( pcre2_match_context_create( nullptr ) ) {
+    pcre2_jit_compile( code_, PCRE2_JIT_COMPLETE ); // Falls back to the interpreter if JIT is unavailable
+    uint32_t n = 0;
+    pcre2_pattern_info( code_, PCRE2_INFO_CAPTURECOUNT, &n );
+    groups_ = n;
+  }
+  ~Pcre2Engine() override {
+    pcre2_match_context_free( limits_ );
+    pcre2_match_data_free( match_ );
+    pcre2_code_free( code_ );
+  }
+
+  bool search( const char* data, size_t len ) const override { return run( data, len, 0 ) > 0; }
+
+  bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const override {
+    int rc = run( data, len, offset );
+    if ( rc <= 0 ) {
+      return false;
+    }
+    PCRE2_SIZE* ov = pcre2_get_ovector_pointer( match_ );
+    groups.resize( groups_ + 1 );
+    for ( size_t i = 0; i <= groups_; ++i ) {
+      if ( i < static_cast< size_t >( rc ) && ov[ 2 * i ] != PCRE2_UNSET ) {
+        groups[ i ] = { static_cast< std::ptrdiff_t >( ov[ 2 * i ] ), static_cast< std::ptrdiff_t >( ov[ 2 * i + 1 ] ) };
+      } else {
+        groups[ i ] = { -1, -1 };
+      }
+    }
+    return true;
+  }
+
+  size_t groupCount() const override { return groups_; }
+
+private:
+  // PCRE2 counts backtracking steps, not time; the budget left becomes a step limit at a rate the interpreter
+  // sustains on ordinary hardware. The JIT is faster, so it stops somewhat before the deadline instead of after it.
+  static const uint64_t kStepsPerUs = 100;
+
+  int run( const char* data, size_t len, size_t offset ) const {
+    pcre2_match_context* limits = nullptr;
+    if ( RegexBudget::active() ) {
+      RegexBudget::check();
+      uint64_t left = RegexBudget::remaining_us();
+      if ( left != UINT64_MAX && limits_ ) {
+        pcre2_set_match_limit( limits_, static_cast< uint32_t >( std::min< uint64_t >( std::max< uint64_t >( left, 1 ) * kStepsPerUs, UINT32_MAX ) ) );
+        limits = limits_;
+      }
+    }
+    int rc = pcre2_match( code_, reinterpret_cast< PCRE2_SPTR >( data ), len, offset, 0, match_, limits );
+    if ( rc == PCRE2_ERROR_MATCHLIMIT && limits ) {
+      RegexBudget::check();
+      throw RegexBudgetExceeded( "Regex match exceeded regex_budget_us (step limit reached)", false );
+    }
+    if ( rc < 0 && rc != PCRE2_ERROR_NOMATCH ) {
+      throw std::runtime_error( "Regex match failed (PCRE2 error " + std::to_string( rc ) + ")" );
+    }
+    return rc;
+  }
+
+  pcre2_code*       code_;
+  pcre2_match_data*    match_; // One per pattern; a connection runs one statement step at a time
+  pcre2_match_context* limits_; // Match limit for the budget in scope; null without memory, then unlimited
+  size_t               groups_;
+};
+
+std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error ) {
+  uint32_t options = PCRE2_UTF;
+#ifdef PCRE2_MATCH_INVALID_UTF
+  options |= PCRE2_MATCH_INVALID_UTF; // SQLite TEXT is not guaranteed to be valid UTF-8
+#endif
+  if ( flags.icase ) options |= PCRE2_CASELESS;
+  if ( flags.multiline ) options |= PCRE2_MULTILINE;
+  if ( flags.dotall ) options |= PCRE2_DOTALL;
+  int         errcode   = 0;
+  PCRE2_SIZE  erroffset = 0;
+  pcre2_code* code      = pcre2_compile( reinterpret_cast< PCRE2_SPTR >( pattern.data() ), pattern.size(), options, &errcode, &erroffset, nullptr );
+  if ( !code ) {
+    PCRE2_UCHAR msg[ 256 ];
+    pcre2_get_error_message( errcode, msg, sizeof( msg ) );
+    error = reinterpret_cast< const char* >( msg );
+    return nullptr;
+  }
+  return with_prefilter( std::unique_ptr< RegexEngine >( new Pcre2Engine( code ) ), pattern, flags );
+}
+
+std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error ) {
+  return compile_regex_list( patterns, flags, error );
+}
+
+const char* regex_engine_name() { return "pcre2"; }
+
+#elif defined( BOLTON_REGEX_RE2 )
+
+class Re2Engine : public RegexEngine {
+public:
+  Re2Engine( const std::string& pattern, const RE2::Options& options ) : re_( pattern, options ) {}
+
+  bool ok() const { return re_.ok(); }
+  const std::string& error() const { return re_.error(); }
+
+  bool search( const char* data, size_t len ) const override {
+    RegexBudget::check();
+    return re_.Match( re2::StringPiece( data, len ), 0, len, RE2::UNANCHORED, nullptr, 0 );
+  }
+
+  bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const override {
+    RegexBudget::check();
+    size_t                          n = groupCount() + 1;
+    std::vector< re2::StringPiece > sub( n );
+    if ( !re_.Match( re2::StringPiece( data, len ), offset, len, RE2::UNANCHORED, sub.data(), static_cast< int >( n ) ) ) {
+      return false;
+    }
+    groups.resize( n );
+    for ( size_t i = 0; i < n; ++i ) {
+      if ( sub[ i ].data() ) {
+        groups[ i ] = { sub[ i ].data() - data, sub[ i ].data() + sub[ i ].size() - data };
+      } else {
+        groups[ i ] = { -1, -1 };
+      }
+    }
+    return true;
+  }
+
+  size_t groupCount() const override { return static_cast< size_t >( re_.NumberOfCapturingGroups() ); }
+
+private:
+  RE2 re_;
+};
+
+std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error ) {
+  RE2::Options options;
+  options.set_log_errors( false );
+  options.set_case_sensitive( !flags.icase );
+  options.set_dot_nl( flags.dotall );
+  std::unique_ptr< Re2Engine > re( new Re2Engine( flags.multiline ? "(?m)" + pattern : pattern, options ) );
+  if ( !re->ok() ) {
+    error = re->error();
+    return nullptr;
+  }
+  return with_prefilter( std::unique_ptr< RegexEngine >( re.release() ), pattern, flags );
+}
+
+// RE2::Set runs every pattern in one DFA pass over the text.
+class Re2SetEngine : public RegexSetEngine {
+public:
+  explicit Re2SetEngine( const RE2::Options& options ) : set_( options, RE2::UNANCHORED ) {}
+
+  int add( const std::string& pattern, std::string& error ) { return set_.Add( pattern, &error ); }
+  bool compile() { return set_.Compile(); }
+
+  bool any( const char* data, size_t len ) const override {
+    RegexBudget::check();
+    return set_.Match( re2::StringPiece( data, len ), nullptr );
+  }
+
+  void which( const char* data, size_t len, std::vector< int >& hits ) const override {
+    RegexBudget::check();
+    hits.clear();
+    set_.Match( re2::StringPiece( data, len ), &hits );
+    std::sort( hits.begin(), hits.end() );
+  }
+
+private:
+  RE2::Set set_;
+};
+
+std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error ) {
+  RE2::Options options;
+  options.set_log_errors( false );
+  options.set_case_sensitive( !flags.icase );
+  options.set_dot_nl( flags.dotall );
+  std::unique_ptr< Re2SetEngine > set( new Re2SetEngine( options ) );
+  for ( const std::string& pattern : patterns ) {
+    if ( set->add( flags.multiline ? "(?m)" + pattern : pattern, error ) < 0 ) {
+      return nullptr;
+    }
+  }
+  if ( !set->compile() ) {
+    error = "RE2 ran out of memory compiling the pattern set";
+    return nullptr;
+  }
+  return std::unique_ptr< RegexSetEngine >( set.release() );
+}
+
+const char* regex_engine_name() { return "re2"; }
+
+#elif defined( BOLTON_REGEX_HYPERSCAN )
+
+// Hyperscan's stream mode: state carried between pieces, so a match across two of them is still seen
+class HyperscanStream : public RegexStream {
+public:
+  HyperscanStream( hs_stream_t* stream, hs_scratch_t* scratch ) : stream_( stream ), scratch_( scratch ) {}
+  ~HyperscanStream() override {
+    if ( stream_ ) {
+      hs_close_stream( stream_, scratch_, nullptr, nullptr );
+    }
+  }
+
+  bool feed( const char* data, size_t len ) override {
+    if ( !matched_ ) {
+      RegexBudget::check();
+      hs_error_t rc = hs_scan_stream( stream_, data, static_cast< unsigned int >( len ), 0, scratch_, &on_match, &matched_ );
+      if ( rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED ) {
+        throw std::runtime_error( "Regex match failed (Hyperscan error " + std::to_string( rc ) + ")" );
+      }
+    }
+    return matched_;
+  }
+
+  // Closing reports the matches that needed the end of the data, such as those of a trailing $
+  bool finish() override {
+    if ( stream_ ) {
+      hs_error_t rc = hs_close_stream( stream_, scratch_, matched_ ? nullptr : &on_match, &matched_ );
+      stream_       = nullptr;
+      if ( rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED ) {
+        throw std::runtime_error( "Regex match failed (Hyperscan error " + std::to_string( rc ) + ")" );
+      }
+    }
+    return matched_;
+  }
+
+private:
+  static int on_match( unsigned int, unsigned long long, unsigned long long, unsigned int, void* matched ) {
+    *static_cast< bool* >( matched ) = true;
+    return 1;
+  }
+
+  hs_stream_t*  stream_;
+  hs_scratch_t* scratch_;
+  bool          matched_ = false;
+};
+
+// Hyperscan only reports match offsets, so group captures go to a std::regex compiled alongside it.
+class HyperscanEngine : public RegexEngine {
+public:
+  HyperscanEngine( hs_database_t* db, hs_scratch_t* scratch, std::unique_ptr< RegexEngine > captures, std::string pattern, unsigned int hsFlags )
+    : db_( db ), scratch_( scratch ), captures_( std::move( captures ) ), pattern_( std::move( pattern ) ), hsFlags_( hsFlags ) {}
+  ~HyperscanEngine() override {
+    hs_free_scratch( scratch_ );
+    hs_free_database( streamDb_ );
+    hs_free_database( db_ );
+  }
+
+  bool search( const char* data, size_t len ) const override {
+    RegexBudget::check();
+    hs_error_t rc = hs_scan( db_, data, static_cast< unsigned int >( len ), 0, scratch_, &stop_on_match, nullptr );
+    if ( rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED ) {
+      throw std::runtime_error( "Regex match failed (Hyperscan error " + std::to_string( rc ) + ")" );
+    }
+    return rc == HS_SCAN_TERMINATED;
+  }
+
+  bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const override {
+    if ( !captures_ ) {
+      throw std::runtime_error( "Pattern is not supported by std::regex, which Hyperscan builds use for match positions" );
+    }
+    return captures_->find( data, len, offset, groups );
+  }
+
+  size_t groupCount() const override { return captures_ ? captures_->groupCount() : 0; }
+
+  // The stream-mode database is compiled on first use, and the scratch grown to serve both
+  std::unique_ptr< RegexStream > stream() const override {
+    if ( !streamDb_ && !streamFailed_ ) {
+      hs_compile_error_t* err = nullptr;
+      if ( hs_compile( pattern_.c_str(), hsFlags_, HS_MODE_STREAM, nullptr, &streamDb_, &err ) != HS_SUCCESS || hs_alloc_scratch( streamDb_, &scratch_ ) != HS_SUCCESS ) {
+        hs_free_compile_error( err );
+        hs_free_database( streamDb_ );
+        streamDb_     = nullptr;
+        streamFailed_ = true; // Windowed instead, through find()
+      }
+    }
+    hs_stream_t* stream = nullptr;
+    if ( !streamDb_ || hs_open_stream( streamDb_, 0, &stream ) != HS_SUCCESS ) {
+      return nullptr;
+    }
+    return std::unique_ptr< RegexStream >( new HyperscanStream( stream, scratch_ ) );
+  }
+
+private:
+  static int stop_on_match( unsigned int, unsigned long long, unsigned long long, unsigned int, void* ) { return 1; }
+
+  hs_database_t*                 db_;
+  mutable hs_scratch_t*          scratch_; // One per pattern; a connection runs one statement step at a time
+  std::unique_ptr< RegexEngine > captures_;
+  std::string                    pattern_;
+  unsigned int                   hsFlags_;
+  mutable hs_database_t*         streamDb_     = nullptr;
+  mutable bool                   streamFailed_ = false;
+};
+
+std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error ) {
+  unsigned int hsFlags = HS_FLAG_ALLOWEMPTY | HS_FLAG_SINGLEMATCH | HS_FLAG_UTF8;
+  if ( flags.icase ) hsFlags |= HS_FLAG_CASELESS;
+  if ( flags.multiline ) hsFlags |= HS_FLAG_MULTILINE;
+  if ( flags.dotall ) hsFlags |= HS_FLAG_DOTALL;
+  hs_database_t*      db  = nullptr;
+  hs_compile_error_t* err = nullptr;
+  if ( hs_compile( pattern.c_str(), hsFlags, HS_MODE_BLOCK, nullptr, &db, &err ) != HS_SUCCESS ) {
+    error = err ? err->message : "Hyperscan compile failed";
+    hs_free_compile_error( err );
+    return nullptr;
+  }
+  hs_scratch_t* scratch = nullptr;
+  if ( hs_alloc_scratch( db, &scratch ) != HS_SUCCESS ) {
+    hs_free_database( db );
+    error = "Hyperscan scratch allocation failed";
+    return nullptr;
+  }
+  std::unique_ptr< RegexEngine > captures;
+  try {
+    captures = std_regex_engine( pattern, flags );
+  } catch ( std::regex_error& ) {} // Still usable for regexp(); only capture-based functions will refuse it
+  return std::unique_ptr< RegexEngine >( new HyperscanEngine( db, scratch, std::move( captures ), pattern, hsFlags ) );
+}
+
+// One Hyperscan database for the whole set; each pattern's id is its position in the list.
+class HyperscanSetEngine : public RegexSetEngine {
+public:
+  HyperscanSetEngine( hs_database_t* db, hs_scratch_t* scratch ) : db_( db ), scratch_( scratch ) {}
+  ~HyperscanSetEngine() override {
+    hs_free_scratch( scratch_ );
+    hs_free_database( db_ );
+  }
+
+  bool any( const char* data, size_t len ) const override { return scan( data, len, &stop_on_match, nullptr ) == HS_SCAN_TERMINATED; }
+
+  void which( const char* data, size_t len, std::vector< int >& hits ) const override {
+    hits.clear();
+    scan( data, len, &collect, &hits );
+    std::sort( hits.begin(), hits.end() ); // HS_FLAG_SINGLEMATCH reports each id once, in match order
+  }
+
+private:
+  hs_error_t scan( const char* data, size_t len, match_event_handler onMatch, void* context ) const {
+    RegexBudget::check();
+    hs_error_t rc = hs_scan( db_, data, static_cast< unsigned int >( len ), 0, scratch_, onMatch, context );
+    if ( rc != HS_SUCCESS && rc != HS_SCAN_TERMINATED ) {
+      throw std::runtime_error( "Regex match failed (Hyperscan error " + std::to_string( rc ) + ")" );
+    }
+    RegexBudget::check(); // Rethrows what made collect() stop the scan early
+    return rc;
+  }
+
+  static int stop_on_match( unsigned int, unsigned long long, unsigned long long, unsigned int, void* ) { return 1; }
+  static int collect( unsigned int id, unsigned long long, unsigned long long, unsigned int, void* context ) {
+    try {
+      RegexBudget::check(); // Not thrown through Hyperscan's C frames
+    } catch ( RegexBudgetExceeded& ) { return 1; }
+    static_cast< std::vector< int >* >( context )->push_back( static_cast< int >( id ) );
+    return 0;
+  }
+
+  hs_database_t* db_;
+  hs_scratch_t*  scratch_;
+};
+
+std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error ) {
+  unsigned int hsFlags = HS_FLAG_ALLOWEMPTY | HS_FLAG_SINGLEMATCH | HS_FLAG_UTF8;
+  if ( flags.icase ) hsFlags |= HS_FLAG_CASELESS;
+  if ( flags.multiline ) hsFlags |= HS_FLAG_MULTILINE;
+  if ( flags.dotall ) hsFlags |= HS_FLAG_DOTALL;
+  std::vector< const char* >  expressions;
+  std::vector< unsigned int > allFlags( patterns.size(), hsFlags );
+  std::vector< unsigned int > ids;
+  for ( size_t i = 0; i < patterns.size(); ++i ) {
+    expressions.push_back( patterns[ i ].c_str() );
+    ids.push_back( static_cast< unsigned int >( i ) );
+  }
+  hs_database_t*      db  = nullptr;
+  hs_compile_error_t* err = nullptr;
+  if ( hs_compile_multi( expressions.data(), allFlags.data(), ids.data(), static_cast< unsigned int >( patterns.size() ), HS_MODE_BLOCK, nullptr, &db, &err ) != HS_SUCCESS ) {
+    error = err ? err->message : "Hyperscan compile failed";
+    hs_free_compile_error( err );
+    return nullptr;
+  }
+  hs_scratch_t* scratch = nullptr;
+  if ( hs_alloc_scratch( db, &scratch ) != HS_SUCCESS ) {
+    hs_free_database( db );
+    error = "Hyperscan scratch allocation failed";
+    return nullptr;
+  }
+  return std::unique_ptr< RegexSetEngine >( new HyperscanSetEngine( db, scratch ) );
+}
+
+const char* regex_engine_name() { return "hyperscan"; }
+
+#else // BOLTON_REGEX_STD
+
+std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error ) {
+  try {
+    return with_prefilter( std_regex_engine( pattern, flags ), pattern, flags );
+  } catch ( std::regex_error& e ) {
+    error = e.what();
+    return nullptr;
+  }
+}
+
+std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error ) {
+  return compile_regex_list( patterns, flags, error );
+}
+
+const char* regex_engine_name() { return "std::regex"; }
+
+#endif
+
+bool regex_replace_all( const RegexEngine& re, const char* data, size_t len, const char* fmt, size_t fmtLen, TextSink& out ) {
+  std::vector< RegexSpan > groups;
+  size_t                   pos     = 0; // Start of the next search
+  size_t                   copied  = 0; // End of the input already written to out
+  size_t                   prevEnd = 0; // End of the previous match, where $` starts
+  bool                     matched = false;
+  while ( pos <= len && re.find( data, len, pos, groups ) ) {
+    if ( !matched ) {
+      out.reserve( out.size() + len + fmtLen ); // Usually enough for the whole result in one allocation
+      matched = true;
+    }
+    size_t start = static_cast< size_t >( groups[ 0 ].start );
+    size_t end   = static_cast< size_t >( groups[ 0 ].end );
+    out.append( data + copied, start - copied );
+    for ( size_t i = 0; i < fmtLen; ++i ) {
+      char c = fmt[ i ];
+      if ( c != '$' || i + 1 == fmtLen ) {
+        out.push_back( c );
+        continue;
+      }
+      char next = fmt[ i + 1 ];
+      if ( next == '$' ) {
+        out.push_back( '$' );
+        ++i;
+      } else if ( next == '&' ) {
+        out.append( data + start, end - start );
+        ++i;
+      } else if ( next == '`' ) {
+        out.append( data + prevEnd, start - prevEnd ); // Like match_results::prefix(): since the previous match
+        ++i;
+      } else if ( next == '\'' ) {
+        out.append( data + end, len - end );
+        ++i;
+      } else if ( next >= '0' && next <= '9' ) {
+        size_t n = static_cast< size_t >( next - '0' );
+        ++i;
+        if ( i + 1 < fmtLen && fmt[ i + 1 ] >= '0' && fmt[ i + 1 ] <= '9' ) {
+          n = n * 10 + static_cast< size_t >( fmt[ i + 1 ] - '0' );
+          ++i;
+        }
+        if ( n < groups.size() && groups[ n ].start >= 0 ) {
+          out.append( data + groups[ n ].start, static_cast< size_t >( groups[ n ].end - groups[ n ].start ) );
+        }
+      } else {
+        out.push_back( c );
+      }
+    }
+    copied  = end;
+    prevEnd = end;
+    if ( end == start ) { // Empty match: copy the next whole character through so the scan always advances
+      copied = end + 1;
+      while ( copied < len && ( static_cast< unsigned char >( data[ copied ] ) & 0xC0 ) == 0x80 ) {
+        ++copied;
+      }
+      if ( end < len ) {
+        out.append( data + end, copied - end );
+      }
+    }
+    pos = copied;
+  }
+  if ( matched && copied < len ) {
+    out.append( data + copied, len - copied );
+  }
+  return matched;
+}
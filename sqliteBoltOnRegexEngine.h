@@ -0,0 +1,213 @@
+#pragma once
+
+#ifndef SQLLITEBOLTONREGEXENGINE_H
+#define SQLLITEBOLTONREGEXENGINE_H
+
+/* Internal regex engine interface shared by the bolt-on functions.
+*
+* The engine is picked at compile time, std::regex unless one of these is defined:
+*   -DBOLTON_REGEX_PCRE2       PCRE2 with JIT            (link -lpcre2-8)
+*   -DBOLTON_REGEX_RE2         RE2, linear time          (link -lre2)
+*   -DBOLTON_REGEX_HYPERSCAN   Hyperscan for matching    (link -lhs), std::regex for capture groups
+*
+* The syntax accepted is whatever the selected engine accepts. RE2 rejects backreferences and lookaround.
+*
+* A literal that every match must contain is pulled out of the pattern at compile time and searched for first,
+* so rows without it never reach std::regex, PCRE2 or RE2. Hyperscan does its own literal factoring.
+*
+* std::regex has no dotall option; 's' is applied by rewriting '.' outside classes. With 'i' and an ASCII pattern it
+* folds case on ASCII letters directly rather than through the locale, which is most of the cost of caseless matching.
+*
+* A RegexBudget bounds the matching done while it is in scope; see below for where each engine checks it.
+*
+* A RegexStream matches a value fed to it in pieces, for values too large to read whole. Hyperscan streams natively;
+* the other engines search a window that keeps the tail of the previous piece, which is exact for any pattern
+* whose matches have a bounded length (see regex_match_reach()).
+*/
+
+#if !defined( BOLTON_REGEX_PCRE2 ) && !defined( BOLTON_REGEX_RE2 ) && !defined( BOLTON_REGEX_HYPERSCAN )
+#define BOLTON_REGEX_STD
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct RegexFlags {
+  bool icase     = false;
+  bool multiline = false;
+  bool dotall    = false;
+};
+
+struct RegexSpan {
+  std::ptrdiff_t start; // -1 when the group did not take part in the match
+  std::ptrdiff_t end;
+};
+
+class RegexStream;
+
+class RegexEngine {
+public:
+  virtual ~RegexEngine() {}
+
+  // True if the pattern matches anywhere in [data, data + len).
+  virtual bool search( const char* data, size_t len ) const = 0;
+
+  // Leftmost match starting at or after offset. groups[0] is the whole match, groups[1..] the captures.
+  // Context before offset is visible to the engine, so ^, \b and lookbehind behave as in a full scan.
+  virtual bool find( const char* data, size_t len, size_t offset, std::vector< RegexSpan >& groups ) const = 0;
+
+  virtual size_t groupCount() const = 0;
+
+  // A native stream over this engine, or nullptr to have open_regex_stream() window it instead.
+  virtual std::unique_ptr< RegexStream > stream() const { return nullptr; }
+};
+
+// Whether a pattern matches anywhere in a value fed to it in order, one piece at a time. Memory does not grow with
+// the value, and the caller can stop feeding at the first match.
+class RegexStream {
+public:
+  virtual ~RegexStream() {}
+
+  // Feeds the next bytes of the value. True once a match has been seen; what is left need not be fed.
+  virtual bool feed( const char* data, size_t len ) = 0;
+
+  // Ends the value. True if the pattern matched anywhere in it, counting matches at its very end.
+  virtual bool finish() = 0;
+};
+
+// Several patterns matched as one. RE2 and Hyperscan builds scan each value once for the whole set;
+// std::regex and PCRE2 builds run the patterns one after another.
+class RegexSetEngine {
+public:
+  virtual ~RegexSetEngine() {}
+
+  // True if any pattern matches anywhere in [data, data + len).
+  virtual bool any( const char* data, size_t len ) const = 0;
+
+  // Sets hits to the positions, in the list the set was compiled from, of every pattern that matches, ascending.
+  virtual void which( const char* data, size_t len, std::vector< int >& hits ) const = 0;
+};
+
+// Thrown out of a match once the budget in scope has run out, or its statement was interrupted.
+class RegexBudgetExceeded : public std::runtime_error {
+public:
+  RegexBudgetExceeded( const std::string& what, bool interrupted ) : std::runtime_error( what ), interrupted_( interrupted ) {}
+
+  bool interrupted() const { return interrupted_; }
+
+private:
+  bool interrupted_;
+};
+
+/* A time limit on the matching done by this thread while the budget is in scope, for one SQL function call.
+* Where it is checked:
+*   std::regex  every 4096 steps of the matcher, so catastrophic backtracking is cut off mid-match
+*   PCRE2       through the match limit, set from the time left at the usual rate of the interpreter
+*   RE2         before each match only; RE2 runs in time linear in the input
+*   Hyperscan   before each scan and at every match event the scan reports
+* and between the matches of a replace or multi-pattern call. interrupted, when given, is polled at the same
+* points, so a statement stopped by sqlite3_interrupt() or its progress handler stops inside a long match too.
+* budgetUs 0 is no limit. Budgets nest; the innermost one is checked.
+*/
+class RegexBudget {
+public:
+  typedef bool ( *Poll )( void* arg );
+
+  explicit RegexBudget( uint64_t budgetUs, Poll interrupted = nullptr, void* arg = nullptr );
+  ~RegexBudget();
+  RegexBudget( const RegexBudget& )            = delete;
+  RegexBudget& operator=( const RegexBudget& ) = delete;
+
+  // True while a budget is in scope on this thread, so engines can skip their counting when there is none.
+  static bool active() { return current_ != nullptr; }
+
+  // Throws RegexBudgetExceeded if the budget in scope has run out or its statement was interrupted.
+  static void check() {
+    if ( current_ ) {
+      current_->check_now();
+    }
+  }
+
+  // Microseconds left of the budget in scope, or UINT64_MAX without a limit.
+  static uint64_t remaining_us();
+
+private:
+  void check_now() const;
+
+  static thread_local RegexBudget* current_;
+
+  RegexBudget*                          outer_;
+  uint64_t                              budgetUs_;
+  std::chrono::steady_clock::time_point deadline_;
+  Poll                                  interrupted_;
+  void*                                 arg_;
+  bool                                  armed_; // False with neither a limit nor a poll: then it is not installed at all
+};
+
+// Returns nullptr and sets error if the pattern does not compile. Match-time failures throw std::runtime_error.
+std::unique_ptr< RegexEngine > compile_regex( const std::string& pattern, const RegexFlags& flags, std::string& error );
+
+// The most bytes a match of pattern can span, counting one byte past it for \b, $ and the like; SIZE_MAX when
+// it has no bound or uses something this cannot bound (lookaround, backreferences, recursion, *, + and {n,}).
+size_t regex_match_reach( const std::string& pattern, const RegexFlags& flags );
+
+// The longest literal that every match of pattern must contain, folded to lower case with icase, or "" when none
+// can be proven. The std::regex, PCRE2 and RE2 engines from compile_regex() search for it before matching.
+std::string regex_required_literal( const std::string& pattern, bool icase );
+
+// Opens a stream over re, which must outlive it. reach is regex_match_reach() of the pattern re was compiled from.
+// Returns nullptr when re has no native stream and reach is unbounded or too large to window.
+std::unique_ptr< RegexStream > open_regex_stream( const RegexEngine& re, size_t reach );
+
+// As compile_regex(), for a list of patterns sharing one set of flags.
+std::unique_ptr< RegexSetEngine > compile_regex_set( const std::vector< std::string >& patterns, const RegexFlags& flags, std::string& error );
+
+// Output for regex_replace_all(). Subclasses decide where the bytes live, so a result can be built straight
+// into memory that is then handed on without another copy.
+class TextSink {
+public:
+  virtual ~TextSink() {}
+
+  void reserve( size_t n ) {
+    if ( n > capacity_ ) {
+      grow( n );
+    }
+  }
+
+  void append( const char* p, size_t n ) {
+    if ( n > capacity_ - size_ ) {
+      grow( size_ + n );
+    }
+    if ( n ) {
+      memcpy( data_ + size_, p, n );
+      size_ += n;
+    }
+  }
+
+  void push_back( char c ) { append( &c, 1 ); }
+
+  const char* data() const { return data_; }
+  size_t      size() const { return size_; }
+
+protected:
+  // Leaves capacity_ >= need, keeping the first size_ bytes, or throws std::bad_alloc.
+  virtual void grow( size_t need ) = 0;
+
+  char*  data_     = nullptr;
+  size_t size_     = 0;
+  size_t capacity_ = 0;
+};
+
+// Replaces every match using ECMAScript format rules ($&, $1..$99, $`, $', $$), the same as std::regex_replace,
+// appending the result to out. Returns false, having written nothing, when the pattern does not match at all.
+bool regex_replace_all( const RegexEngine& re, const char* data, size_t len, const char* fmt, size_t fmtLen, TextSink& out );
+
+const char* regex_engine_name();
+
+#endif // SQLLITEBOLTONREGEXENGINE_H
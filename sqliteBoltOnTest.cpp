@@ -0,0 +1,595 @@
+/* Tests for the bolt-on regex functions and the Levenshtein extension, run through SQL the way queries use them.
+*
+* Results are checked against values worked out here, independently of the code under test: the plain DP for
+* every Levenshtein kernel, a full-value search for the windowed streams, and a WHERE regexp(...) for the
+* table-valued scans. Exits non-zero when any check fails, with one line on stderr per failure.
+*
+* Build and run: cmake -S . -B build && cmake --build build && ctest --test-dir build. CMakeLists.txt links this with
+* libboltons.a, so every connection opened here has both sets of functions.
+*
+*   bolton_test --extension=PATH [regex] [levenshtein]
+* instead loads the loadable extension at PATH into a plain connection and runs fixed queries with known results
+* against it: those of each set of functions named, which it must define, and none of the others, which it must not.
+* ctest runs this for levenshtein.so, bolton.so and boltons.so.
+*
+* Documented functions:
+   static std::string query( sqlite3* db, const std::string& sql );
+   static void expect( sqlite3* db, const std::string& sql, const std::string& expected );
+   static int reference_levenshtein( const std::vector< int >& a, const std::vector< int >& b );
+   static int reference_osa( const std::vector< int >& a, const std::vector< int >& b );
+   static void test_regex_functions();
+   static void test_regex_stream();
+   static void test_regexp_blob();
+   static void test_regex_memo();
+   static void test_regexp_scan();
+   static void test_levenshtein_kernels();
+   static void test_levenshtein_indexes();
+   static void test_levenshtein_memo();
+   static void test_extension( const std::string& path, bool regex, bool levenshtein );
+   int main( int argc, char** argv );
+
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+#include "sqliteBoltOnBundle.h"
+#include "sqliteBoltOnFunctions.h"
+#include "sqliteBoltOnRegexEngine.h"
+
+static int failures = 0;
+
+#define CHECK( cond, what )                                                                 \
+  do {                                                                                      \
+    if ( !( cond ) ) {                                                                      \
+      std::cerr << __FILE__ << ':' << __LINE__ << ": " << #cond << " failed: " << what << '\n'; \
+      ++failures;                                                                           \
+    }                                                                                       \
+  } while ( 0 )
+
+// Every row of the result, one per line, columns separated by '|' and NULL written as NULL; "error: ..." on failure
+static std::string query( sqlite3* db, const std::string& sql ) {
+  std::string   out;
+  sqlite3_stmt* stmt = nullptr;
+  if ( sqlite3_prepare_v2( db, sql.c_str(), -1, &stmt, nullptr ) != SQLITE_OK ) {
+    return std::string( "error: " ) + sqlite3_errmsg( db );
+  }
+  int rc;
+  while ( ( rc = sqlite3_step( stmt ) ) == SQLITE_ROW ) {
+    if ( !out.empty() ) {
+      out += '\n';
+    }
+    for ( int i = 0; i < sqlite3_column_count( stmt ); ++i ) {
+      if ( i ) {
+        out += '|';
+      }
+      const unsigned char* text = sqlite3_column_text( stmt, i );
+      out += text ? reinterpret_cast< const char* >( text ) : "NULL";
+    }
+  }
+  if ( rc != SQLITE_DONE ) {
+    out = std::string( "error: " ) + sqlite3_errmsg( db );
+  }
+  sqlite3_finalize( stmt );
+  return out;
+}
+
+static void expect( sqlite3* db, const std::string& sql, const std::string& expected ) {
+  std::string got = query( db, sql );
+  CHECK( got == expected, sql << "\n  got:      " << got << "\n  expected: " << expected );
+}
+
+static void exec( sqlite3* db, const std::string& sql ) {
+  char* error = nullptr;
+  if ( sqlite3_exec( db, sql.c_str(), nullptr, nullptr, &error ) != SQLITE_OK ) {
+    CHECK( false, sql << ": " << ( error ? error : "?" ) );
+    sqlite3_free( error );
+  }
+}
+
+// Inserts each value into table( column ) as TEXT, in order, so the n-th value has rowid n
+static void insert_values( sqlite3* db, const std::string& table, const std::string& column, const std::vector< std::string >& values ) {
+  sqlite3_stmt* stmt = nullptr;
+  std::string   sql  = "INSERT INTO " + table + "( " + column + " ) VALUES ( ?1 )";
+  if ( sqlite3_prepare_v2( db, sql.c_str(), -1, &stmt, nullptr ) != SQLITE_OK ) {
+    CHECK( false, sql << ": " << sqlite3_errmsg( db ) );
+    return;
+  }
+  exec( db, "BEGIN" );
+  for ( const std::string& v : values ) {
+    sqlite3_bind_text( stmt, 1, v.data(), static_cast< int >( v.size() ), SQLITE_TRANSIENT );
+    CHECK( sqlite3_step( stmt ) == SQLITE_DONE, sql << ": " << sqlite3_errmsg( db ) );
+    sqlite3_reset( stmt );
+  }
+  exec( db, "COMMIT" );
+  sqlite3_finalize( stmt );
+}
+
+static sqlite3* open_db( const char* path = ":memory:" ) {
+  sqlite3* db = nullptr;
+  if ( sqlite3_open( path, &db ) != SQLITE_OK ) {
+    std::cerr << "cannot open " << path << ": " << sqlite3_errmsg( db ) << '\n';
+    exit( 1 );
+  }
+  return db;
+}
+
+static std::string random_string( std::mt19937_64& rng, const std::string& alphabet, size_t len ) {
+  std::string s;
+  for ( size_t i = 0; i < len; ++i ) {
+    s += alphabet[ rng() % alphabet.size() ];
+  }
+  return s;
+}
+
+// The plain two-row DP, over whatever symbols the caller splits its strings into
+static int reference_levenshtein( const std::vector< int >& a, const std::vector< int >& b ) {
+  std::vector< int > prev( b.size() + 1 ), curr( b.size() + 1 );
+  for ( size_t j = 0; j <= b.size(); ++j ) {
+    prev[ j ] = static_cast< int >( j );
+  }
+  for ( size_t i = 0; i < a.size(); ++i ) {
+    curr[ 0 ] = static_cast< int >( i + 1 );
+    for ( size_t j = 0; j < b.size(); ++j ) {
+      curr[ j + 1 ] = std::min( { prev[ j + 1 ] + 1, curr[ j ] + 1, prev[ j ] + ( a[ i ] != b[ j ] ) } );
+    }
+    std::swap( prev, curr );
+  }
+  return prev[ b.size() ];
+}
+
+// Optimal string alignment: Levenshtein plus transposition of adjacent symbols, no substring edited twice
+static int reference_osa( const std::vector< int >& a, const std::vector< int >& b ) {
+  std::vector< std::vector< int > > d( a.size() + 1, std::vector< int >( b.size() + 1 ) );
+  for ( size_t i = 0; i <= a.size(); ++i ) {
+    d[ i ][ 0 ] = static_cast< int >( i );
+  }
+  for ( size_t j = 0; j <= b.size(); ++j ) {
+    d[ 0 ][ j ] = static_cast< int >( j );
+  }
+  for ( size_t i = 1; i <= a.size(); ++i ) {
+    for ( size_t j = 1; j <= b.size(); ++j ) {
+      d[ i ][ j ] = std::min( { d[ i - 1 ][ j ] + 1, d[ i ][ j - 1 ] + 1, d[ i - 1 ][ j - 1 ] + ( a[ i - 1 ] != b[ j - 1 ] ) } );
+      if ( i > 1 && j > 1 && a[ i - 1 ] == b[ j - 2 ] && a[ i - 2 ] == b[ j - 1 ] ) {
+        d[ i ][ j ] = std::min( d[ i ][ j ], d[ i - 2 ][ j - 2 ] + 1 );
+      }
+    }
+  }
+  return d[ a.size() ][ b.size() ];
+}
+
+static std::vector< int > bytes_of( const std::string& s ) { return std::vector< int >( s.begin(), s.end() ); }
+
+static void test_regex_functions() {
+  sqlite3* db = open_db();
+  expect( db, "SELECT 'MRN:123' REGEXP 'MRN:\\d+', 'mrn:123' REGEXP 'MRN:\\d+', regexp( 'MRN', 'mrn:123', 'i' )", "1|0|1" );
+  expect( db, "SELECT NULL REGEXP 'a', 'a' REGEXP NULL", "0|0" );
+  expect( db, "SELECT regex_replace( 'John Smith', '(\\w+) (\\w+)', '$2, $1' ), regex_replace( 'abc', 'x', 'y' )", "Smith, John|abc" );
+  expect( db, "SELECT regex_replace( 'é', '', '-' ), regex_replace( 'aéb', 'x*', '-' )", "-é-|-a-é-b-" );
+  expect( db, "SELECT regex_extract( 'MRN:123456 seen', 'MRN:(\\d+)', 1 ), regex_extract( 'none', 'MRN:(\\d+)' )", "123456|NULL" );
+  expect( db, "SELECT regexp_any( 'chest pain', '[\"fever\", \"pain\"]' ), regexp_any( 'cough', '[\"fever\", \"pain\"]' )", "1|0" );
+  expect( db, "SELECT regexp_which( 'Fever and PAIN', '{\"f\": \"fever\", \"p\": \"pain\", \"c\": \"cough\"}', 'i' )", "[\"f\",\"p\"]" );
+  expect( db, "SELECT match, group1, start FROM regex_matches( 'a1 b22 c333', '([a-z])(\\d+)' ) WHERE group1 <> 'b'", "a1|a|0\nc333|c|7" );
+  CHECK( query( db, "SELECT 'x' REGEXP '('" ).compare( 0, 7, "error: " ) == 0, "an invalid pattern is an error" );
+  CHECK( query( db, "SELECT regexp( 'x', 'x', 'q' )" ) == "error: Invalid regex flag used", "an invalid flag is an error" );
+
+  // Literal prefilter: rows without the required literal never reach the engine, the rest must still match exactly
+  expect( db, "SELECT 'acd' REGEXP 'ab?cd', 'abcd' REGEXP 'ab?cd', 'ad' REGEXP 'ab?cd'", "1|1|0" );
+  expect( db, "SELECT 'xx HELLO yy' REGEXP 'hello', 'xx HELLO yy' REGEXP '(?:)hello', regexp( 'hello', 'xx HELLO yy', 'i' )", "0|0|1" );
+  expect( db, "SELECT 'seen at MRN:123456.' REGEXP 'MRN:\\d{6}', 'MRN:12345' REGEXP 'MRN:\\d{6}'", "1|0" );
+  expect( db, "SELECT 'colour' REGEXP 'colou?r', 'color' REGEXP 'colou?r', 'a.b' REGEXP 'a\\.b', 'axb' REGEXP 'a\\.b'", "1|1|1|0" );
+  // A '{' that is not a plain repeat ends the prefilter: {,n} repeats in newer PCRE2, and is literal text elsewhere
+  expect( db, "SELECT 'abbbcd' REGEXP 'ab{,3}cd', 'ab{,3}cd' REGEXP 'ab{,3}cd', 'a{b' REGEXP 'a{b', 'x{' REGEXP 'x{'",
+          query( db, "SELECT 'abbbcd' REGEXP '(?:ab{,3}cd)', 'ab{,3}cd' REGEXP '(?:ab{,3}cd)', 'a{b' REGEXP '(?:a{b)', 'x{' REGEXP '(?:x{)'" ) );
+  sqlite3_close( db );
+
+  struct Case {
+    const char* pattern;
+    bool        icase;
+    const char* literal;
+  };
+  const Case cases[] = {
+    { "MRN:\\d{6}", false, "MRN:" },
+    { "ab{2}cd", false, "ab" },
+    { "ab{0,2}cd", false, "cd" },
+    { "ab{1,}cd", false, "ab" },
+    { "ab{,3}cd", false, "" },
+    { "ab{,3}", false, "" },
+    { "a{b", false, "" },
+    { "xy{", false, "" },
+    { "xy{2", false, "" },
+    { "xy{2,", false, "" },
+    { "Hello", true, "hello" },
+    { "a|bcd", false, "" },
+  };
+  for ( const Case& c : cases ) {
+    std::string literal = regex_required_literal( c.pattern, c.icase );
+    CHECK( literal == c.literal, c.pattern << " gave literal \"" << literal << "\", expected \"" << c.literal << "\"" );
+  }
+}
+
+// A stream fed in pieces of every size must agree with a search over the whole value
+static void test_regex_stream() {
+  struct Case {
+    const char* pattern;
+    std::string value;
+  };
+  const std::vector< Case > cases = {
+    { "MRN:\\d{6}", std::string( 5000, 'x' ) + "MRN:123456" + std::string( 3000, 'y' ) },
+    { "MRN:\\d{6}", std::string( 5000, 'x' ) + "MRN:12345" + std::string( 3000, 'y' ) },
+    { "end$", std::string( 9000, 'z' ) + "end" },
+    { "end$", std::string( 9000, 'z' ) + "end." },
+    { "\\bcat\\b", std::string( 4000, ' ' ) + "concatenate" + std::string( 4000, ' ' ) },
+    { "\\bcat\\b", std::string( 4000, '-' ) + "cat" },
+  };
+  for ( const Case& c : cases ) {
+    std::string                    error;
+    RegexFlags                     flags;
+    std::unique_ptr< RegexEngine > re = compile_regex( c.pattern, flags, error );
+    CHECK( re, c.pattern << ": " << error );
+    if ( !re ) {
+      continue;
+    }
+    bool   whole = re->search( c.value.data(), c.value.size() );
+    size_t reach = regex_match_reach( c.pattern, flags );
+    CHECK( reach != SIZE_MAX, c.pattern << " should have a bounded reach" );
+    for ( size_t piece : { 1, 7, 100, 4096 } ) {
+      std::unique_ptr< RegexStream > stream = open_regex_stream( *re, reach );
+      CHECK( stream, c.pattern << " did not open a stream" );
+      if ( !stream ) {
+        break;
+      }
+      bool matched = false;
+      for ( size_t offset = 0; offset < c.value.size() && !matched; offset += piece ) {
+        matched = stream->feed( c.value.data() + offset, std::min( piece, c.value.size() - offset ) );
+      }
+      matched = stream->finish() || matched;
+      CHECK( matched == whole, c.pattern << " in pieces of " << piece << ": stream " << matched << ", whole value " << whole );
+    }
+  }
+  CHECK( regex_match_reach( "a.*b", RegexFlags() ) == SIZE_MAX, "a.*b has no bound" );
+}
+
+// regexp_blob() reads 64 KB chunks; matches straddling a chunk boundary or ending the value must still be found
+static void test_regexp_blob() {
+  sqlite3* db = open_db();
+  exec( db, "CREATE TABLE docs( body TEXT )" );
+  insert_values( db, "docs", "body",
+                 { std::string( 65536 - 5, 'x' ) + "MRN:123456" + std::string( 140000, 'y' ), std::string( 200000, 'x' ) + "MRN:12345",
+                   std::string( 200000, 'y' ) + "MRN:654321", "short MRN:111111", std::string( 140000, 'z' ) } );
+  exec( db, "INSERT INTO docs VALUES ( NULL )" );
+  expect( db, "SELECT group_concat( regexp_blob( 'docs', 'body', rowid, 'MRN:\\d{6}$' ) || regexp( 'MRN:\\d{6}$', body ), ',' ) FROM docs",
+          "00,00,11,11,00,00" );
+  expect( db, "SELECT group_concat( regexp_blob( 'docs', 'body', rowid, 'mrn:\\d{6}', 'i' ) || regexp( 'mrn:\\d{6}', body, 'i' ), ',' ) FROM docs",
+          "11,00,11,11,00,00" );
+  expect( db, "SELECT regexp_blob( 'docs', 'body', 99, 'x' )", "0" );
+  sqlite3_close( db );
+}
+
+// With the memo on, a statement that repeats its arguments must give the same results and serve some from the memo
+static void test_regex_memo() {
+  sqlite3*                   db = open_db();
+  std::vector< std::string > values;
+  const char*                distinct[] = { "banana", "Apple pie", "cherry", "MRN:123456", "", "naan bread" };
+  for ( int i = 0; i < 300; ++i ) {
+    values.push_back( distinct[ i % 6 ] );
+  }
+  exec( db, "CREATE TABLE m( v TEXT )" );
+  insert_values( db, "m", "v", values );
+  const std::string sql = "SELECT group_concat( regex_replace( v, '[aeiou]+', '<$&>' ) || regexp( 'an', v ) || ifnull( regex_extract( v, '(n)a', 1 ), '-' ), ',' ) FROM m";
+  std::string       plain = query( db, sql );
+  expect( db, "SELECT boltOn_config( 'memo_slots', 1024 )", "1024" );
+  expect( db, sql, plain );
+  CHECK( query( db, "SELECT sum( memo_hits ) > 0 FROM boltOn_stats()" ) == "1", "no memo hits" );
+  exec( db, "CREATE VIEW clear_stats AS SELECT boltOn_stats_reset()" );
+  CHECK( query( db, "SELECT * FROM clear_stats" ).compare( 0, 7, "error: " ) == 0, "boltOn_stats_reset() ran from a view" );
+  expect( db, "SELECT boltOn_config( 'memo_slots', 1 )", "1" );
+  expect( db, sql, plain );
+  sqlite3_close( db );
+}
+
+// regexp_scan() must return the same rowids as the single-threaded WHERE, on a file (worker threads) and in memory
+static void test_regexp_scan() {
+  std::mt19937_64            rng( 7 );
+  std::vector< std::string > values;
+  for ( int i = 0; i < 5000; ++i ) {
+    std::string v = random_string( rng, "abc MRN:0123456789", 10 + rng() % 200 );
+    values.push_back( i % 97 == 0 ? std::string( 3000, 'q' ) + "sepsis" + v : v ); // Some values spill onto overflow pages
+  }
+  const std::string path = "bolton_test_scan.db";
+  std::remove( path.c_str() );
+  for ( const char* where : { path.c_str(), ":memory:" } ) {
+    sqlite3* db = open_db( where );
+    exec( db, "PRAGMA journal_mode = WAL; CREATE TABLE notes( body TEXT )" );
+    insert_values( db, "notes", "body", values );
+    exec( db, "INSERT INTO notes VALUES ( NULL ), ( 42 )" );
+    for ( const char* threads : { "1", "4" } ) {
+      exec( db, std::string( "SELECT boltOn_config( 'scan_threads', " ) + threads + " )" );
+      for ( const char* pattern : { "MRN:\\d{4}", "SEPSIS", "a b c", "^q+sepsis", "no such text" } ) {
+        std::string p        = pattern;
+        std::string expected = query( db, "SELECT group_concat( rowid ) FROM ( SELECT rowid FROM notes WHERE regexp( '" + p + "', body, 'i' ) ORDER BY rowid )" );
+        expect( db, "SELECT group_concat( id ) FROM ( SELECT id FROM regexp_scan( 'notes', 'body', '" + p + "', 'i' ) ORDER BY id )", expected );
+      }
+    }
+    expect( db, "SELECT count(*) FROM notes n JOIN regexp_scan( 'notes', 'body', '42' ) s ON n.rowid = s.id", query( db, "SELECT count(*) FROM notes WHERE body REGEXP '42'" ) );
+    sqlite3_close( db );
+  }
+  std::remove( path.c_str() );
+  std::remove( ( path + "-wal" ).c_str() );
+  std::remove( ( path + "-shm" ).c_str() );
+}
+
+// Every kernel, picked by length (64-bit Myers, blocked Myers, the SIMD wavefront from 8 words up, the DPs),
+// against the reference DP, with and without a bound
+static void test_levenshtein_kernels() {
+  sqlite3*      db   = open_db();
+  sqlite3_stmt* stmt = nullptr;
+  if ( sqlite3_prepare_v2( db, "SELECT levenshtein( ?1, ?2 ), levenshtein( ?1, ?2, ?3 ), levenshtein( ?2, ?1, ?3 ), damerau_levenshtein( ?1, ?2 ), levenshtein_utf8( ?1, ?2 )",
+                           -1, &stmt, nullptr ) != SQLITE_OK ) {
+    CHECK( false, sqlite3_errmsg( db ) );
+    sqlite3_close( db );
+    return;
+  }
+  std::mt19937_64       rng( 3 );
+  std::vector< size_t > lengths = { 0, 1, 2, 31, 63, 64, 65, 127, 128, 129, 200, 448, 511, 512, 513, 600 };
+  for ( int i = 0; i < 40; ++i ) {
+    lengths.push_back( rng() % 700 );
+  }
+  for ( size_t len : lengths ) {
+    for ( const char* alphabet : { "ab", "acgt", "abcdefghijklmnopqrstuvwxyz" } ) {
+      std::string a = random_string( rng, alphabet, len );
+      std::string b = a;
+      int         edits = static_cast< int >( rng() % ( 2 + len / 4 ) );
+      for ( int e = 0; e < edits; ++e ) { // Substitutions, insertions, deletions and transpositions
+        size_t at = b.empty() ? 0 : rng() % b.size();
+        switch ( rng() % 4 ) {
+          case 0:
+            if ( !b.empty() ) b[ at ] = alphabet[ rng() % strlen( alphabet ) ];
+            break;
+          case 1:
+            b.insert( b.begin() + at, alphabet[ rng() % strlen( alphabet ) ] );
+            break;
+          case 2:
+            if ( !b.empty() ) b.erase( b.begin() + at );
+            break;
+          default:
+            if ( at + 1 < b.size() ) std::swap( b[ at ], b[ at + 1 ] );
+            break;
+        }
+      }
+      if ( rng() % 5 == 0 ) {
+        b = random_string( rng, alphabet, rng() % 700 ); // Unrelated, so lengths differ widely too
+      }
+      int d   = reference_levenshtein( bytes_of( a ), bytes_of( b ) );
+      int osa = a.size() <= 300 && b.size() <= 300 ? reference_osa( bytes_of( a ), bytes_of( b ) ) : -1;
+      for ( int max : { 0, 1, 3, d - 1, d, d + 5 } ) {
+        if ( max < 0 ) {
+          continue;
+        }
+        sqlite3_bind_text( stmt, 1, a.data(), static_cast< int >( a.size() ), SQLITE_STATIC );
+        sqlite3_bind_text( stmt, 2, b.data(), static_cast< int >( b.size() ), SQLITE_STATIC );
+        sqlite3_bind_int( stmt, 3, max );
+        if ( sqlite3_step( stmt ) != SQLITE_ROW ) {
+          CHECK( false, sqlite3_errmsg( db ) );
+        } else {
+          int bounded = std::min( d, max + 1 );
+          CHECK( sqlite3_column_int( stmt, 0 ) == d, "levenshtein, lengths " << a.size() << ' ' << b.size() << ": " << sqlite3_column_int( stmt, 0 ) << " != " << d );
+          CHECK( sqlite3_column_int( stmt, 1 ) == bounded, "levenshtein max " << max << ", lengths " << a.size() << ' ' << b.size() << ": " << sqlite3_column_int( stmt, 1 ) << " != " << bounded );
+          CHECK( sqlite3_column_int( stmt, 2 ) == bounded, "levenshtein max " << max << ", lengths " << b.size() << ' ' << a.size() << ": " << sqlite3_column_int( stmt, 2 ) << " != " << bounded );
+          CHECK( osa < 0 || sqlite3_column_int( stmt, 3 ) == osa, "damerau_levenshtein, lengths " << a.size() << ' ' << b.size() << ": " << sqlite3_column_int( stmt, 3 ) << " != " << osa );
+          CHECK( sqlite3_column_int( stmt, 4 ) == d, "levenshtein_utf8 of ASCII, lengths " << a.size() << ' ' << b.size() );
+        }
+        sqlite3_reset( stmt );
+      }
+    }
+  }
+
+  // Code points, not bytes: 1- to 4-byte UTF-8 sequences
+  const char* symbols[] = { "a", "\xc3\xa9", "\xc3\x9f", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+  for ( int i = 0; i < 60; ++i ) {
+    std::vector< int > ca, cb;
+    std::string        a, b;
+    size_t             la = rng() % ( i < 50 ? 80 : 300 ), lb = rng() % ( i < 50 ? 80 : 300 );
+    for ( size_t k = 0; k < la; ++k ) {
+      ca.push_back( static_cast< int >( rng() % 5 ) );
+      a += symbols[ ca.back() ];
+    }
+    for ( size_t k = 0; k < lb; ++k ) {
+      cb.push_back( k < la && rng() % 3 ? ca[ k ] : static_cast< int >( rng() % 5 ) );
+      b += symbols[ cb.back() ];
+    }
+    int d = reference_levenshtein( ca, cb );
+    sqlite3_bind_text( stmt, 1, a.data(), static_cast< int >( a.size() ), SQLITE_STATIC );
+    sqlite3_bind_text( stmt, 2, b.data(), static_cast< int >( b.size() ), SQLITE_STATIC );
+    sqlite3_bind_int( stmt, 3, d );
+    if ( sqlite3_step( stmt ) == SQLITE_ROW ) {
+      CHECK( sqlite3_column_int( stmt, 4 ) == d, "levenshtein_utf8, " << la << ' ' << lb << " code points: " << sqlite3_column_int( stmt, 4 ) << " != " << d );
+      CHECK( sqlite3_column_int( stmt, 0 ) == reference_levenshtein( bytes_of( a ), bytes_of( b ) ), "levenshtein of UTF-8 counts bytes" );
+    } else {
+      CHECK( false, sqlite3_errmsg( db ) );
+    }
+    sqlite3_reset( stmt );
+  }
+  sqlite3_finalize( stmt );
+
+  // A constant pattern is compiled once per statement, also beside a second call site whose arguments both vary
+  exec( db, "CREATE TABLE words( a TEXT, b TEXT )" );
+  for ( int i = 0; i < 200; ++i ) {
+    std::string a, b;
+    for ( int k = 0; k < 12; ++k ) {
+      a += symbols[ rng() % 5 ];
+      b += symbols[ rng() % 5 ];
+    }
+    exec( db, "INSERT INTO words VALUES ( '" + a + "', '" + b + "' )" );
+  }
+  const std::string term = std::string( "caf" ) + symbols[ 1 ] + symbols[ 4 ] + symbols[ 3 ];
+  std::string       each = query( db, "SELECT group_concat( levenshtein_utf8( a, b ) || ':' || levenshtein_utf8( '" + term + "', a ), ',' ) FROM ( SELECT a, b FROM words ORDER BY rowid )" );
+  exec( db, "SELECT levenshtein_stats_reset()" );
+  expect( db, "SELECT group_concat( levenshtein_utf8( a, b ) || ':' || levenshtein_utf8( '" + term + "', a ), ',' ) FROM words", each );
+  // The constant site misses on the row that leaves its markers and the row that compiles, the other on every row
+  expect( db, "SELECT cache_hits, cache_misses FROM levenshtein_stats() WHERE function = 'levenshtein_utf8'", "198|202" );
+
+  expect( db, "SELECT levenshtein( 'kitten', 'sitting' ), levenshtein( 'kitten', 'sitting', 2 ), levenshtein( 'café', 'cafe' ), levenshtein_utf8( 'café', 'cafe' )", "3|3|2|1" );
+  expect( db, "SELECT damerau_levenshtein( 'ab', 'ba' ), damerau_levenshtein( 'ca', 'abc' ), hamming( 'karolin', 'kathrin' )", "1|3|3" );
+  expect( db, "SELECT levenshtein( NULL, 'a' ), levenshtein( '', '' )", "NULL|0" );
+
+  // Innocuous: usable in the views, triggers and indexes of a schema read with trusted_schema off
+  exec( db, "PRAGMA trusted_schema = OFF; CREATE TABLE pairs( a TEXT, b TEXT ); INSERT INTO pairs VALUES ( 'kitten', 'sitting' )" );
+  exec( db, "CREATE VIEW scores AS SELECT levenshtein( a, b ), levenshtein( a, b, 1 ), levenshtein_utf8( a, b ), damerau_levenshtein( a, b ), "
+            "round( levenshtein_ratio( a, b ), 3 ), round( jaro_winkler( a, b ), 3 ), hamming( a, a ), soundex( a ), double_metaphone( a ), nysiis( a ), "
+            "levenshtein_topk( b, a, 1 ) FROM pairs" );
+  exec( db, "CREATE INDEX pairs_distance ON pairs( levenshtein( a, b ) )" );
+  expect( db, "SELECT * FROM scores", "3|2|3|3|0.571|0.746|0|K350|KTN|CATAN|[{\"value\":\"sitting\",\"distance\":3}]" );
+  // Direct-only: what changes connection state is refused from a view even when the schema is trusted
+  exec( db, "PRAGMA trusted_schema = ON; CREATE VIEW clear_stats AS SELECT levenshtein_stats_reset()" );
+  CHECK( query( db, "SELECT * FROM clear_stats" ).compare( 0, 7, "error: " ) == 0, "levenshtein_stats_reset() ran from a view" );
+  sqlite3_close( db );
+}
+
+// Each index, and levenshtein_pairs(), against the same search done row by row with levenshtein()
+static void test_levenshtein_indexes() {
+  sqlite3*                   db = open_db();
+  std::mt19937_64            rng( 11 );
+  std::vector< std::string > names;
+  for ( int i = 0; i < 400; ++i ) {
+    names.push_back( random_string( rng, "abcd", 2 + rng() % 9 ) );
+  }
+  exec( db, "CREATE TABLE names( name TEXT ); CREATE INDEX names_name ON names( name )" );
+  insert_values( db, "names", "name", names );
+  exec( db, "CREATE VIRTUAL TABLE name_idx USING levenshtein_index( names, name ); CREATE VIRTUAL TABLE name_q USING qgram_index( names, name, 2 )" );
+  insert_values( db, "names", "name", { "abcabc", "dddd", "abca" } ); // Through the triggers the indexes keep
+  exec( db, "UPDATE names SET name = 'bbbbbbb' WHERE rowid = 5; DELETE FROM names WHERE rowid = 6" );
+
+  for ( const char* target : { "abca", "dcbadcba", "a", "bbbbbbbb" } ) {
+    for ( int k : { 0, 1, 2, 3 } ) {
+      std::string t = target, ks = std::to_string( k );
+      std::string expected = query( db, "SELECT group_concat( rowid || ':' || d ) FROM ( SELECT rowid, levenshtein( name, '" + t + "' ) AS d FROM names ORDER BY rowid ) WHERE d <= " + ks );
+      expect( db, "SELECT group_concat( rowid || ':' || distance ) FROM ( SELECT rowid, distance FROM name_idx WHERE word MATCH '" + t + "' AND distance <= " + ks + " ORDER BY rowid )", expected );
+      expect( db, "SELECT group_concat( rowid || ':' || distance ) FROM ( SELECT rowid, distance FROM name_q( '" + t + "', " + ks + " ) ORDER BY rowid )", expected );
+      expect( db, "SELECT group_concat( rowid || ':' || distance ) FROM ( SELECT rowid, distance FROM fuzzy_candidates( 'names', 'name', '" + t + "', " + ks + " ) ORDER BY rowid )", expected );
+    }
+  }
+  // A k past every target length still finds keys much longer than the target
+  exec( db, "CREATE TABLE t2( x TEXT ); CREATE INDEX t2_x ON t2( x )" );
+  insert_values( db, "t2", "x", { std::string( 2000, 'a' ), "abc" } );
+  for ( const char* k : { "5000", "2000", "1999" } ) {
+    expect( db, std::string( "SELECT group_concat( rowid || ':' || distance ) FROM ( SELECT rowid, distance FROM fuzzy_candidates( 't2', 'x', '', " ) + k + " ) ORDER BY rowid )",
+            query( db, std::string( "SELECT group_concat( rowid || ':' || d ) FROM ( SELECT rowid, levenshtein( '', x, " ) + k + " ) AS d FROM t2 ORDER BY rowid ) WHERE d <= " + k ) );
+  }
+  // BLOB keys sort after every text key; one equal to a text key's bytes is still not a text match
+  exec( db, "INSERT INTO t2( x ) VALUES ( x'616263' ), ( x'61626364' )" );
+  expect( db, "SELECT group_concat( rowid || ':' || distance ) FROM ( SELECT rowid, distance FROM fuzzy_candidates( 't2', 'x', 'abc', 1 ) ORDER BY rowid )", "2:0" );
+  CHECK( query( db, "SELECT count(*) FROM fuzzy_candidates( 't2', 'x', '', 2147483647 )" ).compare( 0, 7, "error: " ) == 0, "k that overflows int accepted" );
+
+  for ( const char* threads : { "1", "3" } ) {
+    std::string expected = query( db, "SELECT count(*), sum( a.rowid * 7 + b.rowid * 13 + levenshtein( a.name, b.name ) ) FROM names a JOIN names b ON a.rowid < b.rowid WHERE levenshtein( a.name, b.name, 2 ) <= 2" );
+    expect( db, std::string( "SELECT count(*), sum( rowid_a * 7 + rowid_b * 13 + distance ) FROM levenshtein_pairs( 'names', 'name', 2, " ) + threads + " )", expected );
+  }
+  // Both read any table they are named, so a view or trigger, which may come from a schema the user did not write,
+  // cannot use them
+  exec( db, "CREATE VIEW close_pairs AS SELECT * FROM levenshtein_pairs( 'names', 'name', 1 )" );
+  CHECK( query( db, "SELECT count(*) FROM close_pairs" ).compare( 0, 7, "error: " ) == 0, "levenshtein_pairs() ran from a view" );
+  exec( db, "CREATE VIEW near_jon AS SELECT * FROM fuzzy_candidates( 'names', 'name', 'jon', 1 )" );
+  CHECK( query( db, "SELECT count(*) FROM near_jon" ).compare( 0, 7, "error: " ) == 0, "fuzzy_candidates() ran from a view" );
+  sqlite3_close( db );
+}
+
+static void test_levenshtein_memo() {
+  sqlite3*                   db = open_db();
+  std::vector< std::string > values;
+  const char*                distinct[] = { "jonathan", "jonathon", "café crème", "", "johnathan smith" };
+  for ( int i = 0; i < 250; ++i ) {
+    values.push_back( distinct[ i % 5 ] );
+  }
+  exec( db, "CREATE TABLE m( v TEXT )" );
+  insert_values( db, "m", "v", values );
+  const std::string sql   = "SELECT group_concat( levenshtein( v, 'jonathan' ) || levenshtein( v, 'jon', 2 ) || damerau_levenshtein( v, 'jnoathan' ) || levenshtein_utf8( v, 'cafe creme' ) || round( levenshtein_ratio( v, 'jonathan' ), 6 ), ',' ) FROM m";
+  std::string       plain = query( db, sql );
+  expect( db, "SELECT levenshtein_config( 'memo_slots', 512 )", "512" );
+  expect( db, sql, plain );
+  CHECK( query( db, "SELECT sum( memo_hits ) > 0 FROM levenshtein_stats()" ) == "1", "no memo hits" );
+  sqlite3_close( db );
+}
+
+// The examples documented in sqlite_levenshtein.c and sqliteBoltOnFunctions.cpp, with the results given there
+static void test_extension( const std::string& path, bool regex, bool levenshtein ) {
+  sqlite3* db    = open_db();
+  char*    error = nullptr;
+  sqlite3_enable_load_extension( db, 1 );
+  if ( sqlite3_load_extension( db, path.c_str(), nullptr, &error ) != SQLITE_OK ) {
+    CHECK( false, "cannot load " << path << ": " << ( error ? error : "?" ) );
+    sqlite3_free( error );
+    sqlite3_close( db );
+    return;
+  }
+  static const char* const kHas = "SELECT count(*) > 0 FROM pragma_function_list WHERE name = ";
+  expect( db, std::string( kHas ) + "'regex_replace'", regex ? "1" : "0" );
+  expect( db, std::string( kHas ) + "'levenshtein'", levenshtein ? "1" : "0" );
+
+  if ( regex ) {
+    expect( db, "SELECT 'MRN:123' REGEXP 'MRN:\\d+', regex_replace( 'Apple pie', 'p+', 'P', 'i' )", "1|APle Pie" );
+    expect( db, "SELECT regex_extract( 'MRN:123456 seen', 'MRN:(\\d+)', 1 ), regexp_which( 'fever and pain', '[\"cough\", \"pain\", \"fever\"]' )", "123456|[1,2]" );
+    expect( db, "SELECT group_concat( match, ' ' ) FROM regex_matches( 'a1 b22 c333', '[a-z]\\d+' )", "a1 b22 c333" );
+    exec( db, "CREATE TABLE notes( body TEXT ); INSERT INTO notes VALUES ( 'MRN:1' ), ( 'none' ), ( 'Sepsis, MRN:22' ), ( NULL )" );
+    expect( db, "SELECT group_concat( id ) FROM ( SELECT id FROM regexp_scan( 'notes', 'body', 'MRN:\\d+' ) ORDER BY id )", "1,3" );
+    expect( db, "SELECT group_concat( regexp_blob( 'notes', 'body', rowid, 'sepsis', 'i' ) ) FROM notes", "0,0,1,0" );
+    expect( db, "SELECT boltOn_config( 'regex_budget_us', 50000 ), calls FROM boltOn_stats() WHERE function = 'regexp_blob'", "50000|4" );
+  }
+  if ( levenshtein ) {
+    expect( db, "SELECT levenshtein( 'kitten', 'sitting' ), levenshtein( 'kitten', 'sitting', 2 ), levenshtein( 'café', 'cafe' ), levenshtein_utf8( 'café', 'cafe' )", "3|3|2|1" );
+    expect( db, "SELECT damerau_levenshtein( 'ab', 'ba' ), levenshtein_ratio( 'kitten', 'sitting' ), jaro_winkler( 'martha', 'marhta' ), hamming( 'karolin', 'kathrin' )",
+            "1|0.571428571428571|0.961111111111111|3" );
+    expect( db, "SELECT soundex( 'Robert' ), double_metaphone( 'Schmidt' ), double_metaphone( 'Schmidt', 1 ), nysiis( 'Macintosh' )", "R163|XMT|SMT|MCANT" );
+    exec( db, "CREATE TABLE names( name TEXT ); INSERT INTO names VALUES ( 'jon' ), ( 'john' ), ( 'joan' ), ( 'mary' ), ( 'jonathan' ); CREATE INDEX names_name ON names( name )" );
+    exec( db, "CREATE VIRTUAL TABLE name_idx USING levenshtein_index( names, name ); CREATE VIRTUAL TABLE name_q USING qgram_index( names, name )" );
+    expect( db, "SELECT group_concat( word || ':' || distance ) FROM ( SELECT word, distance FROM name_idx WHERE word MATCH 'jon' AND distance <= 1 ORDER BY rowid )", "jon:0,john:1,joan:1" );
+    expect( db, "SELECT group_concat( word || ':' || distance ) FROM ( SELECT word, distance FROM name_q( 'jonathon', 1 ) ORDER BY rowid )", "jonathan:1" );
+    expect( db, "SELECT group_concat( word || ':' || distance ) FROM ( SELECT word, distance FROM fuzzy_candidates( 'names', 'name', 'jon', 1 ) ORDER BY rowid )", "jon:0,john:1,joan:1" );
+    expect( db, "SELECT group_concat( rowid_a || '-' || rowid_b || ':' || distance ) FROM ( SELECT * FROM levenshtein_pairs( 'names', 'name', 1 ) ORDER BY 1, 2 )", "1-2:1,1-3:1,2-3:1" );
+    expect( db, "SELECT levenshtein_topk( name, 'jonathon', 1 ) FROM names", "[{\"value\":\"jonathan\",\"distance\":1}]" );
+    expect( db, "SELECT levenshtein_config( 'memo_slots', 4096 ), sum( calls ) > 0 FROM levenshtein_stats()", "4096|1" );
+  }
+  sqlite3_close( db );
+}
+
+int main( int argc, char** argv ) {
+  if ( argc > 1 && strncmp( argv[ 1 ], "--extension=", 12 ) == 0 ) {
+    bool regex = false, levenshtein = false;
+    for ( int i = 2; i < argc; ++i ) {
+      regex       = regex || strcmp( argv[ i ], "regex" ) == 0;
+      levenshtein = levenshtein || strcmp( argv[ i ], "levenshtein" ) == 0;
+    }
+    test_extension( argv[ 1 ] + 12, regex, levenshtein );
+    if ( failures ) {
+      std::cerr << failures << " checks failed\n";
+      return 1;
+    }
+    std::cout << "All checks passed (" << argv[ 1 ] + 12 << ")\n";
+    return 0;
+  }
+  if ( sqlite3_boltons_autoload() != SQLITE_OK ) {
+    std::cerr << "sqlite3_boltons_autoload failed\n";
+    return 1;
+  }
+  failures += sqlLiteBoltOnRegexReplaceTest();
+  test_regex_functions();
+  test_regex_stream();
+  test_regexp_blob();
+  test_regex_memo();
+  test_regexp_scan();
+  test_levenshtein_kernels();
+  test_levenshtein_indexes();
+  test_levenshtein_memo();
+  if ( failures ) {
+    std::cerr << failures << " checks failed\n";
+    return 1;
+  }
+  std::cout << "All checks passed (" << regex_engine_name() << ")\n";
+  return 0;
+}
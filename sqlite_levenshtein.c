@@ -4,12 +4,44 @@
  * Provides a fast C implementation of Levenshtein distance for SQLite3.
  * 
  * COMPILATION:
- *   gcc -shared -fPIC -o levenshtein.so sqlite_levenshtein.c -lsqlite3
+ *   CMakeLists.txt builds this as levenshtein.so, and together with the bolt-on regex functions as boltons.so and
+ *   the static libboltons.a (see sqliteBoltOnBundle.c). By hand:
+ *   gcc -O3 -shared -fPIC -pthread -o levenshtein.so sqlite_levenshtein.c
+ *   Add -DLEVENSHTEIN_REFERENCE to use only the plain DP kernels, e.g. to cross-check the bit-parallel ones.
+ *   AVX2 (x86-64) and NEON (AArch64) kernels for long strings are built in and picked at load time from the
+ *   running CPU; -DLEVENSHTEIN_NO_SIMD leaves them out.
+ *   -DLEVENSHTEIN_NO_THREADS builds levenshtein_pairs() without worker threads, for SQLITE_THREADSAFE=0 builds.
+ *   -DLEVENSHTEIN_NO_STATS leaves out the per-function counters behind levenshtein_stats().
+ *   -DLEVENSHTEIN_BUNDLED leaves sqlite3_api and sqlite3_extension_init() to the bundle it is linked into.
  * 
  * USAGE IN SQLITE3:
  *   sqlite> .load ./levenshtein
  *   sqlite> SELECT levenshtein( 'kitten', 'sitting' );
  *   -- Returns: 3
+ *   sqlite> SELECT levenshtein( 'kitten', 'sitting', 2 );
+ *   -- Returns: 3 (max + 1: the distance is known to exceed 2, computation stopped early)
+ *   sqlite> SELECT levenshtein( 'café', 'cafe' ), levenshtein_utf8( 'café', 'cafe' );
+ *   -- Returns: 2|1 (levenshtein() counts bytes, levenshtein_utf8() counts code points)
+ *   sqlite> SELECT damerau_levenshtein( 'ab', 'ba' ), levenshtein_ratio( 'kitten', 'sitting' ), jaro_winkler( 'martha', 'marhta' ), hamming( 'karolin', 'kathrin' );
+ *   -- Returns: 1|0.571428571428571|0.961111111111111|3
+ *   sqlite> SELECT soundex( 'Robert' ), double_metaphone( 'Schmidt' ), double_metaphone( 'Schmidt', 1 ), nysiis( 'Macintosh' );
+ *   -- Returns: R163|XMT|SMT|MCANT (phonetic keys, deterministic so they can be indexed)
+ *   sqlite> SELECT levenshtein_topk( name, 'jon', 10 ) FROM names;
+ *   -- JSON array of the 10 closest names with their distances
+ *   sqlite> CREATE VIRTUAL TABLE name_idx USING levenshtein_index( names, name );
+ *   sqlite> SELECT rowid, word, distance FROM name_idx WHERE word MATCH 'jon' AND distance <= 2;
+ *   -- Indexed fuzzy search; kept current by triggers on names (see levenshtein_index below)
+ *   sqlite> CREATE VIRTUAL TABLE addr_q USING qgram_index( addresses, line );
+ *   sqlite> SELECT rowid, word, distance FROM addr_q( '12 main st', 2 );
+ *   -- The same search over a q-gram index, which prunes better on longer text (see qgram_index below)
+ *   sqlite> SELECT rowid, word, distance FROM fuzzy_candidates( 'names', 'name', 'jon', 2 );
+ *   -- The same search walking an existing index on names( name ) instead
+ *   sqlite> SELECT rowid_a, rowid_b, distance FROM levenshtein_pairs( 'names', 'name', 2 );
+ *   -- Every pair of names within 2 edits, computed on all cores
+ *   sqlite> SELECT function, calls, early_exits, nanoseconds FROM levenshtein_stats();
+ *   -- Per-function counters for this connection; SELECT levenshtein_stats_reset() clears them
+ *   sqlite> SELECT levenshtein_config( 'memo_slots', 4096 );
+ *   -- Remember up to 4096 results per statement, for joins that compare the same values again and again
  * 
  * USAGE IN PYTHON:
  *   import sqlite3
@@ -21,110 +53,5434 @@
  */
 
 #include <sqlite3ext.h>
+#ifdef LEVENSHTEIN_BUNDLED
+SQLITE_EXTENSION_INIT3
+#else
 SQLITE_EXTENSION_INIT1
+#endif
+
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef LEVENSHTEIN_NO_THREADS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+#define MIN3( a, b, c ) ( ( a ) < ( b ) ? ( ( a ) < ( c ) ? ( a ) : ( c ) ) : ( ( b ) < ( c ) ? ( b ) : ( c ) ) )
+
+/*
+ * The DP kernels are generated for 8-, 16- and 32-bit cells; levenshtein_distance() picks the narrowest
+ * type that holds every value the rows can take, so long rows stay in cache. The cp variant compares
+ * code points instead of bytes.
+ *
+ * levenshtein_dp_*: reference kernel, the plain two-row DP. Always correct, used for every call when
+ * built with -DLEVENSHTEIN_REFERENCE so the bit-parallel kernels can be checked against it.
+ *
+ * levenshtein_bounded_*: distance limited to max, for WHERE levenshtein( a, b, k ) <= k. Returns max + 1
+ * as soon as the distance is known to exceed max: up front on the length difference, then when a whole
+ * row of the DP is above max. Only the Ukkonen band |i - j| <= max is computed; cells just outside it
+ * hold max + 1 as sentinels. Cells saturate at max + 1, which cannot change any answer <= max.
+ *
+ * prev_row and curr_row must hold len2 + 1 cells.
+ */
+#define LEVENSHTEIN_DP_KERNELS( suffix, sym_t, cell_t ) \
+static int levenshtein_dp_##suffix( const sym_t *s1, int len1, const sym_t *s2, int len2, cell_t *prev_row, cell_t *curr_row ) { \
+    cell_t *temp; \
+    int i, j; \
+ \
+    for ( j = 0; j <= len2; j++ ) { \
+        prev_row[j] = ( cell_t )j; \
+    } \
+ \
+    for ( i = 0; i < len1; i++ ) { \
+        curr_row[0] = ( cell_t )( i + 1 ); \
+ \
+        for ( j = 0; j < len2; j++ ) { \
+            int cost = ( s1[i] == s2[j] ) ? 0 : 1; \
+            curr_row[j + 1] = ( cell_t )MIN3( \
+                prev_row[j + 1] + 1,      /* deletion */ \
+                curr_row[j] + 1,          /* insertion */ \
+                prev_row[j] + cost        /* substitution */ \
+            ); \
+        } \
+ \
+        temp = prev_row; \
+        prev_row = curr_row; \
+        curr_row = temp; \
+    } \
+ \
+    return prev_row[len2]; \
+} \
+ \
+static int levenshtein_bounded_##suffix( const sym_t *s1, int len1, const sym_t *s2, int len2, int max, cell_t *prev_row, cell_t *curr_row ) { \
+    cell_t *temp; \
+    int i, j, lo, hi, row_min; \
+ \
+    if ( len1 - len2 > max || len2 - len1 > max ) { \
+        return max + 1; \
+    } \
+    if ( len1 == 0 || len2 == 0 ) { \
+        return len1 + len2; \
+    } \
+ \
+    hi = len2 < max ? len2 : max; \
+    for ( j = 0; j <= hi; j++ ) { \
+        prev_row[j] = ( cell_t )j; \
+    } \
+    if ( hi < len2 ) { \
+        prev_row[hi + 1] = ( cell_t )( max + 1 ); \
+    } \
+ \
+    for ( i = 1; i <= len1; i++ ) { \
+        lo = i - max > 1 ? i - max : 1; \
+        hi = i + max < len2 ? i + max : len2; \
+ \
+        curr_row[lo - 1] = ( cell_t )( ( lo == 1 && i <= max ) ? i : max + 1 ); \
+        row_min = curr_row[lo - 1]; \
+ \
+        for ( j = lo; j <= hi; j++ ) { \
+            int cost = ( s1[i - 1] == s2[j - 1] ) ? 0 : 1; \
+            int v = MIN3( \
+                prev_row[j] + 1,          /* deletion */ \
+                curr_row[j - 1] + 1,      /* insertion */ \
+                prev_row[j - 1] + cost    /* substitution */ \
+            ); \
+            if ( v > max + 1 ) { \
+                v = max + 1; \
+            } \
+            curr_row[j] = ( cell_t )v; \
+            if ( v < row_min ) { \
+                row_min = v; \
+            } \
+        } \
+        if ( hi < len2 ) { \
+            curr_row[hi + 1] = ( cell_t )( max + 1 ); \
+        } \
+ \
+        if ( row_min > max ) { \
+            return max + 1; \
+        } \
+ \
+        temp = prev_row; \
+        prev_row = curr_row; \
+        curr_row = temp; \
+    } \
+ \
+    return prev_row[len2] > max ? max + 1 : prev_row[len2]; \
+}
+
+LEVENSHTEIN_DP_KERNELS( u8, unsigned char, uint8_t )
+LEVENSHTEIN_DP_KERNELS( u16, unsigned char, uint16_t )
+LEVENSHTEIN_DP_KERNELS( i32, unsigned char, int )
+LEVENSHTEIN_DP_KERNELS( cp, uint32_t, int )             // Code points, for levenshtein_utf8() on very mixed text
+
+#ifndef LEVENSHTEIN_REFERENCE
+/*
+ * Myers' bit-vector algorithm (Hyyrö's formulation) for a pattern p of 1..64 bytes: one column of the
+ * DP per text byte, in a handful of word operations. score tracks D[m][j], the last row of the matrix.
+ * With max >= 0 it returns max + 1 once score - ( n - j ) > max, since the remaining n - j columns can
+ * lower the score by at most one each.
+ */
+static int levenshtein_myers64( const unsigned char *p, int m, const unsigned char *t, int n, int max ) {
+    uint64_t peq[256];
+    uint64_t vp = ~( uint64_t )0, vn = 0;
+    uint64_t last = ( uint64_t )1 << ( m - 1 );
+    int score = m;
+    int i, j;
+
+    memset( peq, 0, sizeof( peq ) );
+    for ( i = 0; i < m; i++ ) {
+        peq[p[i]] |= ( uint64_t )1 << i;
+    }
+
+    for ( j = 0; j < n; j++ ) {
+        uint64_t x = peq[t[j]];
+        uint64_t d0 = ( ( ( x & vp ) + vp ) ^ vp ) | x | vn;
+        uint64_t hp = vn | ~( d0 | vp );
+        uint64_t hn = d0 & vp;
+
+        score += ( hp & last ) != 0;
+        score -= ( hn & last ) != 0;
+        if ( max >= 0 && score - ( n - j - 1 ) > max ) {
+            return max + 1;
+        }
+
+        hp = ( hp << 1 ) | 1;
+        hn = hn << 1;
+        vp = hn | ~( d0 | hp );
+        vn = hp & d0;
+    }
+
+    return ( max >= 0 && score > max ) ? max + 1 : score;
+}
+
+/*
+ * Blocked Myers/Hyyrö for patterns longer than 64 bytes: the pattern is split into 64-bit words and the
+ * horizontal deltas carry from one word to the next within each column. peq holds 256 * words masks laid
+ * out [byte * words + word], and must be all zero on entry; it is left all zero again on return so a
+ * caller can keep reusing one buffer. vp and vn hold words entries each.
+ */
+static int levenshtein_myers_blocked( const unsigned char *p, int m, const unsigned char *t, int n, int max, uint64_t *peq, uint64_t *vp, uint64_t *vn ) {
+    int words = ( m + 63 ) / 64;
+    uint64_t last = ( uint64_t )1 << ( ( m - 1 ) % 64 );
+    int score = m;
+    int i, j, w;
+
+    for ( i = 0; i < m; i++ ) {
+        peq[p[i] * words + i / 64] |= ( uint64_t )1 << ( i % 64 );
+    }
+    for ( w = 0; w < words; w++ ) {
+        vp[w] = ~( uint64_t )0;
+        vn[w] = 0;
+    }
+
+    for ( j = 0; j < n; j++ ) {
+        const uint64_t *eq = peq + t[j] * words;
+        uint64_t hp_carry = 1, hn_carry = 0;
+
+        for ( w = 0; w < words; w++ ) {
+            uint64_t x = eq[w] | hn_carry;
+            uint64_t d0 = ( ( ( x & vp[w] ) + vp[w] ) ^ vp[w] ) | x | vn[w];
+            uint64_t hp = vn[w] | ~( d0 | vp[w] );
+            uint64_t hn = d0 & vp[w];
+            uint64_t hp_in = hp_carry, hn_in = hn_carry;
+
+            if ( w < words - 1 ) {
+                hp_carry = hp >> 63;
+                hn_carry = hn >> 63;
+            } else {
+                hp_carry = ( hp & last ) != 0;
+                hn_carry = ( hn & last ) != 0;
+            }
+
+            hp = ( hp << 1 ) | hp_in;
+            hn = ( hn << 1 ) | hn_in;
+            vp[w] = hn | ~( d0 | hp );
+            vn[w] = hp & d0;
+        }
+
+        score += ( int )hp_carry - ( int )hn_carry;
+        if ( max >= 0 && score - ( n - j - 1 ) > max ) {
+            score = max + 1;
+            break;
+        }
+    }
+
+    for ( i = 0; i < m; i++ ) {
+        peq[p[i] * words + i / 64] = 0;
+    }
+
+    return ( max >= 0 && score > max ) ? max + 1 : score;
+}
+#endif
+
+/*
+ * SIMD kernels for long strings. Cell-per-lane anti-diagonals (16-bit lanes) measured about 2.5x slower
+ * than the scalar blocked kernel above, so the vector lanes hold whole 64-bit words of it instead: word w
+ * processes column s - w at step s, so every word on one block anti-diagonal is independent of the others
+ * and the horizontal carries flow from one step to the next through hp_in / hn_in (entry w is the carry
+ * into word w). The last word stays scalar since it alone updates the score.
+ * Same contract as levenshtein_myers_blocked(); hp_in and hn_in hold words + 1 entries each.
+ */
+#if !defined( LEVENSHTEIN_REFERENCE ) && !defined( LEVENSHTEIN_NO_SIMD )
+#if defined( __x86_64__ ) || defined( _M_X64 )
+#define LEVENSHTEIN_HAVE_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LEVENSHTEIN_TARGET_AVX2
+#else
+#define LEVENSHTEIN_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#endif
+#elif defined( __aarch64__ ) || defined( _M_ARM64 )
+#define LEVENSHTEIN_HAVE_NEON 1 // Always present on AArch64, nothing to detect
+#include <arm_neon.h>
+#endif
+#endif
+
+#if defined( LEVENSHTEIN_HAVE_AVX2 ) || defined( LEVENSHTEIN_HAVE_NEON )
+
+// Below about 8 words the wavefront's ramp-up and ramp-down steps cost more than the lanes save
+#define LEVENSHTEIN_WAVEFRONT_MIN_WORDS 8
+
+typedef int ( *levenshtein_wavefront_fn )( const unsigned char *p, int m, const unsigned char *t, int n, int max, uint64_t *peq, uint64_t *vp, uint64_t *vn, uint64_t *hp_in, uint64_t *hn_in );
+
+// Scalar step for word w of the wavefront, used for the last word and for words left over from the lanes
+#define LEVENSHTEIN_WAVEFRONT_WORD( w ) do { \
+        uint64_t x_ = peq[t[s - ( w )] * words + ( w )] | hn_in[w]; \
+        uint64_t d0_ = ( ( ( x_ & vp[w] ) + vp[w] ) ^ vp[w] ) | x_ | vn[w]; \
+        uint64_t hp_ = vn[w] | ~( d0_ | vp[w] ); \
+        uint64_t hn_ = d0_ & vp[w]; \
+        if ( ( w ) == words - 1 ) { \
+            score += ( hp_ & last ) != 0; \
+            score -= ( hn_ & last ) != 0; \
+        } else { \
+            hp_in[( w ) + 1] = hp_ >> 63; \
+            hn_in[( w ) + 1] = hn_ >> 63; \
+        } \
+        hp_ = ( hp_ << 1 ) | hp_in[w]; \
+        hn_ = ( hn_ << 1 ) | hn_in[w]; \
+        vp[w] = hn_ | ~( d0_ | hp_ ); \
+        vn[w] = hp_ & d0_; \
+    } while ( 0 )
+
+// Shared setup; words are walked from the bottom up so each reads its carry before the word above overwrites it
+#define LEVENSHTEIN_WAVEFRONT_BEGIN \
+    int words = ( m + 63 ) / 64; \
+    uint64_t last = ( uint64_t )1 << ( ( m - 1 ) % 64 ); \
+    int score = m; \
+    int i, s, w; \
+    for ( i = 0; i < m; i++ ) { \
+        peq[p[i] * words + i / 64] |= ( uint64_t )1 << ( i % 64 ); \
+    } \
+    for ( w = 0; w < words; w++ ) { \
+        vp[w] = ~( uint64_t )0; \
+        vn[w] = 0; \
+    } \
+    memset( hp_in, 0, ( words + 1 ) * sizeof( uint64_t ) ); \
+    memset( hn_in, 0, ( words + 1 ) * sizeof( uint64_t ) ); \
+    hp_in[0] = 1; \
+    for ( s = 0; s < n + words - 1; s++ ) { \
+        int wlo = s - n + 1 > 0 ? s - n + 1 : 0; \
+        w = s < words - 1 ? s : words - 1; \
+        if ( w == words - 1 ) { \
+            LEVENSHTEIN_WAVEFRONT_WORD( w ); \
+            w--; \
+            /* Column s - words + 1 is now final; the remaining columns can lower the score by one each */ \
+            if ( max >= 0 && score - ( n - ( s - words + 1 ) - 1 ) > max ) { \
+                score = max + 1; \
+                break; \
+            } \
+        }
+
+#define LEVENSHTEIN_WAVEFRONT_END \
+        for ( ; w >= wlo; w-- ) { \
+            LEVENSHTEIN_WAVEFRONT_WORD( w ); \
+        } \
+    } \
+    for ( i = 0; i < m; i++ ) { \
+        peq[p[i] * words + i / 64] = 0; \
+    } \
+    return ( max >= 0 && score > max ) ? max + 1 : score;
+
+#ifdef LEVENSHTEIN_HAVE_AVX2
+
+LEVENSHTEIN_TARGET_AVX2
+static int levenshtein_wavefront_avx2( const unsigned char *p, int m, const unsigned char *t, int n, int max, uint64_t *peq, uint64_t *vp, uint64_t *vn, uint64_t *hp_in, uint64_t *hn_in ) {
+    const __m256i ones = _mm256_set1_epi64x( -1 );
+
+    LEVENSHTEIN_WAVEFRONT_BEGIN
+        for ( ; w - 3 >= wlo; w -= 4 ) {
+            int b = w - 3;
+            __m256i eq = _mm256_set_epi64x( ( long long )peq[t[s - b - 3] * words + b + 3], ( long long )peq[t[s - b - 2] * words + b + 2],
+                                            ( long long )peq[t[s - b - 1] * words + b + 1], ( long long )peq[t[s - b] * words + b] );
+            __m256i vpv = _mm256_loadu_si256( ( const __m256i * )( vp + b ) );
+            __m256i vnv = _mm256_loadu_si256( ( const __m256i * )( vn + b ) );
+            __m256i hpi = _mm256_loadu_si256( ( const __m256i * )( hp_in + b ) );
+            __m256i hni = _mm256_loadu_si256( ( const __m256i * )( hn_in + b ) );
+            __m256i x = _mm256_or_si256( eq, hni );
+            __m256i d0 = _mm256_or_si256( _mm256_or_si256( _mm256_xor_si256( _mm256_add_epi64( _mm256_and_si256( x, vpv ), vpv ), vpv ), x ), vnv );
+            __m256i hp = _mm256_or_si256( vnv, _mm256_xor_si256( _mm256_or_si256( d0, vpv ), ones ) );
+            __m256i hn = _mm256_and_si256( d0, vpv );
+
+            _mm256_storeu_si256( ( __m256i * )( hp_in + b + 1 ), _mm256_srli_epi64( hp, 63 ) );
+            _mm256_storeu_si256( ( __m256i * )( hn_in + b + 1 ), _mm256_srli_epi64( hn, 63 ) );
+            hp = _mm256_or_si256( _mm256_slli_epi64( hp, 1 ), hpi );
+            hn = _mm256_or_si256( _mm256_slli_epi64( hn, 1 ), hni );
+            _mm256_storeu_si256( ( __m256i * )( vp + b ), _mm256_or_si256( hn, _mm256_xor_si256( _mm256_or_si256( d0, hp ), ones ) ) );
+            _mm256_storeu_si256( ( __m256i * )( vn + b ), _mm256_and_si256( hp, d0 ) );
+        }
+    LEVENSHTEIN_WAVEFRONT_END
+}
+
+static int levenshtein_cpu_has_avx2( void ) {
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid( info, 0 );
+    if ( info[0] < 7 ) {
+        return 0;
+    }
+    __cpuid( info, 1 );
+    if ( !( info[2] & ( 1 << 27 ) ) || ( _xgetbv( 0 ) & 6 ) != 6 ) { // OSXSAVE, and the OS saves YMM state
+        return 0;
+    }
+    __cpuidex( info, 7, 0 );
+    return ( info[1] & ( 1 << 5 ) ) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "avx2" );
+#endif
+}
+
+#endif
+
+#ifdef LEVENSHTEIN_HAVE_NEON
+
+static int levenshtein_wavefront_neon( const unsigned char *p, int m, const unsigned char *t, int n, int max, uint64_t *peq, uint64_t *vp, uint64_t *vn, uint64_t *hp_in, uint64_t *hn_in ) {
+    LEVENSHTEIN_WAVEFRONT_BEGIN
+        for ( ; w - 1 >= wlo; w -= 2 ) {
+            int b = w - 1;
+            uint64x2_t eq = vcombine_u64( vcreate_u64( peq[t[s - b] * words + b] ), vcreate_u64( peq[t[s - b - 1] * words + b + 1] ) );
+            uint64x2_t vpv = vld1q_u64( vp + b );
+            uint64x2_t vnv = vld1q_u64( vn + b );
+            uint64x2_t hpi = vld1q_u64( hp_in + b );
+            uint64x2_t hni = vld1q_u64( hn_in + b );
+            uint64x2_t x = vorrq_u64( eq, hni );
+            uint64x2_t d0 = vorrq_u64( vorrq_u64( veorq_u64( vaddq_u64( vandq_u64( x, vpv ), vpv ), vpv ), x ), vnv );
+            uint64x2_t hp = vornq_u64( vnv, vorrq_u64( d0, vpv ) );
+            uint64x2_t hn = vandq_u64( d0, vpv );
+
+            vst1q_u64( hp_in + b + 1, vshrq_n_u64( hp, 63 ) );
+            vst1q_u64( hn_in + b + 1, vshrq_n_u64( hn, 63 ) );
+            hp = vorrq_u64( vshlq_n_u64( hp, 1 ), hpi );
+            hn = vorrq_u64( vshlq_n_u64( hn, 1 ), hni );
+            vst1q_u64( vp + b, vornq_u64( hn, vorrq_u64( d0, hp ) ) );
+            vst1q_u64( vn + b, vandq_u64( hp, d0 ) );
+        }
+    LEVENSHTEIN_WAVEFRONT_END
+}
+
+#endif
+
+// Chosen once in sqlite3_levenshtein_init() from the CPU that loads the extension; NULL means scalar only
+static levenshtein_wavefront_fn levenshtein_wavefront = NULL;
+
+#endif
+
+/*
+ * Per-function counters, read with SELECT * FROM levenshtein_stats() and cleared with levenshtein_stats_reset().
+ * Calls and bytes are counted on every call; time is measured on one call in LEVENSHTEIN_STATS_SAMPLE with the
+ * cycle counter and scaled up. -DLEVENSHTEIN_NO_STATS compiles all of it out, including both SQL entry points.
+ */
+#ifndef LEVENSHTEIN_NO_STATS
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define LEVENSHTEIN_STATS_SAMPLE 64 // A power of two
+
+enum {
+    LEVENSHTEIN_STAT_LEVENSHTEIN,
+    LEVENSHTEIN_STAT_UTF8,
+    LEVENSHTEIN_STAT_DAMERAU,
+    LEVENSHTEIN_STAT_RATIO,
+    LEVENSHTEIN_STAT_JARO_WINKLER,
+    LEVENSHTEIN_STAT_HAMMING,
+    LEVENSHTEIN_STAT_TOPK,
+    LEVENSHTEIN_STAT_SOUNDEX,
+    LEVENSHTEIN_STAT_DOUBLE_METAPHONE,
+    LEVENSHTEIN_STAT_NYSIIS,
+    LEVENSHTEIN_STAT_COUNT
+};
+
+typedef struct levenshtein_stats {
+    sqlite3_uint64 calls;
+    sqlite3_uint64 bytes;        // The strings compared or keyed
+    sqlite3_uint64 cache_hits;   // levenshtein_utf8(): pattern reused from auxdata
+    sqlite3_uint64 cache_misses; // levenshtein_utf8(): pattern built for the call
+    sqlite3_uint64 memo_hits;    // Result served from the statement's memo
+    sqlite3_uint64 memo_misses;  // Memoized call computed
+    sqlite3_uint64 early_exits;  // Bounded calls cut short, on the lengths or by the kernel
+    sqlite3_uint64 ticks;        // Cycle counter ticks spent in the sampled calls
+    sqlite3_uint64 samples;
+} levenshtein_stats;
+
+// Set while a counted function runs, so helpers shared with the vtabs count only calls made through SQL functions
+#define LEVENSHTEIN_COUNT( scratch, field ) \
+    do { \
+        if ( ( scratch )->current ) { \
+            ( scratch )->current->field++; \
+        } \
+    } while ( 0 )
+
+#else
+
+#define LEVENSHTEIN_COUNT( scratch, field ) ( ( void )0 )
+
+#endif
+
+/*
+ * Per-connection scratch memory, handed to the functions through the pApp pointer so a call allocates
+ * nothing once the buffers have grown to the longest strings seen. Calls on one connection never overlap.
+ */
+typedef struct levenshtein_buffer {
+    void *data;
+    size_t bytes;
+} levenshtein_buffer;
+
+typedef struct levenshtein_scratch {
+    int refs;                   // One per registered function using it, plus one held by init while registering
+    uint64_t *peq;              // Match masks for the blocked kernels; the kernels leave it all zero
+    size_t peq_words;
+    levenshtein_buffer work;    // DP rows or bit vectors; nothing in any buffer survives a call
+    levenshtein_buffer text;    // levenshtein_utf8(): the other string as symbols or code points; phonetic keys: the name
+    levenshtein_buffer pattern; // levenshtein_utf8(): a pattern that is not cached in auxdata
+    levenshtein_buffer memo_key; // The memo key of the call now running; the functions never touch it
+    struct levenshtein_memo_result *memo_result; // Set while a memoized call runs
+    sqlite3_uint64 memo_slots;  // levenshtein_config( 'memo_slots' ): results kept per statement, 0 for no memo
+#ifndef LEVENSHTEIN_NO_STATS
+    levenshtein_stats stats[LEVENSHTEIN_STAT_COUNT];
+    levenshtein_stats *current; // The counted function now running, or NULL
+    sqlite3_uint64 tick0, ns0;  // Clock readings at load, for converting ticks to nanoseconds
+#endif
+} levenshtein_scratch;
+
+// Strings this short get their rows or bit vectors from the stack instead of the scratch
+#define LEVENSHTEIN_STACK_WORDS 128
+
+// Grows buf to at least bytes; the contents are not kept
+static void *levenshtein_buffer_reserve( levenshtein_buffer *buf, size_t bytes ) {
+    if ( bytes > buf->bytes ) {
+        size_t grow = buf->bytes * 2 > bytes ? buf->bytes * 2 : bytes;
+        void *data = sqlite3_realloc64( buf->data, grow );
+
+        if ( !data ) {
+            return NULL;
+        }
+        buf->data = data;
+        buf->bytes = grow;
+    }
+    return buf->data;
+}
+
+#ifndef LEVENSHTEIN_REFERENCE // Only the bit-parallel kernels use it
+static uint64_t *levenshtein_scratch_peq( levenshtein_scratch *scratch, size_t words ) {
+    if ( words > scratch->peq_words ) {
+        uint64_t *peq = ( uint64_t * )sqlite3_malloc64( words * sizeof( uint64_t ) );
+
+        if ( !peq ) {
+            return NULL;
+        }
+        memset( peq, 0, words * sizeof( uint64_t ) );
+        sqlite3_free( scratch->peq );
+        scratch->peq = peq;
+        scratch->peq_words = words;
+    }
+    return scratch->peq;
+}
+#endif
+
+// Frees the buffers of a scratch that is not reference counted, e.g. one owned by a worker thread
+static void levenshtein_scratch_release( levenshtein_scratch *scratch ) {
+    sqlite3_free( scratch->peq );
+    sqlite3_free( scratch->work.data );
+    sqlite3_free( scratch->text.data );
+    sqlite3_free( scratch->pattern.data );
+    sqlite3_free( scratch->memo_key.data );
+    memset( scratch, 0, sizeof( *scratch ) );
+}
+
+static void levenshtein_scratch_unref( void *p ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )p;
+
+    if ( --scratch->refs == 0 ) {
+        levenshtein_scratch_release( scratch );
+        sqlite3_free( scratch );
+    }
+}
+
+/*
+ * A per-statement memo of results, for statements that compare the same pair of strings over and over, as a join
+ * on normalized codes does. Off by default: SELECT levenshtein_config( 'memo_slots', n ) keeps up to n results per
+ * statement for levenshtein(), levenshtein_utf8(), damerau_levenshtein(), levenshtein_ratio() and jaro_winkler(),
+ * and levenshtein_stats() counts memo_hits and memo_misses. A short ASCII pair costs about as much to look up as
+ * to compare, so the memo pays off on longer or non-ASCII strings, and only when pairs repeat.
+ *
+ * It lives in an auxdata slot tied to no argument, which SQLite keeps until the statement is reset and shares between
+ * every call in it, the way its own JSON functions cache parsed documents. A key holds the function and every
+ * argument, so a hit is an exact repeat and never a hash collision. Keys over LEVENSHTEIN_MEMO_MAX_KEY bytes are not
+ * kept. A table three quarters full starts over.
+ */
+#define LEVENSHTEIN_MEMO_AUX ( -0x6c657665 ) // Negative: not tied to an argument, so kept across rows
+#define LEVENSHTEIN_MEMO_MAX_KEY 1024
+
+typedef struct levenshtein_memo_entry {
+    sqlite3_uint64 hash; // 0 for an empty slot
+    unsigned char *key;
+    int key_len;
+    int is_double;
+    sqlite3_int64 i;
+    double d;
+} levenshtein_memo_entry;
+
+typedef struct levenshtein_memo {
+    sqlite3_uint64 mask;
+    sqlite3_uint64 used;
+    levenshtein_memo_entry slots[1];
+} levenshtein_memo;
+
+// The result of the memoized call now running, set by the levenshtein_result_*() helpers
+typedef struct levenshtein_memo_result {
+    int kept;
+    int is_double;
+    sqlite3_int64 i;
+    double d;
+} levenshtein_memo_result;
+
+static void levenshtein_memo_clear( levenshtein_memo *memo ) {
+    sqlite3_uint64 i;
+
+    for ( i = 0; i <= memo->mask; i++ ) {
+        sqlite3_free( memo->slots[i].key );
+        memo->slots[i].key = NULL;
+        memo->slots[i].hash = 0;
+    }
+    memo->used = 0;
+}
+
+static void levenshtein_memo_free( void *p ) {
+    levenshtein_memo_clear( ( levenshtein_memo * )p );
+    sqlite3_free( p );
+}
+
+static levenshtein_memo *levenshtein_memo_get( sqlite3_context *context, sqlite3_uint64 slots ) {
+    levenshtein_memo *memo = ( levenshtein_memo * )sqlite3_get_auxdata( context, LEVENSHTEIN_MEMO_AUX );
+
+    if ( !memo ) {
+        sqlite3_uint64 size = 8;
+        size_t bytes;
+
+        while ( size < slots + slots / 3 + 1 ) { // n results fit under the three quarters load
+            size *= 2;
+        }
+        bytes = sizeof( levenshtein_memo ) + ( size - 1 ) * sizeof( levenshtein_memo_entry );
+        memo = ( levenshtein_memo * )sqlite3_malloc64( bytes );
+        if ( !memo ) {
+            return NULL;
+        }
+        memset( memo, 0, bytes );
+        memo->mask = size - 1;
+        sqlite3_set_auxdata( context, LEVENSHTEIN_MEMO_AUX, memo, levenshtein_memo_free );
+        memo = ( levenshtein_memo * )sqlite3_get_auxdata( context, LEVENSHTEIN_MEMO_AUX ); // Freed already if SQLite could not keep it
+    }
+    return memo;
+}
+
+static void levenshtein_memo_append( unsigned char *key, int *len, const void *p, int n ) {
+    memcpy( key + *len, p, ( size_t )n );
+    *len += n;
+}
+
+/*
+ * Builds the key for fn on these arguments into scratch->memo_key: numbers by value, so 1 and '1' stay apart, the rest
+ * as the text the functions read. Returns its length, or -1 when it is too long to keep or memory runs out.
+ */
+static int levenshtein_memo_key( levenshtein_scratch *scratch, void ( *fn )( sqlite3_context *, int, sqlite3_value ** ), int argc, sqlite3_value **argv ) {
+    unsigned char *key = ( unsigned char * )levenshtein_buffer_reserve( &scratch->memo_key, LEVENSHTEIN_MEMO_MAX_KEY );
+    int len = 0, i;
+
+    if ( !key ) {
+        return -1;
+    }
+    levenshtein_memo_append( key, &len, &fn, ( int )sizeof( fn ) ); // Tells the functions apart within one memo
+    for ( i = 0; i < argc; i++ ) {
+        unsigned char type = ( unsigned char )sqlite3_value_type( argv[i] );
+
+        if ( len + 1 + 8 > LEVENSHTEIN_MEMO_MAX_KEY ) {
+            return -1;
+        }
+        key[len++] = type;
+        if ( type == SQLITE_INTEGER ) {
+            sqlite3_int64 v = sqlite3_value_int64( argv[i] );
+            levenshtein_memo_append( key, &len, &v, ( int )sizeof( v ) );
+        } else if ( type == SQLITE_FLOAT ) {
+            double v = sqlite3_value_double( argv[i] );
+            levenshtein_memo_append( key, &len, &v, ( int )sizeof( v ) );
+        } else if ( type != SQLITE_NULL ) {
+            const unsigned char *text = sqlite3_value_text( argv[i] );
+            int n = sqlite3_value_bytes( argv[i] );
+
+            if ( !text || n > LEVENSHTEIN_MEMO_MAX_KEY - len - ( int )sizeof( n ) ) {
+                return -1;
+            }
+            levenshtein_memo_append( key, &len, &n, ( int )sizeof( n ) );
+            levenshtein_memo_append( key, &len, text, n );
+        }
+    }
+    return len;
+}
+
+// FNV-1a, never 0 so that 0 can mark an empty slot
+static sqlite3_uint64 levenshtein_memo_hash( const unsigned char *key, int len ) {
+    sqlite3_uint64 h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for ( i = 0; i < len; i++ ) {
+        h = ( h ^ key[i] ) * 0x100000001b3ULL;
+    }
+    return h | 1;
+}
+
+// Serves fn from the statement's memo when memo_slots is set and these arguments have been seen
+static void levenshtein_memoized( sqlite3_context *context, int argc, sqlite3_value **argv, void ( *fn )( sqlite3_context *, int, sqlite3_value ** ) ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    levenshtein_memo *memo = scratch->memo_slots ? levenshtein_memo_get( context, scratch->memo_slots ) : NULL;
+    levenshtein_memo_result result;
+    levenshtein_memo_entry *e;
+    const unsigned char *key;
+    sqlite3_uint64 hash, slot;
+    int len = memo ? levenshtein_memo_key( scratch, fn, argc, argv ) : -1;
+
+    if ( len < 0 ) {
+        fn( context, argc, argv );
+        return;
+    }
+    key = ( const unsigned char * )scratch->memo_key.data;
+    hash = levenshtein_memo_hash( key, len );
+    for ( slot = hash & memo->mask; memo->slots[slot].hash; slot = ( slot + 1 ) & memo->mask ) {
+        e = &memo->slots[slot];
+        if ( e->hash == hash && e->key_len == len && memcmp( e->key, key, ( size_t )len ) == 0 ) {
+            LEVENSHTEIN_COUNT( scratch, memo_hits );
+            if ( e->is_double ) {
+                sqlite3_result_double( context, e->d );
+            } else {
+                sqlite3_result_int64( context, e->i );
+            }
+            return;
+        }
+    }
+    LEVENSHTEIN_COUNT( scratch, memo_misses );
+
+    result.kept = 0;
+    scratch->memo_result = &result;
+    fn( context, argc, argv );
+    scratch->memo_result = NULL;
+    if ( !result.kept ) {
+        return; // Errors and NULLs are not kept
+    }
+
+    if ( memo->used >= ( memo->mask + 1 ) / 4 * 3 ) {
+        levenshtein_memo_clear( memo );
+        slot = hash & memo->mask;
+    }
+    e = &memo->slots[slot]; // fn left the key alone: it only uses the other buffers
+    e->key = ( unsigned char * )sqlite3_malloc( len );
+    if ( !e->key ) {
+        return;
+    }
+    memcpy( e->key, key, ( size_t )len );
+    e->hash = hash;
+    e->key_len = len;
+    e->is_double = result.is_double;
+    e->i = result.i;
+    e->d = result.d;
+    memo->used++;
+}
+
+#define LEVENSHTEIN_MEMOIZED( fn ) \
+    static void fn##_memo( sqlite3_context *context, int argc, sqlite3_value **argv ) { \
+        levenshtein_memoized( context, argc, argv, fn ); \
+    }
+
+// Results of the memoized functions go through these, so the memo can keep a copy
+static void levenshtein_result_int( sqlite3_context *context, levenshtein_scratch *scratch, sqlite3_int64 value ) {
+    if ( scratch->memo_result ) {
+        scratch->memo_result->kept = 1;
+        scratch->memo_result->is_double = 0;
+        scratch->memo_result->i = value;
+    }
+    sqlite3_result_int64( context, value );
+}
+
+static void levenshtein_result_double( sqlite3_context *context, levenshtein_scratch *scratch, double value ) {
+    if ( scratch->memo_result ) {
+        scratch->memo_result->kept = 1;
+        scratch->memo_result->is_double = 1;
+        scratch->memo_result->d = value;
+    }
+    sqlite3_result_double( context, value );
+}
+
+/*
+ * Picks the kernel for one comparison. max < 0 means unbounded. Returns -1 if memory runs out.
+ * s2 must be the shorter string; it is the pattern for the bit vectors and indexes the DP rows.
+ */
+static int levenshtein_distance( levenshtein_scratch *scratch, const unsigned char *s1, int len1, const unsigned char *s2, int len2, int max ) {
+    uint64_t stack_buf[LEVENSHTEIN_STACK_WORDS];
+    int result;
+
+    if ( len2 == 0 ) {
+        return ( max >= 0 && len1 > max ) ? max + 1 : len1;
+    }
+
+#ifndef LEVENSHTEIN_REFERENCE
+    if ( len2 <= 64 ) {
+        return levenshtein_myers64( s2, len2, s1, len1, max );
+    }
+
+    // The band DP does ( 2k + 1 ) cells per row, the blocked kernel about 8 cells' worth of work per word
+    if ( max < 0 || 2 * max + 1 >= 8 * ( ( len2 + 63 ) / 64 ) ) {
+        size_t words = ( size_t )( len2 + 63 ) / 64;
+        size_t vec_words = 4 * words + 2; // vp, vn, then the wavefront's two carry arrays
+        uint64_t *peq = levenshtein_scratch_peq( scratch, words * 256 );
+        uint64_t *vec = vec_words <= LEVENSHTEIN_STACK_WORDS ? stack_buf : ( uint64_t * )levenshtein_buffer_reserve( &scratch->work, vec_words * sizeof( uint64_t ) );
+
+        if ( !peq || !vec ) {
+            return -1;
+        }
+#if defined( LEVENSHTEIN_HAVE_AVX2 ) || defined( LEVENSHTEIN_HAVE_NEON )
+        if ( levenshtein_wavefront && words >= LEVENSHTEIN_WAVEFRONT_MIN_WORDS ) {
+            return levenshtein_wavefront( s2, len2, s1, len1, max, peq, vec, vec + words, vec + 2 * words, vec + 3 * words + 1 );
+        }
+#endif
+        return levenshtein_myers_blocked( s2, len2, s1, len1, max, peq, vec, vec + words );
+    }
+#endif
+
+    {
+        int cap = max >= 0 ? max + 1 : len1; // No cell ever holds more than this
+        size_t cell = cap <= UINT8_MAX ? sizeof( uint8_t ) : cap <= UINT16_MAX ? sizeof( uint16_t ) : sizeof( int );
+        size_t bytes = 2 * ( size_t )( len2 + 1 ) * cell;
+        void *rows = bytes <= sizeof( stack_buf ) ? ( void * )stack_buf : levenshtein_buffer_reserve( &scratch->work, bytes );
+
+        if ( !rows ) {
+            return -1;
+        }
+
+        if ( cell == sizeof( uint8_t ) ) {
+            uint8_t *r = ( uint8_t * )rows;
+            result = max >= 0 ? levenshtein_bounded_u8( s1, len1, s2, len2, max, r, r + len2 + 1 ) : levenshtein_dp_u8( s1, len1, s2, len2, r, r + len2 + 1 );
+        } else if ( cell == sizeof( uint16_t ) ) {
+            uint16_t *r = ( uint16_t * )rows;
+            result = max >= 0 ? levenshtein_bounded_u16( s1, len1, s2, len2, max, r, r + len2 + 1 ) : levenshtein_dp_u16( s1, len1, s2, len2, r, r + len2 + 1 );
+        } else {
+            int *r = ( int * )rows;
+            result = max >= 0 ? levenshtein_bounded_i32( s1, len1, s2, len2, max, r, r + len2 + 1 ) : levenshtein_dp_i32( s1, len1, s2, len2, r, r + len2 + 1 );
+        }
+        return result;
+    }
+}
+
+// Reads the optional max argument: -1 when absent or NULL. Returns 0 after setting an error.
+static int levenshtein_max_arg( sqlite3_context *context, int argc, sqlite3_value **argv, const char *error, sqlite3_int64 *max ) {
+    *max = -1;
+
+    // A NULL limit means unbounded, so levenshtein( a, b, ? ) can be bound either way
+    if ( argc == 3 && sqlite3_value_type( argv[2] ) != SQLITE_NULL ) {
+        *max = sqlite3_value_int64( argv[2] );
+        if ( *max < 0 ) {
+            sqlite3_result_error( context, error, -1 );
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Fits max to the lengths. Returns 0 if the length difference alone puts the distance above max.
+static int levenshtein_limit( int len1, int len2, sqlite3_int64 *max ) {
+    if ( *max < 0 ) {
+        return 1;
+    }
+    if ( *max >= ( len1 > len2 ? len1 : len2 ) ) {
+        *max = -1; // The distance can never exceed the longer length, so the limit cannot cut anything
+    } else if ( len1 - len2 > *max || len2 - len1 > *max ) {
+        return 0;
+    }
+    return 1;
+}
+
+// Distance between two byte (or symbol) strings in either order, max + 1 once it exceeds max. -1 if memory runs out.
+static sqlite3_int64 levenshtein_pair( levenshtein_scratch *scratch, const unsigned char *s1, int len1, const unsigned char *s2, int len2, sqlite3_int64 max ) {
+    int result;
+
+    if ( !levenshtein_limit( len1, len2, &max ) ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+        return max + 1;
+    }
+
+    // Distance is symmetric; keep the shorter string in s2 so the rows and bit vectors stay small
+    if ( len1 < len2 ) {
+        const unsigned char *ts = s1;
+        int tl = len1;
+        s1 = s2;
+        len1 = len2;
+        s2 = ts;
+        len2 = tl;
+    }
+
+    result = levenshtein_distance( scratch, s1, len1, s2, len2, ( int )max );
+    if ( max >= 0 && result > max ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+    }
+    return result;
+}
+
+// Sets the distance between two byte (or symbol) strings as the result
+static void levenshtein_result( sqlite3_context *context, levenshtein_scratch *scratch, const unsigned char *s1, int len1, const unsigned char *s2, int len2, sqlite3_int64 max ) {
+    sqlite3_int64 result = levenshtein_pair( scratch, s1, len1, s2, len2, max );
+
+    if ( result < 0 ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+
+    levenshtein_result_int( context, scratch, result );
+}
+
+static void levenshtein_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    const unsigned char *s1, *s2;
+    sqlite3_int64 max;
+
+    if ( argc != 2 && argc != 3 ) {
+        sqlite3_result_error( context, "levenshtein() requires 2 or 3 arguments", -1 );
+        return;
+    }
+
+    if ( sqlite3_value_type( argv[0] ) == SQLITE_NULL || sqlite3_value_type( argv[1] ) == SQLITE_NULL ) {
+        sqlite3_result_null( context );
+        return;
+    }
+
+    s1 = sqlite3_value_text( argv[0] );
+    s2 = sqlite3_value_text( argv[1] );
+    
+    if ( !s1 || !s2 ) {
+        sqlite3_result_null( context );
+        return;
+    }
+
+    if ( !levenshtein_max_arg( context, argc, argv, "levenshtein() max must not be negative", &max ) ) {
+        return;
+    }
+
+    // Lengths from SQLite, not strlen(): no rescan, and text with embedded NULs is compared in full
+    levenshtein_result( context, ( levenshtein_scratch * )sqlite3_user_data( context ), s1, sqlite3_value_bytes( argv[0] ), s2, sqlite3_value_bytes( argv[1] ), max );
+}
+
+/*
+ * levenshtein_utf8(): the same distance counted in code points, so 'café' vs 'cafe' is 1, not 2.
+ *
+ * When both strings are 7-bit ASCII it is exactly levenshtein(). Otherwise one string becomes the
+ * pattern: each distinct code point in it gets a symbol id 1..255, the other string is mapped through
+ * that table (code points the pattern lacks become 0, which matches nothing), and the byte kernels run
+ * on the ids. A pattern with more than 255 distinct code points falls back to the code point DP.
+ *
+ * A constant argument (e.g. the search term in WHERE levenshtein_utf8( name, ? ) <= 2) is compiled once
+ * per statement and kept in auxdata. SQLite does not say which arguments are constant, so the first row
+ * leaves a marker on both; a marker that survives to the next row belongs to a constant argument. Each
+ * call site leaves its markers once per statement, not on every row whose markers were dropped, since
+ * every sqlite3_set_auxdata() allocates.
+ * Malformed UTF-8 is compared byte by byte, each stray byte as one symbol.
+ */
+
+typedef struct levenshtein_pattern {
+    int len;                    // Code points
+    int ascii;                  // Pure 7-bit: the text itself can be used with the byte kernels
+    int nsym;                   // Distinct code points, or 0 if more than 255 and only cps is usable
+    uint32_t *cps;              // len code points
+    unsigned char *syms;        // len symbol ids
+    uint32_t *keys;             // Open-addressing table of non-ASCII code points, 0 marks a free slot
+    unsigned char *vals;
+    uint32_t mask;              // Table slots - 1
+    unsigned char ascii_sym[128];
+} levenshtein_pattern;
+
+static const char levenshtein_aux_marker = 0;
+
+/*
+ * The call sites of a statement that have left their markers, in a slot tied to no argument. A site is
+ * told apart by its first argument's sqlite3_value, which is the same VM register on every row. Past
+ * LEVENSHTEIN_PROBE_SITES sites the rest leave none, and compile their patterns on every row.
+ */
+#define LEVENSHTEIN_PROBE_AUX ( -0x75746638 )
+#define LEVENSHTEIN_PROBE_SITES 8
+
+typedef struct levenshtein_probes {
+    int n;
+    const sqlite3_value *sites[LEVENSHTEIN_PROBE_SITES];
+} levenshtein_probes;
+
+// True the first time a call site asks in this statement: then it should leave its markers
+static int levenshtein_first_probe( sqlite3_context *context, sqlite3_value **argv ) {
+    levenshtein_probes *probes = ( levenshtein_probes * )sqlite3_get_auxdata( context, LEVENSHTEIN_PROBE_AUX );
+    int i;
+
+    if ( !probes ) {
+        probes = ( levenshtein_probes * )sqlite3_malloc( sizeof( *probes ) );
+        if ( !probes ) {
+            return 0;
+        }
+        probes->n = 0;
+        sqlite3_set_auxdata( context, LEVENSHTEIN_PROBE_AUX, probes, sqlite3_free );
+        probes = ( levenshtein_probes * )sqlite3_get_auxdata( context, LEVENSHTEIN_PROBE_AUX ); // Freed already if SQLite could not keep it
+        if ( !probes ) {
+            return 0;
+        }
+    }
+    for ( i = 0; i < probes->n; i++ ) {
+        if ( probes->sites[i] == argv[0] ) {
+            return 0;
+        }
+    }
+    if ( probes->n == LEVENSHTEIN_PROBE_SITES ) {
+        return 0;
+    }
+    probes->sites[probes->n++] = argv[0];
+    return 1;
+}
+
+static int levenshtein_is_ascii( const unsigned char *s, int n ) {
+    int i = 0;
+
+    for ( ; i + 8 <= n; i += 8 ) {
+        uint64_t w;
+        memcpy( &w, s + i, sizeof( w ) );
+        if ( w & 0x8080808080808080ULL ) {
+            return 0;
+        }
+    }
+    for ( ; i < n; i++ ) {
+        if ( s[i] & 0x80 ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Decodes one code point. A byte that does not start a well-formed sequence comes back alone as U+DC80..U+DCFF.
+static uint32_t levenshtein_utf8_next( const unsigned char **pz, const unsigned char *end ) {
+    const unsigned char *z = *pz;
+    uint32_t c = *z;
+    int n, i;
+
+    if ( c < 0x80 ) {
+        *pz = z + 1;
+        return c;
+    }
+
+    n = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+    if ( c < 0xC2 || c > 0xF4 || end - z <= n ) {
+        goto invalid;
+    }
+    c &= 0x3F >> n;
+    for ( i = 1; i <= n; i++ ) {
+        if ( ( z[i] & 0xC0 ) != 0x80 ) {
+            goto invalid;
+        }
+        c = ( c << 6 ) | ( z[i] & 0x3F );
+    }
+    if ( ( n == 2 && c < 0x800 ) || ( n == 3 && ( c < 0x10000 || c > 0x10FFFF ) ) ) {
+        goto invalid; // Overlong or out of range
+    }
+    *pz = z + n + 1;
+    return c;
+
+invalid:
+    *pz = z + 1;
+    return 0xDC00 | *z;
+}
+
+// Table slots for a pattern of this many bytes: at least twice the symbols it can hold, so probes stay short
+static uint32_t levenshtein_pattern_slots( int bytes ) {
+    uint32_t slots = 16;
+
+    while ( slots < 2 * ( uint32_t )( bytes < 255 ? bytes : 255 ) ) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+static size_t levenshtein_pattern_size( int bytes ) {
+    uint32_t slots = levenshtein_pattern_slots( bytes );
+    return sizeof( levenshtein_pattern ) + ( size_t )bytes * ( sizeof( uint32_t ) + 1 ) + slots * ( sizeof( uint32_t ) + 1 );
+}
+
+static unsigned char levenshtein_pattern_sym( const levenshtein_pattern *pat, uint32_t c ) {
+    uint32_t h;
+
+    if ( c < 128 ) {
+        return pat->ascii_sym[c];
+    }
+    for ( h = ( c * 2654435761u ) & pat->mask; pat->keys[h]; h = ( h + 1 ) & pat->mask ) {
+        if ( pat->keys[h] == c ) {
+            return pat->vals[h];
+        }
+    }
+    return 0;
+}
+
+// Builds the pattern in mem, which must hold levenshtein_pattern_size( bytes )
+static levenshtein_pattern *levenshtein_pattern_build( void *mem, const unsigned char *s, int bytes ) {
+    levenshtein_pattern *pat = ( levenshtein_pattern * )mem;
+    const unsigned char *z = s, *end = s + bytes;
+    uint32_t slots = levenshtein_pattern_slots( bytes );
+    int overflow = 0;
+
+    pat->len = 0;
+    pat->ascii = levenshtein_is_ascii( s, bytes );
+    pat->nsym = 0;
+    pat->cps = ( uint32_t * )( pat + 1 );
+    pat->keys = pat->cps + bytes;
+    pat->syms = ( unsigned char * )( pat->keys + slots );
+    pat->vals = pat->syms + bytes;
+    pat->mask = slots - 1;
+    memset( pat->ascii_sym, 0, sizeof( pat->ascii_sym ) );
+    memset( pat->keys, 0, slots * sizeof( uint32_t ) );
+
+    while ( z < end ) {
+        uint32_t c = levenshtein_utf8_next( &z, end );
+        unsigned char sym = 0;
+
+        if ( !overflow ) {
+            sym = levenshtein_pattern_sym( pat, c );
+            if ( !sym && pat->nsym == 255 ) {
+                overflow = 1;
+            } else if ( !sym ) {
+                sym = ( unsigned char )++pat->nsym;
+                if ( c < 128 ) {
+                    pat->ascii_sym[c] = sym;
+                } else {
+                    uint32_t h = ( c * 2654435761u ) & pat->mask;
+                    while ( pat->keys[h] ) {
+                        h = ( h + 1 ) & pat->mask;
+                    }
+                    pat->keys[h] = c;
+                    pat->vals[h] = sym;
+                }
+            }
+        }
+        pat->cps[pat->len] = c;
+        pat->syms[pat->len] = sym;
+        pat->len++;
+    }
+    if ( overflow ) {
+        pat->nsym = 0;
+    }
+    return pat;
+}
+
+// Distance in code points once the pattern has too many distinct ones for symbol ids
+static void levenshtein_utf8_wide( sqlite3_context *context, levenshtein_scratch *scratch, const levenshtein_pattern *pat, const unsigned char *text, int bytes, sqlite3_int64 max ) {
+    const unsigned char *z = text, *end = text + bytes;
+    const uint32_t *s1, *s2;
+    uint32_t *cps;
+    int len1 = 0, len2, *rows;
+    int result;
+
+    cps = ( uint32_t * )levenshtein_buffer_reserve( &scratch->text, ( size_t )bytes * sizeof( uint32_t ) + 1 );
+    if ( !cps ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    while ( z < end ) {
+        cps[len1++] = levenshtein_utf8_next( &z, end );
+    }
+
+    s1 = cps;
+    s2 = pat->cps;
+    len2 = pat->len;
+    if ( !levenshtein_limit( len1, len2, &max ) ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+        levenshtein_result_int( context, scratch, max + 1 );
+        return;
+    }
+    if ( len1 < len2 ) {
+        const uint32_t *ts = s1;
+        int tl = len1;
+        s1 = s2;
+        len1 = len2;
+        s2 = ts;
+        len2 = tl;
+    }
+
+    rows = ( int * )levenshtein_buffer_reserve( &scratch->work, 2 * ( size_t )( len2 + 1 ) * sizeof( int ) );
+    if ( !rows ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    result = max >= 0 ? levenshtein_bounded_cp( s1, len1, s2, len2, ( int )max, rows, rows + len2 + 1 ) : levenshtein_dp_cp( s1, len1, s2, len2, rows, rows + len2 + 1 );
+    if ( max >= 0 && result > max ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+    }
+    levenshtein_result_int( context, scratch, result );
+}
+
+static void levenshtein_utf8_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    const unsigned char *s[2];
+    int bytes[2];
+    void *aux[2];
+    levenshtein_pattern *pat = NULL, *compiled = NULL;
+    const unsigned char *text, *z, *end;
+    unsigned char *mapped;
+    sqlite3_int64 max;
+    int p, len;
+
+    if ( argc != 2 && argc != 3 ) {
+        sqlite3_result_error( context, "levenshtein_utf8() requires 2 or 3 arguments", -1 );
+        return;
+    }
+
+    if ( sqlite3_value_type( argv[0] ) == SQLITE_NULL || sqlite3_value_type( argv[1] ) == SQLITE_NULL ) {
+        sqlite3_result_null( context );
+        return;
+    }
+
+    s[0] = sqlite3_value_text( argv[0] );
+    s[1] = sqlite3_value_text( argv[1] );
+
+    if ( !s[0] || !s[1] ) {
+        sqlite3_result_null( context );
+        return;
+    }
+    bytes[0] = sqlite3_value_bytes( argv[0] );
+    bytes[1] = sqlite3_value_bytes( argv[1] );
+
+    if ( !levenshtein_max_arg( context, argc, argv, "levenshtein_utf8() max must not be negative", &max ) ) {
+        return;
+    }
+
+    aux[0] = sqlite3_get_auxdata( context, 0 );
+    aux[1] = sqlite3_get_auxdata( context, 1 );
+
+    // Pattern side: a cached one, else whichever argument kept its marker, else the second
+    if ( aux[1] && aux[1] != &levenshtein_aux_marker ) {
+        p = 1;
+        pat = ( levenshtein_pattern * )aux[1];
+    } else if ( aux[0] && aux[0] != &levenshtein_aux_marker ) {
+        p = 0;
+        pat = ( levenshtein_pattern * )aux[0];
+    } else {
+        p = ( !aux[1] && aux[0] ) ? 0 : 1;
+    }
+    text = s[1 - p];
+
+    if ( pat ? pat->ascii && levenshtein_is_ascii( text, bytes[1 - p] ) : levenshtein_is_ascii( s[0], bytes[0] ) && levenshtein_is_ascii( s[1], bytes[1] ) ) {
+        levenshtein_result( context, scratch, s[0], bytes[0], s[1], bytes[1], max );
+        return;
+    }
+
+    if ( pat ) {
+        LEVENSHTEIN_COUNT( scratch, cache_hits );
+    } else {
+        size_t size = levenshtein_pattern_size( bytes[p] );
+        void *mem;
+
+        LEVENSHTEIN_COUNT( scratch, cache_misses );
+
+        if ( aux[p] == &levenshtein_aux_marker ) {
+            mem = compiled = ( levenshtein_pattern * )sqlite3_malloc64( size ); // Constant: worth keeping
+        } else {
+            mem = levenshtein_buffer_reserve( &scratch->pattern, size );
+        }
+        if ( !mem ) {
+            sqlite3_result_error_nomem( context );
+            return;
+        }
+        pat = levenshtein_pattern_build( mem, s[p], bytes[p] );
+    }
+
+    if ( !pat->nsym && pat->len ) {
+        levenshtein_utf8_wide( context, scratch, pat, text, bytes[1 - p], max );
+    } else {
+        mapped = ( unsigned char * )levenshtein_buffer_reserve( &scratch->text, ( size_t )bytes[1 - p] + 1 );
+        if ( !mapped ) {
+            sqlite3_result_error_nomem( context );
+            sqlite3_free( compiled );
+            return;
+        }
+        len = 0;
+        for ( z = text, end = text + bytes[1 - p]; z < end; ) {
+            mapped[len++] = *z < 0x80 ? pat->ascii_sym[*z++] : levenshtein_pattern_sym( pat, levenshtein_utf8_next( &z, end ) );
+        }
+        levenshtein_result( context, scratch, mapped, len, pat->syms, pat->len, max );
+    }
+
+    // Cache last: SQLite frees auxdata at once if it cannot store it
+    if ( compiled ) {
+        sqlite3_set_auxdata( context, p, compiled, sqlite3_free );
+    } else if ( !aux[0] && !aux[1] && levenshtein_first_probe( context, argv ) ) {
+        sqlite3_set_auxdata( context, 0, ( void * )&levenshtein_aux_marker, NULL );
+        sqlite3_set_auxdata( context, 1, ( void * )&levenshtein_aux_marker, NULL );
+    }
+}
+
+/*
+ * The rest of the edit-distance family, on the same scratch and kernels:
+ *
+ *   damerau_levenshtein( a, b [, max] )  Levenshtein plus adjacent transpositions ('ab' -> 'ba' costs 1), in the
+ *                                        optimal string alignment form: no substring is edited twice.
+ *   levenshtein_ratio( a, b [, min] )    1 - levenshtein / longer length, 1.0 for two empty strings. Given min, any
+ *                                        ratio below it comes back as 0.0 and is cut short by the bounded kernels.
+ *   jaro_winkler( a, b )                 Jaro similarity with Winkler's boost for a common prefix of up to 4 bytes
+ *                                        (scale 0.1, applied when Jaro is above 0.7).
+ *   hamming( a, b )                      Positions that differ; NULL when the lengths differ.
+ *
+ * All of them count bytes, like levenshtein().
+ */
+
+static int levenshtein_popcount64( uint64_t x ) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return __builtin_popcountll( x );
+#else
+    x = x - ( ( x >> 1 ) & 0x5555555555555555ULL );
+    x = ( x & 0x3333333333333333ULL ) + ( ( x >> 2 ) & 0x3333333333333333ULL );
+    x = ( x + ( x >> 4 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+    return ( int )( ( x * 0x0101010101010101ULL ) >> 56 );
+#endif
+}
+
+// Index of the lowest set bit; x must not be 0
+static int levenshtein_ctz64( uint64_t x ) {
+#if defined( __GNUC__ ) || defined( __clang__ )
+    return __builtin_ctzll( x );
+#else
+    return levenshtein_popcount64( ( x & ( 0 - x ) ) - 1 );
+#endif
+}
+
+#ifndef LEVENSHTEIN_REFERENCE
+/*
+ * Hyyrö's bit-vector OSA distance for a pattern of 1..64 bytes: the Myers step plus a transposition
+ * term TR, set where the previous and current text bytes match the pattern the other way round.
+ * Horizontal differences stay within -1..1, so the early cutoff of levenshtein_myers64() still holds.
+ */
+static int levenshtein_osa64( const unsigned char *p, int m, const unsigned char *t, int n, int max ) {
+    uint64_t peq[256];
+    uint64_t vp = ~( uint64_t )0, vn = 0, d0 = 0, pm_prev = 0;
+    uint64_t last = ( uint64_t )1 << ( m - 1 );
+    int score = m;
+    int i, j;
+
+    memset( peq, 0, sizeof( peq ) );
+    for ( i = 0; i < m; i++ ) {
+        peq[p[i]] |= ( uint64_t )1 << i;
+    }
+
+    for ( j = 0; j < n; j++ ) {
+        uint64_t x = peq[t[j]];
+        uint64_t tr = ( ( ( ~d0 ) & x ) << 1 ) & pm_prev;
+        uint64_t hp, hn;
+
+        d0 = ( ( ( x & vp ) + vp ) ^ vp ) | x | vn | tr;
+        hp = vn | ~( d0 | vp );
+        hn = d0 & vp;
+
+        score += ( hp & last ) != 0;
+        score -= ( hn & last ) != 0;
+        if ( max >= 0 && score - ( n - j - 1 ) > max ) {
+            return max + 1;
+        }
+
+        hp = ( hp << 1 ) | 1;
+        hn = hn << 1;
+        vp = hn | ~( d0 | hp );
+        vn = hp & d0;
+        pm_prev = x;
+    }
+
+    return ( max >= 0 && score > max ) ? max + 1 : score;
+}
+#endif
+
+// OSA distance by DP over three rows of len2 + 1 cells, for patterns past one word. Row minima never drop.
+static int levenshtein_osa_dp( const unsigned char *s1, int len1, const unsigned char *s2, int len2, int max, int *rows ) {
+    int *back = rows, *prev = rows + len2 + 1, *curr = rows + 2 * ( len2 + 1 ), *temp;
+    int i, j;
+
+    for ( j = 0; j <= len2; j++ ) {
+        prev[j] = j;
+    }
+    for ( i = 1; i <= len1; i++ ) {
+        int row_min;
+
+        curr[0] = row_min = i;
+        for ( j = 1; j <= len2; j++ ) {
+            int cost = s1[i - 1] != s2[j - 1];
+            int v = MIN3( prev[j] + 1, curr[j - 1] + 1, prev[j - 1] + cost );
+
+            if ( i > 1 && j > 1 && s1[i - 1] == s2[j - 2] && s1[i - 2] == s2[j - 1] && back[j - 2] + 1 < v ) {
+                v = back[j - 2] + 1;
+            }
+            curr[j] = v;
+            row_min = v < row_min ? v : row_min;
+        }
+        if ( max >= 0 && row_min > max ) {
+            return max + 1;
+        }
+        temp = back;
+        back = prev;
+        prev = curr;
+        curr = temp;
+    }
+    return ( max >= 0 && prev[len2] > max ) ? max + 1 : prev[len2];
+}
+
+// OSA distance under the same conventions as levenshtein_distance(): s2 is the shorter string, -1 on OOM
+static int levenshtein_osa( levenshtein_scratch *scratch, const unsigned char *s1, int len1, const unsigned char *s2, int len2, int max ) {
+    int *rows;
+
+    if ( len2 == 0 ) {
+        return ( max >= 0 && len1 > max ) ? max + 1 : len1;
+    }
+#ifndef LEVENSHTEIN_REFERENCE
+    if ( len2 <= 64 ) {
+        return levenshtein_osa64( s2, len2, s1, len1, max );
+    }
+#endif
+    rows = ( int * )levenshtein_buffer_reserve( &scratch->work, 3 * ( size_t )( len2 + 1 ) * sizeof( int ) );
+    return rows ? levenshtein_osa_dp( s1, len1, s2, len2, max, rows ) : -1;
+}
+
+static void damerau_levenshtein_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    const unsigned char *s1, *s2;
+    int len1, len2, result;
+    sqlite3_int64 max;
+
+    if ( argc != 2 && argc != 3 ) {
+        sqlite3_result_error( context, "damerau_levenshtein() requires 2 or 3 arguments", -1 );
+        return;
+    }
+    s1 = sqlite3_value_text( argv[0] );
+    s2 = sqlite3_value_text( argv[1] );
+    if ( !s1 || !s2 ) {
+        sqlite3_result_null( context );
+        return;
+    }
+    if ( !levenshtein_max_arg( context, argc, argv, "damerau_levenshtein() max must not be negative", &max ) ) {
+        return;
+    }
+    len1 = sqlite3_value_bytes( argv[0] );
+    len2 = sqlite3_value_bytes( argv[1] );
+    if ( !levenshtein_limit( len1, len2, &max ) ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+        levenshtein_result_int( context, scratch, max + 1 );
+        return;
+    }
+    result = len1 >= len2 ? levenshtein_osa( scratch, s1, len1, s2, len2, ( int )max ) : levenshtein_osa( scratch, s2, len2, s1, len1, ( int )max );
+    if ( result < 0 ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    if ( max >= 0 && result > max ) {
+        LEVENSHTEIN_COUNT( scratch, early_exits );
+    }
+    levenshtein_result_int( context, scratch, result );
+}
+
+static void levenshtein_ratio_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    const unsigned char *s1, *s2;
+    int len1, len2, longer;
+    sqlite3_int64 max = -1, d;
+
+    if ( argc != 2 && argc != 3 ) {
+        sqlite3_result_error( context, "levenshtein_ratio() requires 2 or 3 arguments", -1 );
+        return;
+    }
+    s1 = sqlite3_value_text( argv[0] );
+    s2 = sqlite3_value_text( argv[1] );
+    if ( !s1 || !s2 ) {
+        sqlite3_result_null( context );
+        return;
+    }
+    len1 = sqlite3_value_bytes( argv[0] );
+    len2 = sqlite3_value_bytes( argv[1] );
+    longer = len1 > len2 ? len1 : len2;
+    if ( longer == 0 ) {
+        levenshtein_result_double( context, scratch, 1.0 );
+        return;
+    }
+
+    // ratio >= min exactly when d <= ( 1 - min ) * longer
+    if ( argc == 3 && sqlite3_value_type( argv[2] ) != SQLITE_NULL ) {
+        double min = sqlite3_value_double( argv[2] );
+        if ( min > 1.0 ) {
+            levenshtein_result_double( context, scratch, 0.0 );
+            return;
+        }
+        if ( min > 0.0 ) {
+            max = ( sqlite3_int64 )( ( 1.0 - min ) * longer + 1e-9 );
+        }
+    }
+    d = levenshtein_pair( scratch, s1, len1, s2, len2, max );
+    if ( d < 0 ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    levenshtein_result_double( context, scratch, ( max >= 0 && d > max ) ? 0.0 : 1.0 - ( double )d / longer );
+}
+
+/*
+ * Jaro: bytes match when equal and at most max( len1, len2 ) / 2 - 1 apart, each byte of b used once;
+ * half the matched pairs that come out in a different order are transpositions. When b fits in a word
+ * its unmatched positions per byte value are a bit mask, so each byte of a finds its match in one AND.
+ */
+static double levenshtein_jaro( levenshtein_scratch *scratch, const unsigned char *a, int la, const unsigned char *b, int lb, int *ok ) {
+    int window = ( la > lb ? la : lb ) / 2 - 1;
+    int matches = 0, half = 0, i, j, k;
+
+    *ok = 1;
+    if ( la == 0 || lb == 0 ) {
+        return la == lb ? 1.0 : 0.0;
+    }
+    window = window < 0 ? 0 : window;
+
+    if ( lb <= 64 ) {
+        uint64_t peq[256], used = 0;
+        unsigned char order[64];    // Matched bytes of a, in order; there are at most lb of them
+
+        memset( peq, 0, sizeof( peq ) );
+        for ( j = 0; j < lb; j++ ) {
+            peq[b[j]] |= ( uint64_t )1 << j;
+        }
+        for ( i = 0; i < la && matches < lb; i++ ) {
+            int lo = i - window > 0 ? i - window : 0, hi = i + window < lb - 1 ? i + window : lb - 1;
+            uint64_t span, hit;
+
+            if ( lo > hi ) {
+                continue;
+            }
+            span = ( hi - lo == 63 ? ~( uint64_t )0 : ( ( ( uint64_t )1 << ( hi - lo + 1 ) ) - 1 ) ) << lo;
+            hit = peq[a[i]] & span & ~used;
+            if ( hit ) {
+                used |= hit & ( 0 - hit );
+                order[matches++] = a[i];
+            }
+        }
+        for ( k = 0; used; used &= used - 1, k++ ) {
+            half += b[levenshtein_ctz64( used )] != order[k];
+        }
+    } else {
+        unsigned char *used_a = ( unsigned char * )levenshtein_buffer_reserve( &scratch->work, ( size_t )la + lb );
+        unsigned char *used_b;
+
+        if ( !used_a ) {
+            *ok = 0;
+            return 0.0;
+        }
+        used_b = used_a + la;
+        memset( used_a, 0, ( size_t )la + lb );
+        for ( i = 0; i < la; i++ ) {
+            int lo = i - window > 0 ? i - window : 0, hi = i + window < lb - 1 ? i + window : lb - 1;
+            for ( j = lo; j <= hi; j++ ) {
+                if ( !used_b[j] && a[i] == b[j] ) {
+                    used_a[i] = used_b[j] = 1;
+                    matches++;
+                    break;
+                }
+            }
+        }
+        for ( i = 0, j = 0; i < la; i++ ) {
+            if ( used_a[i] ) {
+                while ( !used_b[j] ) {
+                    j++;
+                }
+                half += a[i] != b[j++];
+            }
+        }
+    }
+
+    if ( !matches ) {
+        return 0.0;
+    }
+    return ( ( double )matches / la + ( double )matches / lb + ( double )( matches - half / 2 ) / matches ) / 3.0;
+}
+
+static void jaro_winkler_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    const unsigned char *s1 = sqlite3_value_text( argv[0] ), *s2 = sqlite3_value_text( argv[1] );
+    int len1, len2, prefix = 0, ok;
+    double jaro;
+
+    if ( !s1 || !s2 ) {
+        sqlite3_result_null( context );
+        return;
+    }
+    len1 = sqlite3_value_bytes( argv[0] );
+    len2 = sqlite3_value_bytes( argv[1] );
+    jaro = levenshtein_jaro( scratch, s1, len1, s2, len2, &ok );
+    if ( !ok ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    if ( jaro > 0.7 ) {
+        while ( prefix < 4 && prefix < len1 && prefix < len2 && s1[prefix] == s2[prefix] ) {
+            prefix++;
+        }
+        jaro += prefix * 0.1 * ( 1.0 - jaro );
+    }
+    levenshtein_result_double( context, scratch, jaro );
+}
+
+LEVENSHTEIN_MEMOIZED( levenshtein_func )
+LEVENSHTEIN_MEMOIZED( levenshtein_utf8_func )
+LEVENSHTEIN_MEMOIZED( damerau_levenshtein_func )
+LEVENSHTEIN_MEMOIZED( levenshtein_ratio_func )
+LEVENSHTEIN_MEMOIZED( jaro_winkler_func )
+
+static void hamming_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    const unsigned char *s1 = sqlite3_value_text( argv[0] ), *s2 = sqlite3_value_text( argv[1] );
+    int len, i, diff = 0;
+
+    if ( !s1 || !s2 || sqlite3_value_bytes( argv[0] ) != sqlite3_value_bytes( argv[1] ) ) {
+        sqlite3_result_null( context );
+        return;
+    }
+    len = sqlite3_value_bytes( argv[0] );
+
+    // Eight bytes at a time: after the add, bit 7 of each byte is set exactly when that byte differs
+    for ( i = 0; i + 8 <= len; i += 8 ) {
+        uint64_t x, y;
+        memcpy( &x, s1 + i, sizeof( x ) );
+        memcpy( &y, s2 + i, sizeof( y ) );
+        x ^= y;
+        x = ( ( ( x & 0x7F7F7F7F7F7F7F7FULL ) + 0x7F7F7F7F7F7F7F7FULL ) | x ) & 0x8080808080808080ULL;
+        diff += levenshtein_popcount64( x );
+    }
+    for ( ; i < len; i++ ) {
+        diff += s1[i] != s2[i];
+    }
+    sqlite3_result_int( context, diff );
+}
+
+/*
+ * Phonetic keys, for blocking record linkage on an index instead of comparing every pair. All three are
+ * deterministic and innocuous, so they can appear in expression indexes and in schemas read with
+ * trusted_schema off:
+ *
+ *   CREATE INDEX people_dm ON people( double_metaphone( surname ) );
+ *   SELECT a.rowid, b.rowid FROM people a JOIN people b ON double_metaphone( b.surname ) = double_metaphone( a.surname )
+ *    WHERE b.rowid > a.rowid AND levenshtein( a.surname, b.surname, 2 ) <= 2;
+ *
+ * soundex( name ): American Soundex, a letter and three digits.
+ * double_metaphone( name [, alternate] ): Philips' Double Metaphone, primary key or, when alternate is
+ *   true, the alternate key, each at most four characters.
+ * nysiis( name [, length] ): the New York State Identification and Intelligence System key, cut to
+ *   length characters (default 6, 0 for the whole key).
+ *
+ * Only ASCII letters carry sound, except that double_metaphone() also knows Ç and Ñ; other characters are
+ * skipped. A name with no letters has no key and gives NULL, so blank names never block together.
+ */
+
+// The Soundex digit of each letter; 0 for vowels, which separate equal digits, and '-' for H and W, which do not
+static const char levenshtein_soundex_codes[26] = {
+    0, '1', '2', '3', 0, '1', '2', '-', 0, '2', '2', '4', '5', '5', 0, '1', '2', '6', '2', '3', 0, '1', '-', '2', 0, '2'
+};
+
+static void soundex_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    const unsigned char *s = sqlite3_value_text( argv[0] );
+    int len = sqlite3_value_bytes( argv[0] ), i, n = 0;
+    char key[4] = { '0', '0', '0', '0' }, last = 0;
+
+    if ( !s ) {
+        return;
+    }
+    for ( i = 0; i < len && n < 4; i++ ) {
+        int c = s[i] | 0x20;
+        char code;
+
+        if ( c < 'a' || c > 'z' ) {
+            continue;
+        }
+        code = levenshtein_soundex_codes[c - 'a'];
+        if ( n == 0 ) {
+            key[n++] = ( char )( c - 0x20 );
+        } else if ( code && code != '-' && code != last ) {
+            key[n++] = code;
+        }
+        if ( code != '-' ) {
+            last = code;
+        }
+    }
+    if ( n ) {
+        sqlite3_result_text( context, key, 4, SQLITE_TRANSIENT );
+    }
+}
+
+/*
+ * Double Metaphone works on the name as upper-case characters, one byte each: ASCII letters and spaces
+ * as themselves, Ç and Ñ as the two codes below, and anything else as a byte no rule looks at. Every rule
+ * reads characters through levenshtein_dm_at() and levenshtein_dm_is(), which treat positions outside
+ * the name as matching nothing, so the rules can be written as in the reference implementation.
+ */
+
+#define LEVENSHTEIN_DM_MAX 4
+#define LEVENSHTEIN_DM_C_CEDILLA 0x01
+#define LEVENSHTEIN_DM_N_TILDE 0x02
+#define LEVENSHTEIN_DM_OTHER 0x7F
+
+typedef struct levenshtein_dm {
+    const char *s;
+    int len;
+    int slavo_germanic;         // W, K, CZ or WITZ anywhere: some rules change
+    char primary[LEVENSHTEIN_DM_MAX + 1];
+    char alternate[LEVENSHTEIN_DM_MAX + 1];
+    int nprimary, nalternate;
+} levenshtein_dm;
+
+static char levenshtein_dm_at( const levenshtein_dm *dm, int i ) {
+    return i >= 0 && i < dm->len ? dm->s[i] : 0;
+}
+
+// Whether the n characters at i are one of the |-separated words in list, which all have length n
+static int levenshtein_dm_is( const levenshtein_dm *dm, int i, int n, const char *list ) {
+    if ( i < 0 || i + n > dm->len ) {
+        return 0;
+    }
+    for ( ; *list; list += n + ( list[n] == '|' ) ) {
+        if ( !memcmp( dm->s + i, list, n ) ) {
+            return 1;
+        }
+        if ( !list[n] ) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int levenshtein_dm_vowel( char c ) {
+    return c && strchr( "AEIOUY", c ) != NULL;
+}
+
+static void levenshtein_dm_add2( levenshtein_dm *dm, const char *primary, const char *alternate ) {
+    for ( ; *primary && dm->nprimary < LEVENSHTEIN_DM_MAX; primary++ ) {
+        dm->primary[dm->nprimary++] = *primary;
+    }
+    for ( ; *alternate && dm->nalternate < LEVENSHTEIN_DM_MAX; alternate++ ) {
+        dm->alternate[dm->nalternate++] = *alternate;
+    }
+}
+
+static void levenshtein_dm_add( levenshtein_dm *dm, const char *both ) {
+    levenshtein_dm_add2( dm, both, both );
+}
+
+static int levenshtein_dm_c( levenshtein_dm *dm, int i ) {
+    // Germanic CH as K: BACHER, MACHER, and ACH not followed by I or E
+    if ( levenshtein_dm_is( dm, i, 4, "CHIA" ) ||
+         ( i > 1 && !levenshtein_dm_vowel( levenshtein_dm_at( dm, i - 2 ) ) && levenshtein_dm_is( dm, i - 1, 3, "ACH" ) &&
+           ( ( levenshtein_dm_at( dm, i + 2 ) != 'I' && levenshtein_dm_at( dm, i + 2 ) != 'E' ) || levenshtein_dm_is( dm, i - 2, 6, "BACHER|MACHER" ) ) ) ) {
+        levenshtein_dm_add( dm, "K" );
+        return i + 2;
+    }
+    if ( i == 0 && levenshtein_dm_is( dm, i, 6, "CAESAR" ) ) {
+        levenshtein_dm_add( dm, "S" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "CH" ) ) {
+        if ( i > 0 && levenshtein_dm_is( dm, i, 4, "CHAE" ) ) {
+            levenshtein_dm_add2( dm, "K", "X" );
+        } else if ( i == 0 && ( levenshtein_dm_is( dm, i + 1, 5, "HARAC|HARIS" ) || levenshtein_dm_is( dm, i + 1, 3, "HOR|HYM|HIA|HEM" ) ) &&
+                    !levenshtein_dm_is( dm, 0, 5, "CHORE" ) ) {
+            levenshtein_dm_add( dm, "K" ); // Greek roots: CHARACTER, CHARISMA, CHORUS
+        } else if ( levenshtein_dm_is( dm, 0, 4, "VAN |VON " ) || levenshtein_dm_is( dm, 0, 3, "SCH" ) ||
+                    levenshtein_dm_is( dm, i - 2, 6, "ORCHES|ARCHIT|ORCHID" ) || levenshtein_dm_is( dm, i + 2, 1, "T|S" ) ||
+                    ( ( levenshtein_dm_is( dm, i - 1, 1, "A|O|U|E" ) || i == 0 ) &&
+                      ( levenshtein_dm_is( dm, i + 2, 1, "L|R|N|M|B|H|F|V|W| " ) || i + 1 == dm->len - 1 ) ) ) {
+            levenshtein_dm_add( dm, "K" );
+        } else if ( i > 0 ) {
+            if ( levenshtein_dm_is( dm, 0, 2, "MC" ) ) {
+                levenshtein_dm_add( dm, "K" );
+            } else {
+                levenshtein_dm_add2( dm, "X", "K" );
+            }
+        } else {
+            levenshtein_dm_add( dm, "X" );
+        }
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "CZ" ) && !levenshtein_dm_is( dm, i - 2, 4, "WICZ" ) ) {
+        levenshtein_dm_add2( dm, "S", "X" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i + 1, 3, "CIA" ) ) {
+        levenshtein_dm_add( dm, "X" );
+        return i + 3;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "CC" ) && !( i == 1 && levenshtein_dm_at( dm, 0 ) == 'M' ) ) {
+        if ( levenshtein_dm_is( dm, i + 2, 1, "I|E|H" ) && !levenshtein_dm_is( dm, i + 2, 2, "HU" ) ) {
+            if ( ( i == 1 && levenshtein_dm_at( dm, i - 1 ) == 'A' ) || levenshtein_dm_is( dm, i - 1, 5, "UCCEE|UCCES" ) ) {
+                levenshtein_dm_add( dm, "KS" ); // ACCIDENT, SUCCEED
+            } else {
+                levenshtein_dm_add( dm, "X" ); // BACCI, BERTUCCI
+            }
+            return i + 3;
+        }
+        levenshtein_dm_add( dm, "K" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "CK|CG|CQ" ) ) {
+        levenshtein_dm_add( dm, "K" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "CI|CE|CY" ) ) {
+        if ( levenshtein_dm_is( dm, i, 3, "CIO|CIE|CIA" ) ) {
+            levenshtein_dm_add2( dm, "S", "X" );
+        } else {
+            levenshtein_dm_add( dm, "S" );
+        }
+        return i + 2;
+    }
+    levenshtein_dm_add( dm, "K" );
+    if ( levenshtein_dm_is( dm, i + 1, 2, " C| Q| G" ) ) {
+        return i + 3; // MAC CAFFREY
+    }
+    if ( levenshtein_dm_is( dm, i + 1, 1, "C|K|Q" ) && !levenshtein_dm_is( dm, i + 1, 2, "CE|CI" ) ) {
+        return i + 2;
+    }
+    return i + 1;
+}
+
+static int levenshtein_dm_g( levenshtein_dm *dm, int i ) {
+    char next = levenshtein_dm_at( dm, i + 1 );
+
+    if ( next == 'H' ) {
+        if ( i > 0 && !levenshtein_dm_vowel( levenshtein_dm_at( dm, i - 1 ) ) ) {
+            levenshtein_dm_add( dm, "K" );
+        } else if ( i == 0 ) {
+            levenshtein_dm_add( dm, levenshtein_dm_at( dm, i + 2 ) == 'I' ? "J" : "K" );
+        } else if ( ( i > 1 && levenshtein_dm_is( dm, i - 2, 1, "B|H|D" ) ) || ( i > 2 && levenshtein_dm_is( dm, i - 3, 1, "B|H|D" ) ) ||
+                    ( i > 3 && levenshtein_dm_is( dm, i - 4, 1, "B|H" ) ) ) {
+            // Silent: HUGH, BOUGH, BROUGHTON
+        } else if ( i > 2 && levenshtein_dm_at( dm, i - 1 ) == 'U' && levenshtein_dm_is( dm, i - 3, 1, "C|G|L|R|T" ) ) {
+            levenshtein_dm_add( dm, "F" ); // LAUGH, COUGH, TOUGH
+        } else if ( i > 0 && levenshtein_dm_at( dm, i - 1 ) != 'I' ) {
+            levenshtein_dm_add( dm, "K" );
+        }
+        return i + 2;
+    }
+    if ( next == 'N' ) {
+        if ( i == 1 && levenshtein_dm_vowel( levenshtein_dm_at( dm, 0 ) ) && !dm->slavo_germanic ) {
+            levenshtein_dm_add2( dm, "KN", "N" );
+        } else if ( !levenshtein_dm_is( dm, i + 2, 2, "EY" ) && levenshtein_dm_at( dm, i + 1 ) != 'Y' && !dm->slavo_germanic ) {
+            levenshtein_dm_add2( dm, "N", "KN" );
+        } else {
+            levenshtein_dm_add( dm, "KN" );
+        }
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i + 1, 2, "LI" ) && !dm->slavo_germanic ) {
+        levenshtein_dm_add2( dm, "KL", "L" ); // TAGLIARO
+        return i + 2;
+    }
+    if ( i == 0 && ( next == 'Y' || levenshtein_dm_is( dm, i + 1, 2, "ES|EP|EB|EL|EY|IB|IL|IN|IE|EI|ER" ) ) ) {
+        levenshtein_dm_add2( dm, "K", "J" );
+        return i + 2;
+    }
+    if ( ( levenshtein_dm_is( dm, i + 1, 2, "ER" ) || next == 'Y' ) && !levenshtein_dm_is( dm, 0, 6, "DANGER|RANGER|MANGER" ) &&
+         !levenshtein_dm_is( dm, i - 1, 1, "E|I" ) && !levenshtein_dm_is( dm, i - 1, 3, "RGY|OGY" ) ) {
+        levenshtein_dm_add2( dm, "K", "J" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i + 1, 1, "E|I|Y" ) || levenshtein_dm_is( dm, i - 1, 4, "AGGI|OGGI" ) ) {
+        if ( levenshtein_dm_is( dm, 0, 4, "VAN |VON " ) || levenshtein_dm_is( dm, 0, 3, "SCH" ) || levenshtein_dm_is( dm, i + 1, 2, "ET" ) ) {
+            levenshtein_dm_add( dm, "K" );
+        } else if ( levenshtein_dm_is( dm, i + 1, 3, "IER" ) ) {
+            levenshtein_dm_add( dm, "J" );
+        } else {
+            levenshtein_dm_add2( dm, "J", "K" );
+        }
+        return i + 2;
+    }
+    levenshtein_dm_add( dm, "K" );
+    return next == 'G' ? i + 2 : i + 1;
+}
+
+static int levenshtein_dm_j( levenshtein_dm *dm, int i ) {
+    if ( levenshtein_dm_is( dm, i, 4, "JOSE" ) || levenshtein_dm_is( dm, 0, 4, "SAN " ) ) {
+        if ( ( i == 0 && levenshtein_dm_at( dm, i + 4 ) == ' ' ) || dm->len == 4 || levenshtein_dm_is( dm, 0, 4, "SAN " ) ) {
+            levenshtein_dm_add( dm, "H" );
+        } else {
+            levenshtein_dm_add2( dm, "J", "H" );
+        }
+        return i + 1;
+    }
+    if ( i == 0 ) {
+        levenshtein_dm_add2( dm, "J", "A" ); // JANKELOWICZ
+    } else if ( levenshtein_dm_vowel( levenshtein_dm_at( dm, i - 1 ) ) && !dm->slavo_germanic && ( levenshtein_dm_at( dm, i + 1 ) == 'A' || levenshtein_dm_at( dm, i + 1 ) == 'O' ) ) {
+        levenshtein_dm_add2( dm, "J", "H" ); // BAJADOR
+    } else if ( i == dm->len - 1 ) {
+        levenshtein_dm_add2( dm, "J", "" );
+    } else if ( !levenshtein_dm_is( dm, i + 1, 1, "L|T|K|S|N|M|B|Z" ) && !levenshtein_dm_is( dm, i - 1, 1, "S|K|L" ) ) {
+        levenshtein_dm_add( dm, "J" );
+    }
+    return levenshtein_dm_at( dm, i + 1 ) == 'J' ? i + 2 : i + 1;
+}
+
+static int levenshtein_dm_s( levenshtein_dm *dm, int i ) {
+    if ( levenshtein_dm_is( dm, i - 1, 3, "ISL|YSL" ) ) {
+        return i + 1; // Silent: ISLAND, CARLYSLE
+    }
+    if ( i == 0 && levenshtein_dm_is( dm, i, 5, "SUGAR" ) ) {
+        levenshtein_dm_add2( dm, "X", "S" );
+        return i + 1;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "SH" ) ) {
+        levenshtein_dm_add( dm, levenshtein_dm_is( dm, i + 1, 4, "HEIM|HOEK|HOLM|HOLZ" ) ? "S" : "X" );
+        return i + 2;
+    }
+    if ( levenshtein_dm_is( dm, i, 3, "SIO|SIA" ) || levenshtein_dm_is( dm, i, 4, "SIAN" ) ) {
+        if ( dm->slavo_germanic ) {
+            levenshtein_dm_add( dm, "S" );
+        } else {
+            levenshtein_dm_add2( dm, "S", "X" );
+        }
+        return i + 3;
+    }
+    if ( ( i == 0 && levenshtein_dm_is( dm, i + 1, 1, "M|N|L|W" ) ) || levenshtein_dm_is( dm, i + 1, 1, "Z" ) ) {
+        levenshtein_dm_add2( dm, "S", "X" ); // SMITH and SCHMIDT, SNIDER and SCHNEIDER
+        return levenshtein_dm_is( dm, i + 1, 1, "Z" ) ? i + 2 : i + 1;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "SC" ) ) {
+        if ( levenshtein_dm_at( dm, i + 2 ) == 'H' ) {
+            if ( levenshtein_dm_is( dm, i + 3, 2, "OO|ER|EN|UY|ED|EM" ) ) {
+                if ( levenshtein_dm_is( dm, i + 3, 2, "ER|EN" ) ) {
+                    levenshtein_dm_add2( dm, "X", "SK" ); // SCHENKER
+                } else {
+                    levenshtein_dm_add( dm, "SK" ); // SCHOOL, SCHOONER
+                }
+            } else if ( i == 0 && !levenshtein_dm_vowel( levenshtein_dm_at( dm, 3 ) ) && levenshtein_dm_at( dm, 3 ) != 'W' ) {
+                levenshtein_dm_add2( dm, "X", "S" );
+            } else {
+                levenshtein_dm_add( dm, "X" );
+            }
+        } else if ( levenshtein_dm_is( dm, i + 2, 1, "I|E|Y" ) ) {
+            levenshtein_dm_add( dm, "S" );
+        } else {
+            levenshtein_dm_add( dm, "SK" );
+        }
+        return i + 3;
+    }
+    if ( i == dm->len - 1 && levenshtein_dm_is( dm, i - 2, 2, "AI|OI" ) ) {
+        levenshtein_dm_add2( dm, "", "S" ); // Silent in French: RESNAIS, ARTOIS
+    } else {
+        levenshtein_dm_add( dm, "S" );
+    }
+    return levenshtein_dm_is( dm, i + 1, 1, "S|Z" ) ? i + 2 : i + 1;
+}
+
+static int levenshtein_dm_t( levenshtein_dm *dm, int i ) {
+    if ( levenshtein_dm_is( dm, i, 4, "TION" ) || levenshtein_dm_is( dm, i, 3, "TIA|TCH" ) ) {
+        levenshtein_dm_add( dm, "X" );
+        return i + 3;
+    }
+    if ( levenshtein_dm_is( dm, i, 2, "TH" ) || levenshtein_dm_is( dm, i, 3, "TTH" ) ) {
+        if ( levenshtein_dm_is( dm, i + 2, 2, "OM|AM" ) || levenshtein_dm_is( dm, 0, 4, "VAN |VON " ) || levenshtein_dm_is( dm, 0, 3, "SCH" ) ) {
+            levenshtein_dm_add( dm, "T" ); // THOMAS, THAMES
+        } else {
+            levenshtein_dm_add2( dm, "0", "T" ); // 0 stands for TH
+        }
+        return i + 2;
+    }
+    levenshtein_dm_add( dm, "T" );
+    return levenshtein_dm_is( dm, i + 1, 1, "T|D" ) ? i + 2 : i + 1;
+}
+
+static int levenshtein_dm_w( levenshtein_dm *dm, int i ) {
+    if ( levenshtein_dm_is( dm, i, 2, "WR" ) ) {
+        levenshtein_dm_add( dm, "R" );
+        return i + 2;
+    }
+    if ( i == 0 && ( levenshtein_dm_vowel( levenshtein_dm_at( dm, i + 1 ) ) || levenshtein_dm_is( dm, i, 2, "WH" ) ) ) {
+        if ( levenshtein_dm_vowel( levenshtein_dm_at( dm, i + 1 ) ) ) {
+            levenshtein_dm_add2( dm, "A", "F" ); // WASSERMAN and VASSERMAN
+        } else {
+            levenshtein_dm_add( dm, "A" );
+        }
+        return i + 1;
+    }
+    if ( ( i == dm->len - 1 && levenshtein_dm_vowel( levenshtein_dm_at( dm, i - 1 ) ) ) || levenshtein_dm_is( dm, i - 1, 5, "EWSKI|EWSKY|OWSKI|OWSKY" ) ||
+         levenshtein_dm_is( dm, 0, 3, "SCH" ) ) {
+        levenshtein_dm_add2( dm, "", "F" ); // ARNOW, LEWINSKI as LEVINSKI
+        return i + 1;
+    }
+    if ( levenshtein_dm_is( dm, i, 4, "WICZ|WITZ" ) ) {
+        levenshtein_dm_add2( dm, "TS", "FX" );
+        return i + 4;
+    }
+    return i + 1;
+}
+
+static void levenshtein_double_metaphone( levenshtein_dm *dm ) {
+    int i = levenshtein_dm_is( dm, 0, 2, "GN|KN|PN|WR|PS" ) ? 1 : 0;
+
+    while ( i < dm->len && ( dm->nprimary < LEVENSHTEIN_DM_MAX || dm->nalternate < LEVENSHTEIN_DM_MAX ) ) {
+        char c = dm->s[i], next = levenshtein_dm_at( dm, i + 1 ), one[2] = { 0, 0 };
+
+        switch ( c ) {
+            case 'A': case 'E': case 'I': case 'O': case 'U': case 'Y':
+                if ( i == 0 ) {
+                    levenshtein_dm_add( dm, "A" ); // Only an initial vowel is kept
+                }
+                i++;
+                break;
+            case 'B':
+                levenshtein_dm_add( dm, "P" );
+                i += next == 'B' ? 2 : 1;
+                break;
+            case LEVENSHTEIN_DM_C_CEDILLA:
+                levenshtein_dm_add( dm, "S" );
+                i++;
+                break;
+            case 'C':
+                i = levenshtein_dm_c( dm, i );
+                break;
+            case 'D':
+                if ( levenshtein_dm_is( dm, i, 2, "DG" ) ) {
+                    if ( levenshtein_dm_is( dm, i + 2, 1, "I|E|Y" ) ) {
+                        levenshtein_dm_add( dm, "J" ); // EDGE
+                        i += 3;
+                    } else {
+                        levenshtein_dm_add( dm, "TK" ); // EDGAR
+                        i += 2;
+                    }
+                } else {
+                    levenshtein_dm_add( dm, "T" );
+                    i += levenshtein_dm_is( dm, i, 2, "DT|DD" ) ? 2 : 1;
+                }
+                break;
+            case 'F': case 'K': case 'N': case 'Q': case 'V':
+                // A doubled letter sounds once; Q sounds as K and V as F
+                one[0] = c == 'Q' ? 'K' : c == 'V' ? 'F' : c;
+                levenshtein_dm_add( dm, one );
+                i += next == c ? 2 : 1;
+                break;
+            case 'G':
+                i = levenshtein_dm_g( dm, i );
+                break;
+            case 'H':
+                // Sounded only before a vowel, and then only at the start or after another vowel
+                if ( ( i == 0 || levenshtein_dm_vowel( levenshtein_dm_at( dm, i - 1 ) ) ) && levenshtein_dm_vowel( next ) ) {
+                    levenshtein_dm_add( dm, "H" );
+                    i += 2;
+                } else {
+                    i++;
+                }
+                break;
+            case 'J':
+                i = levenshtein_dm_j( dm, i );
+                break;
+            case 'L':
+                if ( next == 'L' ) {
+                    // Spanish LL: CABRILLO, GALLEGOS
+                    if ( ( i == dm->len - 3 && levenshtein_dm_is( dm, i - 1, 4, "ILLO|ILLA|ALLE" ) ) ||
+                         ( ( levenshtein_dm_is( dm, dm->len - 2, 2, "AS|OS" ) || levenshtein_dm_is( dm, dm->len - 1, 1, "A|O" ) ) && levenshtein_dm_is( dm, i - 1, 4, "ALLE" ) ) ) {
+                        levenshtein_dm_add2( dm, "L", "" );
+                    } else {
+                        levenshtein_dm_add( dm, "L" );
+                    }
+                    i += 2;
+                } else {
+                    levenshtein_dm_add( dm, "L" );
+                    i++;
+                }
+                break;
+            case 'M':
+                levenshtein_dm_add( dm, "M" );
+                i += next == 'M' || ( levenshtein_dm_is( dm, i - 1, 3, "UMB" ) && ( i + 1 == dm->len - 1 || levenshtein_dm_is( dm, i + 2, 2, "ER" ) ) ) ? 2 : 1; // DUMB, THUMB
+                break;
+            case LEVENSHTEIN_DM_N_TILDE:
+                levenshtein_dm_add( dm, "N" );
+                i++;
+                break;
+            case 'P':
+                if ( next == 'H' ) {
+                    levenshtein_dm_add( dm, "F" );
+                    i += 2;
+                } else {
+                    levenshtein_dm_add( dm, "P" );
+                    i += next == 'P' || next == 'B' ? 2 : 1; // CAMPBELL
+                }
+                break;
+            case 'R':
+                // French final R after IE: ROGIER
+                if ( i == dm->len - 1 && !dm->slavo_germanic && levenshtein_dm_is( dm, i - 2, 2, "IE" ) && !levenshtein_dm_is( dm, i - 4, 2, "ME|MA" ) ) {
+                    levenshtein_dm_add2( dm, "", "R" );
+                } else {
+                    levenshtein_dm_add( dm, "R" );
+                }
+                i += next == 'R' ? 2 : 1;
+                break;
+            case 'S':
+                i = levenshtein_dm_s( dm, i );
+                break;
+            case 'T':
+                i = levenshtein_dm_t( dm, i );
+                break;
+            case 'W':
+                i = levenshtein_dm_w( dm, i );
+                break;
+            case 'X':
+                if ( i == 0 ) {
+                    levenshtein_dm_add( dm, "S" ); // XAVIER
+                    i++;
+                    break;
+                }
+                // Silent in French at the end: BREAUX
+                if ( !( ( i == dm->len - 1 && ( levenshtein_dm_is( dm, i - 3, 3, "IAU|EAU" ) || levenshtein_dm_is( dm, i - 2, 2, "AU|OU" ) ) ) ) ) {
+                    levenshtein_dm_add( dm, "KS" );
+                }
+                i += next == 'C' || next == 'X' ? 2 : 1;
+                break;
+            case 'Z':
+                if ( next == 'H' ) {
+                    levenshtein_dm_add( dm, "J" ); // Chinese: ZHAO
+                    i += 2;
+                    break;
+                }
+                if ( levenshtein_dm_is( dm, i + 1, 2, "ZO|ZI|ZA" ) || ( dm->slavo_germanic && i > 0 && levenshtein_dm_at( dm, i - 1 ) != 'T' ) ) {
+                    levenshtein_dm_add2( dm, "S", "TS" );
+                } else {
+                    levenshtein_dm_add( dm, "S" );
+                }
+                i += next == 'Z' ? 2 : 1;
+                break;
+            default:
+                i++;
+                break;
+        }
+    }
+}
+
+static void double_metaphone_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    const unsigned char *s = sqlite3_value_text( argv[0] );
+    int len = sqlite3_value_bytes( argv[0] ), alternate = argc > 1 && sqlite3_value_int( argv[1] ), i, n = 0;
+    levenshtein_buffer *buf;
+    char *name;
+    levenshtein_dm dm;
+
+    if ( !s ) {
+        return;
+    }
+    buf = &( ( levenshtein_scratch * )sqlite3_user_data( context ) )->text;
+    name = ( char * )levenshtein_buffer_reserve( buf, ( size_t )len + 1 );
+    if ( !name ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+
+    // One byte per character, so positions count characters as the rules expect; outer spaces do not count
+    while ( len > 0 && s[len - 1] == ' ' ) {
+        len--;
+    }
+    for ( i = 0; i < len && s[i] == ' '; i++ ) {
+    }
+    for ( ; i < len; i++ ) {
+        unsigned char c = s[i];
+
+        if ( c < 0x80 ) {
+            name[n++] = ( char )( c >= 'a' && c <= 'z' ? c - 0x20 : c );
+            continue;
+        }
+        if ( c == 0xC3 && i + 1 < len && ( ( s[i + 1] | 0x20 ) == 0xA7 || ( s[i + 1] | 0x20 ) == 0xB1 ) ) {
+            name[n++] = ( s[i + 1] | 0x20 ) == 0xA7 ? LEVENSHTEIN_DM_C_CEDILLA : LEVENSHTEIN_DM_N_TILDE;
+        } else {
+            name[n++] = LEVENSHTEIN_DM_OTHER;
+        }
+        while ( i + 1 < len && ( s[i + 1] & 0xC0 ) == 0x80 ) {
+            i++;
+        }
+    }
+
+    memset( &dm, 0, sizeof( dm ) );
+    dm.s = name;
+    dm.len = n;
+    name[n] = 0;
+    dm.slavo_germanic = strchr( name, 'W' ) || strchr( name, 'K' ) || strstr( name, "CZ" ) || strstr( name, "WITZ" );
+    levenshtein_double_metaphone( &dm );
+    if ( alternate ? dm.nalternate : dm.nprimary ) {
+        sqlite3_result_text( context, alternate ? dm.alternate : dm.primary, alternate ? dm.nalternate : dm.nprimary, SQLITE_TRANSIENT );
+    }
+}
+
+static int levenshtein_nysiis_vowel( char c ) {
+    return c == 'A' || c == 'E' || c == 'I' || c == 'O' || c == 'U';
+}
+
+static void nysiis_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    const unsigned char *s = sqlite3_value_text( argv[0] );
+    int len = sqlite3_value_bytes( argv[0] ), max = argc > 1 ? sqlite3_value_int( argv[1] ) : 6;
+    levenshtein_buffer *buf;
+    char *name, *key;
+    int n = 0, nkey = 0, i;
+
+    if ( !s ) {
+        return;
+    }
+    buf = &( ( levenshtein_scratch * )sqlite3_user_data( context ) )->text;
+    name = ( char * )levenshtein_buffer_reserve( buf, 2 * ( size_t )len + 2 ); // The name, then its key, which is never longer
+    if ( !name ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    for ( i = 0; i < len; i++ ) {
+        int c = s[i] | 0x20;
+        if ( c >= 'a' && c <= 'z' ) {
+            name[n++] = ( char )( c - 0x20 );
+        }
+    }
+    if ( !n ) {
+        return;
+    }
+    key = name + len + 1;
+
+    // The start and the end of the name are transcoded first
+    if ( n >= 3 && !memcmp( name, "MAC", 3 ) ) {
+        name[1] = 'C';
+    } else if ( n >= 3 && !memcmp( name, "SCH", 3 ) ) {
+        name[1] = name[2] = 'S';
+    } else if ( n >= 2 && ( !memcmp( name, "PH", 2 ) || !memcmp( name, "PF", 2 ) ) ) {
+        name[0] = name[1] = 'F';
+    } else if ( n >= 2 && !memcmp( name, "KN", 2 ) ) {
+        name[0] = 'N';
+    } else if ( name[0] == 'K' ) {
+        name[0] = 'C';
+    }
+    if ( n >= 2 && ( !memcmp( name + n - 2, "EE", 2 ) || !memcmp( name + n - 2, "IE", 2 ) ) ) {
+        name[n - 2] = 'Y';
+        n--;
+    } else if ( n >= 2 && ( !memcmp( name + n - 2, "DT", 2 ) || !memcmp( name + n - 2, "RT", 2 ) || !memcmp( name + n - 2, "RD", 2 ) ||
+                            !memcmp( name + n - 2, "NT", 2 ) || !memcmp( name + n - 2, "ND", 2 ) ) ) {
+        name[n - 2] = 'D';
+        n--;
+    }
+
+    key[nkey++] = name[0];
+    for ( i = 1; i < n; i++ ) {
+        char c = name[i], next = i + 1 < n ? name[i + 1] : 0;
+        const char *add;
+        char one[2] = { 0, 0 };
+
+        if ( c == 'E' && next == 'V' ) {
+            add = "AF";
+            i++;
+        } else if ( levenshtein_nysiis_vowel( c ) ) {
+            add = "A";
+        } else if ( c == 'Q' ) {
+            add = "G";
+        } else if ( c == 'Z' ) {
+            add = "S";
+        } else if ( c == 'M' ) {
+            add = "N";
+        } else if ( c == 'K' ) {
+            add = next == 'N' ? "N" : "C";
+        } else if ( c == 'S' && i + 2 < n && name[i + 1] == 'C' && name[i + 2] == 'H' ) {
+            add = "SSS";
+            i += 2;
+        } else if ( c == 'P' && next == 'H' ) {
+            add = "FF";
+            i++;
+        } else if ( c == 'H' && ( !levenshtein_nysiis_vowel( name[i - 1] ) || ( next && !levenshtein_nysiis_vowel( next ) ) ) ) {
+            one[0] = levenshtein_nysiis_vowel( name[i - 1] ) ? 'A' : name[i - 1]; // Takes the sound of the letter before
+            add = one;
+        } else if ( c == 'W' && levenshtein_nysiis_vowel( name[i - 1] ) ) {
+            add = "A";
+        } else {
+            one[0] = c;
+            add = one;
+        }
+        if ( add[strlen( add ) - 1] != key[nkey - 1] ) {
+            while ( *add ) {
+                key[nkey++] = *add++;
+            }
+        }
+    }
+
+    if ( nkey > 1 && key[nkey - 1] == 'S' ) {
+        nkey--;
+    }
+    if ( nkey > 1 && key[nkey - 2] == 'A' && key[nkey - 1] == 'Y' ) {
+        key[nkey - 2] = 'Y';
+        nkey--;
+    }
+    if ( nkey > 1 && key[nkey - 1] == 'A' ) {
+        nkey--;
+    }
+    if ( max > 0 && nkey > max ) {
+        nkey = max;
+    }
+    sqlite3_result_text( context, key, nkey, SQLITE_TRANSIENT );
+}
+
+/*
+ * levenshtein_topk( value, target, k ): the k values closest to target, as a JSON array of
+ * {"value":..., "distance":...} sorted by distance, ties in the order the rows arrived.
+ *
+ *   SELECT levenshtein_topk( name, 'jonathan', 10 ) FROM names;
+ *   SELECT j.value ->> 'value' FROM json_each( ( SELECT levenshtein_topk( name, 'jonathan', 10 ) FROM names ) ) j;
+ *
+ * The best k so far sit in a max-heap on ( distance, arrival ). Once it is full, the worst distance
+ * minus one is the max handed to the bounded kernels, so a row that cannot make the list is dropped
+ * as soon as that is known, usually on the length difference alone. NULL values are skipped.
+ */
+
+typedef struct levenshtein_topk_entry {
+    int distance;
+    sqlite3_int64 seq;          // Arrival order, to break ties
+    char *value;
+    int len;
+} levenshtein_topk_entry;
+
+typedef struct levenshtein_topk {
+    levenshtein_topk_entry *heap;
+    int n, cap;
+    sqlite3_int64 k;
+    sqlite3_int64 seq;
+} levenshtein_topk;
+
+static int levenshtein_topk_worse( const levenshtein_topk_entry *a, const levenshtein_topk_entry *b ) {
+    return a->distance != b->distance ? a->distance > b->distance : a->seq > b->seq;
+}
+
+static void levenshtein_topk_sift_down( levenshtein_topk *top, int i ) {
+    for ( ;; ) {
+        int l = 2 * i + 1, r = l + 1, w = i;
+        levenshtein_topk_entry t;
+
+        if ( l < top->n && levenshtein_topk_worse( &top->heap[l], &top->heap[w] ) ) {
+            w = l;
+        }
+        if ( r < top->n && levenshtein_topk_worse( &top->heap[r], &top->heap[w] ) ) {
+            w = r;
+        }
+        if ( w == i ) {
+            return;
+        }
+        t = top->heap[i];
+        top->heap[i] = top->heap[w];
+        top->heap[w] = t;
+        i = w;
+    }
+}
+
+static void levenshtein_topk_step( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_topk *top = ( levenshtein_topk * )sqlite3_aggregate_context( context, sizeof( *top ) );
+    const unsigned char *value, *target;
+    levenshtein_topk_entry e;
+    sqlite3_int64 max = -1, d;
+
+    if ( !top ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    if ( !top->k ) {
+        top->k = sqlite3_value_int64( argv[2] );
+        if ( top->k <= 0 ) {
+            sqlite3_result_error( context, "levenshtein_topk() k must be positive", -1 );
+            return;
+        }
+    }
+
+    value = sqlite3_value_text( argv[0] );
+    target = sqlite3_value_text( argv[1] );
+    if ( !value || !target ) {
+        return;
+    }
+    e.seq = top->seq++;
+
+    // A full heap only takes a row strictly better than its worst, which is at the root
+    if ( top->n == top->k ) {
+        max = top->heap[0].distance - 1;
+        if ( max < 0 ) {
+            return;
+        }
+    }
+    d = levenshtein_pair( ( levenshtein_scratch * )sqlite3_user_data( context ), value, sqlite3_value_bytes( argv[0] ), target, sqlite3_value_bytes( argv[1] ), max );
+    if ( d < 0 ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    if ( max >= 0 && d > max ) {
+        return;
+    }
+
+    e.distance = ( int )d;
+    e.len = sqlite3_value_bytes( argv[0] );
+    e.value = ( char * )sqlite3_malloc64( ( size_t )e.len + 1 );
+    if ( !e.value ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    memcpy( e.value, value, e.len );
+
+    if ( top->n == top->k ) {
+        sqlite3_free( top->heap[0].value );
+        top->heap[0] = e;
+        levenshtein_topk_sift_down( top, 0 );
+        return;
+    }
+    if ( top->n == top->cap ) {
+        int cap = top->cap ? 2 * top->cap : 16;
+        levenshtein_topk_entry *heap;
+
+        cap = cap > top->k ? ( int )top->k : cap;
+        heap = ( levenshtein_topk_entry * )sqlite3_realloc64( top->heap, ( size_t )cap * sizeof( *heap ) );
+        if ( !heap ) {
+            sqlite3_free( e.value );
+            sqlite3_result_error_nomem( context );
+            return;
+        }
+        top->heap = heap;
+        top->cap = cap;
+    }
+    {
+        int i = top->n++;
+
+        // Sift up
+        while ( i > 0 && levenshtein_topk_worse( &e, &top->heap[( i - 1 ) / 2] ) ) {
+            top->heap[i] = top->heap[( i - 1 ) / 2];
+            i = ( i - 1 ) / 2;
+        }
+        top->heap[i] = e;
+    }
+}
+
+static void levenshtein_json_string( sqlite3_str *out, const char *s, int len ) {
+    int i;
+
+    sqlite3_str_appendchar( out, 1, '"' );
+    for ( i = 0; i < len; i++ ) {
+        unsigned char c = ( unsigned char )s[i];
+
+        if ( c == '"' || c == '\\' ) {
+            sqlite3_str_appendchar( out, 1, '\\' );
+            sqlite3_str_appendchar( out, 1, ( char )c );
+        } else if ( c < 0x20 ) {
+            sqlite3_str_appendf( out, "\\u%04x", c );
+        } else {
+            sqlite3_str_appendchar( out, 1, ( char )c );
+        }
+    }
+    sqlite3_str_appendchar( out, 1, '"' );
+}
+
+static void levenshtein_topk_final( sqlite3_context *context ) {
+    levenshtein_topk *top = ( levenshtein_topk * )sqlite3_aggregate_context( context, 0 );
+    sqlite3_str *out;
+    int count, n, i;
+
+    if ( !top ) {
+        sqlite3_result_text( context, "[]", 2, SQLITE_STATIC );
+        return;
+    }
+
+    // Move the worst to the back until the array is in ascending order
+    count = top->n;
+    for ( n = count; n > 1; n-- ) {
+        levenshtein_topk_entry t = top->heap[0];
+        top->heap[0] = top->heap[n - 1];
+        top->heap[n - 1] = t;
+        top->n = n - 1;
+        levenshtein_topk_sift_down( top, 0 );
+    }
+
+    out = sqlite3_str_new( sqlite3_context_db_handle( context ) );
+    sqlite3_str_appendchar( out, 1, '[' );
+    for ( i = 0; i < count; i++ ) {
+        sqlite3_str_appendall( out, i ? ",{\"value\":" : "{\"value\":" );
+        levenshtein_json_string( out, top->heap[i].value, top->heap[i].len );
+        sqlite3_str_appendf( out, ",\"distance\":%d}", top->heap[i].distance );
+        sqlite3_free( top->heap[i].value );
+    }
+    sqlite3_free( top->heap );
+    sqlite3_str_appendchar( out, 1, ']' );
+    if ( sqlite3_str_errcode( out ) ) {
+        sqlite3_free( sqlite3_str_finish( out ) );
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    n = sqlite3_str_length( out );
+    sqlite3_result_text( context, sqlite3_str_finish( out ), n, sqlite3_free );
+}
+
+/*
+ * levenshtein_index: a BK-tree over one text column, so a distance-limited search does not have to
+ * compare against every row.
+ *
+ *   CREATE VIRTUAL TABLE name_idx USING levenshtein_index( names, name );
+ *   SELECT rowid, word, distance FROM name_idx WHERE word MATCH 'jon' AND distance <= 2 ORDER BY distance;
+ *   SELECT rowid, word, distance FROM name_idx( 'jon', 2 );      -- the same, as a table-valued function
+ *
+ * The rowid is the source row's rowid. The tree lives in memory: it is built from the source table when
+ * the virtual table is opened on a connection, and triggers created with it keep it current as that
+ * connection inserts, updates and deletes source rows. A commit from another connection or a rollback
+ * makes it stale, and the next search rebuilds it. The source table must be in the same schema. The
+ * distance is levenshtein(), in bytes.
+ *
+ * A search computes the distance d to a node and only descends into children whose edge lies in
+ * [d - max, d + max] (the triangle inequality rules out the rest). Duplicate words hang off their first
+ * copy on edge 0 and cost no extra comparison. Deleted rows stay in the tree as routing nodes until
+ * more than half of it is dead, then it is compacted.
+ */
+
+// rowid -> entry number for the in-memory indexes: linear probing over a power-of-two table at most half full
+typedef struct levenshtein_rowid_slot {
+    sqlite3_int64 rowid;
+    int n;                      // -1 for an empty slot
+} levenshtein_rowid_slot;
+
+typedef struct levenshtein_rowid_map {
+    levenshtein_rowid_slot *slots;
+    int nslots, nused;
+} levenshtein_rowid_map;
+
+static uint32_t levenshtein_rowid_hash( sqlite3_int64 rowid, int nslots ) {
+    uint64_t h = ( uint64_t )rowid * 0x9E3779B97F4A7C15ULL;
+    return ( uint32_t )( h >> 32 ) & ( uint32_t )( nslots - 1 );
+}
+
+static int levenshtein_rowid_find( const levenshtein_rowid_map *map, sqlite3_int64 rowid ) {
+    uint32_t h;
+
+    if ( !map->nslots ) {
+        return -1;
+    }
+    for ( h = levenshtein_rowid_hash( rowid, map->nslots ); map->slots[h].n >= 0; h = ( h + 1 ) & ( uint32_t )( map->nslots - 1 ) ) {
+        if ( map->slots[h].rowid == rowid ) {
+            return map->slots[h].n;
+        }
+    }
+    return -1;
+}
+
+// Makes room for one more entry, so the next levenshtein_rowid_put() cannot fail
+static int levenshtein_rowid_reserve( levenshtein_rowid_map *map ) {
+    levenshtein_rowid_slot *slots;
+    int nslots, i;
+
+    if ( 2 * ( map->nused + 1 ) <= map->nslots ) {
+        return SQLITE_OK;
+    }
+    nslots = map->nslots ? 2 * map->nslots : 256;
+    slots = ( levenshtein_rowid_slot * )sqlite3_malloc64( ( size_t )nslots * sizeof( *slots ) );
+    if ( !slots ) {
+        return SQLITE_NOMEM;
+    }
+    memset( slots, 0xFF, ( size_t )nslots * sizeof( *slots ) );
+    for ( i = 0; i < map->nslots; i++ ) {
+        if ( map->slots[i].n >= 0 ) {
+            uint32_t h = levenshtein_rowid_hash( map->slots[i].rowid, nslots );
+            while ( slots[h].n >= 0 ) {
+                h = ( h + 1 ) & ( uint32_t )( nslots - 1 );
+            }
+            slots[h] = map->slots[i];
+        }
+    }
+    sqlite3_free( map->slots );
+    map->slots = slots;
+    map->nslots = nslots;
+    return SQLITE_OK;
+}
+
+// Maps rowid, which must not be mapped yet, to n
+static int levenshtein_rowid_put( levenshtein_rowid_map *map, sqlite3_int64 rowid, int n ) {
+    int rc = levenshtein_rowid_reserve( map );
+    uint32_t h;
+
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    for ( h = levenshtein_rowid_hash( rowid, map->nslots ); map->slots[h].n >= 0; h = ( h + 1 ) & ( uint32_t )( map->nslots - 1 ) ) {
+    }
+    map->slots[h].rowid = rowid;
+    map->slots[h].n = n;
+    map->nused++;
+    return SQLITE_OK;
+}
+
+// Unmaps rowid and returns the entry it mapped to, or -1 if there was none
+static int levenshtein_rowid_remove( levenshtein_rowid_map *map, sqlite3_int64 rowid ) {
+    uint32_t h, mask = ( uint32_t )( map->nslots - 1 );
+    int n;
+
+    if ( !map->nslots ) {
+        return -1;
+    }
+    for ( h = levenshtein_rowid_hash( rowid, map->nslots ); map->slots[h].n >= 0 && map->slots[h].rowid != rowid; h = ( h + 1 ) & mask ) {
+    }
+    n = map->slots[h].n;
+    if ( n < 0 ) {
+        return -1;
+    }
+    map->nused--;
+
+    // Backward-shift delete keeps every probe chain unbroken without tombstones
+    for ( ;; ) {
+        uint32_t next = ( h + 1 ) & mask, home;
+        map->slots[h].n = -1;
+        for ( ;; next = ( next + 1 ) & mask ) {
+            if ( map->slots[next].n < 0 ) {
+                return n;
+            }
+            home = levenshtein_rowid_hash( map->slots[next].rowid, map->nslots );
+            // Move it back unless its home lies cyclically in ( h, next ]
+            if ( h <= next ? ( home <= h || home > next ) : ( home <= h && home > next ) ) {
+                break;
+            }
+        }
+        map->slots[h] = map->slots[next];
+        h = next;
+    }
+}
+
+static void levenshtein_rowid_clear( levenshtein_rowid_map *map ) {
+    sqlite3_free( map->slots );
+    map->slots = NULL;
+    map->nslots = map->nused = 0;
+}
+
+typedef struct levenshtein_bk_node {
+    sqlite3_int64 rowid;
+    size_t word;                // Offset into words
+    int len;
+    int dist;                   // Edge distance to the parent
+    int child;                  // First child, -1 if none
+    int sibling;                // Next child of the same parent
+    int live;                   // 0 once the row is deleted
+} levenshtein_bk_node;
+
+typedef struct levenshtein_index {
+    sqlite3_vtab base;
+    sqlite3 *db;
+    char *schema;
+    char *name;
+    char *source;
+    char *column;
+    levenshtein_scratch *scratch;
+    levenshtein_bk_node *nodes;
+    int nnodes, nodes_cap, nlive;
+    unsigned char *words;
+    size_t words_len, words_cap;
+    levenshtein_rowid_map rowids; // rowid -> live node
+    int cursors;                // Open cursors; node numbers must not move while any exist
+    int stale;                  // Rebuild from the source table before the next search
+    sqlite3_int64 data_version;
+} levenshtein_index;
+
+typedef struct levenshtein_index_cursor {
+    sqlite3_vtab_cursor base;
+    int *hits;                  // Node numbers
+    int *dists;                 // Distance per hit, -1 when no query was given
+    int nhits, hits_cap, pos;
+    sqlite3_value *query;
+    sqlite3_int64 max;
+} levenshtein_index_cursor;
+
+// Column numbers in the declared schema
+#define LEVENSHTEIN_INDEX_WORD 0
+#define LEVENSHTEIN_INDEX_DISTANCE 1
+#define LEVENSHTEIN_INDEX_QUERY 2
+#define LEVENSHTEIN_INDEX_MAX 3
+
+// xBestIndex plan bits; the matching arguments come in this order
+#define LEVENSHTEIN_PLAN_QUERY 1
+#define LEVENSHTEIN_PLAN_MAX 2
+#define LEVENSHTEIN_PLAN_ROWID 4
+#define LEVENSHTEIN_PLAN_SORTED 8
+
+static int levenshtein_index_find( levenshtein_index *idx, sqlite3_int64 rowid ) {
+    return levenshtein_rowid_find( &idx->rowids, rowid );
+}
+
+// Distance between two stored or query words, unbounded. Returns -1 if memory runs out.
+static int levenshtein_index_distance( levenshtein_index *idx, const unsigned char *a, int la, const unsigned char *b, int lb ) {
+    return la >= lb ? levenshtein_distance( idx->scratch, a, la, b, lb, -1 ) : levenshtein_distance( idx->scratch, b, lb, a, la, -1 );
+}
+
+static int levenshtein_index_add( levenshtein_index *idx, sqlite3_int64 rowid, const unsigned char *word, int len ) {
+    levenshtein_bk_node *node;
+    int n = idx->nnodes, at = 0;
+
+    if ( n == idx->nodes_cap ) {
+        int cap = n ? 2 * n : 64;
+        levenshtein_bk_node *nodes = ( levenshtein_bk_node * )sqlite3_realloc64( idx->nodes, ( size_t )cap * sizeof( *nodes ) );
+        if ( !nodes ) {
+            return SQLITE_NOMEM;
+        }
+        idx->nodes = nodes;
+        idx->nodes_cap = cap;
+    }
+    if ( idx->words_len + len > idx->words_cap ) {
+        size_t cap = idx->words_cap * 2 > idx->words_len + len ? idx->words_cap * 2 : idx->words_len + len + 4096;
+        unsigned char *words = ( unsigned char * )sqlite3_realloc64( idx->words, cap );
+        if ( !words ) {
+            return SQLITE_NOMEM;
+        }
+        idx->words = words;
+        idx->words_cap = cap;
+    }
+    if ( levenshtein_rowid_reserve( &idx->rowids ) != SQLITE_OK ) {
+        return SQLITE_NOMEM;
+    }
+
+    node = &idx->nodes[n];
+    node->rowid = rowid;
+    node->word = idx->words_len;
+    node->len = len;
+    node->dist = 0;
+    node->child = -1;
+    node->sibling = -1;
+    node->live = 1;
+    memcpy( idx->words + idx->words_len, word, len );
+    idx->words_len += len;
+
+    // Walk down from the root to the first node with no child on our edge
+    while ( n > 0 ) {
+        levenshtein_bk_node *parent = &idx->nodes[at];
+        int d = levenshtein_index_distance( idx, idx->words + parent->word, parent->len, word, len );
+        int c;
+
+        if ( d < 0 ) {
+            idx->words_len -= len;
+            return SQLITE_NOMEM;
+        }
+        for ( c = parent->child; c >= 0 && idx->nodes[c].dist != d; c = idx->nodes[c].sibling ) {
+        }
+        if ( c < 0 ) {
+            node->dist = d;
+            node->sibling = parent->child;
+            parent->child = n;
+            break;
+        }
+        at = c;
+    }
+
+    levenshtein_rowid_put( &idx->rowids, rowid, n ); // Reserved above
+    idx->nnodes++;
+    idx->nlive++;
+    return SQLITE_OK;
+}
+
+static void levenshtein_index_clear( levenshtein_index *idx ) {
+    sqlite3_free( idx->nodes );
+    sqlite3_free( idx->words );
+    levenshtein_rowid_clear( &idx->rowids );
+    idx->nodes = NULL;
+    idx->words = NULL;
+    idx->nnodes = idx->nodes_cap = idx->nlive = 0;
+    idx->words_len = idx->words_cap = 0;
+}
+
+// Rebuilds the tree from its own live nodes, dropping the dead ones
+static int levenshtein_index_compact( levenshtein_index *idx ) {
+    levenshtein_bk_node *nodes = idx->nodes;
+    unsigned char *words = idx->words;
+    int nnodes = idx->nnodes, i, rc = SQLITE_OK;
+
+    levenshtein_rowid_clear( &idx->rowids );
+    idx->nodes = NULL;
+    idx->words = NULL;
+    idx->nnodes = idx->nodes_cap = idx->nlive = 0;
+    idx->words_len = idx->words_cap = 0;
+    for ( i = 0; i < nnodes && rc == SQLITE_OK; i++ ) {
+        if ( nodes[i].live ) {
+            rc = levenshtein_index_add( idx, nodes[i].rowid, words + nodes[i].word, nodes[i].len );
+        }
+    }
+    sqlite3_free( nodes );
+    sqlite3_free( words );
+    return rc;
+}
+
+static int levenshtein_index_remove( levenshtein_index *idx, sqlite3_int64 rowid ) {
+    int n = levenshtein_rowid_remove( &idx->rowids, rowid );
+
+    if ( n >= 0 ) {
+        idx->nodes[n].live = 0;
+        idx->nlive--;
+    }
+    return SQLITE_OK;
+}
+
+// Changes whenever another connection commits to schema; shared by the in-memory indexes
+static sqlite3_int64 levenshtein_index_version( sqlite3 *db, const char *schema ) {
+    sqlite3_stmt *stmt = NULL;
+    sqlite3_int64 version = -1;
+    char *sql = sqlite3_mprintf( "PRAGMA \"%w\".data_version", schema );
+
+    if ( sql && sqlite3_prepare_v2( db, sql, -1, &stmt, NULL ) == SQLITE_OK && sqlite3_step( stmt ) == SQLITE_ROW ) {
+        version = sqlite3_column_int64( stmt, 0 );
+    }
+    sqlite3_finalize( stmt );
+    sqlite3_free( sql );
+    return version;
+}
+
+static int levenshtein_index_load( levenshtein_index *idx ) {
+    sqlite3_stmt *stmt = NULL;
+    char *sql = sqlite3_mprintf( "SELECT rowid, \"%w\" FROM \"%w\".\"%w\"", idx->column, idx->schema, idx->source );
+    int rc;
+
+    levenshtein_index_clear( idx );
+    if ( !sql ) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_prepare_v2( idx->db, sql, -1, &stmt, NULL );
+    sqlite3_free( sql );
+    while ( rc == SQLITE_OK && sqlite3_step( stmt ) == SQLITE_ROW ) {
+        const unsigned char *word = sqlite3_column_text( stmt, 1 );
+        if ( word ) {
+            rc = levenshtein_index_add( idx, sqlite3_column_int64( stmt, 0 ), word, sqlite3_column_bytes( stmt, 1 ) );
+        }
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_finalize( stmt );
+    } else {
+        sqlite3_finalize( stmt );
+    }
+    if ( rc != SQLITE_OK ) {
+        idx->base.zErrMsg = sqlite3_mprintf( "levenshtein_index: cannot read %s.%s: %s", idx->source, idx->column, sqlite3_errmsg( idx->db ) );
+        return rc;
+    }
+    idx->stale = 0;
+    idx->data_version = levenshtein_index_version( idx->db, idx->schema );
+    return SQLITE_OK;
+}
+
+// Creates or drops the triggers that forward writes on source to the virtual table called name
+static int levenshtein_index_triggers( sqlite3 *db, const char *schema, const char *name, const char *source, const char *column, int create ) {
+    char *sql;
+    int rc;
+
+    if ( create ) {
+        sql = sqlite3_mprintf(
+            "CREATE TRIGGER \"%w\".\"%w_lev_ai\" AFTER INSERT ON \"%w\" BEGIN "
+            "INSERT INTO \"%w\"( rowid, word ) VALUES( new.rowid, new.\"%w\" ); END;"
+            "CREATE TRIGGER \"%w\".\"%w_lev_ad\" AFTER DELETE ON \"%w\" BEGIN "
+            "DELETE FROM \"%w\" WHERE rowid = old.rowid; END;"
+            "CREATE TRIGGER \"%w\".\"%w_lev_au\" AFTER UPDATE ON \"%w\" WHEN old.rowid IS NOT new.rowid OR old.\"%w\" IS NOT new.\"%w\" BEGIN "
+            "DELETE FROM \"%w\" WHERE rowid = old.rowid; INSERT INTO \"%w\"( rowid, word ) VALUES( new.rowid, new.\"%w\" ); END;",
+            schema, name, source, name, column,
+            schema, name, source, name,
+            schema, name, source, column, column, name, name, column );
+    } else {
+        sql = sqlite3_mprintf(
+            "DROP TRIGGER IF EXISTS \"%w\".\"%w_lev_ai\";"
+            "DROP TRIGGER IF EXISTS \"%w\".\"%w_lev_ad\";"
+            "DROP TRIGGER IF EXISTS \"%w\".\"%w_lev_au\";",
+            schema, name, schema, name, schema, name );
+    }
+    if ( !sql ) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_exec( db, sql, NULL, NULL, NULL );
+    sqlite3_free( sql );
+    return rc;
+}
+
+static void levenshtein_index_free( levenshtein_index *idx ) {
+    levenshtein_index_clear( idx );
+    sqlite3_free( idx->schema );
+    sqlite3_free( idx->name );
+    sqlite3_free( idx->source );
+    sqlite3_free( idx->column );
+    levenshtein_scratch_unref( idx->scratch );
+    sqlite3_free( idx );
+}
+
+// Strips one level of SQL quoting from a module argument
+static char *levenshtein_unquote( const char *arg ) {
+    size_t n = strlen( arg );
+    char q = arg[0] == '[' ? ']' : arg[0];
+    char *out, *o;
+    size_t i;
+
+    if ( n < 2 || ( q != '"' && q != '\'' && q != '`' && q != ']' ) || arg[n - 1] != q ) {
+        return sqlite3_mprintf( "%s", arg );
+    }
+    out = o = ( char * )sqlite3_malloc64( n );
+    if ( !out ) {
+        return NULL;
+    }
+    for ( i = 1; i < n - 1; i++ ) {
+        *o++ = arg[i];
+        if ( arg[i] == q && arg[i + 1] == q ) {
+            i++;
+        }
+    }
+    *o = 0;
+    return out;
+}
+
+static int levenshtein_index_init( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr, int create ) {
+    levenshtein_index *idx;
+    int rc;
+
+    if ( argc != 5 ) {
+        *pzErr = sqlite3_mprintf( "levenshtein_index requires 2 arguments: ( source_table, column )" );
+        return SQLITE_ERROR;
+    }
+    idx = ( levenshtein_index * )sqlite3_malloc( sizeof( *idx ) );
+    if ( !idx ) {
+        return SQLITE_NOMEM;
+    }
+    memset( idx, 0, sizeof( *idx ) );
+    idx->db = db;
+    idx->scratch = ( levenshtein_scratch * )pAux;
+    idx->scratch->refs++;
+    idx->schema = sqlite3_mprintf( "%s", argv[1] );
+    idx->name = sqlite3_mprintf( "%s", argv[2] );
+    idx->source = levenshtein_unquote( argv[3] );
+    idx->column = levenshtein_unquote( argv[4] );
+    if ( !idx->schema || !idx->name || !idx->source || !idx->column ) {
+        levenshtein_index_free( idx );
+        return SQLITE_NOMEM;
+    }
+
+    rc = sqlite3_declare_vtab( db, "CREATE TABLE x( word TEXT, distance INTEGER, query HIDDEN, max HIDDEN )" );
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_vtab_config( db, SQLITE_VTAB_INNOCUOUS ); // Its triggers must run with trusted_schema off
+    }
+    if ( rc == SQLITE_OK && create ) {
+        rc = levenshtein_index_triggers( db, idx->schema, idx->name, idx->source, idx->column, 1 );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_index_load( idx );
+        if ( rc != SQLITE_OK ) {
+            *pzErr = idx->base.zErrMsg;
+            idx->base.zErrMsg = NULL;
+        }
+    } else {
+        *pzErr = sqlite3_mprintf( "levenshtein_index: %s", sqlite3_errmsg( db ) );
+    }
+    if ( rc != SQLITE_OK ) {
+        levenshtein_index_free( idx );
+        return rc;
+    }
+    *ppVtab = &idx->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_create( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    return levenshtein_index_init( db, pAux, argc, argv, ppVtab, pzErr, 1 );
+}
+
+static int levenshtein_index_connect( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    return levenshtein_index_init( db, pAux, argc, argv, ppVtab, pzErr, 0 );
+}
+
+static int levenshtein_index_disconnect( sqlite3_vtab *pVtab ) {
+    levenshtein_index_free( ( levenshtein_index * )pVtab );
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_destroy( sqlite3_vtab *pVtab ) {
+    levenshtein_index *idx = ( levenshtein_index * )pVtab;
+    int rc = levenshtein_index_triggers( idx->db, idx->schema, idx->name, idx->source, idx->column, 0 );
+
+    if ( rc == SQLITE_OK ) {
+        levenshtein_index_free( idx );
+    }
+    return rc;
+}
+
+// Plans a search over nrows rows; shared with qgram_index, which takes the same constraints
+static int levenshtein_index_plan( sqlite3_index_info *info, int nrows ) {
+    int query = -1, max = -1, rowid = -1, i;
+    int argv = 0;
+
+    for ( i = 0; i < info->nConstraint; i++ ) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+
+        if ( !c->usable ) {
+            continue;
+        }
+        if ( c->iColumn == LEVENSHTEIN_INDEX_WORD && c->op == SQLITE_INDEX_CONSTRAINT_MATCH ) {
+            query = i;
+        } else if ( c->iColumn == LEVENSHTEIN_INDEX_QUERY && c->op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+            query = i;
+        } else if ( ( c->iColumn == LEVENSHTEIN_INDEX_MAX && c->op == SQLITE_INDEX_CONSTRAINT_EQ ) || ( c->iColumn == LEVENSHTEIN_INDEX_DISTANCE && c->op == SQLITE_INDEX_CONSTRAINT_LE ) ) {
+            max = i;
+        } else if ( c->iColumn == LEVENSHTEIN_INDEX_DISTANCE && ( c->op == SQLITE_INDEX_CONSTRAINT_LT || c->op == SQLITE_INDEX_CONSTRAINT_EQ ) && max < 0 ) {
+            max = i; // Searched as <=; SQLite still applies the exact test
+        } else if ( c->iColumn == -1 && c->op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+            rowid = i;
+        }
+    }
+
+    info->idxNum = 0;
+    if ( query >= 0 ) {
+        info->idxNum |= LEVENSHTEIN_PLAN_QUERY;
+        info->aConstraintUsage[query].argvIndex = ++argv;
+        info->aConstraintUsage[query].omit = 1;
+    }
+    if ( query >= 0 && max >= 0 ) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[max];
+        info->idxNum |= LEVENSHTEIN_PLAN_MAX;
+        info->aConstraintUsage[max].argvIndex = ++argv;
+        info->aConstraintUsage[max].omit = c->iColumn == LEVENSHTEIN_INDEX_MAX || c->op == SQLITE_INDEX_CONSTRAINT_LE;
+    }
+    if ( rowid >= 0 ) {
+        info->idxNum |= LEVENSHTEIN_PLAN_ROWID;
+        info->aConstraintUsage[rowid].argvIndex = ++argv;
+        info->aConstraintUsage[rowid].omit = 1;
+        info->estimatedCost = 10;
+        info->estimatedRows = 1;
+        info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+    } else if ( query >= 0 && max >= 0 ) {
+        // A bounded BK search touches a small fraction of the tree; the exact share depends on max
+        info->estimatedCost = 100 + nrows / 10.0;
+        info->estimatedRows = 25;
+    } else {
+        info->estimatedCost = query >= 0 ? 1000 + 10.0 * nrows : 1000 + nrows;
+        info->estimatedRows = nrows;
+    }
+
+    // Results come out sorted by distance whenever there is a query
+    if ( query >= 0 && info->nOrderBy == 1 && info->aOrderBy[0].iColumn == LEVENSHTEIN_INDEX_DISTANCE && !info->aOrderBy[0].desc ) {
+        info->idxNum |= LEVENSHTEIN_PLAN_SORTED;
+        info->orderByConsumed = 1;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_best( sqlite3_vtab *pVtab, sqlite3_index_info *info ) {
+    return levenshtein_index_plan( info, ( ( levenshtein_index * )pVtab )->nlive );
+}
+
+static int levenshtein_index_open( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )sqlite3_malloc( sizeof( *cur ) );
+
+    if ( !cur ) {
+        return SQLITE_NOMEM;
+    }
+    memset( cur, 0, sizeof( *cur ) );
+    cur->max = -1;
+    ( ( levenshtein_index * )pVtab )->cursors++;
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_close( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+
+    ( ( levenshtein_index * )pCursor->pVtab )->cursors--;
+    sqlite3_value_free( cur->query );
+    sqlite3_free( cur->hits );
+    sqlite3_free( cur->dists );
+    sqlite3_free( cur );
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_hit( levenshtein_index_cursor *cur, int node, int dist ) {
+    if ( cur->nhits == cur->hits_cap ) {
+        int cap = cur->hits_cap ? 2 * cur->hits_cap : 64;
+        int *hits = ( int * )sqlite3_realloc64( cur->hits, ( size_t )cap * sizeof( int ) );
+        int *dists;
+        if ( !hits ) {
+            return SQLITE_NOMEM;
+        }
+        cur->hits = hits;
+        dists = ( int * )sqlite3_realloc64( cur->dists, ( size_t )cap * sizeof( int ) );
+        if ( !dists ) {
+            return SQLITE_NOMEM;
+        }
+        cur->dists = dists;
+        cur->hits_cap = cap;
+    }
+    cur->hits[cur->nhits] = node;
+    cur->dists[cur->nhits] = dist;
+    cur->nhits++;
+    return SQLITE_OK;
+}
+
+// BK search from the root; max < 0 computes the distance to every node
+static int levenshtein_index_search( levenshtein_index *idx, levenshtein_index_cursor *cur, const unsigned char *q, int len, sqlite3_int64 max ) {
+    levenshtein_buffer stack = { NULL, 0 };
+    int *todo;                  // Pairs of node and its distance, -1 while not yet computed
+    int ntodo = 0, rc = SQLITE_OK;
+
+    if ( !idx->nnodes ) {
+        return SQLITE_OK;
+    }
+    if ( max < 0 || max > INT32_MAX / 2 ) {
+        max = INT32_MAX / 2;
+    }
+    todo = ( int * )levenshtein_buffer_reserve( &stack, 64 * sizeof( int ) );
+    if ( !todo ) {
+        return SQLITE_NOMEM;
+    }
+    todo[ntodo++] = 0;
+    todo[ntodo++] = -1;
+
+    while ( ntodo && rc == SQLITE_OK ) {
+        int n = todo[ntodo - 2], d = todo[ntodo - 1], c;
+        const levenshtein_bk_node *node = &idx->nodes[n];
+
+        ntodo -= 2;
+        if ( d < 0 ) {
+            d = levenshtein_index_distance( idx, idx->words + node->word, node->len, q, len );
+            if ( d < 0 ) {
+                rc = SQLITE_NOMEM;
+                break;
+            }
+        }
+        if ( node->live && d <= max ) {
+            rc = levenshtein_index_hit( cur, n, d );
+        }
+        for ( c = node->child; c >= 0 && rc == SQLITE_OK; c = idx->nodes[c].sibling ) {
+            int e = idx->nodes[c].dist;
+
+            if ( e >= d - max && e <= d + max ) {
+                if ( ( size_t )( ntodo + 2 ) * sizeof( int ) > stack.bytes ) {
+                    todo = ( int * )levenshtein_buffer_reserve( &stack, ( size_t )( ntodo + 2 ) * sizeof( int ) );
+                    if ( !todo ) {
+                        rc = SQLITE_NOMEM;
+                        break;
+                    }
+                }
+                todo[ntodo++] = c;
+                todo[ntodo++] = e == 0 ? d : -1; // Same word as its parent, same distance
+            }
+        }
+    }
+    sqlite3_free( stack.data );
+    return rc;
+}
+
+// Counting sort of the hits by distance, keeping tree order within a distance
+static int levenshtein_index_sort( levenshtein_index_cursor *cur ) {
+    int *count, *hits, *dists, top = 0, i;
+
+    for ( i = 0; i < cur->nhits; i++ ) {
+        top = cur->dists[i] > top ? cur->dists[i] : top;
+    }
+    count = ( int * )sqlite3_malloc64( ( size_t )( top + 2 ) * sizeof( int ) );
+    hits = ( int * )sqlite3_malloc64( ( size_t )cur->nhits * sizeof( int ) + 1 );
+    dists = ( int * )sqlite3_malloc64( ( size_t )cur->nhits * sizeof( int ) + 1 );
+    if ( !count || !hits || !dists ) {
+        sqlite3_free( count );
+        sqlite3_free( hits );
+        sqlite3_free( dists );
+        return SQLITE_NOMEM;
+    }
+    memset( count, 0, ( size_t )( top + 2 ) * sizeof( int ) );
+    for ( i = 0; i < cur->nhits; i++ ) {
+        count[cur->dists[i] + 1]++;
+    }
+    for ( i = 1; i <= top + 1; i++ ) {
+        count[i] += count[i - 1];
+    }
+    for ( i = 0; i < cur->nhits; i++ ) {
+        int at = count[cur->dists[i]]++;
+        hits[at] = cur->hits[i];
+        dists[at] = cur->dists[i];
+    }
+    sqlite3_free( count );
+    sqlite3_free( cur->hits );
+    sqlite3_free( cur->dists );
+    cur->hits = hits;
+    cur->dists = dists;
+    cur->hits_cap = cur->nhits;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_filter( sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    levenshtein_index *idx = ( levenshtein_index * )pCursor->pVtab;
+    int arg = 0, rc = SQLITE_OK, i;
+
+    cur->nhits = cur->pos = 0;
+    cur->max = -1;
+    sqlite3_value_free( cur->query );
+    cur->query = NULL;
+
+    // Only rebuild or compact when no other cursor holds node numbers
+    if ( idx->cursors == 1 ) {
+        if ( idx->stale || levenshtein_index_version( idx->db, idx->schema ) != idx->data_version ) {
+            rc = levenshtein_index_load( idx );
+        } else if ( idx->nnodes > 64 && 2 * idx->nlive < idx->nnodes ) {
+            rc = levenshtein_index_compact( idx );
+        }
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+    }
+
+    if ( idxNum & LEVENSHTEIN_PLAN_QUERY ) {
+        cur->query = sqlite3_value_dup( argv[arg++] );
+        if ( !cur->query ) {
+            return SQLITE_NOMEM;
+        }
+    }
+    if ( idxNum & LEVENSHTEIN_PLAN_MAX ) {
+        if ( sqlite3_value_type( argv[arg] ) != SQLITE_NULL ) {
+            cur->max = sqlite3_value_int64( argv[arg] );
+            if ( cur->max < 0 ) {
+                return SQLITE_OK; // No distance is negative
+            }
+        }
+        arg++;
+    }
+
+    if ( idxNum & LEVENSHTEIN_PLAN_ROWID ) {
+        int n = levenshtein_index_find( idx, sqlite3_value_int64( argv[arg] ) );
+        if ( n >= 0 && !cur->query ) {
+            rc = levenshtein_index_hit( cur, n, -1 );
+        } else if ( n >= 0 ) {
+            const unsigned char *q = sqlite3_value_text( cur->query );
+            int d = q ? levenshtein_index_distance( idx, idx->words + idx->nodes[n].word, idx->nodes[n].len, q, sqlite3_value_bytes( cur->query ) ) : 0;
+            if ( d < 0 ) {
+                return SQLITE_NOMEM;
+            }
+            if ( q && ( cur->max < 0 || d <= cur->max ) ) {
+                rc = levenshtein_index_hit( cur, n, d );
+            }
+        }
+    } else if ( cur->query ) {
+        const unsigned char *q = sqlite3_value_text( cur->query );
+        if ( q ) {
+            rc = levenshtein_index_search( idx, cur, q, sqlite3_value_bytes( cur->query ), cur->max );
+        }
+        if ( rc == SQLITE_OK && cur->nhits > 1 ) {
+            rc = levenshtein_index_sort( cur );
+        }
+    } else {
+        for ( i = 0; i < idx->nnodes && rc == SQLITE_OK; i++ ) {
+            if ( idx->nodes[i].live ) {
+                rc = levenshtein_index_hit( cur, i, -1 );
+            }
+        }
+    }
+    return rc;
+}
+
+static int levenshtein_index_next( sqlite3_vtab_cursor *pCursor ) {
+    ( ( levenshtein_index_cursor * )pCursor )->pos++;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_eof( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    return cur->pos >= cur->nhits;
+}
+
+static int levenshtein_index_column( sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int i ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    levenshtein_index *idx = ( levenshtein_index * )pCursor->pVtab;
+    const levenshtein_bk_node *node = &idx->nodes[cur->hits[cur->pos]];
+
+    switch ( i ) {
+        case LEVENSHTEIN_INDEX_WORD:
+            // Transient: an insert through this connection may move the word store
+            sqlite3_result_text( context, ( const char * )idx->words + node->word, node->len, SQLITE_TRANSIENT );
+            break;
+        case LEVENSHTEIN_INDEX_DISTANCE:
+            if ( cur->dists[cur->pos] >= 0 ) {
+                sqlite3_result_int( context, cur->dists[cur->pos] );
+            }
+            break;
+        case LEVENSHTEIN_INDEX_QUERY:
+            if ( cur->query ) {
+                sqlite3_result_value( context, cur->query );
+            }
+            break;
+        case LEVENSHTEIN_INDEX_MAX:
+            if ( cur->max >= 0 ) {
+                sqlite3_result_int64( context, cur->max );
+            }
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_rowid( sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    *pRowid = ( ( levenshtein_index * )pCursor->pVtab )->nodes[cur->hits[cur->pos]].rowid;
+    return SQLITE_OK;
+}
+
+// Called by the source table triggers; a direct write works too but does not touch the source table
+static int levenshtein_index_update( sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int64 *pRowid ) {
+    levenshtein_index *idx = ( levenshtein_index * )pVtab;
+    const unsigned char *word;
+    int rc = SQLITE_OK;
+
+    if ( sqlite3_value_type( argv[0] ) != SQLITE_NULL ) {
+        rc = levenshtein_index_remove( idx, sqlite3_value_int64( argv[0] ) );
+    }
+    if ( argc == 1 || rc != SQLITE_OK ) {
+        return rc;
+    }
+    if ( sqlite3_value_type( argv[1] ) == SQLITE_NULL ) {
+        pVtab->zErrMsg = sqlite3_mprintf( "levenshtein_index: rows are keyed by the source rowid, which must be given" );
+        return SQLITE_CONSTRAINT;
+    }
+    *pRowid = sqlite3_value_int64( argv[1] );
+    rc = levenshtein_index_remove( idx, *pRowid );
+    word = sqlite3_value_text( argv[2 + LEVENSHTEIN_INDEX_WORD] );
+    if ( rc == SQLITE_OK && word ) {
+        rc = levenshtein_index_add( idx, *pRowid, word, sqlite3_value_bytes( argv[2 + LEVENSHTEIN_INDEX_WORD] ) );
+    }
+    return rc;
+}
+
+static int levenshtein_index_begin( sqlite3_vtab *pVtab ) {
+    return SQLITE_OK;
+}
+
+// Writes already went into the tree; after a rollback it no longer matches the source table
+static int levenshtein_index_rollback( sqlite3_vtab *pVtab ) {
+    ( ( levenshtein_index * )pVtab )->stale = 1;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_savepoint( sqlite3_vtab *pVtab, int iSavepoint ) {
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_rollback_to( sqlite3_vtab *pVtab, int iSavepoint ) {
+    ( ( levenshtein_index * )pVtab )->stale = 1;
+    return SQLITE_OK;
+}
+
+static int levenshtein_index_rename( sqlite3_vtab *pVtab, const char *zNew ) {
+    levenshtein_index *idx = ( levenshtein_index * )pVtab;
+    char *name = sqlite3_mprintf( "%s", zNew );
+    int rc;
+
+    if ( !name ) {
+        return SQLITE_NOMEM;
+    }
+    rc = levenshtein_index_triggers( idx->db, idx->schema, idx->name, idx->source, idx->column, 0 );
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_index_triggers( idx->db, idx->schema, name, idx->source, idx->column, 1 );
+    }
+    if ( rc != SQLITE_OK ) {
+        sqlite3_free( name );
+        return rc;
+    }
+    sqlite3_free( idx->name );
+    idx->name = name;
+    return SQLITE_OK;
+}
+
+static sqlite3_module levenshtein_index_module = {
+    2,                                  // iVersion: savepoints
+    levenshtein_index_create,
+    levenshtein_index_connect,
+    levenshtein_index_best,
+    levenshtein_index_disconnect,
+    levenshtein_index_destroy,
+    levenshtein_index_open,
+    levenshtein_index_close,
+    levenshtein_index_filter,
+    levenshtein_index_next,
+    levenshtein_index_eof,
+    levenshtein_index_column,
+    levenshtein_index_rowid,
+    levenshtein_index_update,
+    levenshtein_index_begin,
+    NULL,                               // xSync
+    NULL,                               // xCommit
+    levenshtein_index_rollback,
+    NULL,                               // xFindFunction
+    levenshtein_index_rename,
+    levenshtein_index_savepoint,
+    NULL,                               // xRelease
+    levenshtein_index_rollback_to
+};
+
+/*
+ * qgram_index: an inverted index of the q-grams of one text column, for fuzzy search on longer text where
+ * the BK-tree of levenshtein_index prunes poorly.
+ *
+ *   CREATE VIRTUAL TABLE addr_q USING qgram_index( addresses, line );      -- q = 3
+ *   CREATE VIRTUAL TABLE addr_q2 USING qgram_index( addresses, line, 2 );  -- q from 1 to 8
+ *   SELECT rowid, word, distance FROM addr_q WHERE word MATCH '12 main st' AND distance <= 2;
+ *   SELECT rowid, word, distance FROM addr_q( '12 main st', 2 );
+ *
+ * It has the schema, triggers and lifetime of levenshtein_index: the postings live in memory, are built
+ * from the source table when the virtual table is opened, and are kept current by triggers on it.
+ *
+ * A word of length n has n - q + 1 q-grams (overlapping runs of q bytes), and one edit destroys at most q
+ * of them. So two words within k edits share at least max( la, lb ) - q + 1 - k * q q-grams, counted with
+ * multiplicity, and their lengths differ by at most k. A search with a max merges the posting lists of the
+ * query's q-grams into a shared count per row, and only the rows passing both filters get the bounded
+ * exact distance. When the bound is not positive, e.g. for a query shorter than ( k + 1 ) * q, a count
+ * cannot rule anything out and the search falls back to checking every row of a possible length.
+ */
+
+typedef struct levenshtein_qgram_entry {
+    sqlite3_int64 rowid;
+    size_t word;                // Offset into words
+    int len;
+    int live;                   // 0 once the row is deleted
+} levenshtein_qgram_entry;
+
+typedef struct levenshtein_qgram_list {
+    uint64_t gram;              // The q bytes, packed
+    int *ids;                   // Entries holding gram, once per occurrence, ascending; NULL for an empty slot
+    int n, cap;
+} levenshtein_qgram_list;
+
+typedef struct levenshtein_qgram_index {
+    sqlite3_vtab base;
+    sqlite3 *db;
+    char *schema;
+    char *name;
+    char *source;
+    char *column;
+    int q;
+    levenshtein_scratch *scratch;
+    levenshtein_qgram_entry *entries;
+    int nentries, entries_cap, nlive;
+    unsigned char *words;
+    size_t words_len, words_cap;
+    levenshtein_qgram_list *lists; // Open addressing on the gram, at most half full
+    int nlists, lists_cap;
+    int *counts;                // Shared q-grams per entry during a search, all zero between searches
+    int counts_cap;
+    levenshtein_rowid_map rowids; // rowid -> live entry
+    int cursors;                // Open cursors; entry numbers must not move while any exist
+    int stale;                  // Rebuild from the source table before the next search
+    sqlite3_int64 data_version;
+} levenshtein_qgram_index;
+
+#define LEVENSHTEIN_QGRAM_DEFAULT 3
+
+static uint64_t levenshtein_qgram_pack( const unsigned char *s, int q ) {
+    uint64_t g = 0;
+    int i;
+
+    for ( i = 0; i < q; i++ ) {
+        g = g << 8 | s[i];
+    }
+    return g;
+}
+
+static uint32_t levenshtein_qgram_hash( uint64_t gram, int cap ) {
+    uint64_t h = ( gram ^ gram >> 29 ) * 0xBF58476D1CE4E5B9ULL;
+    return ( uint32_t )( h >> 32 ) & ( uint32_t )( cap - 1 );
+}
+
+static levenshtein_qgram_list *levenshtein_qgram_lookup( levenshtein_qgram_index *idx, uint64_t gram ) {
+    uint32_t h;
+
+    if ( !idx->lists_cap ) {
+        return NULL;
+    }
+    for ( h = levenshtein_qgram_hash( gram, idx->lists_cap ); idx->lists[h].ids; h = ( h + 1 ) & ( uint32_t )( idx->lists_cap - 1 ) ) {
+        if ( idx->lists[h].gram == gram ) {
+            return &idx->lists[h];
+        }
+    }
+    return NULL;
+}
+
+// The posting list of gram, created empty if it has none yet
+static levenshtein_qgram_list *levenshtein_qgram_list_for( levenshtein_qgram_index *idx, uint64_t gram ) {
+    levenshtein_qgram_list *list = levenshtein_qgram_lookup( idx, gram );
+    uint32_t h;
+
+    if ( list ) {
+        return list;
+    }
+    if ( 2 * ( idx->nlists + 1 ) > idx->lists_cap ) {
+        int cap = idx->lists_cap ? 2 * idx->lists_cap : 1024, i;
+        levenshtein_qgram_list *lists = ( levenshtein_qgram_list * )sqlite3_malloc64( ( size_t )cap * sizeof( *lists ) );
+
+        if ( !lists ) {
+            return NULL;
+        }
+        memset( lists, 0, ( size_t )cap * sizeof( *lists ) );
+        for ( i = 0; i < idx->lists_cap; i++ ) {
+            if ( idx->lists[i].ids ) {
+                h = levenshtein_qgram_hash( idx->lists[i].gram, cap );
+                while ( lists[h].ids ) {
+                    h = ( h + 1 ) & ( uint32_t )( cap - 1 );
+                }
+                lists[h] = idx->lists[i];
+            }
+        }
+        sqlite3_free( idx->lists );
+        idx->lists = lists;
+        idx->lists_cap = cap;
+    }
+    for ( h = levenshtein_qgram_hash( gram, idx->lists_cap ); idx->lists[h].ids; h = ( h + 1 ) & ( uint32_t )( idx->lists_cap - 1 ) ) {
+    }
+    list = &idx->lists[h];
+    list->ids = ( int * )sqlite3_malloc64( 4 * sizeof( int ) );
+    if ( !list->ids ) {
+        return NULL;
+    }
+    list->gram = gram;
+    list->n = 0;
+    list->cap = 4;
+    idx->nlists++;
+    return list;
+}
+
+static int levenshtein_qgram_add( levenshtein_qgram_index *idx, sqlite3_int64 rowid, const unsigned char *word, int len ) {
+    levenshtein_qgram_entry *entry;
+    int n = idx->nentries, i;
+
+    if ( n == idx->entries_cap ) {
+        int cap = n ? 2 * n : 64;
+        levenshtein_qgram_entry *entries = ( levenshtein_qgram_entry * )sqlite3_realloc64( idx->entries, ( size_t )cap * sizeof( *entries ) );
+        if ( !entries ) {
+            return SQLITE_NOMEM;
+        }
+        idx->entries = entries;
+        idx->entries_cap = cap;
+    }
+    if ( n == idx->counts_cap ) {
+        int *counts = ( int * )sqlite3_realloc64( idx->counts, ( size_t )idx->entries_cap * sizeof( int ) );
+        if ( !counts ) {
+            return SQLITE_NOMEM;
+        }
+        memset( counts + idx->counts_cap, 0, ( size_t )( idx->entries_cap - idx->counts_cap ) * sizeof( int ) );
+        idx->counts = counts;
+        idx->counts_cap = idx->entries_cap;
+    }
+    if ( idx->words_len + len > idx->words_cap ) {
+        size_t cap = idx->words_cap * 2 > idx->words_len + len ? idx->words_cap * 2 : idx->words_len + len + 4096;
+        unsigned char *words = ( unsigned char * )sqlite3_realloc64( idx->words, cap );
+        if ( !words ) {
+            return SQLITE_NOMEM;
+        }
+        idx->words = words;
+        idx->words_cap = cap;
+    }
+    if ( levenshtein_rowid_reserve( &idx->rowids ) != SQLITE_OK ) {
+        return SQLITE_NOMEM;
+    }
+
+    // Entry numbers only grow, so every list stays sorted. Postings left behind when memory runs out
+    // part way go to the next entry added; they can only raise its count, never hide a match.
+    for ( i = 0; i + idx->q <= len; i++ ) {
+        levenshtein_qgram_list *list = levenshtein_qgram_list_for( idx, levenshtein_qgram_pack( word + i, idx->q ) );
+
+        if ( !list ) {
+            return SQLITE_NOMEM;
+        }
+        if ( list->n == list->cap ) {
+            int *ids = ( int * )sqlite3_realloc64( list->ids, ( size_t )list->cap * 2 * sizeof( int ) );
+            if ( !ids ) {
+                return SQLITE_NOMEM;
+            }
+            list->ids = ids;
+            list->cap *= 2;
+        }
+        list->ids[list->n++] = n;
+    }
+
+    entry = &idx->entries[n];
+    entry->rowid = rowid;
+    entry->word = idx->words_len;
+    entry->len = len;
+    entry->live = 1;
+    memcpy( idx->words + idx->words_len, word, len );
+    idx->words_len += len;
+    levenshtein_rowid_put( &idx->rowids, rowid, n ); // Reserved above
+    idx->nentries++;
+    idx->nlive++;
+    return SQLITE_OK;
+}
+
+static void levenshtein_qgram_clear( levenshtein_qgram_index *idx ) {
+    int i;
+
+    for ( i = 0; i < idx->lists_cap; i++ ) {
+        sqlite3_free( idx->lists[i].ids );
+    }
+    sqlite3_free( idx->lists );
+    sqlite3_free( idx->entries );
+    sqlite3_free( idx->words );
+    sqlite3_free( idx->counts );
+    levenshtein_rowid_clear( &idx->rowids );
+    idx->lists = NULL;
+    idx->entries = NULL;
+    idx->words = NULL;
+    idx->counts = NULL;
+    idx->nlists = idx->lists_cap = idx->counts_cap = 0;
+    idx->nentries = idx->entries_cap = idx->nlive = 0;
+    idx->words_len = idx->words_cap = 0;
+}
+
+// Rebuilds the postings from the live entries, dropping the dead ones
+static int levenshtein_qgram_compact( levenshtein_qgram_index *idx ) {
+    levenshtein_qgram_entry *entries = idx->entries;
+    unsigned char *words = idx->words;
+    int nentries = idx->nentries, i, rc = SQLITE_OK;
+
+    idx->entries = NULL;
+    idx->words = NULL;
+    levenshtein_qgram_clear( idx );
+    for ( i = 0; i < nentries && rc == SQLITE_OK; i++ ) {
+        if ( entries[i].live ) {
+            rc = levenshtein_qgram_add( idx, entries[i].rowid, words + entries[i].word, entries[i].len );
+        }
+    }
+    sqlite3_free( entries );
+    sqlite3_free( words );
+    return rc;
+}
+
+// The postings of a deleted row stay until compaction; searches skip entries that are not live
+static int levenshtein_qgram_remove( levenshtein_qgram_index *idx, sqlite3_int64 rowid ) {
+    int n = levenshtein_rowid_remove( &idx->rowids, rowid );
+
+    if ( n >= 0 ) {
+        idx->entries[n].live = 0;
+        idx->nlive--;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_load( levenshtein_qgram_index *idx ) {
+    sqlite3_stmt *stmt = NULL;
+    char *sql = sqlite3_mprintf( "SELECT rowid, \"%w\" FROM \"%w\".\"%w\"", idx->column, idx->schema, idx->source );
+    int rc;
+
+    levenshtein_qgram_clear( idx );
+    if ( !sql ) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_prepare_v2( idx->db, sql, -1, &stmt, NULL );
+    sqlite3_free( sql );
+    while ( rc == SQLITE_OK && sqlite3_step( stmt ) == SQLITE_ROW ) {
+        const unsigned char *word = sqlite3_column_text( stmt, 1 );
+        if ( word ) {
+            rc = levenshtein_qgram_add( idx, sqlite3_column_int64( stmt, 0 ), word, sqlite3_column_bytes( stmt, 1 ) );
+        }
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_finalize( stmt );
+    } else {
+        sqlite3_finalize( stmt );
+    }
+    if ( rc != SQLITE_OK ) {
+        idx->base.zErrMsg = sqlite3_mprintf( "qgram_index: cannot read %s.%s: %s", idx->source, idx->column, sqlite3_errmsg( idx->db ) );
+        return rc;
+    }
+    idx->stale = 0;
+    idx->data_version = levenshtein_index_version( idx->db, idx->schema );
+    return SQLITE_OK;
+}
+
+static void levenshtein_qgram_free( levenshtein_qgram_index *idx ) {
+    levenshtein_qgram_clear( idx );
+    sqlite3_free( idx->schema );
+    sqlite3_free( idx->name );
+    sqlite3_free( idx->source );
+    sqlite3_free( idx->column );
+    levenshtein_scratch_unref( idx->scratch );
+    sqlite3_free( idx );
+}
+
+static int levenshtein_qgram_init( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr, int create ) {
+    levenshtein_qgram_index *idx;
+    int q = LEVENSHTEIN_QGRAM_DEFAULT, rc;
+
+    if ( argc != 5 && argc != 6 ) {
+        *pzErr = sqlite3_mprintf( "qgram_index requires 2 or 3 arguments: ( source_table, column [, q] )" );
+        return SQLITE_ERROR;
+    }
+    if ( argc == 6 ) {
+        char *end;
+        long v = strtol( argv[5], &end, 10 );
+        if ( *end || end == argv[5] || v < 1 || v > 8 ) {
+            *pzErr = sqlite3_mprintf( "qgram_index: q must be an integer from 1 to 8, not %s", argv[5] );
+            return SQLITE_ERROR;
+        }
+        q = ( int )v;
+    }
+    idx = ( levenshtein_qgram_index * )sqlite3_malloc( sizeof( *idx ) );
+    if ( !idx ) {
+        return SQLITE_NOMEM;
+    }
+    memset( idx, 0, sizeof( *idx ) );
+    idx->db = db;
+    idx->q = q;
+    idx->scratch = ( levenshtein_scratch * )pAux;
+    idx->scratch->refs++;
+    idx->schema = sqlite3_mprintf( "%s", argv[1] );
+    idx->name = sqlite3_mprintf( "%s", argv[2] );
+    idx->source = levenshtein_unquote( argv[3] );
+    idx->column = levenshtein_unquote( argv[4] );
+    if ( !idx->schema || !idx->name || !idx->source || !idx->column ) {
+        levenshtein_qgram_free( idx );
+        return SQLITE_NOMEM;
+    }
+
+    rc = sqlite3_declare_vtab( db, "CREATE TABLE x( word TEXT, distance INTEGER, query HIDDEN, max HIDDEN )" );
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_vtab_config( db, SQLITE_VTAB_INNOCUOUS ); // Its triggers must run with trusted_schema off
+    }
+    if ( rc == SQLITE_OK && create ) {
+        rc = levenshtein_index_triggers( db, idx->schema, idx->name, idx->source, idx->column, 1 );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_qgram_load( idx );
+        if ( rc != SQLITE_OK ) {
+            *pzErr = idx->base.zErrMsg;
+            idx->base.zErrMsg = NULL;
+        }
+    } else {
+        *pzErr = sqlite3_mprintf( "qgram_index: %s", sqlite3_errmsg( db ) );
+    }
+    if ( rc != SQLITE_OK ) {
+        levenshtein_qgram_free( idx );
+        return rc;
+    }
+    *ppVtab = &idx->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_create( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    return levenshtein_qgram_init( db, pAux, argc, argv, ppVtab, pzErr, 1 );
+}
+
+static int levenshtein_qgram_connect( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    return levenshtein_qgram_init( db, pAux, argc, argv, ppVtab, pzErr, 0 );
+}
+
+static int levenshtein_qgram_disconnect( sqlite3_vtab *pVtab ) {
+    levenshtein_qgram_free( ( levenshtein_qgram_index * )pVtab );
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_destroy( sqlite3_vtab *pVtab ) {
+    levenshtein_qgram_index *idx = ( levenshtein_qgram_index * )pVtab;
+    int rc = levenshtein_index_triggers( idx->db, idx->schema, idx->name, idx->source, idx->column, 0 );
+
+    if ( rc == SQLITE_OK ) {
+        levenshtein_qgram_free( idx );
+    }
+    return rc;
+}
+
+static int levenshtein_qgram_best( sqlite3_vtab *pVtab, sqlite3_index_info *info ) {
+    return levenshtein_index_plan( info, ( ( levenshtein_qgram_index * )pVtab )->nlive );
+}
+
+static int levenshtein_qgram_open( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )sqlite3_malloc( sizeof( *cur ) );
+
+    if ( !cur ) {
+        return SQLITE_NOMEM;
+    }
+    memset( cur, 0, sizeof( *cur ) );
+    cur->max = -1;
+    ( ( levenshtein_qgram_index * )pVtab )->cursors++;
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_close( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+
+    ( ( levenshtein_qgram_index * )pCursor->pVtab )->cursors--;
+    sqlite3_value_free( cur->query );
+    sqlite3_free( cur->hits );
+    sqlite3_free( cur->dists );
+    sqlite3_free( cur );
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_cmp( const void *a, const void *b ) {
+    uint64_t x = *( const uint64_t * )a, y = *( const uint64_t * )b;
+    return x < y ? -1 : x > y;
+}
+
+// Adds entry n as a hit if it is within max of q; max < 0 always adds it, with its distance
+static int levenshtein_qgram_check( levenshtein_qgram_index *idx, levenshtein_index_cursor *cur, int n, const unsigned char *q, int len, int max ) {
+    const levenshtein_qgram_entry *e = &idx->entries[n];
+    const unsigned char *w = idx->words + e->word;
+    int d = e->len >= len ? levenshtein_distance( idx->scratch, w, e->len, q, len, max ) : levenshtein_distance( idx->scratch, q, len, w, e->len, max );
+
+    if ( d < 0 ) {
+        return SQLITE_NOMEM;
+    }
+    return max < 0 || d <= max ? levenshtein_index_hit( cur, n, d ) : SQLITE_OK;
+}
+
+static int levenshtein_qgram_search( levenshtein_qgram_index *idx, levenshtein_index_cursor *cur, const unsigned char *q, int len, sqlite3_int64 max ) {
+    levenshtein_buffer touched = { NULL, 0 };
+    uint64_t *grams;
+    int *ids;
+    int k, ngrams, ntouched = 0, i, rc = SQLITE_OK;
+
+    k = max < 0 || max > INT32_MAX / 16 ? -1 : ( int )max; // A max that large bounds nothing
+    if ( k < 0 || len - idx->q + 1 - k * idx->q <= 0 ) {
+        // No usable count bound: every row of a possible length gets the exact distance
+        for ( i = 0; i < idx->nentries && rc == SQLITE_OK; i++ ) {
+            const levenshtein_qgram_entry *e = &idx->entries[i];
+            if ( e->live && ( k < 0 || ( e->len >= len - k && e->len <= len + k ) ) ) {
+                rc = levenshtein_qgram_check( idx, cur, i, q, len, k );
+            }
+        }
+        return rc;
+    }
+    ngrams = len - idx->q + 1;
+    grams = ( uint64_t * )sqlite3_malloc64( ( size_t )ngrams * sizeof( uint64_t ) );
+    if ( !grams ) {
+        return SQLITE_NOMEM;
+    }
+    for ( i = 0; i < ngrams; i++ ) {
+        grams[i] = levenshtein_qgram_pack( q + i, idx->q );
+    }
+    qsort( grams, ngrams, sizeof( uint64_t ), levenshtein_qgram_cmp );
+
+    // Each run of one gram in the query meets runs of one entry in its list: they share the smaller count
+    for ( i = 0; i < ngrams && rc == SQLITE_OK; ) {
+        const levenshtein_qgram_list *list = levenshtein_qgram_lookup( idx, grams[i] );
+        int m = 1, p = 0;
+
+        while ( i + m < ngrams && grams[i + m] == grams[i] ) {
+            m++;
+        }
+        i += m;
+        while ( list && p < list->n ) {
+            int n = list->ids[p], r = 1;
+
+            while ( p + r < list->n && list->ids[p + r] == n ) {
+                r++;
+            }
+            p += r;
+            if ( !idx->counts[n] ) {
+                if ( ( size_t )( ntouched + 1 ) * sizeof( int ) > touched.bytes && !levenshtein_buffer_reserve( &touched, ( size_t )( ntouched + 1 ) * sizeof( int ) ) ) {
+                    rc = SQLITE_NOMEM;
+                    break;
+                }
+                ( ( int * )touched.data )[ntouched++] = n;
+            }
+            idx->counts[n] += r < m ? r : m;
+        }
+    }
+
+    ids = ( int * )touched.data;
+    for ( i = 0; i < ntouched; i++ ) {
+        const levenshtein_qgram_entry *e = &idx->entries[ids[i]];
+        int longer = e->len > len ? e->len : len;
+
+        if ( rc == SQLITE_OK && e->live && e->len >= len - k && e->len <= len + k && idx->counts[ids[i]] >= longer - idx->q + 1 - k * idx->q ) {
+            rc = levenshtein_qgram_check( idx, cur, ids[i], q, len, k );
+        }
+        idx->counts[ids[i]] = 0;
+    }
+    sqlite3_free( touched.data );
+    sqlite3_free( grams );
+    return rc;
+}
+
+static int levenshtein_qgram_filter( sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    levenshtein_qgram_index *idx = ( levenshtein_qgram_index * )pCursor->pVtab;
+    int arg = 0, rc = SQLITE_OK, i;
+
+    cur->nhits = cur->pos = 0;
+    cur->max = -1;
+    sqlite3_value_free( cur->query );
+    cur->query = NULL;
+
+    // Only rebuild or compact when no other cursor holds entry numbers
+    if ( idx->cursors == 1 ) {
+        if ( idx->stale || levenshtein_index_version( idx->db, idx->schema ) != idx->data_version ) {
+            rc = levenshtein_qgram_load( idx );
+        } else if ( idx->nentries > 64 && 2 * idx->nlive < idx->nentries ) {
+            rc = levenshtein_qgram_compact( idx );
+        }
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+    }
+
+    if ( idxNum & LEVENSHTEIN_PLAN_QUERY ) {
+        cur->query = sqlite3_value_dup( argv[arg++] );
+        if ( !cur->query ) {
+            return SQLITE_NOMEM;
+        }
+    }
+    if ( idxNum & LEVENSHTEIN_PLAN_MAX ) {
+        if ( sqlite3_value_type( argv[arg] ) != SQLITE_NULL ) {
+            cur->max = sqlite3_value_int64( argv[arg] );
+            if ( cur->max < 0 ) {
+                return SQLITE_OK; // No distance is negative
+            }
+        }
+        arg++;
+    }
+
+    if ( idxNum & LEVENSHTEIN_PLAN_ROWID ) {
+        int n = levenshtein_rowid_find( &idx->rowids, sqlite3_value_int64( argv[arg] ) );
+        if ( n >= 0 && !cur->query ) {
+            rc = levenshtein_index_hit( cur, n, -1 );
+        } else if ( n >= 0 ) {
+            const unsigned char *q = sqlite3_value_text( cur->query );
+            if ( q ) {
+                rc = levenshtein_qgram_check( idx, cur, n, q, sqlite3_value_bytes( cur->query ), cur->max > INT32_MAX / 16 ? -1 : ( int )cur->max );
+            }
+        }
+    } else if ( cur->query ) {
+        const unsigned char *q = sqlite3_value_text( cur->query );
+        if ( q ) {
+            rc = levenshtein_qgram_search( idx, cur, q, sqlite3_value_bytes( cur->query ), cur->max );
+        }
+        if ( rc == SQLITE_OK && cur->nhits > 1 ) {
+            rc = levenshtein_index_sort( cur );
+        }
+    } else {
+        for ( i = 0; i < idx->nentries && rc == SQLITE_OK; i++ ) {
+            if ( idx->entries[i].live ) {
+                rc = levenshtein_index_hit( cur, i, -1 );
+            }
+        }
+    }
+    return rc;
+}
+
+static int levenshtein_qgram_column( sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int i ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    levenshtein_qgram_index *idx = ( levenshtein_qgram_index * )pCursor->pVtab;
+    const levenshtein_qgram_entry *e = &idx->entries[cur->hits[cur->pos]];
+
+    switch ( i ) {
+        case LEVENSHTEIN_INDEX_WORD:
+            // Transient: an insert through this connection may move the word store
+            sqlite3_result_text( context, ( const char * )idx->words + e->word, e->len, SQLITE_TRANSIENT );
+            break;
+        case LEVENSHTEIN_INDEX_DISTANCE:
+            if ( cur->dists[cur->pos] >= 0 ) {
+                sqlite3_result_int( context, cur->dists[cur->pos] );
+            }
+            break;
+        case LEVENSHTEIN_INDEX_QUERY:
+            if ( cur->query ) {
+                sqlite3_result_value( context, cur->query );
+            }
+            break;
+        case LEVENSHTEIN_INDEX_MAX:
+            if ( cur->max >= 0 ) {
+                sqlite3_result_int64( context, cur->max );
+            }
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_rowid( sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid ) {
+    levenshtein_index_cursor *cur = ( levenshtein_index_cursor * )pCursor;
+    *pRowid = ( ( levenshtein_qgram_index * )pCursor->pVtab )->entries[cur->hits[cur->pos]].rowid;
+    return SQLITE_OK;
+}
+
+// Called by the source table triggers; a direct write works too but does not touch the source table
+static int levenshtein_qgram_update( sqlite3_vtab *pVtab, int argc, sqlite3_value **argv, sqlite3_int64 *pRowid ) {
+    levenshtein_qgram_index *idx = ( levenshtein_qgram_index * )pVtab;
+    const unsigned char *word;
+    int rc = SQLITE_OK;
+
+    if ( sqlite3_value_type( argv[0] ) != SQLITE_NULL ) {
+        rc = levenshtein_qgram_remove( idx, sqlite3_value_int64( argv[0] ) );
+    }
+    if ( argc == 1 || rc != SQLITE_OK ) {
+        return rc;
+    }
+    if ( sqlite3_value_type( argv[1] ) == SQLITE_NULL ) {
+        pVtab->zErrMsg = sqlite3_mprintf( "qgram_index: rows are keyed by the source rowid, which must be given" );
+        return SQLITE_CONSTRAINT;
+    }
+    *pRowid = sqlite3_value_int64( argv[1] );
+    rc = levenshtein_qgram_remove( idx, *pRowid );
+    word = sqlite3_value_text( argv[2 + LEVENSHTEIN_INDEX_WORD] );
+    if ( rc == SQLITE_OK && word ) {
+        rc = levenshtein_qgram_add( idx, *pRowid, word, sqlite3_value_bytes( argv[2 + LEVENSHTEIN_INDEX_WORD] ) );
+    }
+    return rc;
+}
+
+// Writes already went into the postings; after a rollback they no longer match the source table
+static int levenshtein_qgram_rollback( sqlite3_vtab *pVtab ) {
+    ( ( levenshtein_qgram_index * )pVtab )->stale = 1;
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_rollback_to( sqlite3_vtab *pVtab, int iSavepoint ) {
+    ( ( levenshtein_qgram_index * )pVtab )->stale = 1;
+    return SQLITE_OK;
+}
+
+static int levenshtein_qgram_rename( sqlite3_vtab *pVtab, const char *zNew ) {
+    levenshtein_qgram_index *idx = ( levenshtein_qgram_index * )pVtab;
+    char *name = sqlite3_mprintf( "%s", zNew );
+    int rc;
+
+    if ( !name ) {
+        return SQLITE_NOMEM;
+    }
+    rc = levenshtein_index_triggers( idx->db, idx->schema, idx->name, idx->source, idx->column, 0 );
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_index_triggers( idx->db, idx->schema, name, idx->source, idx->column, 1 );
+    }
+    if ( rc != SQLITE_OK ) {
+        sqlite3_free( name );
+        return rc;
+    }
+    sqlite3_free( idx->name );
+    idx->name = name;
+    return SQLITE_OK;
+}
+
+static sqlite3_module levenshtein_qgram_module = {
+    2,                                  // iVersion: savepoints
+    levenshtein_qgram_create,
+    levenshtein_qgram_connect,
+    levenshtein_qgram_best,
+    levenshtein_qgram_disconnect,
+    levenshtein_qgram_destroy,
+    levenshtein_qgram_open,
+    levenshtein_qgram_close,
+    levenshtein_qgram_filter,
+    levenshtein_index_next,
+    levenshtein_index_eof,
+    levenshtein_qgram_column,
+    levenshtein_qgram_rowid,
+    levenshtein_qgram_update,
+    levenshtein_index_begin,
+    NULL,                               // xSync
+    NULL,                               // xCommit
+    levenshtein_qgram_rollback,
+    NULL,                               // xFindFunction
+    levenshtein_qgram_rename,
+    levenshtein_index_savepoint,
+    NULL,                               // xRelease
+    levenshtein_qgram_rollback_to
+};
+
+/*
+ * fuzzy_candidates( table, column, target, k ): rows whose column is within k of target, in index order,
+ * found by walking an index on the column instead of scanning the table.
+ *
+ *   CREATE INDEX names_name ON names( name );
+ *   SELECT rowid, word, distance FROM fuzzy_candidates( 'names', 'name', 'jonathan', 2 );
+ *
+ * The target is run as a Levenshtein automaton whose state is the DP row against target, capped at
+ * k + 1; a state is dead once every cell is above k. Each key read from the index is fed through it. A
+ * rejected key yields the smallest string after it that the automaton can still accept, and the walk
+ * seeks straight there, so whole ranges of keys that share a dead prefix are skipped. The index must use
+ * the BINARY collation, and only text keys are visited: the walk ends at the first BLOB, which sorts
+ * after every text key. Distance is levenshtein(), in bytes. It reads whatever table it is told to, so
+ * it runs only from top-level SQL, never from a view or trigger.
+ */
+
+typedef struct levenshtein_candidates_vtab {
+    sqlite3_vtab base;
+    sqlite3 *db;
+} levenshtein_candidates_vtab;
+
+typedef struct levenshtein_candidates_cursor {
+    sqlite3_vtab_cursor base;
+    sqlite3_stmt *seek;         // rowid and key at or after ?1 in BINARY order
+    sqlite3_value *args[4];     // table, column, target, k, for the hidden columns
+    unsigned char *target;
+    int m, k;
+    unsigned char has[256];     // Bytes that occur in target; the others all step alike
+    int *rows;                  // Automaton state after each prefix of key, m + 1 cells each
+    int rows_cap;               // Prefixes rows has room for
+    unsigned char *key;         // Last key fed through the automaton; its states are still in rows
+    int key_len, key_live, key_cap;
+    unsigned char *bound;       // Next seek target
+    int bound_len, bound_cap;
+    int distance;
+    int eof;
+} levenshtein_candidates_cursor;
+
+#define LEVENSHTEIN_CANDIDATES_WORD 0
+#define LEVENSHTEIN_CANDIDATES_DISTANCE 1
+#define LEVENSHTEIN_CANDIDATES_TABLE 2  // First hidden argument column
+
+// Automaton step on byte c, or on a byte not in target if c < 0. Returns the smallest cell; above k means dead.
+static int levenshtein_automaton_step( const unsigned char *t, int m, int k, const int *row, int *next, int c ) {
+    int j, low;
+
+    next[0] = row[0] + 1 > k + 1 ? k + 1 : row[0] + 1;
+    low = next[0];
+    for ( j = 1; j <= m; j++ ) {
+        int v = MIN3( row[j] + 1, next[j - 1] + 1, row[j - 1] + ( t[j - 1] != c ) );
+        next[j] = v > k + 1 ? k + 1 : v;
+        low = next[j] < low ? next[j] : low;
+    }
+    return low;
+}
+
+static int levenshtein_candidates_reserve( void **buf, int *cap, int need, size_t size ) {
+    if ( need > *cap ) {
+        int grow = *cap * 2 > need ? *cap * 2 : need + 64;
+        void *p = sqlite3_realloc64( *buf, ( size_t )grow * size );
+        if ( !p ) {
+            return SQLITE_NOMEM;
+        }
+        *buf = p;
+        *cap = grow;
+    }
+    return SQLITE_OK;
+}
+
+// First byte >= from that keeps state row alive, stepping into next; -1 if there is none
+static int levenshtein_candidates_byte( levenshtein_candidates_cursor *cur, const int *row, int *next, int from ) {
+    int other = -1, c;
+
+    for ( c = from; c < 256; c++ ) {
+        if ( cur->has[c] ) {
+            if ( levenshtein_automaton_step( cur->target, cur->m, cur->k, row, next, c ) <= cur->k ) {
+                return c;
+            }
+        } else {
+            if ( other < 0 ) {
+                other = levenshtein_automaton_step( cur->target, cur->m, cur->k, row, next, -1 ) <= cur->k;
+            }
+            if ( other ) {
+                // next may hold a later target byte's step; redo the one we return
+                levenshtein_automaton_step( cur->target, cur->m, cur->k, row, next, -1 );
+                return c;
+            }
+        }
+    }
+    return -1;
+}
+
+// Feeds key through the automaton, reusing the states of the prefix it shares with the previous key
+static int levenshtein_candidates_feed( levenshtein_candidates_cursor *cur, const unsigned char *key, int len ) {
+    int w = cur->m + 1, i = 0, rc;
+
+    rc = levenshtein_candidates_reserve( ( void ** )&cur->rows, &cur->rows_cap, len + 1, ( size_t )w * sizeof( int ) );
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_candidates_reserve( ( void ** )&cur->key, &cur->key_cap, len + 1, 1 );
+    }
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    while ( i < len && i < cur->key_len && i < cur->key_live && key[i] == cur->key[i] ) {
+        i++;
+    }
+    memcpy( cur->key, key, len );
+    cur->key_len = len;
+    for ( ; i < len; i++ ) {
+        if ( levenshtein_automaton_step( cur->target, cur->m, cur->k, cur->rows + i * w, cur->rows + ( i + 1 ) * w, key[i] ) > cur->k ) {
+            break;
+        }
+    }
+    cur->key_live = i; // States 0..key_live are alive
+    return SQLITE_OK;
+}
+
+// Appends to bound the smallest suffix that takes the live state at rows[at] to acceptance
+static int levenshtein_candidates_complete( levenshtein_candidates_cursor *cur, int at ) {
+    int w = cur->m + 1, rc;
+
+    for ( ;; ) {
+        const int *row;
+        int c;
+
+        rc = levenshtein_candidates_reserve( ( void ** )&cur->rows, &cur->rows_cap, at + 2, ( size_t )w * sizeof( int ) );
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+        row = cur->rows + at * w;
+        if ( row[cur->m] <= cur->k ) {
+            return SQLITE_OK;
+        }
+        c = levenshtein_candidates_byte( cur, row, cur->rows + ( at + 1 ) * w, 0 ); // Always found from a live state
+        rc = levenshtein_candidates_reserve( ( void ** )&cur->bound, &cur->bound_cap, cur->bound_len + 1, 1 );
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+        cur->bound[cur->bound_len++] = ( unsigned char )c;
+        at++;
+    }
+}
+
+// Sets bound to the smallest string after key the automaton accepts. Returns SQLITE_DONE if none exists.
+static int levenshtein_candidates_next_bound( levenshtein_candidates_cursor *cur ) {
+    int w = cur->m + 1, i, rc;
+
+    rc = levenshtein_candidates_reserve( ( void ** )&cur->bound, &cur->bound_cap, cur->key_len + 1, 1 );
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    memcpy( cur->bound, cur->key, cur->key_len );
+
+    // Every extension of a live key sorts before any other later string
+    if ( cur->key_live == cur->key_len ) {
+        cur->bound_len = cur->key_len;
+        return levenshtein_candidates_complete( cur, cur->key_len );
+    }
+    // Otherwise raise the deepest byte that can be raised without killing the automaton
+    for ( i = cur->key_live; i >= 0; i-- ) {
+        int c = cur->key[i] < 255 ? levenshtein_candidates_byte( cur, cur->rows + i * w, cur->rows + ( i + 1 ) * w, cur->key[i] + 1 ) : -1;
+        if ( c >= 0 ) {
+            cur->bound[i] = ( unsigned char )c;
+            cur->bound_len = i + 1;
+            cur->key_live = i; // rows past i now describe bound, not key
+            return levenshtein_candidates_complete( cur, i + 1 );
+        }
+    }
+    return SQLITE_DONE;
+}
+
+static int levenshtein_candidates_seek( levenshtein_candidates_cursor *cur ) {
+    int rc;
+
+    sqlite3_reset( cur->seek );
+    rc = sqlite3_bind_text( cur->seek, 1, cur->bound_len ? ( const char * )cur->bound : "", cur->bound_len, SQLITE_STATIC );
+    return rc == SQLITE_OK ? sqlite3_step( cur->seek ) : rc;
+}
+
+// Moves to the next accepted key, starting from the row seek is on (rc is its last step result)
+static int levenshtein_candidates_advance( levenshtein_candidates_cursor *cur, int rc ) {
+    int w = cur->m + 1;
+
+    while ( rc == SQLITE_ROW ) {
+        const unsigned char *key;
+        int len, cmp;
+
+        if ( sqlite3_column_type( cur->seek, 1 ) != SQLITE_TEXT ) {
+            break; // BLOBs sort after every text key, and >= a text bound leaves out NULLs and numbers
+        }
+        key = ( const unsigned char * )sqlite3_column_blob( cur->seek, 1 );
+        len = sqlite3_column_bytes( cur->seek, 1 );
+        rc = levenshtein_candidates_feed( cur, key, len );
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+        if ( cur->key_live == len && cur->rows[len * w + cur->m] <= cur->k ) {
+            cur->distance = cur->rows[len * w + cur->m];
+            return SQLITE_OK;
+        }
+
+        rc = levenshtein_candidates_next_bound( cur );
+        if ( rc == SQLITE_DONE ) {
+            break;
+        }
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+        // The next key is often already past the bound; try it before paying for a seek
+        rc = sqlite3_step( cur->seek );
+        if ( rc == SQLITE_ROW ) {
+            len = sqlite3_column_bytes( cur->seek, 1 );
+            key = ( const unsigned char * )sqlite3_column_blob( cur->seek, 1 );
+            cmp = memcmp( key, cur->bound, len < cur->bound_len ? len : cur->bound_len );
+            if ( cmp < 0 || ( cmp == 0 && len < cur->bound_len ) ) {
+                rc = levenshtein_candidates_seek( cur );
+            }
+        }
+    }
+    cur->eof = 1;
+    return rc == SQLITE_DONE || rc == SQLITE_ROW ? SQLITE_OK : rc;
+}
+
+static int levenshtein_candidates_connect( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    levenshtein_candidates_vtab *vtab;
+    int rc = sqlite3_declare_vtab( db, "CREATE TABLE x( word TEXT, distance INTEGER, tbl HIDDEN, col HIDDEN, target HIDDEN, k HIDDEN )" );
+
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    vtab = ( levenshtein_candidates_vtab * )sqlite3_malloc( sizeof( *vtab ) );
+    if ( !vtab ) {
+        return SQLITE_NOMEM;
+    }
+    memset( vtab, 0, sizeof( *vtab ) );
+    vtab->db = db;
+    sqlite3_vtab_config( db, SQLITE_VTAB_DIRECTONLY ); // Reads any table it is named: only from top-level SQL
+    *ppVtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_candidates_disconnect( sqlite3_vtab *pVtab ) {
+    sqlite3_free( pVtab );
+    return SQLITE_OK;
+}
+
+// All four arguments are required; the plan is the same whatever their values
+static int levenshtein_candidates_best( sqlite3_vtab *pVtab, sqlite3_index_info *info ) {
+    int found = 0, i;
+
+    for ( i = 0; i < info->nConstraint; i++ ) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+        int arg = c->iColumn - LEVENSHTEIN_CANDIDATES_TABLE;
+
+        if ( arg >= 0 && c->op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+            if ( !c->usable ) {
+                return SQLITE_CONSTRAINT;
+            }
+            info->aConstraintUsage[i].argvIndex = arg + 1;
+            info->aConstraintUsage[i].omit = 1;
+            found |= 1 << arg;
+        }
+    }
+    if ( found != 15 ) {
+        pVtab->zErrMsg = sqlite3_mprintf( "fuzzy_candidates() requires 4 arguments: ( table, column, target, k )" );
+        return SQLITE_ERROR;
+    }
+    info->estimatedCost = 1000;
+    info->estimatedRows = 25;
+    return SQLITE_OK;
+}
+
+static int levenshtein_candidates_open( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    levenshtein_candidates_cursor *cur = ( levenshtein_candidates_cursor * )sqlite3_malloc( sizeof( *cur ) );
+
+    if ( !cur ) {
+        return SQLITE_NOMEM;
+    }
+    memset( cur, 0, sizeof( *cur ) );
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static void levenshtein_candidates_reset( levenshtein_candidates_cursor *cur ) {
+    int i;
+
+    sqlite3_finalize( cur->seek );
+    cur->seek = NULL;
+    for ( i = 0; i < 4; i++ ) {
+        sqlite3_value_free( cur->args[i] );
+        cur->args[i] = NULL;
+    }
+    sqlite3_free( cur->target );
+    cur->target = NULL;
+    cur->key_len = cur->key_live = 0;
+}
+
+static int levenshtein_candidates_close( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_candidates_cursor *cur = ( levenshtein_candidates_cursor * )pCursor;
+
+    levenshtein_candidates_reset( cur );
+    sqlite3_free( cur->rows );
+    sqlite3_free( cur->key );
+    sqlite3_free( cur->bound );
+    sqlite3_free( cur );
+    return SQLITE_OK;
+}
+
+static int levenshtein_candidates_filter( sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    levenshtein_candidates_cursor *cur = ( levenshtein_candidates_cursor * )pCursor;
+    sqlite3 *db = ( ( levenshtein_candidates_vtab * )pCursor->pVtab )->db;
+    const char *table, *column;
+    const unsigned char *target;
+    sqlite3_int64 k;
+    char *sql;
+    int i, j, rc;
+
+    levenshtein_candidates_reset( cur );
+    cur->eof = 1;
+    for ( i = 0; i < 4; i++ ) {
+        cur->args[i] = sqlite3_value_dup( argv[i] );
+        if ( !cur->args[i] ) {
+            return SQLITE_NOMEM;
+        }
+    }
+    table = ( const char * )sqlite3_value_text( argv[0] );
+    column = ( const char * )sqlite3_value_text( argv[1] );
+    target = sqlite3_value_text( argv[2] );
+    if ( !table || !column ) {
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf( "fuzzy_candidates() table and column must not be NULL" );
+        return SQLITE_ERROR;
+    }
+    if ( !target || sqlite3_value_type( argv[3] ) == SQLITE_NULL ) {
+        return SQLITE_OK;
+    }
+    k = sqlite3_value_int64( argv[3] );
+    if ( k < 0 ) {
+        return SQLITE_OK;
+    }
+
+    if ( k >= INT_MAX ) { // Automaton cells hold up to k + 1
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf( "fuzzy_candidates() k must be below %d", INT_MAX );
+        return SQLITE_ERROR;
+    }
+
+    cur->m = sqlite3_value_bytes( argv[2] );
+    cur->k = ( int )k;
+    cur->target = ( unsigned char * )sqlite3_malloc64( ( size_t )cur->m + 1 );
+    if ( !cur->target ) {
+        return SQLITE_NOMEM;
+    }
+    memcpy( cur->target, target, cur->m );
+    memset( cur->has, 0, sizeof( cur->has ) );
+    for ( j = 0; j < cur->m; j++ ) {
+        cur->has[cur->target[j]] = 1;
+    }
+
+    // The start state: target[0..j) against the empty string
+    rc = levenshtein_candidates_reserve( ( void ** )&cur->rows, &cur->rows_cap, 1, ( size_t )( cur->m + 1 ) * sizeof( int ) );
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    for ( j = 0; j <= cur->m; j++ ) {
+        cur->rows[j] = j > cur->k ? cur->k + 1 : j;
+    }
+
+    sql = sqlite3_mprintf( "SELECT rowid, \"%w\" FROM \"%w\" WHERE \"%w\" >= ?1 COLLATE BINARY ORDER BY \"%w\" COLLATE BINARY", column, table, column, column );
+    if ( !sql ) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_prepare_v2( db, sql, -1, &cur->seek, NULL );
+    sqlite3_free( sql );
+    if ( rc != SQLITE_OK ) {
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf( "fuzzy_candidates(): %s", sqlite3_errmsg( db ) );
+        return rc;
+    }
+
+    cur->eof = 0;
+    cur->bound_len = 0;
+    rc = levenshtein_candidates_seek( cur );
+    if ( sqlite3_stmt_status( cur->seek, SQLITE_STMTSTATUS_SORT, 0 ) ) {
+        // Every seek would sort the whole table
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf( "fuzzy_candidates() needs an index on %s( %s ) with BINARY collation", table, column );
+        return SQLITE_ERROR;
+    }
+    return levenshtein_candidates_advance( cur, rc );
+}
 
-#include <string.h>
-#include <stdlib.h>
+static int levenshtein_candidates_next( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_candidates_cursor *cur = ( levenshtein_candidates_cursor * )pCursor;
+    return levenshtein_candidates_advance( cur, sqlite3_step( cur->seek ) );
+}
 
-#define MIN3( a, b, c ) ( ( a ) < ( b ) ? ( ( a ) < ( c ) ? ( a ) : ( c ) ) : ( ( b ) < ( c ) ? ( b ) : ( c ) ) )
+static int levenshtein_candidates_eof( sqlite3_vtab_cursor *pCursor ) {
+    return ( ( levenshtein_candidates_cursor * )pCursor )->eof;
+}
 
-static void levenshtein_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
-    const unsigned char *s1, *s2;
-    int len1, len2;
-    int *prev_row, *curr_row, *temp;
-    int i, j;
-    int result;
+static int levenshtein_candidates_column( sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int i ) {
+    levenshtein_candidates_cursor *cur = ( levenshtein_candidates_cursor * )pCursor;
 
-    if ( argc != 2 ) {
-        sqlite3_result_error( context, "levenshtein() requires exactly 2 arguments", -1 );
-        return;
+    if ( i == LEVENSHTEIN_CANDIDATES_WORD ) {
+        sqlite3_result_value( context, sqlite3_column_value( cur->seek, 1 ) );
+    } else if ( i == LEVENSHTEIN_CANDIDATES_DISTANCE ) {
+        sqlite3_result_int( context, cur->distance );
+    } else {
+        sqlite3_result_value( context, cur->args[i - LEVENSHTEIN_CANDIDATES_TABLE] );
     }
+    return SQLITE_OK;
+}
 
-    if ( sqlite3_value_type( argv[0] ) == SQLITE_NULL || sqlite3_value_type( argv[1] ) == SQLITE_NULL ) {
-        sqlite3_result_null( context );
-        return;
+static int levenshtein_candidates_rowid( sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid ) {
+    *pRowid = sqlite3_column_int64( ( ( levenshtein_candidates_cursor * )pCursor )->seek, 0 );
+    return SQLITE_OK;
+}
+
+static sqlite3_module levenshtein_candidates_module = {
+    0,                                  // iVersion
+    NULL,                               // xCreate: eponymous only, used as a table-valued function
+    levenshtein_candidates_connect,
+    levenshtein_candidates_best,
+    levenshtein_candidates_disconnect,
+    NULL,                               // xDestroy
+    levenshtein_candidates_open,
+    levenshtein_candidates_close,
+    levenshtein_candidates_filter,
+    levenshtein_candidates_next,
+    levenshtein_candidates_eof,
+    levenshtein_candidates_column,
+    levenshtein_candidates_rowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+/*
+ * levenshtein_pairs( table, column, max [, threads] ): every pair of rows whose column values are within
+ * max of each other, as ( rowid_a, rowid_b, distance ) with rowid_a < rowid_b. A deduplicating self-join
+ * in one pass that uses every core.
+ *
+ *   SELECT rowid_a, rowid_b, distance FROM levenshtein_pairs( 'names', 'name', 2 );
+ *
+ * The column is read once into one block of memory and sorted by length, so each row is only compared
+ * with the rows after it that are at most max bytes longer. Those comparisons are cut into chunks that
+ * worker threads claim one at a time (faster threads simply claim more), each thread with its own
+ * scratch. Rows stream back chunk by chunk while later chunks are still being computed, in no particular
+ * order. threads defaults to the number of CPUs; 1 computes each chunk in the querying thread as it is
+ * read. A NULL max compares every pair. Built with -DLEVENSHTEIN_NO_THREADS it is always single-threaded.
+ * It reads whatever table it is told to, so it runs only from top-level SQL, never from a view or trigger.
+ */
+
+#ifndef LEVENSHTEIN_NO_THREADS
+#ifdef _WIN32
+typedef HANDLE levenshtein_thread;
+typedef SRWLOCK levenshtein_mutex;
+typedef CONDITION_VARIABLE levenshtein_cond;
+#define levenshtein_mutex_init( m ) InitializeSRWLock( m )
+#define levenshtein_mutex_destroy( m ) ( ( void )0 )
+#define levenshtein_lock( m ) AcquireSRWLockExclusive( m )
+#define levenshtein_unlock( m ) ReleaseSRWLockExclusive( m )
+#define levenshtein_cond_init( c ) InitializeConditionVariable( c )
+#define levenshtein_cond_destroy( c ) ( ( void )0 )
+#define levenshtein_cond_wait( c, m ) SleepConditionVariableSRW( c, m, INFINITE, 0 )
+#define levenshtein_cond_broadcast( c ) WakeAllConditionVariable( c )
+#else
+typedef pthread_t levenshtein_thread;
+typedef pthread_mutex_t levenshtein_mutex;
+typedef pthread_cond_t levenshtein_cond;
+#define levenshtein_mutex_init( m ) pthread_mutex_init( m, NULL )
+#define levenshtein_mutex_destroy( m ) pthread_mutex_destroy( m )
+#define levenshtein_lock( m ) pthread_mutex_lock( m )
+#define levenshtein_unlock( m ) pthread_mutex_unlock( m )
+#define levenshtein_cond_init( c ) pthread_cond_init( c, NULL )
+#define levenshtein_cond_destroy( c ) pthread_cond_destroy( c )
+#define levenshtein_cond_wait( c, m ) pthread_cond_wait( c, m )
+#define levenshtein_cond_broadcast( c ) pthread_cond_broadcast( c )
+#endif
+#define LEVENSHTEIN_MAX_THREADS 64
+#endif
+
+typedef struct levenshtein_pairs_row {
+    sqlite3_int64 rowid;
+    size_t text;                // Offset into the text block
+    int len;
+} levenshtein_pairs_row;
+
+typedef struct levenshtein_pairs_hit {
+    sqlite3_int64 a, b;
+    int distance;
+} levenshtein_pairs_hit;
+
+typedef struct levenshtein_pairs_chunk {
+    levenshtein_pairs_hit *hits;
+    int nhits, cap;
+    int state;                  // 0 waiting, 1 claimed, 2 done
+    int rc;
+} levenshtein_pairs_chunk;
+
+typedef struct levenshtein_pairs_cursor {
+    sqlite3_vtab_cursor base;
+    sqlite3_value *args[4];
+    unsigned char *text;
+    levenshtein_pairs_row *rows;
+    int nrows;
+    sqlite3_int64 max;          // -1 for every pair
+    levenshtein_pairs_chunk *chunks;
+    int nchunks, chunk_rows;
+    int next;                   // Next chunk to claim
+    int at, pos;                // Chunk and hit being read
+    levenshtein_scratch scratch;// For chunks computed by the querying thread
+#ifndef LEVENSHTEIN_NO_THREADS
+    levenshtein_mutex mutex;    // Guards next, stop and chunk state
+    levenshtein_cond cond;
+    levenshtein_thread threads[LEVENSHTEIN_MAX_THREADS];
+    int nthreads;
+    volatile int stop;          // Polled by the workers between rows
+#endif
+} levenshtein_pairs_cursor;
+
+typedef struct levenshtein_pairs_vtab {
+    sqlite3_vtab base;
+    sqlite3 *db;
+} levenshtein_pairs_vtab;
+
+#define LEVENSHTEIN_PAIRS_DISTANCE 2
+#define LEVENSHTEIN_PAIRS_TABLE 3   // First hidden argument column
+
+static int levenshtein_pairs_by_length( const void *a, const void *b ) {
+    const levenshtein_pairs_row *x = ( const levenshtein_pairs_row * )a, *y = ( const levenshtein_pairs_row * )b;
+    return x->len != y->len ? ( x->len < y->len ? -1 : 1 ) : ( x->rowid < y->rowid ? -1 : x->rowid > y->rowid );
+}
+
+// Compares each row of chunk c with the later rows close enough in length
+static int levenshtein_pairs_compute( levenshtein_pairs_cursor *cur, levenshtein_scratch *scratch, int c, const volatile int *stop ) {
+    levenshtein_pairs_chunk *chunk = &cur->chunks[c];
+    int i = c * cur->chunk_rows, end = i + cur->chunk_rows, j;
+
+    end = end > cur->nrows ? cur->nrows : end;
+    for ( ; i < end && !*stop; i++ ) {
+        const levenshtein_pairs_row *a = &cur->rows[i];
+
+        for ( j = i + 1; j < cur->nrows && ( cur->max < 0 || cur->rows[j].len - a->len <= cur->max ); j++ ) {
+            const levenshtein_pairs_row *b = &cur->rows[j];
+            sqlite3_int64 d = levenshtein_pair( scratch, cur->text + a->text, a->len, cur->text + b->text, b->len, cur->max );
+
+            if ( d < 0 ) {
+                return SQLITE_NOMEM;
+            }
+            if ( cur->max >= 0 && d > cur->max ) {
+                continue;
+            }
+            if ( chunk->nhits == chunk->cap ) {
+                int cap = chunk->cap ? 2 * chunk->cap : 64;
+                levenshtein_pairs_hit *hits = ( levenshtein_pairs_hit * )sqlite3_realloc64( chunk->hits, ( size_t )cap * sizeof( *hits ) );
+                if ( !hits ) {
+                    return SQLITE_NOMEM;
+                }
+                chunk->hits = hits;
+                chunk->cap = cap;
+            }
+            chunk->hits[chunk->nhits].a = a->rowid < b->rowid ? a->rowid : b->rowid;
+            chunk->hits[chunk->nhits].b = a->rowid < b->rowid ? b->rowid : a->rowid;
+            chunk->hits[chunk->nhits].distance = ( int )d;
+            chunk->nhits++;
+        }
     }
+    return SQLITE_OK;
+}
 
-    s1 = sqlite3_value_text( argv[0] );
-    s2 = sqlite3_value_text( argv[1] );
-    
-    if ( !s1 || !s2 ) {
-        sqlite3_result_null( context );
-        return;
+#ifndef LEVENSHTEIN_NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI levenshtein_pairs_worker( LPVOID p )
+#else
+static void *levenshtein_pairs_worker( void *p )
+#endif
+{
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )p;
+    levenshtein_scratch scratch;
+
+    memset( &scratch, 0, sizeof( scratch ) );
+    for ( ;; ) {
+        int c, rc;
+
+        levenshtein_lock( &cur->mutex );
+        while ( cur->next < cur->nchunks && cur->chunks[cur->next].state ) {
+            cur->next++;
+        }
+        if ( cur->stop || cur->next >= cur->nchunks ) {
+            levenshtein_unlock( &cur->mutex );
+            break;
+        }
+        c = cur->next++;
+        cur->chunks[c].state = 1;
+        levenshtein_unlock( &cur->mutex );
+
+        rc = levenshtein_pairs_compute( cur, &scratch, c, &cur->stop );
+
+        levenshtein_lock( &cur->mutex );
+        cur->chunks[c].rc = rc;
+        cur->chunks[c].state = 2;
+        levenshtein_cond_broadcast( &cur->cond );
+        levenshtein_unlock( &cur->mutex );
     }
+    levenshtein_scratch_release( &scratch );
+    return 0;
+}
+
+static int levenshtein_cpu_count( void ) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return ( int )info.dwNumberOfProcessors;
+#else
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? ( int )n : 1;
+#endif
+}
 
-    len1 = strlen( ( const char * )s1 );
-    len2 = strlen( ( const char * )s2 );
+static void levenshtein_pairs_join( levenshtein_pairs_cursor *cur ) {
+    int i;
 
-    if ( len1 == 0 ) {
-        sqlite3_result_int( context, len2 );
+    if ( !cur->nthreads ) {
         return;
     }
-    if ( len2 == 0 ) {
-        sqlite3_result_int( context, len1 );
-        return;
+    levenshtein_lock( &cur->mutex );
+    cur->stop = 1;
+    levenshtein_unlock( &cur->mutex );
+    for ( i = 0; i < cur->nthreads; i++ ) {
+#ifdef _WIN32
+        WaitForSingleObject( cur->threads[i], INFINITE );
+        CloseHandle( cur->threads[i] );
+#else
+        pthread_join( cur->threads[i], NULL );
+#endif
+    }
+    cur->nthreads = 0;
+    cur->stop = 0;
+}
+#endif
+
+// Waits for chunk c, computing it here if no worker has claimed it
+static int levenshtein_pairs_wait( levenshtein_pairs_cursor *cur, int c ) {
+    levenshtein_pairs_chunk *chunk = &cur->chunks[c];
+    static const volatile int never = 0;
+
+#ifndef LEVENSHTEIN_NO_THREADS
+    levenshtein_lock( &cur->mutex );
+    if ( !chunk->state ) {
+        chunk->state = 1;
+        levenshtein_unlock( &cur->mutex );
+        chunk->rc = levenshtein_pairs_compute( cur, &cur->scratch, c, &never );
+        levenshtein_lock( &cur->mutex );
+        chunk->state = 2;
     }
+    while ( chunk->state != 2 ) {
+        levenshtein_cond_wait( &cur->cond, &cur->mutex );
+    }
+    levenshtein_unlock( &cur->mutex );
+#else
+    if ( !chunk->state ) {
+        chunk->rc = levenshtein_pairs_compute( cur, &cur->scratch, c, &never );
+        chunk->state = 2;
+    }
+#endif
+    return chunk->rc;
+}
 
-    prev_row = ( int * )malloc( ( len2 + 1 ) * sizeof( int ) );
-    curr_row = ( int * )malloc( ( len2 + 1 ) * sizeof( int ) );
+static void levenshtein_pairs_reset( levenshtein_pairs_cursor *cur ) {
+    int i;
 
-    if ( !prev_row || !curr_row ) {
-        if ( prev_row ) free( prev_row );
-        if ( curr_row ) free( curr_row );
-        sqlite3_result_error_nomem( context );
-        return;
+#ifndef LEVENSHTEIN_NO_THREADS
+    levenshtein_pairs_join( cur );
+#endif
+    for ( i = 0; i < cur->nchunks; i++ ) {
+        sqlite3_free( cur->chunks[i].hits );
+    }
+    sqlite3_free( cur->chunks );
+    sqlite3_free( cur->rows );
+    sqlite3_free( cur->text );
+    cur->chunks = NULL;
+    cur->rows = NULL;
+    cur->text = NULL;
+    cur->nchunks = cur->nrows = 0;
+    cur->at = cur->pos = cur->next = 0;
+    for ( i = 0; i < 4; i++ ) {
+        sqlite3_value_free( cur->args[i] );
+        cur->args[i] = NULL;
     }
+}
 
-    for ( j = 0; j <= len2; j++ ) {
-        prev_row[j] = j;
+static int levenshtein_pairs_connect( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    levenshtein_pairs_vtab *vtab;
+    int rc = sqlite3_declare_vtab( db, "CREATE TABLE x( rowid_a INTEGER, rowid_b INTEGER, distance INTEGER, tbl HIDDEN, col HIDDEN, max HIDDEN, threads HIDDEN )" );
+
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    vtab = ( levenshtein_pairs_vtab * )sqlite3_malloc( sizeof( *vtab ) );
+    if ( !vtab ) {
+        return SQLITE_NOMEM;
+    }
+    memset( vtab, 0, sizeof( *vtab ) );
+    vtab->db = db;
+    sqlite3_vtab_config( db, SQLITE_VTAB_DIRECTONLY ); // Reads any table and starts threads: only from top-level SQL
+    *ppVtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_disconnect( sqlite3_vtab *pVtab ) {
+    sqlite3_free( pVtab );
+    return SQLITE_OK;
+}
+
+// table, column and max are required, threads is optional; idxNum has a bit per argument given
+static int levenshtein_pairs_best( sqlite3_vtab *pVtab, sqlite3_index_info *info ) {
+    int slot[4] = { -1, -1, -1, -1 }, argv = 0, i;
+
+    for ( i = 0; i < info->nConstraint; i++ ) {
+        const struct sqlite3_index_constraint *c = &info->aConstraint[i];
+        int arg = c->iColumn - LEVENSHTEIN_PAIRS_TABLE;
+
+        if ( arg >= 0 && c->op == SQLITE_INDEX_CONSTRAINT_EQ ) {
+            if ( !c->usable ) {
+                return SQLITE_CONSTRAINT;
+            }
+            slot[arg] = i;
+        }
+    }
+    if ( slot[0] < 0 || slot[1] < 0 || slot[2] < 0 ) {
+        pVtab->zErrMsg = sqlite3_mprintf( "levenshtein_pairs() requires 3 or 4 arguments: ( table, column, max [, threads] )" );
+        return SQLITE_ERROR;
+    }
+    info->idxNum = 0;
+    for ( i = 0; i < 4; i++ ) {
+        if ( slot[i] >= 0 ) {
+            info->idxNum |= 1 << i;
+            info->aConstraintUsage[slot[i]].argvIndex = ++argv;
+            info->aConstraintUsage[slot[i]].omit = 1;
+        }
+    }
+    info->estimatedCost = 1e6;
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_open( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )sqlite3_malloc( sizeof( *cur ) );
+
+    if ( !cur ) {
+        return SQLITE_NOMEM;
+    }
+    memset( cur, 0, sizeof( *cur ) );
+#ifndef LEVENSHTEIN_NO_THREADS
+    levenshtein_mutex_init( &cur->mutex );
+    levenshtein_cond_init( &cur->cond );
+#endif
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_close( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+
+    levenshtein_pairs_reset( cur );
+    levenshtein_scratch_release( &cur->scratch );
+#ifndef LEVENSHTEIN_NO_THREADS
+    levenshtein_mutex_destroy( &cur->mutex );
+    levenshtein_cond_destroy( &cur->cond );
+#endif
+    sqlite3_free( cur );
+    return SQLITE_OK;
+}
+
+// Skips empty chunks so the cursor always rests on a hit or at the end
+static int levenshtein_pairs_settle( levenshtein_pairs_cursor *cur ) {
+    while ( cur->at < cur->nchunks ) {
+        int rc = levenshtein_pairs_wait( cur, cur->at );
+
+        if ( rc != SQLITE_OK ) {
+            return rc;
+        }
+        if ( cur->pos < cur->chunks[cur->at].nhits ) {
+            return SQLITE_OK;
+        }
+        sqlite3_free( cur->chunks[cur->at].hits ); // Read in full; give the memory back as we go
+        cur->chunks[cur->at].hits = NULL;
+        cur->at++;
+        cur->pos = 0;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_load( levenshtein_pairs_cursor *cur, sqlite3 *db, const char *table, const char *column ) {
+    sqlite3_stmt *stmt = NULL;
+    size_t text_len = 0, text_cap = 0;
+    int rows_cap = 0, rc;
+    char *sql = sqlite3_mprintf( "SELECT rowid, \"%w\" FROM \"%w\" WHERE \"%w\" IS NOT NULL", column, table, column );
+
+    if ( !sql ) {
+        return SQLITE_NOMEM;
+    }
+    rc = sqlite3_prepare_v2( db, sql, -1, &stmt, NULL );
+    sqlite3_free( sql );
+    if ( rc != SQLITE_OK ) {
+        cur->base.pVtab->zErrMsg = sqlite3_mprintf( "levenshtein_pairs(): %s", sqlite3_errmsg( db ) );
+        return rc;
+    }
+    while ( ( rc = sqlite3_step( stmt ) ) == SQLITE_ROW ) {
+        const unsigned char *s = sqlite3_column_text( stmt, 1 );
+        int len = sqlite3_column_bytes( stmt, 1 );
+
+        if ( !s ) {
+            rc = SQLITE_NOMEM;
+            break;
+        }
+        if ( cur->nrows == rows_cap ) {
+            int cap = rows_cap ? 2 * rows_cap : 1024;
+            levenshtein_pairs_row *rows = ( levenshtein_pairs_row * )sqlite3_realloc64( cur->rows, ( size_t )cap * sizeof( *rows ) );
+            if ( !rows ) {
+                rc = SQLITE_NOMEM;
+                break;
+            }
+            cur->rows = rows;
+            rows_cap = cap;
+        }
+        if ( text_len + len > text_cap ) {
+            size_t cap = text_cap * 2 > text_len + len ? text_cap * 2 : text_len + len + 65536;
+            unsigned char *text = ( unsigned char * )sqlite3_realloc64( cur->text, cap );
+            if ( !text ) {
+                rc = SQLITE_NOMEM;
+                break;
+            }
+            cur->text = text;
+            text_cap = cap;
+        }
+        memcpy( cur->text + text_len, s, len );
+        cur->rows[cur->nrows].rowid = sqlite3_column_int64( stmt, 0 );
+        cur->rows[cur->nrows].text = text_len;
+        cur->rows[cur->nrows].len = len;
+        cur->nrows++;
+        text_len += len;
+    }
+    sqlite3_finalize( stmt );
+    if ( rc != SQLITE_DONE ) {
+        return rc == SQLITE_ROW ? SQLITE_ERROR : rc;
+    }
+    qsort( cur->rows, cur->nrows, sizeof( *cur->rows ), levenshtein_pairs_by_length );
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_filter( sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+    sqlite3 *db = ( ( levenshtein_pairs_vtab * )pCursor->pVtab )->db;
+    sqlite3_int64 threads = 0;
+    const char *table, *column;
+    int arg = 0, i, rc;
+
+    levenshtein_pairs_reset( cur );
+    for ( i = 0; i < 4; i++ ) {
+        if ( idxNum & ( 1 << i ) ) {
+            cur->args[i] = sqlite3_value_dup( argv[arg++] );
+            if ( !cur->args[i] ) {
+                return SQLITE_NOMEM;
+            }
+        }
+    }
+    table = ( const char * )sqlite3_value_text( cur->args[0] );
+    column = ( const char * )sqlite3_value_text( cur->args[1] );
+    if ( !table || !column ) {
+        pCursor->pVtab->zErrMsg = sqlite3_mprintf( "levenshtein_pairs() table and column must not be NULL" );
+        return SQLITE_ERROR;
+    }
+    cur->max = sqlite3_value_type( cur->args[2] ) == SQLITE_NULL ? -1 : sqlite3_value_int64( cur->args[2] );
+    if ( cur->max < 0 && sqlite3_value_type( cur->args[2] ) != SQLITE_NULL ) {
+        return SQLITE_OK; // No distance is negative
+    }
+    cur->max = cur->max > INT32_MAX / 2 ? -1 : cur->max;
+    if ( cur->args[3] && sqlite3_value_type( cur->args[3] ) != SQLITE_NULL ) {
+        threads = sqlite3_value_int64( cur->args[3] );
+        if ( threads < 1 ) {
+            pCursor->pVtab->zErrMsg = sqlite3_mprintf( "levenshtein_pairs() threads must be positive" );
+            return SQLITE_ERROR;
+        }
+    }
+
+    rc = levenshtein_pairs_load( cur, db, table, column );
+    if ( rc != SQLITE_OK ) {
+        return rc;
     }
 
-    for ( i = 0; i < len1; i++ ) {
-        curr_row[0] = i + 1;
+#ifndef LEVENSHTEIN_NO_THREADS
+    if ( !threads ) {
+        threads = levenshtein_cpu_count();
+    }
+    threads = threads > LEVENSHTEIN_MAX_THREADS ? LEVENSHTEIN_MAX_THREADS : threads;
+#else
+    threads = 1;
+#endif
+
+    // Enough chunks per thread that a slow one does not hold up the tail
+    cur->chunk_rows = cur->nrows / ( int )( threads * 16 ) + 1;
+    cur->chunk_rows = cur->chunk_rows > 4096 ? 4096 : cur->chunk_rows;
+    cur->nchunks = ( cur->nrows + cur->chunk_rows - 1 ) / cur->chunk_rows;
+    cur->chunks = ( levenshtein_pairs_chunk * )sqlite3_malloc64( ( size_t )cur->nchunks * sizeof( *cur->chunks ) + 1 );
+    if ( !cur->chunks ) {
+        cur->nchunks = 0;
+        return SQLITE_NOMEM;
+    }
+    memset( cur->chunks, 0, ( size_t )cur->nchunks * sizeof( *cur->chunks ) );
 
-        for ( j = 0; j < len2; j++ ) {
-            int cost = ( s1[i] == s2[j] ) ? 0 : 1;
-            curr_row[j + 1] = MIN3(
-                prev_row[j + 1] + 1,      // deletion
-                curr_row[j] + 1,          // insertion
-                prev_row[j] + cost        // substitution
-            );
+#ifndef LEVENSHTEIN_NO_THREADS
+    // The querying thread reads and helps; the others only compute
+    for ( i = 0; i + 1 < threads && i < cur->nchunks; i++ ) {
+#ifdef _WIN32
+        cur->threads[i] = CreateThread( NULL, 0, levenshtein_pairs_worker, cur, 0, NULL );
+        if ( !cur->threads[i] ) {
+            break;
+        }
+#else
+        if ( pthread_create( &cur->threads[i], NULL, levenshtein_pairs_worker, cur ) != 0 ) {
+            break;
         }
+#endif
+        cur->nthreads++;
+    }
+#endif
+    return levenshtein_pairs_settle( cur );
+}
+
+static int levenshtein_pairs_next( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+
+    cur->pos++;
+    return levenshtein_pairs_settle( cur );
+}
+
+static int levenshtein_pairs_eof( sqlite3_vtab_cursor *pCursor ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+    return cur->at >= cur->nchunks;
+}
+
+static int levenshtein_pairs_column( sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int i ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+    const levenshtein_pairs_hit *hit = &cur->chunks[cur->at].hits[cur->pos];
+
+    switch ( i ) {
+        case 0:
+            sqlite3_result_int64( context, hit->a );
+            break;
+        case 1:
+            sqlite3_result_int64( context, hit->b );
+            break;
+        case LEVENSHTEIN_PAIRS_DISTANCE:
+            sqlite3_result_int( context, hit->distance );
+            break;
+        default:
+            if ( cur->args[i - LEVENSHTEIN_PAIRS_TABLE] ) {
+                sqlite3_result_value( context, cur->args[i - LEVENSHTEIN_PAIRS_TABLE] );
+            }
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int levenshtein_pairs_rowid( sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid ) {
+    levenshtein_pairs_cursor *cur = ( levenshtein_pairs_cursor * )pCursor;
+    *pRowid = ( ( sqlite3_int64 )cur->at << 32 ) | cur->pos;
+    return SQLITE_OK;
+}
+
+static sqlite3_module levenshtein_pairs_module = {
+    0,                                  // iVersion
+    NULL,                               // xCreate: eponymous only, used as a table-valued function
+    levenshtein_pairs_connect,
+    levenshtein_pairs_best,
+    levenshtein_pairs_disconnect,
+    NULL,                               // xDestroy
+    levenshtein_pairs_open,
+    levenshtein_pairs_close,
+    levenshtein_pairs_filter,
+    levenshtein_pairs_next,
+    levenshtein_pairs_eof,
+    levenshtein_pairs_column,
+    levenshtein_pairs_rowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+#ifndef LEVENSHTEIN_NO_STATS
+
+/*
+ * levenshtein_stats(): one row per counted function on this connection.
+ *
+ *   SELECT * FROM levenshtein_stats();
+ *   SELECT levenshtein_stats_reset();
+ *
+ * Columns: function, calls, bytes, cache_hits, cache_misses, early_exits, nanoseconds, memo_hits, memo_misses. The
+ * cache columns are NULL where there is no cache, early_exits where the function takes no bound, and the memo
+ * columns where there is no memo (see memo_slots). nanoseconds is estimated from the sampled calls.
+ */
+
+static const struct {
+    const char *name;
+    int cached;
+    int bounded;
+    int memoized;
+} levenshtein_stat_functions[LEVENSHTEIN_STAT_COUNT] = {
+    { "levenshtein", 0, 1, 1 },
+    { "levenshtein_utf8", 1, 1, 1 },
+    { "damerau_levenshtein", 0, 1, 1 },
+    { "levenshtein_ratio", 0, 1, 1 },
+    { "jaro_winkler", 0, 0, 1 },
+    { "hamming", 0, 0, 0 },
+    { "levenshtein_topk", 0, 1, 0 },
+    { "soundex", 0, 0, 0 },
+    { "double_metaphone", 0, 0, 0 },
+    { "nysiis", 0, 0, 0 },
+};
+
+// Monotonic nanoseconds, read twice per statistics query; the hot path uses levenshtein_ticks()
+static sqlite3_uint64 levenshtein_clock_ns( void ) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &now );
+    return ( sqlite3_uint64 )( now.QuadPart / freq.QuadPart ) * 1000000000u + ( sqlite3_uint64 )( now.QuadPart % freq.QuadPart ) * 1000000000u / ( sqlite3_uint64 )freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( sqlite3_uint64 )ts.tv_sec * 1000000000u + ( sqlite3_uint64 )ts.tv_nsec;
+#endif
+}
+
+// The cheapest clock there is: the time stamp counter on x86, the virtual counter on AArch64
+static sqlite3_uint64 levenshtein_ticks( void ) {
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+    return __rdtsc();
+#elif defined( __aarch64__ ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+    uint64_t v;
+    __asm__ __volatile__( "mrs %0, cntvct_el0" : "=r"( v ) );
+    return v;
+#else
+    return levenshtein_clock_ns();
+#endif
+}
+
+static void levenshtein_stats_start( levenshtein_scratch *scratch ) {
+    scratch->tick0 = levenshtein_ticks();
+    scratch->ns0 = levenshtein_clock_ns();
+}
+
+// Counts one call of fn and times it if it is the sampled one
+static void levenshtein_counted( sqlite3_context *context, int argc, sqlite3_value **argv, int id, void ( *fn )( sqlite3_context *, int, sqlite3_value ** ) ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    levenshtein_stats *st = &scratch->stats[id];
+
+    st->bytes += ( sqlite3_uint64 )sqlite3_value_bytes( argv[0] );
+    if ( argc > 1 && sqlite3_value_type( argv[1] ) != SQLITE_INTEGER ) {
+        st->bytes += ( sqlite3_uint64 )sqlite3_value_bytes( argv[1] ); // The second string, not a flag or length
+    }
+    scratch->current = st;
+    if ( ( st->calls++ & ( LEVENSHTEIN_STATS_SAMPLE - 1 ) ) == 0 ) {
+        sqlite3_uint64 start = levenshtein_ticks();
+        fn( context, argc, argv );
+        st->ticks += levenshtein_ticks() - start;
+        st->samples++;
+    } else {
+        fn( context, argc, argv );
+    }
+    scratch->current = NULL;
+}
+
+#define LEVENSHTEIN_COUNTED( fn, id ) \
+    static void fn##_counted( sqlite3_context *context, int argc, sqlite3_value **argv ) { \
+        levenshtein_counted( context, argc, argv, id, fn ); \
+    }
+
+LEVENSHTEIN_COUNTED( levenshtein_func_memo, LEVENSHTEIN_STAT_LEVENSHTEIN )
+LEVENSHTEIN_COUNTED( levenshtein_utf8_func_memo, LEVENSHTEIN_STAT_UTF8 )
+LEVENSHTEIN_COUNTED( damerau_levenshtein_func_memo, LEVENSHTEIN_STAT_DAMERAU )
+LEVENSHTEIN_COUNTED( levenshtein_ratio_func_memo, LEVENSHTEIN_STAT_RATIO )
+LEVENSHTEIN_COUNTED( jaro_winkler_func_memo, LEVENSHTEIN_STAT_JARO_WINKLER )
+LEVENSHTEIN_COUNTED( hamming_func, LEVENSHTEIN_STAT_HAMMING )
+LEVENSHTEIN_COUNTED( levenshtein_topk_step, LEVENSHTEIN_STAT_TOPK )
+LEVENSHTEIN_COUNTED( soundex_func, LEVENSHTEIN_STAT_SOUNDEX )
+LEVENSHTEIN_COUNTED( double_metaphone_func, LEVENSHTEIN_STAT_DOUBLE_METAPHONE )
+LEVENSHTEIN_COUNTED( nysiis_func, LEVENSHTEIN_STAT_NYSIIS )
+
+#define LEVENSHTEIN_ENTRY( fn ) fn##_counted
+
+enum {
+    LEVENSHTEIN_STATS_FUNCTION,
+    LEVENSHTEIN_STATS_CALLS,
+    LEVENSHTEIN_STATS_BYTES,
+    LEVENSHTEIN_STATS_CACHE_HITS,
+    LEVENSHTEIN_STATS_CACHE_MISSES,
+    LEVENSHTEIN_STATS_EARLY_EXITS,
+    LEVENSHTEIN_STATS_NANOSECONDS,
+    LEVENSHTEIN_STATS_MEMO_HITS,
+    LEVENSHTEIN_STATS_MEMO_MISSES
+};
+
+typedef struct levenshtein_stats_vtab {
+    sqlite3_vtab base;
+    levenshtein_scratch *scratch;
+} levenshtein_stats_vtab;
+
+typedef struct levenshtein_stats_cursor {
+    sqlite3_vtab_cursor base;
+    int row;
+    double ns_per_tick; // Taken once per scan, so every row is scaled alike
+} levenshtein_stats_cursor;
+
+static int levenshtein_stats_connect( sqlite3 *db, void *pAux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    levenshtein_stats_vtab *vtab;
+    int rc = sqlite3_declare_vtab( db, "CREATE TABLE x( function TEXT, calls INTEGER, bytes INTEGER, cache_hits INTEGER, cache_misses INTEGER, early_exits INTEGER, nanoseconds INTEGER, memo_hits INTEGER, memo_misses INTEGER )" );
+
+    if ( rc != SQLITE_OK ) {
+        return rc;
+    }
+    vtab = ( levenshtein_stats_vtab * )sqlite3_malloc( sizeof( *vtab ) );
+    if ( !vtab ) {
+        return SQLITE_NOMEM;
+    }
+    memset( vtab, 0, sizeof( *vtab ) );
+    vtab->scratch = ( levenshtein_scratch * )pAux;
+    *ppVtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_disconnect( sqlite3_vtab *pVtab ) {
+    sqlite3_free( pVtab );
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_best( sqlite3_vtab *pVtab, sqlite3_index_info *info ) {
+    info->estimatedCost = LEVENSHTEIN_STAT_COUNT;
+    info->estimatedRows = LEVENSHTEIN_STAT_COUNT;
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_open( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    levenshtein_stats_cursor *cur = ( levenshtein_stats_cursor * )sqlite3_malloc( sizeof( *cur ) );
+
+    if ( !cur ) {
+        return SQLITE_NOMEM;
+    }
+    memset( cur, 0, sizeof( *cur ) );
+    *ppCursor = &cur->base;
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_close( sqlite3_vtab_cursor *pCursor ) {
+    sqlite3_free( pCursor );
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_filter( sqlite3_vtab_cursor *pCursor, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    levenshtein_stats_cursor *cur = ( levenshtein_stats_cursor * )pCursor;
+    levenshtein_scratch *scratch = ( ( levenshtein_stats_vtab * )pCursor->pVtab )->scratch;
+    sqlite3_uint64 ticks = levenshtein_ticks() - scratch->tick0;
+    sqlite3_uint64 ns = levenshtein_clock_ns() - scratch->ns0;
 
-        temp = prev_row;
-        prev_row = curr_row;
-        curr_row = temp;
+    cur->row = 0;
+    cur->ns_per_tick = ticks ? ( double )ns / ( double )ticks : 0.0;
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_next( sqlite3_vtab_cursor *pCursor ) {
+    ( ( levenshtein_stats_cursor * )pCursor )->row++;
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_eof( sqlite3_vtab_cursor *pCursor ) {
+    return ( ( levenshtein_stats_cursor * )pCursor )->row >= LEVENSHTEIN_STAT_COUNT;
+}
+
+static int levenshtein_stats_column( sqlite3_vtab_cursor *pCursor, sqlite3_context *context, int i ) {
+    levenshtein_stats_cursor *cur = ( levenshtein_stats_cursor * )pCursor;
+    const levenshtein_stats *st = &( ( levenshtein_stats_vtab * )pCursor->pVtab )->scratch->stats[cur->row];
+    int cached = levenshtein_stat_functions[cur->row].cached;
+
+    switch ( i ) {
+        case LEVENSHTEIN_STATS_FUNCTION:
+            sqlite3_result_text( context, levenshtein_stat_functions[cur->row].name, -1, SQLITE_STATIC );
+            break;
+        case LEVENSHTEIN_STATS_CALLS:
+            sqlite3_result_int64( context, ( sqlite3_int64 )st->calls );
+            break;
+        case LEVENSHTEIN_STATS_BYTES:
+            sqlite3_result_int64( context, ( sqlite3_int64 )st->bytes );
+            break;
+        case LEVENSHTEIN_STATS_CACHE_HITS:
+        case LEVENSHTEIN_STATS_CACHE_MISSES:
+            if ( cached ) {
+                sqlite3_result_int64( context, ( sqlite3_int64 )( i == LEVENSHTEIN_STATS_CACHE_HITS ? st->cache_hits : st->cache_misses ) );
+            }
+            break;
+        case LEVENSHTEIN_STATS_EARLY_EXITS:
+            if ( levenshtein_stat_functions[cur->row].bounded ) {
+                sqlite3_result_int64( context, ( sqlite3_int64 )st->early_exits );
+            }
+            break;
+        case LEVENSHTEIN_STATS_NANOSECONDS:
+            sqlite3_result_int64( context, st->samples ? ( sqlite3_int64 )( ( double )st->ticks * cur->ns_per_tick * ( double )st->calls / ( double )st->samples ) : 0 );
+            break;
+        case LEVENSHTEIN_STATS_MEMO_HITS:
+        case LEVENSHTEIN_STATS_MEMO_MISSES:
+            if ( levenshtein_stat_functions[cur->row].memoized ) {
+                sqlite3_result_int64( context, ( sqlite3_int64 )( i == LEVENSHTEIN_STATS_MEMO_HITS ? st->memo_hits : st->memo_misses ) );
+            }
+            break;
     }
+    return SQLITE_OK;
+}
+
+static int levenshtein_stats_rowid( sqlite3_vtab_cursor *pCursor, sqlite3_int64 *pRowid ) {
+    *pRowid = ( ( levenshtein_stats_cursor * )pCursor )->row + 1;
+    return SQLITE_OK;
+}
+
+static sqlite3_module levenshtein_stats_module = {
+    0,                                  // iVersion
+    NULL,                               // xCreate: eponymous only, used as a table-valued function
+    levenshtein_stats_connect,
+    levenshtein_stats_best,
+    levenshtein_stats_disconnect,
+    NULL,                               // xDestroy
+    levenshtein_stats_open,
+    levenshtein_stats_close,
+    levenshtein_stats_filter,
+    levenshtein_stats_next,
+    levenshtein_stats_eof,
+    levenshtein_stats_column,
+    levenshtein_stats_rowid,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+// Zeroes the counters of this connection. The clock reference is kept, so later rates stay calibrated.
+static void levenshtein_stats_reset_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+
+    memset( scratch->stats, 0, sizeof( scratch->stats ) );
+    sqlite3_result_null( context );
+}
+
+#else
+
+#define LEVENSHTEIN_ENTRY( fn ) fn
 
-    result = prev_row[len2];
+#endif
+
+/*
+ * levenshtein_config( name [, value] ): reads a per-connection setting, or sets it and returns the new value.
+ *
+ *   SELECT levenshtein_config( 'memo_slots', 4096 );
+ *
+ *   memo_slots   results remembered per statement, so repeated arguments are not compared again (see the memo
+ *                above). 0, the default, is no memo.
+ */
+static const struct {
+    const char *name;
+    size_t offset; // Of the sqlite3_uint64 in levenshtein_scratch
+    sqlite3_uint64 max;
+} levenshtein_settings[] = {
+    { "memo_slots", offsetof( levenshtein_scratch, memo_slots ), 65536 }, // About 3 MB of slots per statement at most
+};
+
+static void levenshtein_config_func( sqlite3_context *context, int argc, sqlite3_value **argv ) {
+    levenshtein_scratch *scratch = ( levenshtein_scratch * )sqlite3_user_data( context );
+    const char *name = ( const char * )sqlite3_value_text( argv[0] );
+    char *msg;
+    size_t i;
+
+    for ( i = 0; i < sizeof( levenshtein_settings ) / sizeof( levenshtein_settings[0] ); i++ ) {
+        sqlite3_uint64 *field = ( sqlite3_uint64 * )( ( char * )scratch + levenshtein_settings[i].offset );
+
+        if ( !name || sqlite3_stricmp( name, levenshtein_settings[i].name ) != 0 ) {
+            continue;
+        }
+        if ( argc == 2 ) {
+            sqlite3_int64 value = sqlite3_value_int64( argv[1] );
 
-    free( prev_row );
-    free( curr_row );
+            if ( sqlite3_value_numeric_type( argv[1] ) != SQLITE_INTEGER || value < 0 || ( sqlite3_uint64 )value > levenshtein_settings[i].max ) {
+                msg = sqlite3_mprintf( "levenshtein_config: %s must be an integer from 0 to %llu", levenshtein_settings[i].name, ( unsigned long long )levenshtein_settings[i].max );
+                sqlite3_result_error( context, msg ? msg : "levenshtein_config: value out of range", -1 );
+                sqlite3_free( msg );
+                return;
+            }
+            *field = ( sqlite3_uint64 )value;
+        }
+        sqlite3_result_int64( context, ( sqlite3_int64 )*field );
+        return;
+    }
+    msg = sqlite3_mprintf( "levenshtein_config: unknown setting '%s'", name ? name : "" );
+    sqlite3_result_error( context, msg ? msg : "levenshtein_config: unknown setting", -1 );
+    sqlite3_free( msg );
+}
 
-    sqlite3_result_int( context, result );
+/*
+ * The scalar functions, pure functions of their arguments: deterministic, so they can be indexed, and
+ * innocuous, so views, triggers and indexes can use them with trusted_schema off, as the bolt-on regex
+ * functions can. Each registration holds a reference on the scratch; sqlite3_create_function_v2() drops
+ * it on failure too.
+ */
+static int levenshtein_register( sqlite3 *db, const char *name, int nargs, levenshtein_scratch *scratch, void ( *fn )( sqlite3_context *, int, sqlite3_value ** ) ) {
+    scratch->refs++;
+    return sqlite3_create_function_v2( db, name, nargs, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, scratch, fn, NULL, NULL, levenshtein_scratch_unref );
 }
 
 #ifdef _WIN32
 __declspec( dllexport )
 #endif
 int sqlite3_levenshtein_init( sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi ) {
+    levenshtein_scratch *scratch;
+    int rc;
+
     SQLITE_EXTENSION_INIT2( pApi );
-    
-    return sqlite3_create_function(
-        db,
-        "levenshtein",
-        2,
-        SQLITE_UTF8 | SQLITE_DETERMINISTIC,
-        NULL,
-        levenshtein_func,
-        NULL,
-        NULL
-    );
+
+#ifdef LEVENSHTEIN_HAVE_AVX2
+    levenshtein_wavefront = levenshtein_cpu_has_avx2() ? levenshtein_wavefront_avx2 : NULL;
+#elif defined( LEVENSHTEIN_HAVE_NEON )
+    levenshtein_wavefront = levenshtein_wavefront_neon;
+#endif
+
+    scratch = ( levenshtein_scratch * )sqlite3_malloc( sizeof( *scratch ) );
+    if ( !scratch ) {
+        return SQLITE_NOMEM;
+    }
+    memset( scratch, 0, sizeof( *scratch ) );
+    scratch->refs = 1;
+#ifndef LEVENSHTEIN_NO_STATS
+    levenshtein_stats_start( scratch );
+#endif
+
+    rc = levenshtein_register( db, "levenshtein", 2, scratch, LEVENSHTEIN_ENTRY( levenshtein_func_memo ) );
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "levenshtein", 3, scratch, LEVENSHTEIN_ENTRY( levenshtein_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "levenshtein_utf8", 2, scratch, LEVENSHTEIN_ENTRY( levenshtein_utf8_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "levenshtein_utf8", 3, scratch, LEVENSHTEIN_ENTRY( levenshtein_utf8_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "damerau_levenshtein", 2, scratch, LEVENSHTEIN_ENTRY( damerau_levenshtein_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "damerau_levenshtein", 3, scratch, LEVENSHTEIN_ENTRY( damerau_levenshtein_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "levenshtein_ratio", 2, scratch, LEVENSHTEIN_ENTRY( levenshtein_ratio_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "levenshtein_ratio", 3, scratch, LEVENSHTEIN_ENTRY( levenshtein_ratio_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "jaro_winkler", 2, scratch, LEVENSHTEIN_ENTRY( jaro_winkler_func_memo ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "hamming", 2, scratch, LEVENSHTEIN_ENTRY( hamming_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "soundex", 1, scratch, LEVENSHTEIN_ENTRY( soundex_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "double_metaphone", 1, scratch, LEVENSHTEIN_ENTRY( double_metaphone_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "double_metaphone", 2, scratch, LEVENSHTEIN_ENTRY( double_metaphone_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "nysiis", 1, scratch, LEVENSHTEIN_ENTRY( nysiis_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = levenshtein_register( db, "nysiis", 2, scratch, LEVENSHTEIN_ENTRY( nysiis_func ) );
+    }
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_function_v2( db, "levenshtein_topk", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, scratch, NULL, LEVENSHTEIN_ENTRY( levenshtein_topk_step ), levenshtein_topk_final, levenshtein_scratch_unref );
+    }
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_module_v2( db, "levenshtein_index", &levenshtein_index_module, scratch, levenshtein_scratch_unref );
+    }
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_module_v2( db, "qgram_index", &levenshtein_qgram_module, scratch, levenshtein_scratch_unref );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_create_module( db, "fuzzy_candidates", &levenshtein_candidates_module, NULL );
+    }
+    if ( rc == SQLITE_OK ) {
+        rc = sqlite3_create_module( db, "levenshtein_pairs", &levenshtein_pairs_module, NULL );
+    }
+    // Changes connection state, so only from top-level SQL: never from a view, trigger or schema the user did not write
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_function_v2( db, "levenshtein_config", 1, SQLITE_UTF8 | SQLITE_DIRECTONLY, scratch, levenshtein_config_func, NULL, NULL, levenshtein_scratch_unref );
+    }
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_function_v2( db, "levenshtein_config", 2, SQLITE_UTF8 | SQLITE_DIRECTONLY, scratch, levenshtein_config_func, NULL, NULL, levenshtein_scratch_unref );
+    }
+#ifndef LEVENSHTEIN_NO_STATS
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_module_v2( db, "levenshtein_stats", &levenshtein_stats_module, scratch, levenshtein_scratch_unref );
+    }
+    // Clears every counter on the connection, so like levenshtein_config() only from top-level SQL
+    if ( rc == SQLITE_OK ) {
+        scratch->refs++;
+        rc = sqlite3_create_function_v2( db, "levenshtein_stats_reset", 0, SQLITE_UTF8 | SQLITE_DIRECTONLY, scratch, levenshtein_stats_reset_func, NULL, NULL, levenshtein_scratch_unref );
+    }
+#endif
+
+    levenshtein_scratch_unref( scratch );
+    return rc;
 }
 
+#ifndef LEVENSHTEIN_BUNDLED
 #ifdef _WIN32
 __declspec( dllexport )
 #endif
 int sqlite3_extension_init( sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi ) {
     return sqlite3_levenshtein_init( db, pzErrMsg, pApi );
 }
+#endif
@@ -1,30 +1,86 @@
-import sqlite3
+import argparse;
+import sqlite3;
+import time;
 
 # NOTE: Consider implementing in C for better performance with large datasets.
 # A C extension would be significantly faster than this pure Python implementation.
+# It now is: sqlite_levenshtein.c. Measure the difference with
+#   ./bolton_bench --rows=10000 --save=bench.db --benchmark_filter=levenshtein
+#   python3 sqlite_levenstein.py --bench bench.db
 
-def levenshtein( s1, s2 );
-    if len( s1 ) < len( s2 );
+def levenshtein( s1, s2 ):
+    if len( s1 ) < len( s2 ):
         return levenshtein( s2, s1 );
-    
-    if len( s2 ) == 0;
+
+    if len( s2 ) == 0:
         return len( s1 );
-    
+
     previous_row = range( len( s2 ) + 1 );
-    for i, c1 in enumerate( s1 );
+    for i, c1 in enumerate( s1 ):
         current_row = [ i + 1 ];
-        for j, c2 in enumerate( s2 );
+        for j, c2 in enumerate( s2 ):
             insertions = previous_row[ j + 1 ] + 1;
             deletions = current_row[ j ] + 1;
             substitutions = previous_row[ j ] + ( c1 != c2 );
             current_row.append( min( insertions, deletions, substitutions ) );
         previous_row = current_row;
-    
+
     return previous_row[ -1 ];
 
-# Register with SQLite
-conn = sqlite3.connect( 'your.db' );
-conn.create_function( 'levenshtein', 2, levenshtein );
+def example():
+    # Register with SQLite
+    conn = sqlite3.connect( 'your.db' );
+    conn.create_function( 'levenshtein', 2, levenshtein );
+
+    # Now use in SQL
+    cursor = conn.execute( "SELECT name FROM table WHERE levenshtein( name, 'target' ) <= 3" );
+    return cursor.fetchall();
+
+def time_query( conn, sql, rows, min_time ):
+    """Runs sql until min_time seconds have passed; returns ( rows/s, ns/row, result )."""
+    iterations = 0;
+    result = None;
+    start = time.perf_counter();
+    while True:
+        result = conn.execute( sql ).fetchone()[ 0 ];
+        iterations += 1;
+        elapsed = time.perf_counter() - start;
+        if elapsed >= min_time:
+            break;
+    scanned = iterations * rows;
+    return scanned / elapsed, elapsed * 1e9 / scanned, result;
+
+def bench( db_path, thresholds, extension, min_time ):
+    """Times the Python UDF over the bench table written by bolton_bench --save, in the same units."""
+    conn = sqlite3.connect( db_path );
+    conn.create_function( 'levenshtein_py', 2, levenshtein, deterministic = True );
+    rows = conn.execute( "SELECT count(*) FROM bench" ).fetchone()[ 0 ];
+    functions = [ 'levenshtein_py' ];
+    if extension and hasattr( conn, 'enable_load_extension' ):
+        try:
+            conn.enable_load_extension( True );
+            conn.load_extension( extension );
+            functions.append( 'levenshtein' );
+        except sqlite3.OperationalError as e:
+            print( f"C extension not loaded ({e}); timing the Python UDF only" );
+
+    print( f"{rows} rows from {db_path}" );
+    print( f"{'Benchmark':<40} {'rows/s':>14} {'ns/row':>14} {'matched':>10}" );
+    for function in functions:
+        for k in thresholds:
+            sql = f"SELECT count(*) FROM bench WHERE {function}( a, b ) <= {k}";
+            rate, ns, matched = time_query( conn, sql, rows, min_time );
+            print( f"{function + '/max:' + str( k ):<40} {rate:>14,.0f} {ns:>14,.1f} {matched:>10}" );
+    conn.close();
 
-# Now use in SQL
-cursor = conn.execute( "SELECT name FROM table WHERE levenshtein( name, 'target' ) <= 3" );
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser( description = 'Pure-Python Levenshtein UDF for SQLite, and its benchmark.' );
+    parser.add_argument( '--bench', metavar = 'DB', help = 'database written by bolton_bench --save' );
+    parser.add_argument( '--thresholds', default = '1,2,4,8', help = 'distance thresholds (default 1,2,4,8)' );
+    parser.add_argument( '--extension', default = './levenshtein', help = 'C extension to time alongside, when this Python can load extensions' );
+    parser.add_argument( '--min-time', type = float, default = 0.5, help = 'seconds per benchmark (default 0.5)' );
+    args = parser.parse_args();
+    if args.bench:
+        bench( args.bench, [ int( k ) for k in args.thresholds.split( ',' ) ], args.extension, args.min_time );
+    else:
+        print( example() );